@@ -1,20 +1,44 @@
 /*
  * bst.c - This file contains a binary search tree implementation
- *         where each object has a 32-bit key
+ *         where each object has a 32-bit key, a 64-bit key or an
+ *         opaque key with a user supplied compare function
+ */
+
+/*
+ * Trees created with BST_FLAG_CONCURRENT can be read by any number of
+ * threads while another thread updates them. Writers serialize on
+ * write_lock and keep seq odd for the duration of each update. Readers
+ * take no locks: they note seq, walk the tree, and walk it again if seq
+ * shows that a writer got in the way. Child links are published with
+ * release stores so a reader never follows a link to a node it cannot
+ * yet see, and every walk is bounded by the node count so that a reader
+ * racing with a rotation cannot loop.
+ *
+ * Readers also sit in an epoch while they walk. A removed node may still
+ * be under a reader, so the memory holding it must not be freed or
+ * reused until bst_synchronize() has returned.
  */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sched.h>
 #include "bst.h"
 
+#define BST_LOAD(ptr)           __atomic_load_n(&(ptr), __ATOMIC_ACQUIRE)
+#define BST_STORE(ptr, val)     __atomic_store_n(&(ptr), (val), __ATOMIC_RELEASE)
+
+static void* bst_seek (bst_t *bst, bst_node_t *probe, uint8_t inclusive);
+
 /*
- * bst_create
+ * bst_create_flags
  *
- * Create an instance of binary search tree and return a pointer to it
+ * Create an instance of binary search tree with the given behaviour
+ * flags (BST_FLAG_*) and return a pointer to it
  */
 bst_t *
-bst_create (char *name, uint32_t offset, int (*get_key)(void *node))
+bst_create_flags (char *name, uint32_t offset, int (*get_key)(void *node),
+                  uint32_t flags)
 {
     bst_t   *bst;
 
@@ -28,11 +52,106 @@ bst_create (char *name, uint32_t offset, int (*get_key)(void *node))
     bst->node_offset = offset;
     bst->node_count = 0;
     bst->root = NULL;
+    bst->flags = flags;
+    bst->key_type = BST_KEY_INT;
     bst->get_key = get_key;
+    bst->get_key64 = NULL;
+    bst->get_key_ptr = NULL;
+    bst->cmp_fn = NULL;
+    bst->seq = 0;
+    bst->epoch = NULL;
+
+    if (flags & BST_FLAG_CONCURRENT) {
+        bst->epoch = epoch_create();
+        if (!bst->epoch) {
+            free(bst);
+            return NULL;
+        }
+        pthread_mutex_init(&bst->write_lock, NULL);
+    }
+
+    return bst;
+}
+
+/*
+ * bst_create_u64
+ *
+ * Create an instance of binary search tree where each object has an
+ * unsigned 64-bit key. The keys are compared inline.
+ */
+bst_t *
+bst_create_u64 (char *name, uint32_t offset, uint64_t (*get_key)(void *node),
+                uint32_t flags)
+{
+    bst_t   *bst;
+
+    bst = bst_create_flags(name, offset, NULL, flags);
+    if (!bst) {
+        return NULL;
+    }
+
+    bst->key_type = BST_KEY_U64;
+    bst->get_key64 = get_key;
+
+    return bst;
+}
+
+/*
+ * bst_create_cmp
+ *
+ * Create an instance of binary search tree where each object has an
+ * opaque key (a string, a struct, ...). get_key returns a pointer to
+ * the key, which has to stay valid and unchanged while the object is
+ * in the tree. Keys are ordered by cmp_fn, which returns a negative,
+ * zero or positive value like strcmp().
+ */
+bst_t *
+bst_create_cmp (char *name, uint32_t offset, void* (*get_key)(void *node),
+                int32_t (*cmp_fn)(void *key1, void *key2), uint32_t flags)
+{
+    bst_t   *bst;
+
+    /* Sanity check */
+    if (!cmp_fn) {
+        return NULL;
+    }
+
+    bst = bst_create_flags(name, offset, NULL, flags);
+    if (!bst) {
+        return NULL;
+    }
+
+    bst->key_type = BST_KEY_CMP;
+    bst->get_key_ptr = get_key;
+    bst->cmp_fn = cmp_fn;
 
     return bst;
 }
 
+/*
+ * bst_create
+ *
+ * Create an instance of binary search tree and return a pointer to it
+ */
+bst_t *
+bst_create (char *name, uint32_t offset, int (*get_key)(void *node))
+{
+    return (bst_create_flags(name, offset, get_key, 0));
+}
+
+/*
+ * bst_create_balanced
+ *
+ * Create an instance of a self-balancing (AVL) binary search tree.
+ * Insert, remove and lookup are guaranteed to be O(log n) even when
+ * the keys are inserted in sorted order.
+ */
+bst_t *
+bst_create_balanced (char *name, uint32_t offset, int (*get_key)(void *node))
+{
+    return (bst_create_flags(name, offset, get_key, BST_FLAG_BALANCED));
+}
+
 /*
  * bst_destroy
  *
@@ -47,60 +166,148 @@ bst_destroy (bst_t *bst)
     }
 
     /* Do the deed */
+    if (bst->flags & BST_FLAG_CONCURRENT) {
+        pthread_mutex_destroy(&bst->write_lock);
+        epoch_destroy(bst->epoch);
+    }
     free(bst);
 
     return EOK;
 }
 
+/*
+ * bst_write_begin
+ *
+ * Start an update of a concurrent tree. Serializes against other writers
+ * and makes seq odd before any node is touched.
+ */
+static inline void
+bst_write_begin (bst_t *bst)
+{
+    if (!(bst->flags & BST_FLAG_CONCURRENT)) {
+        return;
+    }
+
+    pthread_mutex_lock(&bst->write_lock);
+    __atomic_store_n(&bst->seq, bst->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+/*
+ * bst_write_end
+ *
+ * Finish an update started by bst_write_begin()
+ */
+static inline void
+bst_write_end (bst_t *bst)
+{
+    if (!(bst->flags & BST_FLAG_CONCURRENT)) {
+        return;
+    }
+
+    __atomic_store_n(&bst->seq, bst->seq + 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&bst->write_lock);
+}
+
+/*
+ * bst_read_begin
+ *
+ * Start an optimistic walk of a concurrent tree. Waits out any writer
+ * which is in the middle of an update and returns the sequence number
+ * to validate the walk against.
+ */
+static inline uint32_t
+bst_read_begin (bst_t *bst)
+{
+    uint32_t    seq;
+
+    while ((seq = __atomic_load_n(&bst->seq, __ATOMIC_ACQUIRE)) & 1) {
+        sched_yield();
+    }
+
+    return seq;
+}
+
+/*
+ * bst_read_retry
+ *
+ * Returns TRUE if a writer updated the tree since bst_read_begin(), in
+ * which case whatever the walk found has to be thrown away
+ */
+static inline uint8_t
+bst_read_retry (bst_t *bst, uint32_t seq)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    return (__atomic_load_n(&bst->seq, __ATOMIC_RELAXED) != seq);
+}
+
+/*
+ * bst_read_lock
+ *
+ * Keep the objects returned by lookups on a concurrent tree valid until
+ * bst_read_unlock(). Writers are not blocked. Calls may be nested, and
+ * are a no-op on other trees.
+ */
+void
+bst_read_lock (bst_t *bst)
+{
+    if (bst->flags & BST_FLAG_CONCURRENT) {
+        epoch_enter(bst->epoch);
+    }
+}
+
+/*
+ * bst_read_unlock
+ *
+ * End a section started by bst_read_lock()
+ */
+void
+bst_read_unlock (bst_t *bst)
+{
+    if (bst->flags & BST_FLAG_CONCURRENT) {
+        epoch_exit(bst->epoch);
+    }
+}
+
+/*
+ * bst_synchronize
+ *
+ * Wait until no reader of a concurrent tree can still be looking at a
+ * node removed before this call. The memory of removed objects can be
+ * freed or reused once this returns. Must not be called between
+ * bst_read_lock() and bst_read_unlock().
+ */
+void
+bst_synchronize (bst_t *bst)
+{
+    if (bst->flags & BST_FLAG_CONCURRENT) {
+        epoch_synchronize(bst->epoch);
+    }
+}
+
 /*
  * bst_find_min
  *
- * Find the node with the minimum key from the given level. The
- * delete flag is set to TRUE when its called from bst_remove().
- * If this flag is set, we have to additionally adjust the left
- * and right pointers for the least node's parent.
+ * Find the node with the minimum key in the subtree rooted at the
+ * given node
  */
 static bst_node_t *
-bst_find_min (bst_node_t *root, uint8_t delete)
+bst_find_min (bst_node_t *root)
 {
     bst_node_t *node = root;
-    bst_node_t *min_node;
 
     /* Sanity check */
     if (!root) {
         return NULL;
     }
 
-    /* 
-     * Special case: Check if the left subtree is null. If it is,
-     * the given root is the minimum element.
-     */
-    if (node->left == NULL) {
-        min_node = node;
-
-        if (delete) {
-            node->parent->right = NULL;
-        }
-
-        return min_node;
-    }
-
     /* Walk down the left subtree till we get the last node */
-    while (node->left != NULL && node->left->left != NULL) {
+    while (node->left != NULL) {
         node = node->left;
     }
 
-    min_node = node->left;
-
-    /*
-     * If this is called from bst_remove_internal(), we have to
-     * fix the child pointer for the minimum node's parent
-     */
-    if (delete) {
-        node->left = NULL;
-    }
-
-    return min_node;
+    return node;
 }
 
 /*
@@ -127,12 +334,16 @@ bst_get_least (bst_t *bst)
     bst_node_t *root = bst->root;
     bst_node_t *node;
 
+    if (bst->flags & BST_FLAG_CONCURRENT) {
+        return (bst_seek(bst, NULL, TRUE));
+    }
+
     /* Sanity check */
     if (!root) {
         return NULL;
     }
 
-    node = bst_find_min(root, FALSE);
+    node = bst_find_min(root);
     if (!node) {
         return NULL;
     }
@@ -140,6 +351,39 @@ bst_get_least (bst_t *bst)
     return ((void *)((uint8_t *)node - bst->node_offset));
 }
 
+/*
+ * bst_successor
+ *
+ * Return the in-order successor of the given node, or NULL if it is
+ * the last node in the tree
+ */
+static bst_node_t *
+bst_successor (bst_node_t *node)
+{
+    bst_node_t  *parent;
+
+    /*
+     * We have 2 cases here:
+     *
+     * 1. Right subtree of the node is non-null. In this case, the next
+     *    node is the smallest element in the right subtree
+     * 2. Right subtree of the node is null. In this case, we have to
+     *    move up the tree to find the first ancestor whose left child
+     *    is also anancestor to the given node.
+     */
+    if (node->right != NULL) {
+        return (bst_find_min(node->right));
+    }
+
+    parent = node->parent;
+    while ((parent != NULL) && (node == parent->right)) {
+        node = parent;
+        parent = node->parent;
+    }
+
+    return parent;
+}
+
 /*
  * bst_get_next
  *
@@ -148,7 +392,7 @@ bst_get_least (bst_t *bst)
 void *
 bst_get_next (bst_t *bst, void *prev_node)
 {
-    bst_node_t  *node, *next_node, *parent;
+    bst_node_t  *node, *next_node;
 
     /* Sanity check */
     if (!bst || !prev_node) {
@@ -159,26 +403,15 @@ bst_get_next (bst_t *bst, void *prev_node)
     node = (bst_node_t *)((uint8_t *)prev_node + bst->node_offset);
 
     /*
-     * We have 2 cases here:
-     *
-     * 1. Right subtree of the node is non-null. In this case, the next
-     *    node is the smallest element in the right subtree
-     * 2. Right subtree of the node is null. In this case, we have to
-     *    move up the tree to find the first ancestor whose left child
-     *    is also anancestor to the given node.
+     * The parent links of a concurrent tree can't be followed without the
+     * lock, so look for the next key from the root instead
      */
-    if (node->right != NULL) {
-        next_node = bst_find_min(node->right, FALSE);
-    } else {
-        parent = node->parent;
-        while ((parent != NULL) && (node == parent->right)) {
-            node = parent;
-            parent = node->parent;
-        }
-
-        next_node = parent;
+    if (bst->flags & BST_FLAG_CONCURRENT) {
+        return (bst_seek(bst, node, FALSE));
     }
 
+    next_node = bst_successor(node);
+
     /* Did we find something? */
     if (!next_node) {
         return NULL;
@@ -214,229 +447,1049 @@ bst_empty (bst_t *bst)
 }
 
 /*
- * bst_insert_internal
+ * bst_node_height
  *
- * This routine takes a root pointer and a key pointer and
- * recursively computes where the key node has to be inserted
+ * Return the height of the given subtree. An empty subtree has a
+ * height of 0.
  */
-static bst_node_t *
-bst_insert_internal (bst_t *bst, bst_node_t *root, bst_node_t *key_node)
+static inline int32_t
+bst_node_height (bst_node_t *node)
 {
-    int root_key, key;
-
-    if (root == NULL) {
-        return key_node;
-    }
+    return (node ? node->height : 0);
+}
 
-    root_key = bst->get_key((uint8_t *)root - bst->node_offset);
-    key = bst->get_key((uint8_t *)key_node - bst->node_offset);
+/*
+ * bst_update_height
+ *
+ * Recompute the height of the given node from its children
+ */
+static inline void
+bst_update_height (bst_node_t *node)
+{
+    int32_t left_height = bst_node_height(node->left);
+    int32_t right_height = bst_node_height(node->right);
 
-    if (key < root_key) {
-        root->left = bst_insert_internal(bst, root->left, key_node);
-        root->left->parent = root;
-    } else if (key > root_key) {
-        root->right = bst_insert_internal(bst, root->right, key_node);
-        root->right->parent = root;
-    }
+    node->height = 1 + (left_height > right_height ? left_height : right_height);
+}
 
-    return root;
+/*
+ * bst_node_size
+ *
+ * Return the number of nodes in the given subtree. Only valid for trees
+ * created with BST_FLAG_ORDER_STAT.
+ */
+static inline uint32_t
+bst_node_size (bst_node_t *node)
+{
+    return (node ? node->size : 0);
 }
 
 /*
- * bst_insert
+ * bst_update_size
  *
- * Insert a node to the binary search tree
+ * Recompute the subtree size of the given node from its children
  */
-int
-bst_insert (bst_t *bst, bst_node_t *node)
+static inline void
+bst_update_size (bst_node_t *node)
 {
-    bst_node_t  *root;
+    node->size = 1 + bst_node_size(node->left) + bst_node_size(node->right);
+}
 
-    /* Sanity check */
-    if (!bst || !node) {
-        return EINVAL;
+/*
+ * bst_adjust_sizes
+ *
+ * Add delta to the subtree size of the given node and all its ancestors
+ */
+static inline void
+bst_adjust_sizes (bst_node_t *node, int32_t delta)
+{
+    while (node != NULL) {
+        node->size += delta;
+        node = node->parent;
     }
+}
 
-    /* Grab a pointer to the root */
-    root = bst->root;
-
-    /* Initialize the left, right and parent pointers */
-    node->left = NULL;
-    node->right = NULL;
-    node->parent = NULL;
-
-    /* Special case. Is this the first element? */
-    if (!root) {
-        bst->root = node;
-        bst->node_count++;
-        return EOK;
+/*
+ * bst_replace_child
+ *
+ * Make the parent of old_child point to new_child instead. If old_child
+ * is the root of the tree, the root pointer is updated.
+ */
+static inline void
+bst_replace_child (bst_t *bst, bst_node_t *parent,
+                   bst_node_t *old_child, bst_node_t *new_child)
+{
+    if (!parent) {
+        BST_STORE(bst->root, new_child);
+    } else if (parent->left == old_child) {
+        BST_STORE(parent->left, new_child);
+    } else {
+        BST_STORE(parent->right, new_child);
     }
-
-    /* Recursively compute where this node has to be inserted */
-    bst_insert_internal(bst, root, node);
-
-    /* Increment the node count */
-    bst->node_count++;
-
-    return EOK;
 }
 
 /*
- * bst_remove_internal
+ * bst_rotate_left
+ *
+ * Rotate the subtree rooted at the given node to the left and return
+ * the new subtree root (the old right child).
  *
- * This routine takes a root pointer and a key pointer and
- * recursively computes where the key node is located. It
- * then removes the key node and replaces it with the smallest
- * element in its right subtree.
+ *       node                 pivot
+ *      /    \               /     \
+ *     A    pivot    -->    node    C
+ *         /     \         /    \
+ *        B       C       A      B
  */
 static bst_node_t *
-bst_remove_internal (bst_t *bst, bst_node_t *root, bst_node_t *key_node)
+bst_rotate_left (bst_t *bst, bst_node_t *node)
 {
-    int root_key, key;
-    bst_node_t *node;
+    bst_node_t *pivot = node->right;
+    bst_node_t *parent = node->parent;
 
-    if (root == NULL) {
-        /* Element not found */
-        return NULL;
+    BST_STORE(node->right, pivot->left);
+    if (pivot->left) {
+        pivot->left->parent = node;
     }
+    BST_STORE(pivot->left, node);
+    node->parent = pivot;
+    pivot->parent = parent;
+    bst_replace_child(bst, parent, node, pivot);
 
-    root_key = bst->get_key((uint8_t *)root - bst->node_offset);
-    key = bst->get_key((uint8_t *)key_node - bst->node_offset);
-
-    if (key < root_key) {
-        /* Search the left subtree */
-        root->left = bst_remove_internal(bst, root->left, key_node);
-        if (root->left) {
-            root->left->parent = root;
-        }
-    } else if (key > root_key) {
-        /* Search the right subtree */
-        root->right = bst_remove_internal(bst, root->right, key_node);
-        if (root->right) {
-            root->right->parent = root;
-        }
-    } else {
-        /* Element found. First check if any subtree is NULL */
-        if (!(root->left && root->right)) {
-            if (root->left == NULL) {
-                node = root->right;
-            } else {
-                node = root->left;
-            }
-            return node;
-        }
+    bst_update_height(node);
+    bst_update_height(pivot);
 
-        /* Replace that element with the smallest element in its right subtree */
-        node = bst_find_min(root->right, TRUE);
-        node->left = root->left;
-        node->right = root->right;
-        node->parent = root->parent;
-        if (root->left) {
-            root->left->parent = node;
-        }
-        if (root->right) {
-            root->right->parent = node;
-        }
-        return node;
+    if (bst->flags & BST_FLAG_ORDER_STAT) {
+        bst_update_size(node);
+        bst_update_size(pivot);
     }
 
-    return root;
+    return pivot;
 }
 
 /*
- * bst_remove
+ * bst_rotate_right
  *
- * Remove a node from the binary search tree
+ * Mirror image of bst_rotate_left()
  */
-int
-bst_remove (bst_t *bst, bst_node_t *node)
+static bst_node_t *
+bst_rotate_right (bst_t *bst, bst_node_t *node)
 {
-    bst_node_t  *root, *ret;
+    bst_node_t *pivot = node->left;
+    bst_node_t *parent = node->parent;
 
-    /* Sanity check */
-    if (!bst || !node) {
-        return EINVAL;
+    BST_STORE(node->left, pivot->right);
+    if (pivot->right) {
+        pivot->right->parent = node;
     }
+    BST_STORE(pivot->right, node);
+    node->parent = pivot;
+    pivot->parent = parent;
+    bst_replace_child(bst, parent, node, pivot);
 
-    /* Grab a pointer to the root */
-    root = bst->root;
-    if (!root) {
-        return EINVAL;
-    }
+    bst_update_height(node);
+    bst_update_height(pivot);
 
-    /* Recursively find the position of the node and remove it */
-    ret = bst_remove_internal(bst, root, node);
-    if (!ret) {
-        /* Key was not found */
-        return ENOTFOUND;
+    if (bst->flags & BST_FLAG_ORDER_STAT) {
+        bst_update_size(node);
+        bst_update_size(pivot);
     }
 
-    /* Decrement the node count */
-    bst->node_count--;
-
-    return EOK;
+    return pivot;
 }
 
 /*
- * bst_lookup_internal
+ * bst_rebalance
  *
- * Recursively search for the given node in the BST. Returns NULL if
- * node is not found.
+ * Walk up from the given node to the root, fixing up the heights and
+ * rotating wherever the AVL invariant (the heights of the two subtrees
+ * differ by at most one) has been violated by an insert or a remove.
  */
-static bst_node_t *
-bst_lookup_internal (bst_t *bst, bst_node_t *root, int key)
+static void
+bst_rebalance (bst_t *bst, bst_node_t *node)
 {
-    int root_key;
-    
-    if (!root) {
-        return NULL;
-    }
+    int32_t balance;
 
-    /* Get the key value associated with the root */
-    root_key = bst->get_key((uint8_t *)root - bst->node_offset);
+    while (node != NULL) {
+        bst_update_height(node);
+        balance = bst_node_height(node->left) - bst_node_height(node->right);
 
-    if (key < root_key) {
-        /* Search the left subtree */
-        return (bst_lookup_internal(bst, root->left, key));
-    } else if (key > root_key) {
-        /* Search the right subtree */
-        return (bst_lookup_internal(bst, root->right, key));
-    } else {
-        /* Match found */
-        return root;
+        if (balance > 1) {
+            /* Left heavy. Convert a left-right case to left-left first */
+            if (bst_node_height(node->left->left) <
+                bst_node_height(node->left->right)) {
+                bst_rotate_left(bst, node->left);
+            }
+            node = bst_rotate_right(bst, node);
+        } else if (balance < -1) {
+            /* Right heavy. Convert a right-left case to right-right first */
+            if (bst_node_height(node->right->right) <
+                bst_node_height(node->right->left)) {
+                bst_rotate_right(bst, node->right);
+            }
+            node = bst_rotate_left(bst, node);
+        }
+
+        node = node->parent;
     }
 }
 
 /*
- * bst_lookup
+ * bst_load_key
  *
- * Lookup a node in the BST with the given key. Returns NULL
- * if node is not found.
+ * Fetch the key of the object embedding node and store it in dst. This
+ * is the only place where the get_key callbacks are invoked.
  */
-void *
-bst_lookup (bst_t *bst, int key)
+static inline void
+bst_load_key (bst_t *bst, bst_node_t *dst, bst_node_t *node)
 {
-    bst_node_t  *root;
-    bst_node_t  *key_node;
+    void *obj = (uint8_t *)node - bst->node_offset;
+
+    switch (bst->key_type) {
+    case BST_KEY_U64:
+        dst->key64 = bst->get_key64(obj);
+        break;
+    case BST_KEY_CMP:
+        dst->key_ptr = bst->get_key_ptr(obj);
+        break;
+    default:
+        dst->key = bst->get_key(obj);
+        break;
+    }
+}
 
-    /* Sanity check */
-    if (!bst) {
+/*
+ * bst_key_compare
+ *
+ * Compare the keys cached in two nodes. Returns a negative, zero or
+ * positive value if the key of a is less than, equal to or greater
+ * than the key of b. Only BST_KEY_CMP trees call out to cmp_fn.
+ */
+static inline int32_t
+bst_key_compare (bst_t *bst, bst_node_t *a, bst_node_t *b)
+{
+    switch (bst->key_type) {
+    case BST_KEY_U64:
+        return ((a->key64 > b->key64) - (a->key64 < b->key64));
+    case BST_KEY_CMP:
+        return (bst->cmp_fn(a->key_ptr, b->key_ptr));
+    default:
+        return ((a->key > b->key) - (a->key < b->key));
+    }
+}
+
+/*
+ * bst_find
+ *
+ * Walk down from the root and return the node with the same key as the
+ * probe node. Returns NULL if the key is not present in the tree. Only
+ * the keys cached in the tree nodes are compared, so the containing
+ * objects are never touched. Each key type has its own loop so that
+ * integer lookups are plain compares. The walk never takes more steps
+ * than there are nodes, which only matters for a racing reader.
+ */
+static bst_node_t *
+bst_find (bst_t *bst, bst_node_t *probe)
+{
+    bst_node_t  *node = BST_LOAD(bst->root);
+    uint32_t    steps = bst->node_count;
+    int         key;
+    uint64_t    key64;
+    int32_t     result;
+
+    switch (bst->key_type) {
+    case BST_KEY_U64:
+        key64 = probe->key64;
+        while (node != NULL && key64 != node->key64 && steps-- > 0) {
+            node = (key64 < node->key64) ? BST_LOAD(node->left) :
+                                           BST_LOAD(node->right);
+        }
+        break;
+
+    case BST_KEY_CMP:
+        while (node != NULL && steps-- > 0) {
+            result = bst->cmp_fn(probe->key_ptr, node->key_ptr);
+            if (result == 0) {
+                break;
+            }
+            node = (result < 0) ? BST_LOAD(node->left) : BST_LOAD(node->right);
+        }
+        break;
+
+    default:
+        key = probe->key;
+        while (node != NULL && key != node->key && steps-- > 0) {
+            node = (key < node->key) ? BST_LOAD(node->left) :
+                                       BST_LOAD(node->right);
+        }
+        break;
+    }
+
+    return node;
+}
+
+/*
+ * bst_find_object
+ *
+ * Return the object with the same key as the probe node, or NULL if
+ * the key is not present. Concurrent trees are walked optimistically
+ * and the walk is repeated if a writer got in the way.
+ */
+static void *
+bst_find_object (bst_t *bst, bst_node_t *probe)
+{
+    bst_node_t  *node;
+    uint32_t    seq;
+
+    if (!(bst->flags & BST_FLAG_CONCURRENT)) {
+        node = bst_find(bst, probe);
+    } else {
+        epoch_enter(bst->epoch);
+        do {
+            seq = bst_read_begin(bst);
+            node = bst_find(bst, probe);
+        } while (bst_read_retry(bst, seq));
+        epoch_exit(bst->epoch);
+    }
+
+    if (!node) {
         return NULL;
     }
 
-    /* Grab a pointer to the root */
-    root = bst->root;
-    if (!root) {
+    return ((void *)((uint8_t *)node - bst->node_offset));
+}
+
+/*
+ * bst_unlink
+ *
+ * Unlink the given node from the tree. If the node has two children,
+ * it is replaced by its in-order successor. Only the pointers that
+ * actually change are written. Returns the lowest node whose subtree
+ * changed, which is where rebalancing has to start from.
+ */
+static bst_node_t *
+bst_unlink (bst_t *bst, bst_node_t *node)
+{
+    bst_node_t  *child, *succ, *fix;
+
+    if (node->left == NULL || node->right == NULL) {
+        /* At most one child. Splice it into the node's place */
+        child = node->left ? node->left : node->right;
+        if (child) {
+            child->parent = node->parent;
+        }
+        bst_replace_child(bst, node->parent, node, child);
+
+        return node->parent;
+    }
+
+    /* Two children. Replace the node with its in-order successor */
+    succ = bst_find_min(node->right);
+
+    if (succ->parent != node) {
+        fix = succ->parent;
+        BST_STORE(fix->left, succ->right);
+        if (succ->right) {
+            succ->right->parent = fix;
+        }
+        BST_STORE(succ->right, node->right);
+        node->right->parent = succ;
+    } else {
+        fix = succ;
+    }
+
+    BST_STORE(succ->left, node->left);
+    node->left->parent = succ;
+    succ->parent = node->parent;
+    succ->height = node->height;
+    succ->size = node->size;
+    bst_replace_child(bst, node->parent, node, succ);
+
+    return fix;
+}
+
+/*
+ * bst_insert
+ *
+ * Insert a node to the binary search tree. The insertion point is found
+ * by walking down from the root. Balanced trees additionally fix up the
+ * path back to the root.
+ */
+int
+bst_insert (bst_t *bst, bst_node_t *node)
+{
+    bst_node_t  *parent = NULL;
+    bst_node_t  **link;
+    int32_t     result;
+
+    /* Sanity check */
+    if (!bst || !node) {
+        return EINVAL;
+    }
+
+    /* Cache the key in the node */
+    bst_load_key(bst, node, node);
+
+    bst_write_begin(bst);
+
+    /* Walk down to the empty link where the node has to be attached */
+    link = &bst->root;
+    while (*link != NULL) {
+        parent = *link;
+        result = bst_key_compare(bst, node, parent);
+
+        if (result < 0) {
+            link = &parent->left;
+        } else if (result > 0) {
+            link = &parent->right;
+        } else {
+            /* Duplicate key */
+            bst_write_end(bst);
+            return EFAIL;
+        }
+    }
+
+    /* Initialize the left, right and parent pointers before publishing */
+    node->left = NULL;
+    node->right = NULL;
+    node->parent = parent;
+    node->height = 1;
+    node->size = 1;
+    BST_STORE(*link, node);
+
+    if (bst->flags & BST_FLAG_ORDER_STAT) {
+        bst_adjust_sizes(parent, 1);
+    }
+
+    if (bst->flags & BST_FLAG_BALANCED) {
+        bst_rebalance(bst, parent);
+    }
+
+    /* Increment the node count */
+    bst->node_count++;
+
+    bst_write_end(bst);
+
+    return EOK;
+}
+
+/*
+ * bst_remove
+ *
+ * Remove a node from the binary search tree. For concurrent trees, the
+ * node may still be in use by readers until bst_synchronize() is called.
+ */
+int
+bst_remove (bst_t *bst, bst_node_t *node)
+{
+    bst_node_t  *victim, *fix;
+    bst_node_t  probe;
+
+    /* Sanity check */
+    if (!bst || !node) {
+        return EINVAL;
+    }
+
+    /*
+     * Find the node carrying this key. The key is loaded into a probe so
+     * that the given node is not written to, in case it is not ours.
+     */
+    bst_load_key(bst, &probe, node);
+
+    bst_write_begin(bst);
+
+    if (!bst->root) {
+        bst_write_end(bst);
+        return EINVAL;
+    }
+
+    victim = bst_find(bst, &probe);
+    if (!victim) {
+        /* Key was not found */
+        bst_write_end(bst);
+        return ENOTFOUND;
+    }
+
+    fix = bst_unlink(bst, victim);
+
+    if (bst->flags & BST_FLAG_ORDER_STAT) {
+        bst_adjust_sizes(fix, -1);
+    }
+
+    if (bst->flags & BST_FLAG_BALANCED) {
+        bst_rebalance(bst, fix);
+    }
+
+    /* Decrement the node count */
+    bst->node_count--;
+
+    bst_write_end(bst);
+
+    return EOK;
+}
+
+/*
+ * bst_lookup
+ *
+ * Lookup a node in the BST with the given key. Returns NULL
+ * if node is not found.
+ */
+void *
+bst_lookup (bst_t *bst, int key)
+{
+    bst_node_t  probe;
+
+    /* Sanity check */
+    if (!bst || bst->key_type != BST_KEY_INT) {
+        return NULL;
+    }
+
+    probe.key = key;
+
+    return (bst_find_object(bst, &probe));
+}
+
+/*
+ * bst_lookup_u64
+ *
+ * Lookup a node in a BST created by bst_create_u64() with the given key.
+ * Returns NULL if node is not found.
+ */
+void *
+bst_lookup_u64 (bst_t *bst, uint64_t key)
+{
+    bst_node_t  probe;
+
+    /* Sanity check */
+    if (!bst || bst->key_type != BST_KEY_U64) {
+        return NULL;
+    }
+
+    probe.key64 = key;
+
+    return (bst_find_object(bst, &probe));
+}
+
+/*
+ * bst_lookup_cmp
+ *
+ * Lookup a node in a BST created by bst_create_cmp() with the given key.
+ * Returns NULL if node is not found.
+ */
+void *
+bst_lookup_cmp (bst_t *bst, void *key)
+{
+    bst_node_t  probe;
+
+    /* Sanity check */
+    if (!bst || bst->key_type != BST_KEY_CMP) {
+        return NULL;
+    }
+
+    probe.key_ptr = key;
+
+    return (bst_find_object(bst, &probe));
+}
+
+/*
+ * bst_seek_node
+ *
+ * Return the node with the smallest key which is greater than or equal
+ * to the key of the probe node (or strictly greater than, if inclusive
+ * is FALSE). A NULL probe sorts before every key. Like bst_find(), the
+ * walk is bounded by the node count.
+ */
+static bst_node_t *
+bst_seek_node (bst_t *bst, bst_node_t *probe, uint8_t inclusive)
+{
+    bst_node_t  *node = BST_LOAD(bst->root);
+    bst_node_t  *best = NULL;
+    uint32_t    steps = bst->node_count;
+    int32_t     result;
+
+    while (node != NULL && steps-- > 0) {
+        result = probe ? bst_key_compare(bst, probe, node) : -1;
+
+        if (result < 0 || (inclusive && result == 0)) {
+            /* Candidate. Look for a smaller one on the left */
+            best = node;
+            node = BST_LOAD(node->left);
+        } else {
+            node = BST_LOAD(node->right);
+        }
+    }
+
+    return best;
+}
+
+/*
+ * bst_seek
+ *
+ * Object returning wrapper around bst_seek_node(). Returns NULL if
+ * there is no such object.
+ */
+static void *
+bst_seek (bst_t *bst, bst_node_t *probe, uint8_t inclusive)
+{
+    bst_node_t  *best;
+    uint32_t    seq;
+
+    if (!(bst->flags & BST_FLAG_CONCURRENT)) {
+        best = bst_seek_node(bst, probe, inclusive);
+    } else {
+        epoch_enter(bst->epoch);
+        do {
+            seq = bst_read_begin(bst);
+            best = bst_seek_node(bst, probe, inclusive);
+        } while (bst_read_retry(bst, seq));
+        epoch_exit(bst->epoch);
+    }
+
+    if (!best) {
+        return NULL;
+    }
+
+    return ((void *)((uint8_t *)best - bst->node_offset));
+}
+
+/*
+ * bst_lower_bound
+ *
+ * Return the object with the smallest key greater than or equal to
+ * the given key. Returns NULL if there is no such object.
+ */
+void *
+bst_lower_bound (bst_t *bst, int key)
+{
+    bst_node_t  probe;
+
+    /* Sanity check */
+    if (!bst || bst->key_type != BST_KEY_INT) {
+        return NULL;
+    }
+
+    probe.key = key;
+
+    return (bst_seek(bst, &probe, TRUE));
+}
+
+/*
+ * bst_upper_bound
+ *
+ * Return the object with the smallest key strictly greater than the
+ * given key. Returns NULL if there is no such object.
+ */
+void *
+bst_upper_bound (bst_t *bst, int key)
+{
+    bst_node_t  probe;
+
+    /* Sanity check */
+    if (!bst || bst->key_type != BST_KEY_INT) {
+        return NULL;
+    }
+
+    probe.key = key;
+
+    return (bst_seek(bst, &probe, FALSE));
+}
+
+/*
+ * bst_lower_bound_u64
+ *
+ * Same as bst_lower_bound() for trees created by bst_create_u64()
+ */
+void *
+bst_lower_bound_u64 (bst_t *bst, uint64_t key)
+{
+    bst_node_t  probe;
+
+    /* Sanity check */
+    if (!bst || bst->key_type != BST_KEY_U64) {
+        return NULL;
+    }
+
+    probe.key64 = key;
+
+    return (bst_seek(bst, &probe, TRUE));
+}
+
+/*
+ * bst_upper_bound_u64
+ *
+ * Same as bst_upper_bound() for trees created by bst_create_u64()
+ */
+void *
+bst_upper_bound_u64 (bst_t *bst, uint64_t key)
+{
+    bst_node_t  probe;
+
+    /* Sanity check */
+    if (!bst || bst->key_type != BST_KEY_U64) {
+        return NULL;
+    }
+
+    probe.key64 = key;
+
+    return (bst_seek(bst, &probe, FALSE));
+}
+
+/*
+ * bst_lower_bound_cmp
+ *
+ * Same as bst_lower_bound() for trees created by bst_create_cmp()
+ */
+void *
+bst_lower_bound_cmp (bst_t *bst, void *key)
+{
+    bst_node_t  probe;
+
+    /* Sanity check */
+    if (!bst || bst->key_type != BST_KEY_CMP) {
+        return NULL;
+    }
+
+    probe.key_ptr = key;
+
+    return (bst_seek(bst, &probe, TRUE));
+}
+
+/*
+ * bst_upper_bound_cmp
+ *
+ * Same as bst_upper_bound() for trees created by bst_create_cmp()
+ */
+void *
+bst_upper_bound_cmp (bst_t *bst, void *key)
+{
+    bst_node_t  probe;
+
+    /* Sanity check */
+    if (!bst || bst->key_type != BST_KEY_CMP) {
+        return NULL;
+    }
+
+    probe.key_ptr = key;
+
+    return (bst_seek(bst, &probe, FALSE));
+}
+
+/*
+ * bst_range_foreach_concurrent
+ *
+ * bst_range_foreach() for concurrent trees. Each step is a separate
+ * optimistic seek, and the whole scan stays in the epoch so that the
+ * node handed to the callback can be used to find the next one.
+ */
+static int
+bst_range_foreach_concurrent (bst_t *bst, int lo, int hi,
+                              int (*callback)(void *node, void *ctx),
+                              void *ctx)
+{
+    bst_node_t  *node;
+    void        *obj;
+    int         rc = EOK;
+
+    epoch_enter(bst->epoch);
+
+    obj = bst_lower_bound(bst, lo);
+    while (obj != NULL) {
+        node = (bst_node_t *)((uint8_t *)obj + bst->node_offset);
+        if (node->key >= hi) {
+            break;
+        }
+
+        rc = callback(obj, ctx);
+        if (rc != 0) {
+            break;
+        }
+
+        obj = bst_seek(bst, node, FALSE);
+    }
+
+    epoch_exit(bst->epoch);
+
+    return rc;
+}
+
+/*
+ * bst_range_foreach
+ *
+ * Invoke the callback for every object with a key in [lo, hi), in key
+ * order. The tree is descended once to the first object and the rest
+ * are reached by walking the tree nodes directly. The scan stops early
+ * if the callback returns non-zero, and that value is returned. Only
+ * valid for trees with int keys.
+ *
+ * Concurrent trees are scanned by seeking to each next key from the
+ * root, so the callback never runs with the tree in a torn state. It
+ * sees every key which stays in the tree for the whole scan.
+ */
+int
+bst_range_foreach (bst_t *bst, int lo, int hi,
+                   int (*callback)(void *node, void *ctx), void *ctx)
+{
+    bst_node_t  *node;
+    void        *obj;
+    int         rc;
+
+    /* Sanity check */
+    if (!bst || !callback || bst->key_type != BST_KEY_INT) {
+        return EINVAL;
+    }
+
+    if (lo >= hi) {
+        return EOK;
+    }
+
+    if (bst->flags & BST_FLAG_CONCURRENT) {
+        return (bst_range_foreach_concurrent(bst, lo, hi, callback, ctx));
+    }
+
+    obj = bst_lower_bound(bst, lo);
+    if (!obj) {
+        return EOK;
+    }
+
+    node = (bst_node_t *)((uint8_t *)obj + bst->node_offset);
+    while (node != NULL && node->key < hi) {
+        rc = callback((uint8_t *)node - bst->node_offset, ctx);
+        if (rc != 0) {
+            return rc;
+        }
+
+        node = bst_successor(node);
+    }
+
+    return EOK;
+}
+
+/*
+ * bst_build_internal
+ *
+ * Link nodes[lo..hi) into a perfectly balanced subtree hanging off the
+ * given parent and return its root. The middle node becomes the root
+ * and the two halves are built recursively, so the recursion depth is
+ * only log2(count).
+ */
+static bst_node_t *
+bst_build_internal (bst_node_t **nodes, uint32_t lo, uint32_t hi,
+                    bst_node_t *parent)
+{
+    bst_node_t  *node;
+    uint32_t    mid;
+
+    if (lo >= hi) {
+        return NULL;
+    }
+
+    mid = lo + (hi - lo) / 2;
+    node = nodes[mid];
+    node->parent = parent;
+    node->left = bst_build_internal(nodes, lo, mid, node);
+    node->right = bst_build_internal(nodes, mid + 1, hi, node);
+    node->size = hi - lo;
+    bst_update_height(node);
+
+    return node;
+}
+
+/*
+ * bst_build_sorted
+ *
+ * Build the tree in O(n) from an array of nodes which is already sorted
+ * by key, instead of inserting them one at a time. The tree has to be
+ * empty. The resulting tree is perfectly balanced and has the subtree
+ * sizes filled in, so it is a valid starting point for balanced and
+ * order statistic trees as well.
+ */
+int
+bst_build_sorted (bst_t *bst, bst_node_t **nodes, uint32_t count)
+{
+    uint32_t    i;
+
+    /* Sanity check */
+    if (!bst || (!nodes && count)) {
+        return EINVAL;
+    }
+
+    /* Cache the keys and make sure they are strictly increasing */
+    for (i = 0; i < count; i++) {
+        bst_load_key(bst, nodes[i], nodes[i]);
+        if (i > 0 && bst_key_compare(bst, nodes[i - 1], nodes[i]) >= 0) {
+            return EINVAL;
+        }
+    }
+
+    bst_write_begin(bst);
+
+    /* Bail if the tree is not empty */
+    if (!bst_empty(bst)) {
+        bst_write_end(bst);
+        return EFAIL;
+    }
+
+    /* The whole tree is linked up before readers can reach it */
+    BST_STORE(bst->root, bst_build_internal(nodes, 0, count, NULL));
+    bst->node_count = count;
+
+    bst_write_end(bst);
+
+    return EOK;
+}
+
+/*
+ * bst_select_node
+ *
+ * Return the node with the k-th smallest key, walking down by subtree
+ * size for order statistic trees and in key order for the others
+ */
+static bst_node_t *
+bst_select_node (bst_t *bst, uint32_t k)
+{
+    bst_node_t  *node;
+    uint32_t    steps = bst->node_count;
+    uint32_t    left_size;
+
+    if (k >= bst->node_count) {
+        return NULL;
+    }
+
+    if (!(bst->flags & BST_FLAG_ORDER_STAT)) {
+        node = bst_find_min(bst->root);
+        while (k-- > 0) {
+            node = bst_successor(node);
+        }
+        return node;
+    }
+
+    node = BST_LOAD(bst->root);
+    while (node != NULL && steps-- > 0) {
+        left_size = bst_node_size(BST_LOAD(node->left));
+
+        if (k < left_size) {
+            node = BST_LOAD(node->left);
+        } else if (k > left_size) {
+            k -= left_size + 1;
+            node = BST_LOAD(node->right);
+        } else {
+            return node;
+        }
+    }
+
+    /* Shouldn't come here, unless racing with a writer */
+    return NULL;
+}
+
+/*
+ * bst_select
+ *
+ * Return the object with the k-th smallest key (k starts from 0), or
+ * NULL if the tree has k or fewer objects. This is O(log n) for trees
+ * created with BST_FLAG_ORDER_STAT. Other trees fall back to walking
+ * the nodes in order, which for concurrent trees holds off writers.
+ */
+void *
+bst_select (bst_t *bst, uint32_t k)
+{
+    bst_node_t  *node;
+    uint32_t    seq;
+
+    /* Sanity check */
+    if (!bst) {
         return NULL;
     }
 
-    /* Recursively search for the node with the given key */
-    key_node = bst_lookup_internal(bst, root, key);
-    if (!key_node) {
+    if (!(bst->flags & BST_FLAG_CONCURRENT)) {
+        node = bst_select_node(bst, k);
+    } else if (!(bst->flags & BST_FLAG_ORDER_STAT)) {
+        pthread_mutex_lock(&bst->write_lock);
+        node = bst_select_node(bst, k);
+        pthread_mutex_unlock(&bst->write_lock);
+    } else {
+        epoch_enter(bst->epoch);
+        do {
+            seq = bst_read_begin(bst);
+            node = bst_select_node(bst, k);
+        } while (bst_read_retry(bst, seq));
+        epoch_exit(bst->epoch);
+    }
+
+    if (!node) {
         return NULL;
     }
 
-    return ((void *)((uint8_t *)key_node - bst->node_offset));
+    return ((void *)((uint8_t *)node - bst->node_offset));
+}
+
+/*
+ * bst_rank_internal
+ *
+ * Count the nodes with a key less than the given key, by subtree size
+ * for order statistic trees and in key order for the others
+ */
+static uint32_t
+bst_rank_internal (bst_t *bst, int key)
+{
+    bst_node_t  *node;
+    uint32_t    steps = bst->node_count;
+    uint32_t    rank = 0;
+
+    if (!(bst->flags & BST_FLAG_ORDER_STAT)) {
+        node = bst_find_min(bst->root);
+        while (node != NULL && node->key < key) {
+            rank++;
+            node = bst_successor(node);
+        }
+        return rank;
+    }
+
+    node = BST_LOAD(bst->root);
+    while (node != NULL && steps-- > 0) {
+        if (key <= node->key) {
+            node = BST_LOAD(node->left);
+        } else {
+            rank += bst_node_size(BST_LOAD(node->left)) + 1;
+            node = BST_LOAD(node->right);
+        }
+    }
+
+    return rank;
+}
+
+/*
+ * bst_rank
+ *
+ * Return the number of objects with a key less than the given key.
+ * This is O(log n) for trees created with BST_FLAG_ORDER_STAT. Other
+ * trees fall back to walking the nodes in order, which for concurrent
+ * trees holds off writers. Only valid for trees with int keys.
+ */
+uint32_t
+bst_rank (bst_t *bst, int key)
+{
+    uint32_t    rank, seq;
+
+    /* Sanity check */
+    if (!bst || bst->key_type != BST_KEY_INT) {
+        return 0;
+    }
+
+    if (!(bst->flags & BST_FLAG_CONCURRENT)) {
+        rank = bst_rank_internal(bst, key);
+    } else if (!(bst->flags & BST_FLAG_ORDER_STAT)) {
+        pthread_mutex_lock(&bst->write_lock);
+        rank = bst_rank_internal(bst, key);
+        pthread_mutex_unlock(&bst->write_lock);
+    } else {
+        epoch_enter(bst->epoch);
+        do {
+            seq = bst_read_begin(bst);
+            rank = bst_rank_internal(bst, key);
+        } while (bst_read_retry(bst, seq));
+        epoch_exit(bst->epoch);
+    }
+
+    return rank;
 }
 
 /* End of File */
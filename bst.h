@@ -2,6 +2,8 @@
 #define BST_H
 
 #include <stdint.h>
+#include <pthread.h>
+#include "epoch.h"
 
 /* Defines */
 
@@ -15,12 +17,27 @@
 #define ENOTFOUND                   -2
 #define EFAIL                       -3
 
+#define BST_FLAG_BALANCED           0x1     /* Keep the tree AVL balanced */
+#define BST_FLAG_ORDER_STAT         0x2     /* Track subtree sizes for rank/select */
+#define BST_FLAG_CONCURRENT         0x4     /* Lock-free readers, serialized writers */
+
+#define BST_KEY_INT                 0       /* int keys, compared inline */
+#define BST_KEY_U64                 1       /* uint64_t keys, compared inline */
+#define BST_KEY_CMP                 2       /* Opaque keys, compared by cmp_fn */
+
 /* Structure Definitions */
 
 typedef struct bst_node_ {
     struct bst_node_    *left;
     struct bst_node_    *right;
     struct bst_node_    *parent;
+    union {                         /* Copy of get_key(), taken on insert */
+        int             key;        /* BST_KEY_INT */
+        uint64_t        key64;      /* BST_KEY_U64 */
+        void            *key_ptr;   /* BST_KEY_CMP */
+    };
+    int32_t             height;     /* Only maintained for balanced trees */
+    uint32_t            size;       /* Only maintained with BST_FLAG_ORDER_STAT */
 } bst_node_t;
 
 typedef struct bst_ {
@@ -28,13 +45,31 @@ typedef struct bst_ {
     bst_node_t      *root;
     uint32_t        node_offset;
     uint32_t        node_count;
+    uint32_t        flags;
+    uint32_t        key_type;
     int             (*get_key)(void *node);
+    uint64_t        (*get_key64)(void *node);
+    void*           (*get_key_ptr)(void *node);
+    int32_t         (*cmp_fn)(void *key1, void *key2);
+    uint32_t        seq;        /* Odd while a writer is updating the tree */
+    pthread_mutex_t write_lock; /* Only used with BST_FLAG_CONCURRENT */
+    epoch_t         *epoch;     /* Only used with BST_FLAG_CONCURRENT */
 } bst_t;
 
 /* Function prototypes */
 
 bst_t* bst_create (char *name, uint32_t node_offset, 
                    int (*get_key)(void *node));
+bst_t* bst_create_balanced (char *name, uint32_t node_offset,
+                            int (*get_key)(void *node));
+bst_t* bst_create_flags (char *name, uint32_t node_offset,
+                         int (*get_key)(void *node), uint32_t flags);
+bst_t* bst_create_u64 (char *name, uint32_t node_offset,
+                       uint64_t (*get_key)(void *node), uint32_t flags);
+bst_t* bst_create_cmp (char *name, uint32_t node_offset,
+                       void* (*get_key)(void *node),
+                       int32_t (*cmp_fn)(void *key1, void *key2),
+                       uint32_t flags);
 int bst_destroy (bst_t *bst);
 void* bst_get_root (bst_t *bst);
 void* bst_get_least (bst_t *bst);
@@ -44,5 +79,21 @@ uint8_t bst_empty (bst_t *bst);
 int bst_insert (bst_t *bst, bst_node_t *node);
 int bst_remove (bst_t *bst, bst_node_t *node);
 void* bst_lookup (bst_t *bst, int key);
+void* bst_lower_bound (bst_t *bst, int key);
+void* bst_upper_bound (bst_t *bst, int key);
+void* bst_lookup_u64 (bst_t *bst, uint64_t key);
+void* bst_lower_bound_u64 (bst_t *bst, uint64_t key);
+void* bst_upper_bound_u64 (bst_t *bst, uint64_t key);
+void* bst_lookup_cmp (bst_t *bst, void *key);
+void* bst_lower_bound_cmp (bst_t *bst, void *key);
+void* bst_upper_bound_cmp (bst_t *bst, void *key);
+int bst_build_sorted (bst_t *bst, bst_node_t **nodes, uint32_t count);
+int bst_range_foreach (bst_t *bst, int lo, int hi,
+                       int (*callback)(void *node, void *ctx), void *ctx);
+void* bst_select (bst_t *bst, uint32_t k);
+uint32_t bst_rank (bst_t *bst, int key);
+void bst_read_lock (bst_t *bst);
+void bst_read_unlock (bst_t *bst);
+void bst_synchronize (bst_t *bst);
 
 #endif /* BST_H */
@@ -0,0 +1,751 @@
+/*
+ * btree.c - This file contains a B+tree implementation where each
+ *           record has a 32-bit key
+ */
+
+/*
+ * All the records live in the leaves, which are chained together in key
+ * order for range scans. Internal nodes only hold separator keys. Every
+ * node packs BTREE_NODE_KEYS keys into consecutive cache lines, so a
+ * lookup touches a handful of cache lines per level instead of one per
+ * key as in a binary tree.
+ *
+ *                      [ 30 | 60 ]
+ *                     /     |     \
+ *       [ 5 | 10 | 20 ] [ 30 | 45 ] [ 60 | 70 | 90 ]
+ *              <------------>  <---------->
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "btree.h"
+
+/*
+ * btree_create
+ *
+ * Create an instance of the B+tree and return a pointer to it
+ */
+btree_t *
+btree_create (char *name, int (*get_key)(void *data))
+{
+    btree_t *btree;
+
+    btree = (btree_t *)malloc(sizeof(btree_t));
+    if (!btree) {
+        return NULL;
+    }
+
+    /* Initialize the contents */
+    memset(btree, 0, sizeof(btree_t));
+    strncpy(btree->btree_name, name, MAX_NAME_LEN - 1);
+    btree->root = NULL;
+    btree->height = 0;
+    btree->node_count = 0;
+    btree->key_count = 0;
+    btree->get_key = get_key;
+
+    return btree;
+}
+
+/*
+ * btree_destroy
+ *
+ * Free the given B+tree
+ */
+int
+btree_destroy (btree_t *btree)
+{
+    /* Bail if the tree is not empty */
+    if (!btree_empty(btree)) {
+        return EFAIL;
+    }
+
+    /* Do the deed */
+    free(btree);
+
+    return EOK;
+}
+
+/*
+ * btree_node_alloc
+ *
+ * Allocate a cache line aligned node with all the key slots padded
+ */
+static btree_node_t *
+btree_node_alloc (btree_t *btree, uint16_t leaf)
+{
+    btree_node_t    *node;
+    int             i;
+
+    if (posix_memalign((void **)&node, BTREE_CACHE_LINE,
+                       sizeof(btree_node_t))) {
+        return NULL;
+    }
+
+    for (i = 0; i < BTREE_NODE_KEYS; i++) {
+        node->keys[i] = INT_MAX;
+    }
+    node->num_keys = 0;
+    node->leaf = leaf;
+    node->next = NULL;
+    node->prev = NULL;
+    memset(node->ptrs, 0, sizeof(node->ptrs));
+
+    btree->node_count++;
+
+    return node;
+}
+
+/*
+ * btree_node_free
+ *
+ * Free a node which is no longer part of the tree
+ */
+static void
+btree_node_free (btree_t *btree, btree_node_t *node)
+{
+    free(node);
+    btree->node_count--;
+}
+
+/*
+ * btree_count_less
+ *
+ * Return the number of keys in the node which are less than the given
+ * key, i.e. the position of the first key >= key. All the key slots
+ * are compared at once and the result is clamped, so there are no
+ * data dependent branches.
+ */
+static inline uint32_t
+btree_count_less (btree_node_t *node, int key)
+{
+    uint32_t count = 0;
+    int i;
+
+#ifdef __SSE2__
+    __m128i key_vec = _mm_set1_epi32(key);
+
+    for (i = 0; i < BTREE_NODE_KEYS; i += 4) {
+        __m128i keys = _mm_load_si128((__m128i *)&node->keys[i]);
+        __m128i lt = _mm_cmplt_epi32(keys, key_vec);
+
+        count += __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(lt)));
+    }
+#else
+    for (i = 0; i < BTREE_NODE_KEYS; i++) {
+        count += (node->keys[i] < key);
+    }
+#endif
+
+    return (count < node->num_keys ? count : node->num_keys);
+}
+
+/*
+ * btree_count_less_equal
+ *
+ * Return the number of keys in the node which are less than or equal
+ * to the given key, i.e. the child to descend into for that key.
+ */
+static inline uint32_t
+btree_count_less_equal (btree_node_t *node, int key)
+{
+    uint32_t count = 0;
+    int i;
+
+#ifdef __SSE2__
+    __m128i key_vec = _mm_set1_epi32(key);
+
+    for (i = 0; i < BTREE_NODE_KEYS; i += 4) {
+        __m128i keys = _mm_load_si128((__m128i *)&node->keys[i]);
+        __m128i gt = _mm_cmpgt_epi32(keys, key_vec);
+
+        count += __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(gt)));
+    }
+    count = BTREE_NODE_KEYS - count;
+#else
+    for (i = 0; i < BTREE_NODE_KEYS; i++) {
+        count += (node->keys[i] <= key);
+    }
+#endif
+
+    return (count < node->num_keys ? count : node->num_keys);
+}
+
+/*
+ * btree_find_leaf
+ *
+ * Walk down from the root to the leaf which may contain the given key.
+ * If path is non-NULL, the nodes visited and the child index taken at
+ * each of them are recorded in path/path_index.
+ */
+static btree_node_t *
+btree_find_leaf (btree_t *btree, int key, btree_node_t **path,
+                 uint32_t *path_index)
+{
+    btree_node_t    *node = btree->root;
+    uint32_t        index, depth = 0;
+
+    while (node && !node->leaf) {
+        index = btree_count_less_equal(node, key);
+        if (path) {
+            path[depth] = node;
+            path_index[depth] = index;
+        }
+        depth++;
+        node = (btree_node_t *)node->ptrs[index];
+    }
+
+    return node;
+}
+
+/*
+ * btree_get_least
+ *
+ * Return a pointer to the record with the least key
+ */
+void *
+btree_get_least (btree_t *btree)
+{
+    btree_node_t *node;
+
+    /* Sanity check */
+    if (!btree || !btree->root) {
+        return NULL;
+    }
+
+    node = btree->root;
+    while (!node->leaf) {
+        node = (btree_node_t *)node->ptrs[0];
+    }
+
+    return node->ptrs[0];
+}
+
+/*
+ * btree_get_next
+ *
+ * Return the record following the given one in key order
+ */
+void *
+btree_get_next (btree_t *btree, void *prev_data)
+{
+    btree_node_t    *leaf;
+    uint32_t        pos;
+
+    /* Sanity check */
+    if (!btree || !prev_data || !btree->root) {
+        return NULL;
+    }
+
+    /* Find the first key strictly greater than the previous one */
+    leaf = btree_find_leaf(btree, btree->get_key(prev_data), NULL, NULL);
+    pos = btree_count_less_equal(leaf, btree->get_key(prev_data));
+
+    if (pos == leaf->num_keys) {
+        leaf = leaf->next;
+        pos = 0;
+    }
+
+    if (!leaf) {
+        /* We have iterated over all the records */
+        return NULL;
+    }
+
+    return leaf->ptrs[pos];
+}
+
+/*
+ * btree_get_count
+ *
+ * Return the count of records in the given tree
+ */
+uint32_t
+btree_get_count (btree_t *btree)
+{
+    return btree->key_count;
+}
+
+/*
+ * btree_empty
+ *
+ * Returns true if tree is empty. False otherwise.
+ */
+uint8_t
+btree_empty (btree_t *btree)
+{
+    if (btree->key_count == 0) {
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+/*
+ * btree_insert_into_parent
+ *
+ * Called after the node at the given depth of the path was split into
+ * itself and right. Insert the separator key and the new right node into
+ * the parent, splitting the parent in turn when it is full. The nodes
+ * needed for all the splits have been allocated up front in spare.
+ */
+static void
+btree_insert_into_parent (btree_t *btree, btree_node_t **path,
+                          uint32_t *path_index, int depth, int sep_key,
+                          btree_node_t *right, btree_node_t **spare)
+{
+    int             tmp_keys[BTREE_NODE_KEYS + 1];
+    void            *tmp_ptrs[BTREE_NODE_KEYS + 2];
+    btree_node_t    *parent, *new_node, *root;
+    uint32_t        index, total, mid, i;
+
+    while (depth > 0) {
+        parent = path[depth - 1];
+        index = path_index[depth - 1];
+
+        if (parent->num_keys < BTREE_NODE_KEYS) {
+            /* Room in the parent. Shift and drop the separator in */
+            memmove(&parent->keys[index + 1], &parent->keys[index],
+                    (parent->num_keys - index) * sizeof(int));
+            memmove(&parent->ptrs[index + 2], &parent->ptrs[index + 1],
+                    (parent->num_keys - index) * sizeof(void *));
+            parent->keys[index] = sep_key;
+            parent->ptrs[index + 1] = right;
+            parent->num_keys++;
+            return;
+        }
+
+        /* The parent is full. Build the overfull node and split it */
+        memcpy(tmp_keys, parent->keys, index * sizeof(int));
+        memcpy(tmp_ptrs, parent->ptrs, (index + 1) * sizeof(void *));
+        tmp_keys[index] = sep_key;
+        tmp_ptrs[index + 1] = right;
+        memcpy(&tmp_keys[index + 1], &parent->keys[index],
+               (BTREE_NODE_KEYS - index) * sizeof(int));
+        memcpy(&tmp_ptrs[index + 2], &parent->ptrs[index + 1],
+               (BTREE_NODE_KEYS - index) * sizeof(void *));
+
+        total = BTREE_NODE_KEYS + 1;
+        mid = total / 2;
+        new_node = *spare++;
+
+        /* Left half stays in the parent, the middle key moves up */
+        memcpy(parent->keys, tmp_keys, mid * sizeof(int));
+        memcpy(parent->ptrs, tmp_ptrs, (mid + 1) * sizeof(void *));
+        for (i = mid; i < BTREE_NODE_KEYS; i++) {
+            parent->keys[i] = INT_MAX;
+            parent->ptrs[i + 1] = NULL;
+        }
+        parent->num_keys = mid;
+
+        memcpy(new_node->keys, &tmp_keys[mid + 1],
+               (total - mid - 1) * sizeof(int));
+        memcpy(new_node->ptrs, &tmp_ptrs[mid + 1],
+               (total - mid) * sizeof(void *));
+        new_node->num_keys = total - mid - 1;
+
+        sep_key = tmp_keys[mid];
+        right = new_node;
+        depth--;
+    }
+
+    /* The root was split. Grow the tree by one level */
+    root = *spare;
+    root->keys[0] = sep_key;
+    root->ptrs[0] = btree->root;
+    root->ptrs[1] = right;
+    root->num_keys = 1;
+    btree->root = root;
+    btree->height++;
+}
+
+/*
+ * btree_insert
+ *
+ * Insert a record with the given key to the tree
+ */
+int
+btree_insert (btree_t *btree, int key, void *data)
+{
+    btree_node_t    *path[BTREE_MAX_HEIGHT];
+    uint32_t        path_index[BTREE_MAX_HEIGHT];
+    btree_node_t    *spare[BTREE_MAX_HEIGHT + 1];
+    int             tmp_keys[BTREE_NODE_KEYS + 1];
+    void            *tmp_ptrs[BTREE_NODE_KEYS + 1];
+    btree_node_t    *leaf, *new_leaf;
+    uint32_t        pos, total, mid, i, num_spare;
+    int             depth;
+
+    /* Sanity check */
+    if (!btree) {
+        return EINVAL;
+    }
+
+    /* Special case. Is this the first record? */
+    if (!btree->root) {
+        leaf = btree_node_alloc(btree, TRUE);
+        if (!leaf) {
+            return EFAIL;
+        }
+        leaf->keys[0] = key;
+        leaf->ptrs[0] = data;
+        leaf->num_keys = 1;
+        btree->root = leaf;
+        btree->height = 1;
+        btree->key_count++;
+        return EOK;
+    }
+
+    leaf = btree_find_leaf(btree, key, path, path_index);
+    depth = btree->height - 1;
+    pos = btree_count_less(leaf, key);
+
+    if (pos < leaf->num_keys && leaf->keys[pos] == key) {
+        /* Duplicate key */
+        return EFAIL;
+    }
+
+    /* Easy case. There is room in the leaf */
+    if (leaf->num_keys < BTREE_NODE_KEYS) {
+        memmove(&leaf->keys[pos + 1], &leaf->keys[pos],
+                (leaf->num_keys - pos) * sizeof(int));
+        memmove(&leaf->ptrs[pos + 1], &leaf->ptrs[pos],
+                (leaf->num_keys - pos) * sizeof(void *));
+        leaf->keys[pos] = key;
+        leaf->ptrs[pos] = data;
+        leaf->num_keys++;
+        btree->key_count++;
+        return EOK;
+    }
+
+    /*
+     * The leaf has to be split. Allocate every node the split can
+     * propagate into before touching the tree, so that a failed
+     * allocation leaves the tree intact.
+     */
+    num_spare = 1;
+    for (i = depth; i > 0 && path[i - 1]->num_keys == BTREE_NODE_KEYS; i--) {
+        num_spare++;
+    }
+    if (i == 0) {
+        /* A new root is needed as well */
+        num_spare++;
+    }
+
+    for (i = 0; i < num_spare; i++) {
+        spare[i] = btree_node_alloc(btree, (i == 0));
+        if (!spare[i]) {
+            while (i > 0) {
+                btree_node_free(btree, spare[--i]);
+            }
+            return EFAIL;
+        }
+    }
+
+    /* Build the overfull leaf and split it in two halves */
+    memcpy(tmp_keys, leaf->keys, pos * sizeof(int));
+    memcpy(tmp_ptrs, leaf->ptrs, pos * sizeof(void *));
+    tmp_keys[pos] = key;
+    tmp_ptrs[pos] = data;
+    memcpy(&tmp_keys[pos + 1], &leaf->keys[pos],
+           (BTREE_NODE_KEYS - pos) * sizeof(int));
+    memcpy(&tmp_ptrs[pos + 1], &leaf->ptrs[pos],
+           (BTREE_NODE_KEYS - pos) * sizeof(void *));
+
+    total = BTREE_NODE_KEYS + 1;
+    mid = total / 2;
+    new_leaf = spare[0];
+
+    memcpy(leaf->keys, tmp_keys, mid * sizeof(int));
+    memcpy(leaf->ptrs, tmp_ptrs, mid * sizeof(void *));
+    for (i = mid; i < BTREE_NODE_KEYS; i++) {
+        leaf->keys[i] = INT_MAX;
+        leaf->ptrs[i] = NULL;
+    }
+    leaf->num_keys = mid;
+
+    memcpy(new_leaf->keys, &tmp_keys[mid], (total - mid) * sizeof(int));
+    memcpy(new_leaf->ptrs, &tmp_ptrs[mid], (total - mid) * sizeof(void *));
+    new_leaf->num_keys = total - mid;
+
+    /* Link the new leaf into the leaf chain */
+    new_leaf->next = leaf->next;
+    new_leaf->prev = leaf;
+    if (leaf->next) {
+        leaf->next->prev = new_leaf;
+    }
+    leaf->next = new_leaf;
+
+    btree_insert_into_parent(btree, path, path_index, depth,
+                             new_leaf->keys[0], new_leaf, &spare[1]);
+    btree->key_count++;
+
+    return EOK;
+}
+
+/*
+ * btree_remove_at
+ *
+ * Remove the key at position pos (and the pointer at ptr_pos) from the
+ * given node, padding the vacated key slot
+ */
+static void
+btree_remove_at (btree_node_t *node, uint32_t pos, uint32_t ptr_pos)
+{
+    uint32_t num_ptrs = node->leaf ? node->num_keys : node->num_keys + 1;
+
+    memmove(&node->keys[pos], &node->keys[pos + 1],
+            (node->num_keys - pos - 1) * sizeof(int));
+    memmove(&node->ptrs[ptr_pos], &node->ptrs[ptr_pos + 1],
+            (num_ptrs - ptr_pos - 1) * sizeof(void *));
+    node->num_keys--;
+    node->keys[node->num_keys] = INT_MAX;
+    node->ptrs[num_ptrs - 1] = NULL;
+}
+
+/*
+ * btree_borrow
+ *
+ * Move one entry from sibling into node through the parent. left is
+ * TRUE when sibling is the left neighbour of node. sep is the index of
+ * the separator key between the two in the parent.
+ */
+static void
+btree_borrow (btree_node_t *parent, uint32_t sep, btree_node_t *node,
+              btree_node_t *sibling, uint8_t left)
+{
+    uint32_t n = node->num_keys;
+    uint32_t s = sibling->num_keys;
+
+    if (!left) {
+        /* Append the first entry of the right neighbour */
+        if (node->leaf) {
+            node->keys[n] = sibling->keys[0];
+            node->ptrs[n] = sibling->ptrs[0];
+            btree_remove_at(sibling, 0, 0);
+            parent->keys[sep] = sibling->keys[0];
+        } else {
+            node->keys[n] = parent->keys[sep];
+            node->ptrs[n + 1] = sibling->ptrs[0];
+            parent->keys[sep] = sibling->keys[0];
+            btree_remove_at(sibling, 0, 0);
+        }
+        node->num_keys++;
+        return;
+    }
+
+    /* Make room at the front of the node for the last entry of the left one */
+    memmove(&node->keys[1], &node->keys[0], n * sizeof(int));
+    memmove(&node->ptrs[1], &node->ptrs[0],
+            (node->leaf ? n : n + 1) * sizeof(void *));
+
+    if (node->leaf) {
+        node->keys[0] = sibling->keys[s - 1];
+        node->ptrs[0] = sibling->ptrs[s - 1];
+        sibling->ptrs[s - 1] = NULL;
+        parent->keys[sep] = node->keys[0];
+    } else {
+        node->keys[0] = parent->keys[sep];
+        node->ptrs[0] = sibling->ptrs[s];
+        sibling->ptrs[s] = NULL;
+        parent->keys[sep] = sibling->keys[s - 1];
+    }
+    sibling->keys[s - 1] = INT_MAX;
+    sibling->num_keys--;
+    node->num_keys++;
+}
+
+/*
+ * btree_merge
+ *
+ * Merge right into left. sep is the index of the separator key between
+ * the two in the parent. The separator and the pointer to right are
+ * removed from the parent and right is freed.
+ */
+static void
+btree_merge (btree_t *btree, btree_node_t *parent, uint32_t sep,
+             btree_node_t *left, btree_node_t *right)
+{
+    uint32_t n = left->num_keys;
+
+    if (left->leaf) {
+        memcpy(&left->keys[n], right->keys, right->num_keys * sizeof(int));
+        memcpy(&left->ptrs[n], right->ptrs, right->num_keys * sizeof(void *));
+        left->num_keys += right->num_keys;
+
+        left->next = right->next;
+        if (right->next) {
+            right->next->prev = left;
+        }
+    } else {
+        left->keys[n] = parent->keys[sep];
+        memcpy(&left->keys[n + 1], right->keys, right->num_keys * sizeof(int));
+        memcpy(&left->ptrs[n + 1], right->ptrs,
+               (right->num_keys + 1) * sizeof(void *));
+        left->num_keys += right->num_keys + 1;
+    }
+
+    btree_remove_at(parent, sep, sep + 1);
+    btree_node_free(btree, right);
+}
+
+/*
+ * btree_remove
+ *
+ * Remove the record with the given key from the tree
+ */
+int
+btree_remove (btree_t *btree, int key)
+{
+    btree_node_t    *path[BTREE_MAX_HEIGHT];
+    uint32_t        path_index[BTREE_MAX_HEIGHT];
+    btree_node_t    *node, *parent, *sibling;
+    uint32_t        pos, index;
+    int             depth;
+
+    /* Sanity check */
+    if (!btree) {
+        return EINVAL;
+    }
+
+    if (!btree->root) {
+        return EINVAL;
+    }
+
+    node = btree_find_leaf(btree, key, path, path_index);
+    pos = btree_count_less(node, key);
+
+    if (pos == node->num_keys || node->keys[pos] != key) {
+        return ENOTFOUND;
+    }
+
+    btree_remove_at(node, pos, pos);
+    btree->key_count--;
+
+    /*
+     * Walk up fixing underflows. A node which dropped below half full
+     * borrows an entry from a neighbour if it can spare one, otherwise
+     * the two are merged and the parent loses an entry.
+     */
+    for (depth = btree->height - 1; depth > 0; depth--) {
+        if (node->num_keys >= BTREE_MIN_KEYS) {
+            return EOK;
+        }
+
+        parent = path[depth - 1];
+        index = path_index[depth - 1];
+
+        if (index > 0) {
+            sibling = (btree_node_t *)parent->ptrs[index - 1];
+            if (sibling->num_keys > BTREE_MIN_KEYS) {
+                btree_borrow(parent, index - 1, node, sibling, TRUE);
+                return EOK;
+            }
+            btree_merge(btree, parent, index - 1, sibling, node);
+        } else {
+            sibling = (btree_node_t *)parent->ptrs[1];
+            if (sibling->num_keys > BTREE_MIN_KEYS) {
+                btree_borrow(parent, 0, node, sibling, FALSE);
+                return EOK;
+            }
+            btree_merge(btree, parent, 0, node, sibling);
+        }
+
+        node = parent;
+    }
+
+    /* We are at the root. Shrink the tree if the root ran dry */
+    node = btree->root;
+    if (node->num_keys == 0) {
+        if (node->leaf) {
+            btree->root = NULL;
+            btree->height = 0;
+        } else {
+            btree->root = (btree_node_t *)node->ptrs[0];
+            btree->height--;
+        }
+        btree_node_free(btree, node);
+    }
+
+    return EOK;
+}
+
+/*
+ * btree_lookup
+ *
+ * Lookup a record in the tree with the given key. Returns NULL
+ * if the record is not found.
+ */
+void *
+btree_lookup (btree_t *btree, int key)
+{
+    btree_node_t    *leaf;
+    uint32_t        pos;
+
+    /* Sanity check */
+    if (!btree || !btree->root) {
+        return NULL;
+    }
+
+    leaf = btree_find_leaf(btree, key, NULL, NULL);
+    pos = btree_count_less(leaf, key);
+
+    if (pos < leaf->num_keys && leaf->keys[pos] == key) {
+        return leaf->ptrs[pos];
+    }
+
+    return NULL;
+}
+
+/*
+ * btree_range_foreach
+ *
+ * Invoke the callback for every record with a key in [lo, hi), in key
+ * order. The tree is descended once to the first record and the leaf
+ * chain is streamed from there. The scan stops early if the callback
+ * returns non-zero, and that value is returned.
+ */
+int
+btree_range_foreach (btree_t *btree, int lo, int hi,
+                     int (*callback)(void *data, void *ctx), void *ctx)
+{
+    btree_node_t    *leaf;
+    uint32_t        pos;
+    int             rc;
+
+    /* Sanity check */
+    if (!btree || !callback) {
+        return EINVAL;
+    }
+
+    if (!btree->root || lo >= hi) {
+        return EOK;
+    }
+
+    leaf = btree_find_leaf(btree, lo, NULL, NULL);
+    pos = btree_count_less(leaf, lo);
+
+    while (leaf != NULL) {
+        for (; pos < leaf->num_keys; pos++) {
+            if (leaf->keys[pos] >= hi) {
+                return EOK;
+            }
+
+            rc = callback(leaf->ptrs[pos], ctx);
+            if (rc != 0) {
+                return rc;
+            }
+        }
+
+        leaf = leaf->next;
+        pos = 0;
+    }
+
+    return EOK;
+}
+
+/* End of File */
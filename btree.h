@@ -0,0 +1,67 @@
+#ifndef BTREE_H
+#define BTREE_H
+
+#include <stdint.h>
+
+/* Defines */
+
+#define MAX_NAME_LEN                64
+
+#define TRUE                         1
+#define FALSE                        0
+
+#define EOK                          0
+#define EINVAL                      -1
+#define ENOTFOUND                   -2
+#define EFAIL                       -3
+
+#define BTREE_CACHE_LINE            64
+#define BTREE_NODE_KEYS             32      /* Two cache lines worth of keys */
+#define BTREE_MIN_KEYS              (BTREE_NODE_KEYS / 2)
+#define BTREE_MAX_HEIGHT            32
+
+/* Structure Definitions */
+
+/*
+ * A B+tree node. The key array is placed first so that it starts on a
+ * cache line boundary and can be searched with vector compares. Unused
+ * key slots are always padded with INT_MAX.
+ *
+ * For internal nodes, ptrs[i] is the child holding the keys less than
+ * keys[i] (and greater than or equal to keys[i - 1]). For leaf nodes,
+ * ptrs[i] is the user data for keys[i] and next/prev chain the leaves
+ * in key order.
+ */
+typedef struct btree_node_ {
+    int                 keys[BTREE_NODE_KEYS];
+    uint16_t            num_keys;
+    uint16_t            leaf;
+    struct btree_node_  *next;
+    struct btree_node_  *prev;
+    void                *ptrs[BTREE_NODE_KEYS + 1];
+} btree_node_t;
+
+typedef struct btree_ {
+    char            btree_name[MAX_NAME_LEN];
+    btree_node_t    *root;
+    uint32_t        height;
+    uint32_t        node_count; /* Includes internal nodes as well. For debugging */
+    uint32_t        key_count;  /* This contains the actual number of records */
+    int             (*get_key)(void *data);
+} btree_t;
+
+/* Function prototypes */
+
+btree_t* btree_create (char *name, int (*get_key)(void *data));
+int btree_destroy (btree_t *btree);
+void* btree_get_least (btree_t *btree);
+void* btree_get_next (btree_t *btree, void *prev_data);
+uint32_t btree_get_count (btree_t *btree);
+uint8_t btree_empty (btree_t *btree);
+int btree_insert (btree_t *btree, int key, void *data);
+int btree_remove (btree_t *btree, int key);
+void* btree_lookup (btree_t *btree, int key);
+int btree_range_foreach (btree_t *btree, int lo, int hi,
+                         int (*callback)(void *data, void *ctx), void *ctx);
+
+#endif /* BTREE_H */
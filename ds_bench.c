@@ -0,0 +1,2886 @@
+/*
+ * ds_bench.c - Micro-benchmarks for the different data structure APIs.
+ *              Run without arguments to execute every benchmark, or pass
+ *              the names of the benchmarks to run.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "list.h"
+#include "llist.h"
+#include "hash.h"
+#include "queue.h"
+#include "bst.h"
+#include "btree.h"
+#include "trie.h"
+
+/* Defines */
+
+#define BENCH_LIST_OBJECTS              1000000
+#define BENCH_LIST_QUEUE_ROUNDS         2000000
+#define BENCH_LLIST_OBJECTS             100000
+#define BENCH_LIST_FIND_OBJECTS         50000
+#define BENCH_LIST_FIND_LOOKUPS         20000
+#define BENCH_HASH_OBJECTS              1000000
+#define BENCH_QUEUE_OBJECTS             2000000 /* Split among the producers */
+#define BENCH_QUEUE_PRODUCERS           4
+#define BENCH_QUEUE_RING_SIZE           4096
+#define BENCH_QUEUE_LIST                0       /* list_t behind a mutex */
+#define BENCH_QUEUE_MPSC                1       /* queue_t */
+#define BENCH_QUEUE_RING                2       /* queue_ring_t */
+#define BENCH_BST_BALANCED_OBJECTS      10000000
+#define BENCH_BST_UNBALANCED_OBJECTS    20000
+#define BENCH_BST_RANDOM_OBJECTS        1000000
+#define BENCH_BST_LOOKUP_OBJECTS        1000000
+#define BENCH_BST_LOOKUP_ROUNDS         5
+#define BENCH_BTREE_OBJECTS             1000000
+#define BENCH_BST_KEY_OBJECTS           1000000
+#define BENCH_BST_CONCURRENT_OBJECTS    1000000
+#define BENCH_BST_CONCURRENT_LOOKUPS    1000000 /* Per reader thread */
+#define BENCH_BST_CONCURRENT_CHURN      1024
+#define BENCH_BST_CONCURRENT_THREADS    8
+#define BENCH_TRIE_OBJECTS              1000000
+#define BENCH_TRIE_URL_OBJECTS          200000
+#define BENCH_TRIE_BYTE_KEY_LEN         5
+#define BENCH_TRIE_PREFIX_QUERIES       2000
+#define BENCH_TRIE_TOPK                 10
+#define BENCH_TRIE_LONG_OBJECTS         2000
+#define BENCH_TRIE_LONG_KEY_LEN         1024
+#define BENCH_TRIE_IMAGE_PATH           "/tmp/ds_bench.trie"
+#define BENCH_TRIE_CONCURRENT_OBJECTS   500000
+#define BENCH_TRIE_CONCURRENT_LOOKUPS   1000000 /* Per reader thread */
+#define BENCH_TRIE_CONCURRENT_CHURN     1024    /* Per writer thread */
+#define BENCH_TRIE_CONCURRENT_WRITERS   4
+#define BENCH_TRIE_BATCH_MAX            256     /* Largest batch tried */
+
+/*
+ * Record used by the linked list benchmarks, which can be on a singly
+ * and a doubly linked list
+ */
+typedef struct bench_list_object_ {
+    uint32_t        obj_id;
+    list_elem_t     list_link;
+    llist_elem_t    link;
+} bench_list_object_t;
+
+/*
+ * Record kept in a hash table and a balanced BST at the same time
+ */
+typedef struct bench_hash_object_ {
+    uint32_t        obj_id;
+    hash_elem_t     hash_elem;
+    bst_node_t      bst_node;
+} bench_hash_object_t;
+
+/*
+ * Record used by the binary search tree benchmarks
+ */
+typedef struct bench_object_ {
+    uint32_t        obj_id;
+    uint32_t        obj_size;
+    bst_node_t      bst_node;
+} bench_object_t;
+
+/*
+ * Larger record where the key and the tree node live on different
+ * cache lines, as is the case for most real objects
+ */
+typedef struct bench_large_object_ {
+    uint32_t        obj_id;
+    uint32_t        obj_size;
+    uint8_t         obj_payload[120];
+    bst_node_t      bst_node;
+} bench_large_object_t;
+
+/*
+ * Record indexed by an int, a 64-bit and a string key at the same time
+ */
+typedef struct bench_keyed_object_ {
+    uint32_t        obj_id;
+    uint64_t        obj_id64;
+    char            obj_name[16];
+    bst_node_t      int_node;
+    bst_node_t      u64_node;
+    bst_node_t      str_node;
+} bench_keyed_object_t;
+
+/*
+ * Record used by the trie benchmarks
+ */
+typedef struct bench_trie_object_ {
+    char            obj_name[64];
+    uint32_t        obj_id;
+} bench_trie_object_t;
+
+/*
+ * Record with a long key used by the trie benchmarks. The keys live in
+ * one shared buffer.
+ */
+typedef struct bench_trie_long_object_ {
+    char            *obj_key;
+    uint32_t        obj_len;
+    uint32_t        obj_id;
+} bench_trie_long_object_t;
+
+/*
+ * Per thread state of the concurrent BST benchmark. The tree holds the
+ * even ids for the whole run, readers look those up and the writer
+ * keeps inserting and removing a set of odd ids.
+ */
+typedef struct bench_thread_ {
+    bst_t                   *tree;
+    pthread_mutex_t         *lock;      /* Global lock, NULL if not needed */
+    bench_large_object_t    *objs;
+    uint32_t                count;
+    uint32_t                seed;
+    uint32_t                ops;
+    uint32_t                found;
+    volatile int            *stop;
+} bench_thread_t;
+
+/*
+ * Per thread state of the concurrent trie benchmark. As with the BST,
+ * the even ids stay in the trie for the whole run and each writer keeps
+ * inserting and removing a set of odd ids of its own.
+ */
+typedef struct bench_trie_thread_ {
+    trie_t                  *trie;
+    pthread_mutex_t         *lock;      /* Global lock, NULL if not needed */
+    bench_trie_object_t     *objs;
+    uint32_t                count;
+    uint32_t                writer;     /* Which of the writers, for writers */
+    uint32_t                seed;
+    uint32_t                ops;
+    uint32_t                found;
+    volatile int            *stop;
+} bench_trie_thread_t;
+
+/*
+ * Per producer state of the queue benchmark
+ */
+typedef struct bench_queue_thread_ {
+    uint32_t                kind;       /* BENCH_QUEUE_* */
+    void                    *queue;
+    pthread_mutex_t         *lock;      /* Only for BENCH_QUEUE_LIST */
+    bench_list_object_t     *objs;
+    uint32_t                count;
+} bench_queue_thread_t;
+
+/*
+ * Benchmark table entry
+ */
+typedef struct bench_ {
+    char            *name;
+    void            (*run)(void);
+} bench_t;
+
+/*
+ * bench_now_ns
+ *
+ * Return a monotonic timestamp in nanoseconds
+ */
+static uint64_t
+bench_now_ns (void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+/*
+ * bench_report
+ *
+ * Print the total time and the per-operation latency of a benchmark step
+ */
+static void
+bench_report (char *what, uint32_t ops, uint64_t elapsed_ns)
+{
+    printf("  %-40s %10u ops %10.3f ms %8.1f ns/op\n", what, ops,
+           elapsed_ns / 1e6, ops ? (double)elapsed_ns / ops : 0.0);
+}
+
+/*
+ * bench_rss_kb
+ *
+ * Return the resident set size of the process in KB
+ */
+static uint64_t
+bench_rss_kb (void)
+{
+    FILE *fp;
+    unsigned long size, resident = 0;
+
+    fp = fopen("/proc/self/statm", "r");
+    if (!fp) {
+        return 0;
+    }
+    if (fscanf(fp, "%lu %lu", &size, &resident) != 2) {
+        resident = 0;
+    }
+    fclose(fp);
+
+    return ((uint64_t)resident * (sysconf(_SC_PAGESIZE) / 1024));
+}
+
+/*
+ * bench_bst_get_key
+ *
+ * Return the key for the given node. Called from the BST library.
+ */
+static int
+bench_bst_get_key (void *node)
+{
+    return ((bench_object_t *)node)->obj_id;
+}
+
+/*
+ * bench_bst_get_large_key
+ *
+ * Return the key for the given large node. Called from the BST library.
+ */
+static int
+bench_bst_get_large_key (void *node)
+{
+    return ((bench_large_object_t *)node)->obj_id;
+}
+
+/*
+ * bench_bst_sequential_run
+ *
+ * Insert count objects with monotonically increasing ids into the
+ * given tree, look every one of them up, and then remove them all.
+ */
+static void
+bench_bst_sequential_run (bst_t *tree, uint32_t count)
+{
+    bench_object_t *objs;
+    uint64_t start;
+    uint32_t i, found = 0;
+
+    objs = (bench_object_t *)malloc(count * sizeof(bench_object_t));
+    if (!objs) {
+        printf("  Unable to allocate %u objects\n", count);
+        return;
+    }
+
+    for (i = 0; i < count; i++) {
+        objs[i].obj_id = i;
+        objs[i].obj_size = i;
+    }
+
+    start = bench_now_ns();
+    for (i = 0; i < count; i++) {
+        bst_insert(tree, &objs[i].bst_node);
+    }
+    bench_report("sequential insert", count, bench_now_ns() - start);
+
+    start = bench_now_ns();
+    for (i = 0; i < count; i++) {
+        if (bst_lookup(tree, i)) {
+            found++;
+        }
+    }
+    bench_report("lookup", count, bench_now_ns() - start);
+
+    start = bench_now_ns();
+    for (i = 0; i < count; i++) {
+        bst_remove(tree, &objs[i].bst_node);
+    }
+    bench_report("remove", count, bench_now_ns() - start);
+
+    if (found != count) {
+        printf("  Lookup found only %u of %u objects\n", found, count);
+    }
+
+    free(objs);
+}
+
+/*
+ * bench_bst_sequential_insert
+ *
+ * Sequential-key insert into an unbalanced and a balanced tree
+ */
+static void
+bench_bst_sequential_insert (void)
+{
+    bst_t *tree;
+
+    tree = bst_create("Unbalanced", offsetof(bench_object_t, bst_node),
+                      bench_bst_get_key);
+    printf("Unbalanced BST, %u sequential keys\n", BENCH_BST_UNBALANCED_OBJECTS);
+    bench_bst_sequential_run(tree, BENCH_BST_UNBALANCED_OBJECTS);
+    bst_destroy(tree);
+
+    tree = bst_create_balanced("Balanced", offsetof(bench_object_t, bst_node),
+                               bench_bst_get_key);
+    printf("Balanced BST, %u sequential keys\n", BENCH_BST_BALANCED_OBJECTS);
+    bench_bst_sequential_run(tree, BENCH_BST_BALANCED_OBJECTS);
+    bst_destroy(tree);
+}
+
+/*
+ * bench_shuffle
+ *
+ * Fisher-Yates shuffle of an array of 32-bit values using a fixed seed
+ * so that every run sees the same order
+ */
+static void
+bench_shuffle (uint32_t *arr, uint32_t count, uint32_t seed)
+{
+    uint32_t i, j, tmp;
+
+    srand(seed);
+    for (i = count - 1; i > 0; i--) {
+        j = (uint32_t)(((uint64_t)rand() * RAND_MAX + rand()) % (i + 1));
+        tmp = arr[i];
+        arr[i] = arr[j];
+        arr[j] = tmp;
+    }
+}
+
+/*
+ * bench_bst_build
+ *
+ * Cold start from a sorted snapshot: one bst_insert per object versus a
+ * single bst_build_sorted call
+ */
+static void
+bench_bst_build (void)
+{
+    bst_t *tree;
+    bench_object_t *objs;
+    bst_node_t **nodes;
+    uint32_t i, count = BENCH_BST_BALANCED_OBJECTS;
+    uint64_t start;
+
+    objs = (bench_object_t *)malloc(count * sizeof(bench_object_t));
+    nodes = (bst_node_t **)malloc(count * sizeof(bst_node_t *));
+    if (!objs || !nodes) {
+        printf("  Unable to allocate %u objects\n", count);
+        free(objs);
+        free(nodes);
+        return;
+    }
+
+    for (i = 0; i < count; i++) {
+        objs[i].obj_id = i;
+        objs[i].obj_size = i;
+        nodes[i] = &objs[i].bst_node;
+    }
+
+    printf("Balanced BST, %u sorted keys\n", count);
+
+    tree = bst_create_balanced("Insert", offsetof(bench_object_t, bst_node),
+                               bench_bst_get_key);
+    start = bench_now_ns();
+    for (i = 0; i < count; i++) {
+        bst_insert(tree, nodes[i]);
+    }
+    bench_report("bst_insert loop", count, bench_now_ns() - start);
+    for (i = 0; i < count; i++) {
+        bst_remove(tree, nodes[i]);
+    }
+    bst_destroy(tree);
+
+    tree = bst_create_balanced("Build", offsetof(bench_object_t, bst_node),
+                               bench_bst_get_key);
+    start = bench_now_ns();
+    bst_build_sorted(tree, nodes, count);
+    bench_report("bst_build_sorted", count, bench_now_ns() - start);
+    for (i = 0; i < count; i++) {
+        bst_remove(tree, nodes[i]);
+    }
+    bst_destroy(tree);
+
+    free(objs);
+    free(nodes);
+}
+
+/*
+ * bench_bst_random_ops
+ *
+ * Per-operation latency of insert, lookup and remove on an unbalanced
+ * tree with randomly ordered keys
+ */
+static void
+bench_bst_random_ops (void)
+{
+    bst_t *tree;
+    bench_object_t *objs;
+    uint32_t *order;
+    uint32_t i, count = BENCH_BST_RANDOM_OBJECTS, found = 0;
+    uint64_t start;
+
+    objs = (bench_object_t *)malloc(count * sizeof(bench_object_t));
+    order = (uint32_t *)malloc(count * sizeof(uint32_t));
+    if (!objs || !order) {
+        printf("  Unable to allocate %u objects\n", count);
+        free(objs);
+        free(order);
+        return;
+    }
+
+    for (i = 0; i < count; i++) {
+        objs[i].obj_id = i;
+        objs[i].obj_size = i;
+        order[i] = i;
+    }
+
+    tree = bst_create("Random", offsetof(bench_object_t, bst_node),
+                      bench_bst_get_key);
+    printf("Unbalanced BST, %u random keys\n", count);
+
+    bench_shuffle(order, count, 1);
+    start = bench_now_ns();
+    for (i = 0; i < count; i++) {
+        bst_insert(tree, &objs[order[i]].bst_node);
+    }
+    bench_report("insert", count, bench_now_ns() - start);
+
+    bench_shuffle(order, count, 2);
+    start = bench_now_ns();
+    for (i = 0; i < count; i++) {
+        if (bst_lookup(tree, order[i])) {
+            found++;
+        }
+    }
+    bench_report("lookup", count, bench_now_ns() - start);
+
+    bench_shuffle(order, count, 3);
+    start = bench_now_ns();
+    for (i = 0; i < count; i++) {
+        bst_remove(tree, &objs[order[i]].bst_node);
+    }
+    bench_report("remove", count, bench_now_ns() - start);
+
+    if (found != count) {
+        printf("  Lookup found only %u of %u objects\n", found, count);
+    }
+
+    bst_destroy(tree);
+    free(objs);
+    free(order);
+}
+
+/*
+ * bench_bst_lookup
+ *
+ * Lookup throughput on a balanced tree with 1M nodes, using a random
+ * lookup order. The records are large enough that the key does not
+ * share a cache line with the tree node.
+ */
+static void
+bench_bst_lookup (void)
+{
+    bst_t *tree;
+    bench_large_object_t *objs;
+    uint32_t *order;
+    uint32_t i, round, count = BENCH_BST_LOOKUP_OBJECTS, found = 0;
+    uint64_t start, elapsed;
+
+    objs = (bench_large_object_t *)malloc(count * sizeof(bench_large_object_t));
+    order = (uint32_t *)malloc(count * sizeof(uint32_t));
+    if (!objs || !order) {
+        printf("  Unable to allocate %u objects\n", count);
+        free(objs);
+        free(order);
+        return;
+    }
+
+    tree = bst_create_balanced("Lookup",
+                               offsetof(bench_large_object_t, bst_node),
+                               bench_bst_get_large_key);
+    printf("Balanced BST, %u nodes\n", count);
+
+    for (i = 0; i < count; i++) {
+        objs[i].obj_id = i;
+        objs[i].obj_size = i;
+        order[i] = i;
+    }
+
+    bench_shuffle(order, count, 1);
+    for (i = 0; i < count; i++) {
+        bst_insert(tree, &objs[order[i]].bst_node);
+    }
+
+    bench_shuffle(order, count, 2);
+    start = bench_now_ns();
+    for (round = 0; round < BENCH_BST_LOOKUP_ROUNDS; round++) {
+        for (i = 0; i < count; i++) {
+            if (bst_lookup(tree, order[i])) {
+                found++;
+            }
+        }
+    }
+    elapsed = bench_now_ns() - start;
+    bench_report("random lookup", count * BENCH_BST_LOOKUP_ROUNDS, elapsed);
+    printf("  %-40s %10.2f Mops/s\n", "throughput",
+           (double)count * BENCH_BST_LOOKUP_ROUNDS * 1000.0 / elapsed);
+
+    if (found != count * BENCH_BST_LOOKUP_ROUNDS) {
+        printf("  Lookup found only %u objects\n", found);
+    }
+
+    for (i = 0; i < count; i++) {
+        bst_remove(tree, &objs[i].bst_node);
+    }
+    bst_destroy(tree);
+    free(objs);
+    free(order);
+}
+
+/*
+ * bench_btree_get_key
+ *
+ * Return the key for the given record. Called from the B+tree library.
+ */
+static int
+bench_btree_get_key (void *data)
+{
+    return ((bench_large_object_t *)data)->obj_id;
+}
+
+/*
+ * bench_btree_scan_fn
+ *
+ * Range scan callback which just counts the records
+ */
+static int
+bench_btree_scan_fn (void *data, void *ctx)
+{
+    (*(uint32_t *)ctx)++;
+
+    return 0;
+}
+
+/*
+ * bench_btree_ops
+ *
+ * Random insert, lookup and remove plus a full ordered scan on a B+tree,
+ * next to the same workload on a balanced BST
+ */
+static void
+bench_btree_ops (void)
+{
+    btree_t *btree;
+    bst_t *tree;
+    bench_large_object_t *objs, *obj;
+    uint32_t *order;
+    uint32_t i, count = BENCH_BTREE_OBJECTS, found = 0, scanned = 0;
+    uint64_t start;
+
+    objs = (bench_large_object_t *)malloc(count * sizeof(bench_large_object_t));
+    order = (uint32_t *)malloc(count * sizeof(uint32_t));
+    if (!objs || !order) {
+        printf("  Unable to allocate %u objects\n", count);
+        free(objs);
+        free(order);
+        return;
+    }
+
+    for (i = 0; i < count; i++) {
+        objs[i].obj_id = i;
+        objs[i].obj_size = i;
+        order[i] = i;
+    }
+
+    btree = btree_create("B+tree", bench_btree_get_key);
+    printf("B+tree, %u random keys\n", count);
+
+    bench_shuffle(order, count, 1);
+    start = bench_now_ns();
+    for (i = 0; i < count; i++) {
+        btree_insert(btree, order[i], &objs[order[i]]);
+    }
+    bench_report("insert", count, bench_now_ns() - start);
+
+    bench_shuffle(order, count, 2);
+    start = bench_now_ns();
+    for (i = 0; i < count; i++) {
+        if (btree_lookup(btree, order[i])) {
+            found++;
+        }
+    }
+    bench_report("lookup", count, bench_now_ns() - start);
+
+    start = bench_now_ns();
+    btree_range_foreach(btree, 0, count, bench_btree_scan_fn, &scanned);
+    bench_report("range scan", scanned, bench_now_ns() - start);
+
+    bench_shuffle(order, count, 3);
+    start = bench_now_ns();
+    for (i = 0; i < count; i++) {
+        btree_remove(btree, order[i]);
+    }
+    bench_report("remove", count, bench_now_ns() - start);
+    btree_destroy(btree);
+
+    tree = bst_create_balanced("Balanced",
+                               offsetof(bench_large_object_t, bst_node),
+                               bench_bst_get_large_key);
+    printf("Balanced BST, %u random keys\n", count);
+
+    bench_shuffle(order, count, 1);
+    start = bench_now_ns();
+    for (i = 0; i < count; i++) {
+        bst_insert(tree, &objs[order[i]].bst_node);
+    }
+    bench_report("insert", count, bench_now_ns() - start);
+
+    bench_shuffle(order, count, 2);
+    start = bench_now_ns();
+    for (i = 0; i < count; i++) {
+        if (bst_lookup(tree, order[i])) {
+            found++;
+        }
+    }
+    bench_report("lookup", count, bench_now_ns() - start);
+
+    scanned = 0;
+    start = bench_now_ns();
+    obj = (bench_large_object_t *)bst_get_least(tree);
+    while (obj != NULL) {
+        scanned++;
+        obj = bst_get_next(tree, obj);
+    }
+    bench_report("ordered scan", scanned, bench_now_ns() - start);
+
+    bench_shuffle(order, count, 3);
+    start = bench_now_ns();
+    for (i = 0; i < count; i++) {
+        bst_remove(tree, &objs[order[i]].bst_node);
+    }
+    bench_report("remove", count, bench_now_ns() - start);
+    bst_destroy(tree);
+
+    if (found != 2 * count) {
+        printf("  Lookup found only %u of %u objects\n", found, 2 * count);
+    }
+
+    free(objs);
+    free(order);
+}
+
+/*
+ * bench_bst_get_int_key, bench_bst_get_u64_key, bench_bst_get_str_key
+ *
+ * Key callbacks for the different key types
+ */
+static int
+bench_bst_get_int_key (void *node)
+{
+    return ((bench_keyed_object_t *)node)->obj_id;
+}
+
+static uint64_t
+bench_bst_get_u64_key (void *node)
+{
+    return ((bench_keyed_object_t *)node)->obj_id64;
+}
+
+static void *
+bench_bst_get_str_key (void *node)
+{
+    return ((bench_keyed_object_t *)node)->obj_name;
+}
+
+/*
+ * bench_bst_str_cmp
+ *
+ * Compare function for the string keyed tree
+ */
+static int32_t
+bench_bst_str_cmp (void *key1, void *key2)
+{
+    return (strcmp((char *)key1, (char *)key2));
+}
+
+/*
+ * bench_bst_key_types
+ *
+ * Random lookups on balanced trees with int, uint64_t and string keys
+ */
+static void
+bench_bst_key_types (void)
+{
+    bst_t *int_tree, *u64_tree, *str_tree;
+    bench_keyed_object_t *objs;
+    uint32_t *order;
+    uint32_t i, count = BENCH_BST_KEY_OBJECTS, found = 0;
+    uint64_t start;
+
+    objs = (bench_keyed_object_t *)malloc(count * sizeof(bench_keyed_object_t));
+    order = (uint32_t *)malloc(count * sizeof(uint32_t));
+    if (!objs || !order) {
+        printf("  Unable to allocate %u objects\n", count);
+        free(objs);
+        free(order);
+        return;
+    }
+
+    int_tree = bst_create_flags("int", offsetof(bench_keyed_object_t, int_node),
+                                bench_bst_get_int_key, BST_FLAG_BALANCED);
+    u64_tree = bst_create_u64("u64", offsetof(bench_keyed_object_t, u64_node),
+                              bench_bst_get_u64_key, BST_FLAG_BALANCED);
+    str_tree = bst_create_cmp("str", offsetof(bench_keyed_object_t, str_node),
+                              bench_bst_get_str_key, bench_bst_str_cmp,
+                              BST_FLAG_BALANCED);
+    printf("Balanced BST, %u nodes\n", count);
+
+    for (i = 0; i < count; i++) {
+        objs[i].obj_id = i;
+        objs[i].obj_id64 = ((uint64_t)i << 32) | i;
+        snprintf(objs[i].obj_name, sizeof(objs[i].obj_name), "obj-%08u", i);
+        order[i] = i;
+    }
+
+    bench_shuffle(order, count, 1);
+    for (i = 0; i < count; i++) {
+        bst_insert(int_tree, &objs[order[i]].int_node);
+        bst_insert(u64_tree, &objs[order[i]].u64_node);
+        bst_insert(str_tree, &objs[order[i]].str_node);
+    }
+
+    bench_shuffle(order, count, 2);
+    start = bench_now_ns();
+    for (i = 0; i < count; i++) {
+        found += (bst_lookup(int_tree, objs[order[i]].obj_id) != NULL);
+    }
+    bench_report("int key lookup", count, bench_now_ns() - start);
+
+    start = bench_now_ns();
+    for (i = 0; i < count; i++) {
+        found += (bst_lookup_u64(u64_tree, objs[order[i]].obj_id64) != NULL);
+    }
+    bench_report("uint64_t key lookup", count, bench_now_ns() - start);
+
+    start = bench_now_ns();
+    for (i = 0; i < count; i++) {
+        found += (bst_lookup_cmp(str_tree, objs[order[i]].obj_name) != NULL);
+    }
+    bench_report("string key lookup", count, bench_now_ns() - start);
+
+    if (found != 3 * count) {
+        printf("  Lookup found only %u of %u objects\n", found, 3 * count);
+    }
+
+    for (i = 0; i < count; i++) {
+        bst_remove(int_tree, &objs[i].int_node);
+        bst_remove(u64_tree, &objs[i].u64_node);
+        bst_remove(str_tree, &objs[i].str_node);
+    }
+    bst_destroy(int_tree);
+    bst_destroy(u64_tree);
+    bst_destroy(str_tree);
+    free(objs);
+    free(order);
+}
+
+/*
+ * bench_bst_reader_thread
+ *
+ * Reader side of bench_bst_concurrent(). Looks up random even ids.
+ */
+static void *
+bench_bst_reader_thread (void *arg)
+{
+    bench_thread_t *thr = (bench_thread_t *)arg;
+    uint32_t i, seed = thr->seed;
+    int key;
+
+    for (i = 0; i < thr->ops; i++) {
+        seed = seed * 1103515245 + 12345;
+        key = ((seed >> 8) % thr->count) * 2;
+
+        if (thr->lock) {
+            pthread_mutex_lock(thr->lock);
+        }
+        if (bst_lookup(thr->tree, key)) {
+            thr->found++;
+        }
+        if (thr->lock) {
+            pthread_mutex_unlock(thr->lock);
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * bench_bst_writer_thread
+ *
+ * Writer side of bench_bst_concurrent(). Inserts and removes a spread
+ * out set of odd ids until the readers are done. Removed records are
+ * only reused after bst_synchronize(), as a real user would have to
+ * before freeing them.
+ */
+static void *
+bench_bst_writer_thread (void *arg)
+{
+    bench_thread_t *thr = (bench_thread_t *)arg;
+    uint32_t i, stride = thr->count / BENCH_BST_CONCURRENT_CHURN;
+    bench_large_object_t *obj;
+
+    while (!*thr->stop) {
+        for (i = 0; i < BENCH_BST_CONCURRENT_CHURN; i++) {
+            obj = &thr->objs[i * stride * 2 + 1];
+            if (thr->lock) {
+                pthread_mutex_lock(thr->lock);
+            }
+            bst_insert(thr->tree, &obj->bst_node);
+            if (thr->lock) {
+                pthread_mutex_unlock(thr->lock);
+            }
+        }
+
+        for (i = 0; i < BENCH_BST_CONCURRENT_CHURN; i++) {
+            obj = &thr->objs[i * stride * 2 + 1];
+            if (thr->lock) {
+                pthread_mutex_lock(thr->lock);
+            }
+            bst_remove(thr->tree, &obj->bst_node);
+            if (thr->lock) {
+                pthread_mutex_unlock(thr->lock);
+            }
+        }
+        bst_synchronize(thr->tree);
+
+        thr->ops += 2 * BENCH_BST_CONCURRENT_CHURN;
+    }
+
+    return NULL;
+}
+
+/*
+ * bench_bst_concurrent_run
+ *
+ * Run the given number of reader threads against the tree, with one
+ * writer thread updating it at the same time, and print the aggregate
+ * throughput
+ */
+static void
+bench_bst_concurrent_run (char *what, bst_t *tree, pthread_mutex_t *lock,
+                          bench_large_object_t *objs, uint32_t count,
+                          uint32_t num_readers)
+{
+    bench_thread_t readers[BENCH_BST_CONCURRENT_THREADS], writer;
+    pthread_t reader_tid[BENCH_BST_CONCURRENT_THREADS], writer_tid;
+    volatile int stop = 0;
+    uint32_t i, found = 0;
+    uint64_t start, elapsed;
+    char label[64];
+
+    memset(&writer, 0, sizeof(writer));
+    writer.tree = tree;
+    writer.lock = lock;
+    writer.objs = objs;
+    writer.count = count;
+    writer.stop = &stop;
+
+    start = bench_now_ns();
+    pthread_create(&writer_tid, NULL, bench_bst_writer_thread, &writer);
+    for (i = 0; i < num_readers; i++) {
+        readers[i] = writer;
+        readers[i].seed = i + 1;
+        readers[i].ops = BENCH_BST_CONCURRENT_LOOKUPS;
+        pthread_create(&reader_tid[i], NULL, bench_bst_reader_thread,
+                       &readers[i]);
+    }
+
+    for (i = 0; i < num_readers; i++) {
+        pthread_join(reader_tid[i], NULL);
+        found += readers[i].found;
+    }
+    elapsed = bench_now_ns() - start;
+    stop = 1;
+    pthread_join(writer_tid, NULL);
+
+    snprintf(label, sizeof(label), "%s, %u readers", what, num_readers);
+    printf("  %-40s %10.2f Mops/s %10u updates\n", label,
+           (double)num_readers * BENCH_BST_CONCURRENT_LOOKUPS * 1000.0 / elapsed,
+           writer.ops);
+
+    if (found != num_readers * BENCH_BST_CONCURRENT_LOOKUPS) {
+        printf("  Lookup found only %u objects\n", found);
+    }
+}
+
+/*
+ * bench_bst_concurrent
+ *
+ * Aggregate lookup throughput of 1 to 8 reader threads on a balanced
+ * tree which a writer thread keeps updating. A plain tree behind a
+ * global mutex is compared against a BST_FLAG_CONCURRENT tree, whose
+ * readers take no locks.
+ */
+static void
+bench_bst_concurrent (void)
+{
+    bst_t *tree;
+    pthread_mutex_t lock;
+    bench_large_object_t *objs;
+    uint32_t i, threads, count = BENCH_BST_CONCURRENT_OBJECTS;
+
+    objs = (bench_large_object_t *)malloc(2 * count *
+                                          sizeof(bench_large_object_t));
+    if (!objs) {
+        printf("  Unable to allocate %u objects\n", 2 * count);
+        return;
+    }
+
+    for (i = 0; i < 2 * count; i++) {
+        objs[i].obj_id = i;
+        objs[i].obj_size = i;
+    }
+
+    printf("Balanced BST, %u nodes, 1 writer\n", count);
+
+    pthread_mutex_init(&lock, NULL);
+    tree = bst_create_balanced("Mutex", offsetof(bench_large_object_t, bst_node),
+                               bench_bst_get_large_key);
+    for (i = 0; i < count; i++) {
+        bst_insert(tree, &objs[2 * i].bst_node);
+    }
+    for (threads = 1; threads <= BENCH_BST_CONCURRENT_THREADS; threads *= 2) {
+        bench_bst_concurrent_run("global mutex", tree, &lock, objs, count,
+                                 threads);
+    }
+    for (i = 0; i < count; i++) {
+        bst_remove(tree, &objs[2 * i].bst_node);
+    }
+    bst_destroy(tree);
+    pthread_mutex_destroy(&lock);
+
+    tree = bst_create_flags("Concurrent",
+                            offsetof(bench_large_object_t, bst_node),
+                            bench_bst_get_large_key,
+                            BST_FLAG_BALANCED | BST_FLAG_CONCURRENT);
+    for (i = 0; i < count; i++) {
+        bst_insert(tree, &objs[2 * i].bst_node);
+    }
+    for (threads = 1; threads <= BENCH_BST_CONCURRENT_THREADS; threads *= 2) {
+        bench_bst_concurrent_run("BST_FLAG_CONCURRENT", tree, NULL, objs,
+                                 count, threads);
+    }
+    for (i = 0; i < count; i++) {
+        bst_remove(tree, &objs[2 * i].bst_node);
+    }
+    bst_destroy(tree);
+
+    free(objs);
+}
+
+/*
+ * bench_trie_get_key
+ *
+ * Return the key for the given record. Called from the trie library.
+ */
+static char *
+bench_trie_get_key (void *node)
+{
+    return ((bench_trie_object_t *)node)->obj_name;
+}
+
+/*
+ * bench_trie_get_long_key
+ *
+ * Return the key for the given long key record. Called from the trie
+ * library.
+ */
+static char *
+bench_trie_get_long_key (void *node)
+{
+    return ((bench_trie_long_object_t *)node)->obj_key;
+}
+
+/*
+ * bench_trie_get_score
+ *
+ * Return a made up popularity for the given record. Called from the
+ * trie library.
+ */
+static uint32_t
+bench_trie_get_score (void *node)
+{
+    return (((bench_trie_object_t *)node)->obj_id * 40503U) % 1000000;
+}
+
+/*
+ * bench_trie_score_all
+ *
+ * Same scores as bench_trie_get_score(), for top-k queries which have
+ * to score every match
+ */
+static uint32_t
+bench_trie_score_all (void *node)
+{
+    return (((bench_trie_object_t *)node)->obj_id * 40503U) % 1000000;
+}
+
+/*
+ * bench_trie_count
+ *
+ * trie_prefix_foreach() callback counting the records
+ */
+static int
+bench_trie_count (void *node, void *ctx)
+{
+    (*(uint32_t *)ctx)++;
+
+    return 0;
+}
+
+/*
+ * bench_trie_ops
+ *
+ * Insert, lookup and remove throughput of a trie with 1M random 8
+ * character keys, along with the memory taken up by the trie nodes.
+ * The keys are then inserted again into the freed nodes and dropped
+ * all at once with trie_clear().
+ */
+static void
+bench_trie_ops (void)
+{
+    trie_t *trie;
+    bench_trie_object_t *objs;
+    uint32_t *order;
+    uint32_t i, count = BENCH_TRIE_OBJECTS, found = 0, missed = 0;
+    uint64_t start, rss;
+    char key[16];
+
+    objs = (bench_trie_object_t *)malloc(count * sizeof(bench_trie_object_t));
+    order = (uint32_t *)malloc(count * sizeof(uint32_t));
+    if (!objs || !order) {
+        printf("  Unable to allocate %u objects\n", count);
+        free(objs);
+        free(order);
+        return;
+    }
+
+    /* Multiplying by an odd constant keeps the keys unique */
+    for (i = 0; i < count; i++) {
+        snprintf(objs[i].obj_name, sizeof(objs[i].obj_name), "%08x",
+                 i * 2654435761U);
+        objs[i].obj_id = i;
+        order[i] = i;
+    }
+
+    trie = trie_create("Trie", bench_trie_get_key);
+    printf("Trie, %u random keys\n", count);
+
+    rss = bench_rss_kb();
+    start = bench_now_ns();
+    for (i = 0; i < count; i++) {
+        trie_insert(trie, objs[i].obj_name, &objs[i]);
+    }
+    bench_report("insert", count, bench_now_ns() - start);
+    printf("  %-40s %10llu KB %8.1f bytes/key\n", "resident memory",
+           (unsigned long long)(bench_rss_kb() - rss),
+           (bench_rss_kb() - rss) * 1024.0 / count);
+
+    bench_shuffle(order, count, 1);
+    start = bench_now_ns();
+    for (i = 0; i < count; i++) {
+        if (trie_lookup(trie, objs[order[i]].obj_name)) {
+            found++;
+        }
+    }
+    bench_report("lookup", count, bench_now_ns() - start);
+
+    /* Keys one above the inserted ones, which are almost never there */
+    start = bench_now_ns();
+    for (i = 0; i < count; i++) {
+        snprintf(key, sizeof(key), "%08x", order[i] * 2654435761U + 1);
+        if (trie_lookup(trie, key)) {
+            missed++;
+        }
+    }
+    bench_report("lookup, missing keys", count, bench_now_ns() - start);
+
+    bench_shuffle(order, count, 2);
+    start = bench_now_ns();
+    for (i = 0; i < count; i++) {
+        trie_remove(trie, objs[order[i]].obj_name);
+    }
+    bench_report("remove", count, bench_now_ns() - start);
+
+    /* The freed nodes are reused, so the trie should not grow again */
+    start = bench_now_ns();
+    for (i = 0; i < count; i++) {
+        trie_insert(trie, objs[i].obj_name, &objs[i]);
+    }
+    bench_report("insert after remove", count, bench_now_ns() - start);
+    printf("  %-40s %10llu KB\n", "resident memory",
+           (unsigned long long)(bench_rss_kb() - rss));
+
+    start = bench_now_ns();
+    trie_clear(trie);
+    bench_report("clear", count, bench_now_ns() - start);
+
+    if (found != count) {
+        printf("  Lookup found only %u of %u objects\n", found, count);
+    }
+    if (missed) {
+        printf("  %u of the missing keys were there after all\n", missed);
+    }
+
+    trie_destroy(trie);
+    free(objs);
+    free(order);
+}
+
+/*
+ * bench_trie_layout_run
+ *
+ * Insert the given records into a trie created with the given flags,
+ * and report the memory taken per key and the random lookup latency
+ */
+static void
+bench_trie_layout_run (char *what, uint32_t flags, bench_trie_object_t *objs,
+                       uint32_t *order, uint32_t count)
+{
+    trie_t *trie;
+    uint32_t i, found = 0;
+    uint64_t start, rss;
+    char label[64];
+
+    trie = trie_create_flags("Layout", bench_trie_get_key, flags);
+
+    rss = bench_rss_kb();
+    start = bench_now_ns();
+    for (i = 0; i < count; i++) {
+        trie_insert(trie, objs[i].obj_name, &objs[i]);
+    }
+    snprintf(label, sizeof(label), "%s insert", what);
+    bench_report(label, count, bench_now_ns() - start);
+    printf("  %-40s %10u nodes %8.1f bytes/key\n", "",
+           trie->node_count, (bench_rss_kb() - rss) * 1024.0 / count);
+
+    start = bench_now_ns();
+    for (i = 0; i < count; i++) {
+        if (trie_lookup(trie, objs[order[i]].obj_name)) {
+            found++;
+        }
+    }
+    snprintf(label, sizeof(label), "%s lookup", what);
+    bench_report(label, count, bench_now_ns() - start);
+
+    if (found != count) {
+        printf("  Lookup found only %u of %u objects\n", found, count);
+    }
+
+    trie_clear(trie);
+    trie_destroy(trie);
+}
+
+/*
+ * bench_trie_layout
+ *
+ * Memory per key and lookup latency of the one character per node
+ * layout against the path compressed (TRIE_FLAG_RADIX) layout, for
+ * short random keys, for long URL like keys and for keys of random
+ * bytes which fan out wide at every level
+ */
+static void
+bench_trie_layout (void)
+{
+    bench_trie_object_t *objs;
+    uint32_t *order;
+    uint32_t i, j, seed = 1;
+    uint32_t count = BENCH_TRIE_OBJECTS, url_count = BENCH_TRIE_URL_OBJECTS;
+
+    objs = (bench_trie_object_t *)malloc(count * sizeof(bench_trie_object_t));
+    order = (uint32_t *)malloc(count * sizeof(uint32_t));
+    if (!objs || !order) {
+        printf("  Unable to allocate %u objects\n", count);
+        free(objs);
+        free(order);
+        return;
+    }
+
+    for (i = 0; i < count; i++) {
+        snprintf(objs[i].obj_name, sizeof(objs[i].obj_name), "%08x",
+                 i * 2654435761U);
+        objs[i].obj_id = i;
+        order[i] = i;
+    }
+    bench_shuffle(order, count, 1);
+
+    printf("Trie, %u random 8 character keys\n", count);
+    bench_trie_layout_run("per character", 0, objs, order, count);
+    bench_trie_layout_run("radix", TRIE_FLAG_RADIX, objs, order, count);
+
+    for (i = 0; i < url_count; i++) {
+        snprintf(objs[i].obj_name, sizeof(objs[i].obj_name),
+                 "https://www.example.com/catalog/%08x/item-%08x.html",
+                 i * 2654435761U, i * 40503U);
+        order[i] = i;
+    }
+    bench_shuffle(order, url_count, 2);
+
+    printf("Trie, %u URL keys of %u characters\n", url_count,
+           (uint32_t)strlen(objs[0].obj_name));
+    bench_trie_layout_run("per character", 0, objs, order, url_count);
+    bench_trie_layout_run("radix", TRIE_FLAG_RADIX, objs, order, url_count);
+
+    /* Any byte but the terminating 0 */
+    for (i = 0; i < count; i++) {
+        for (j = 0; j < BENCH_TRIE_BYTE_KEY_LEN; j++) {
+            seed = seed * 1103515245U + 12345U;
+            objs[i].obj_name[j] = (char)(1 + (seed >> 16) % 255);
+        }
+        objs[i].obj_name[j] = '\0';
+        order[i] = i;
+    }
+    bench_shuffle(order, count, 3);
+
+    printf("Trie, %u keys of %u random bytes\n", count,
+           BENCH_TRIE_BYTE_KEY_LEN);
+    bench_trie_layout_run("per character", 0, objs, order, count);
+    bench_trie_layout_run("radix", TRIE_FLAG_RADIX, objs, order, count);
+
+    free(objs);
+    free(order);
+}
+
+/*
+ * bench_trie_scan_run
+ *
+ * Walk every key of a trie created with the given flags, once with
+ * trie_get_next() and once with a cursor
+ */
+static void
+bench_trie_scan_run (char *what, uint32_t flags, bench_trie_object_t *objs,
+                     uint32_t count)
+{
+    trie_t *trie;
+    trie_iter_t iter;
+    bench_trie_object_t *obj;
+    uint32_t i, seen;
+    uint64_t start;
+    char label[64];
+
+    trie = trie_create_flags("Scan", bench_trie_get_key, flags);
+    for (i = 0; i < count; i++) {
+        trie_insert(trie, objs[i].obj_name, &objs[i]);
+    }
+
+    seen = 0;
+    start = bench_now_ns();
+    for (obj = trie_get_least(trie); obj != NULL;
+         obj = trie_get_next(trie, obj)) {
+        seen++;
+    }
+    snprintf(label, sizeof(label), "%s, trie_get_next", what);
+    bench_report(label, seen, bench_now_ns() - start);
+
+    seen = 0;
+    start = bench_now_ns();
+    for (obj = trie_iter_first(trie, &iter); obj != NULL;
+         obj = trie_iter_next(&iter)) {
+        seen++;
+    }
+    snprintf(label, sizeof(label), "%s, cursor", what);
+    bench_report(label, seen, bench_now_ns() - start);
+
+    if (seen != count) {
+        printf("  Scan saw only %u of %u objects\n", seen, count);
+    }
+
+    trie_clear(trie);
+    trie_destroy(trie);
+}
+
+/*
+ * bench_trie_scan
+ *
+ * Full scan of 1M keys, looking every key up again to find the next
+ * one against keeping a cursor on the current one
+ */
+static void
+bench_trie_scan (void)
+{
+    bench_trie_object_t *objs;
+    uint32_t i, count = BENCH_TRIE_OBJECTS;
+
+    objs = (bench_trie_object_t *)malloc(count * sizeof(bench_trie_object_t));
+    if (!objs) {
+        printf("  Unable to allocate %u objects\n", count);
+        return;
+    }
+
+    for (i = 0; i < count; i++) {
+        snprintf(objs[i].obj_name, sizeof(objs[i].obj_name), "%08x",
+                 i * 2654435761U);
+        objs[i].obj_id = i;
+    }
+
+    printf("Trie, full scan of %u random 8 character keys\n", count);
+    bench_trie_scan_run("per character", 0, objs, count);
+    bench_trie_scan_run("radix", TRIE_FLAG_RADIX, objs, count);
+
+    free(objs);
+}
+
+/*
+ * bench_trie_prefix_run
+ *
+ * Prefix queries of the given length against a trie created with the
+ * given flags: listing every match, and picking the top 10 by scoring
+ * every match or by following the cached best scores
+ */
+static void
+bench_trie_prefix_run (char *what, uint32_t flags, bench_trie_object_t *objs,
+                       uint32_t count, uint32_t prefix_len)
+{
+    trie_t *trie;
+    void *best[BENCH_TRIE_TOPK];
+    uint32_t i, matched = 0, queries = BENCH_TRIE_PREFIX_QUERIES;
+    uint64_t start;
+    char label[64], prefix[16];
+
+    trie = trie_create_flags("Prefix", bench_trie_get_key, flags);
+    trie_set_score_fn(trie, bench_trie_get_score);
+    for (i = 0; i < count; i++) {
+        trie_insert(trie, objs[i].obj_name, &objs[i]);
+    }
+
+    start = bench_now_ns();
+    for (i = 0; i < queries; i++) {
+        snprintf(prefix, sizeof(prefix), "%08x", i * 2654435761U);
+        prefix[prefix_len] = '\0';
+        trie_prefix_foreach(trie, prefix, bench_trie_count, &matched);
+    }
+    snprintf(label, sizeof(label), "%s, %u chars, foreach", what, prefix_len);
+    bench_report(label, queries, bench_now_ns() - start);
+    printf("  %-40s %10u matches per query\n", "", matched / queries);
+
+    /* A different function pointer doesn't match the cached scores */
+    start = bench_now_ns();
+    for (i = 0; i < queries; i++) {
+        snprintf(prefix, sizeof(prefix), "%08x", i * 2654435761U);
+        prefix[prefix_len] = '\0';
+        trie_prefix_topk(trie, prefix, BENCH_TRIE_TOPK, bench_trie_score_all,
+                         best);
+    }
+    snprintf(label, sizeof(label), "%s, %u chars, top 10 scan", what,
+             prefix_len);
+    bench_report(label, queries, bench_now_ns() - start);
+
+    start = bench_now_ns();
+    for (i = 0; i < queries; i++) {
+        snprintf(prefix, sizeof(prefix), "%08x", i * 2654435761U);
+        prefix[prefix_len] = '\0';
+        trie_prefix_topk(trie, prefix, BENCH_TRIE_TOPK, bench_trie_get_score,
+                         best);
+    }
+    snprintf(label, sizeof(label), "%s, %u chars, top 10 cached", what,
+             prefix_len);
+    bench_report(label, queries, bench_now_ns() - start);
+
+    trie_clear(trie);
+    trie_destroy(trie);
+}
+
+/*
+ * bench_trie_prefix
+ *
+ * Typeahead style queries on 1M random 8 character keys, with short
+ * prefixes matching many keys and longer ones matching a few hundred
+ */
+static void
+bench_trie_prefix (void)
+{
+    bench_trie_object_t *objs;
+    uint32_t i, count = BENCH_TRIE_OBJECTS;
+
+    objs = (bench_trie_object_t *)malloc(count * sizeof(bench_trie_object_t));
+    if (!objs) {
+        printf("  Unable to allocate %u objects\n", count);
+        return;
+    }
+
+    for (i = 0; i < count; i++) {
+        snprintf(objs[i].obj_name, sizeof(objs[i].obj_name), "%08x",
+                 i * 2654435761U);
+        objs[i].obj_id = i;
+    }
+
+    printf("Trie, prefix queries on %u random 8 character keys\n", count);
+    bench_trie_prefix_run("per character", 0, objs, count, 2);
+    bench_trie_prefix_run("per character", 0, objs, count, 3);
+    bench_trie_prefix_run("radix", TRIE_FLAG_RADIX, objs, count, 2);
+    bench_trie_prefix_run("radix", TRIE_FLAG_RADIX, objs, count, 3);
+
+    free(objs);
+}
+
+/*
+ * bench_trie_long_keys_run
+ *
+ * Insert, lookup and remove the given long key records in a trie
+ * created with the given flags, through both the C string and the
+ * length taking calls
+ */
+static void
+bench_trie_long_keys_run (char *what, uint32_t flags,
+                          bench_trie_long_object_t *objs, uint32_t *order,
+                          uint32_t count)
+{
+    trie_t *trie;
+    uint32_t i, found = 0;
+    uint64_t start;
+    char label[64];
+
+    trie = trie_create_flags("Long", bench_trie_get_long_key, flags);
+
+    start = bench_now_ns();
+    for (i = 0; i < count; i++) {
+        trie_insert(trie, objs[i].obj_key, &objs[i]);
+    }
+    snprintf(label, sizeof(label), "%s insert", what);
+    bench_report(label, count, bench_now_ns() - start);
+
+    start = bench_now_ns();
+    for (i = 0; i < count; i++) {
+        if (trie_lookup(trie, objs[order[i]].obj_key)) {
+            found++;
+        }
+    }
+    snprintf(label, sizeof(label), "%s lookup", what);
+    bench_report(label, count, bench_now_ns() - start);
+
+    start = bench_now_ns();
+    for (i = 0; i < count; i++) {
+        if (trie_lookup_len(trie, objs[order[i]].obj_key,
+                            objs[order[i]].obj_len)) {
+            found++;
+        }
+    }
+    snprintf(label, sizeof(label), "%s lookup with length", what);
+    bench_report(label, count, bench_now_ns() - start);
+
+    start = bench_now_ns();
+    for (i = 0; i < count; i++) {
+        trie_remove(trie, objs[order[i]].obj_key);
+    }
+    snprintf(label, sizeof(label), "%s remove", what);
+    bench_report(label, count, bench_now_ns() - start);
+
+    for (i = 0; i < count; i++) {
+        trie_insert_len(trie, objs[i].obj_key, objs[i].obj_len, &objs[i]);
+    }
+    start = bench_now_ns();
+    for (i = 0; i < count; i++) {
+        trie_remove_len(trie, objs[order[i]].obj_key, objs[order[i]].obj_len);
+    }
+    snprintf(label, sizeof(label), "%s remove with length", what);
+    bench_report(label, count, bench_now_ns() - start);
+
+    if (found != 2 * count) {
+        printf("  Lookup found only %u of %u objects\n", found, 2 * count);
+    }
+    if (!trie_empty(trie)) {
+        printf("  %u objects were left behind\n", trie_get_count(trie));
+    }
+
+    trie_destroy(trie);
+}
+
+/*
+ * bench_trie_long_keys
+ *
+ * Trie throughput with 1KB keys, which used to be scanned with
+ * strlen() once per character and could not be removed at all past 64
+ * characters
+ */
+static void
+bench_trie_long_keys (void)
+{
+    bench_trie_long_object_t *objs;
+    uint32_t *order;
+    char *keys;
+    uint32_t i, j, count = BENCH_TRIE_LONG_OBJECTS;
+    uint32_t len = BENCH_TRIE_LONG_KEY_LEN;
+
+    objs = (bench_trie_long_object_t *)
+        malloc(count * sizeof(bench_trie_long_object_t));
+    order = (uint32_t *)malloc(count * sizeof(uint32_t));
+    keys = (char *)malloc((size_t)count * (len + 1));
+    if (!objs || !order || !keys) {
+        printf("  Unable to allocate %u objects\n", count);
+        free(objs);
+        free(order);
+        free(keys);
+        return;
+    }
+
+    /* The record id written out over and over again */
+    for (i = 0; i < count; i++) {
+        objs[i].obj_key = keys + (size_t)i * (len + 1);
+        for (j = 0; j < len; j += 8) {
+            snprintf(objs[i].obj_key + j, 9, "%08x", i * 2654435761U);
+        }
+        objs[i].obj_len = len;
+        objs[i].obj_id = i;
+        order[i] = i;
+    }
+    bench_shuffle(order, count, 1);
+
+    printf("Trie, %u keys of %u characters\n", count, len);
+    bench_trie_long_keys_run("per character", 0, objs, order, count);
+    bench_trie_long_keys_run("radix", TRIE_FLAG_RADIX, objs, order, count);
+
+    free(objs);
+    free(order);
+    free(keys);
+}
+
+/*
+ * bench_trie_mmap_run
+ *
+ * Build a trie with the given flags the usual way, save it with
+ * trie_serialize() and map it back in, then compare lookups and prefix
+ * scans on the mapped trie against the one in memory
+ */
+static void
+bench_trie_mmap_run (char *what, uint32_t flags, bench_trie_object_t *objs,
+                     uint32_t *order, uint32_t count)
+{
+    trie_t *trie, *mapped;
+    uint32_t i, found = 0, matched = 0;
+    uint32_t queries = BENCH_TRIE_PREFIX_QUERIES;
+    uint64_t start;
+    char label[64], prefix[16];
+
+    trie = trie_create_flags("Image", bench_trie_get_key, flags);
+
+    start = bench_now_ns();
+    for (i = 0; i < count; i++) {
+        trie_insert(trie, objs[i].obj_name, &objs[i]);
+    }
+    snprintf(label, sizeof(label), "%s build by insert", what);
+    bench_report(label, count, bench_now_ns() - start);
+
+    start = bench_now_ns();
+    if (trie_serialize(trie, BENCH_TRIE_IMAGE_PATH,
+                       sizeof(bench_trie_object_t)) != EOK) {
+        printf("  Unable to write %s\n", BENCH_TRIE_IMAGE_PATH);
+        trie_clear(trie);
+        trie_destroy(trie);
+        return;
+    }
+    snprintf(label, sizeof(label), "%s serialize", what);
+    bench_report(label, count, bench_now_ns() - start);
+
+    start = bench_now_ns();
+    mapped = trie_open_mmap("Mapped", BENCH_TRIE_IMAGE_PATH,
+                            bench_trie_get_key);
+    snprintf(label, sizeof(label), "%s open mapped", what);
+    bench_report(label, 1, bench_now_ns() - start);
+    if (!mapped) {
+        printf("  Unable to map %s\n", BENCH_TRIE_IMAGE_PATH);
+        trie_clear(trie);
+        trie_destroy(trie);
+        unlink(BENCH_TRIE_IMAGE_PATH);
+        return;
+    }
+    printf("  %-40s %10llu KB %8.1f bytes/key\n", "image size",
+           (unsigned long long)(mapped->image_size / 1024),
+           (double)mapped->image_size / count);
+
+    start = bench_now_ns();
+    for (i = 0; i < count; i++) {
+        if (trie_lookup(trie, objs[order[i]].obj_name)) {
+            found++;
+        }
+    }
+    snprintf(label, sizeof(label), "%s lookup, in memory", what);
+    bench_report(label, count, bench_now_ns() - start);
+
+    start = bench_now_ns();
+    for (i = 0; i < count; i++) {
+        if (trie_lookup(mapped, objs[order[i]].obj_name)) {
+            found++;
+        }
+    }
+    snprintf(label, sizeof(label), "%s lookup, mapped", what);
+    bench_report(label, count, bench_now_ns() - start);
+
+    start = bench_now_ns();
+    for (i = 0; i < queries; i++) {
+        snprintf(prefix, sizeof(prefix), "%08x", i * 2654435761U);
+        prefix[3] = '\0';
+        trie_prefix_foreach(trie, prefix, bench_trie_count, &matched);
+    }
+    snprintf(label, sizeof(label), "%s 3 char prefix, in memory", what);
+    bench_report(label, queries, bench_now_ns() - start);
+
+    start = bench_now_ns();
+    for (i = 0; i < queries; i++) {
+        snprintf(prefix, sizeof(prefix), "%08x", i * 2654435761U);
+        prefix[3] = '\0';
+        trie_prefix_foreach(mapped, prefix, bench_trie_count, &matched);
+    }
+    snprintf(label, sizeof(label), "%s 3 char prefix, mapped", what);
+    bench_report(label, queries, bench_now_ns() - start);
+
+    if (found != 2 * count) {
+        printf("  Lookup found only %u of %u objects\n", found, 2 * count);
+    }
+
+    trie_destroy(mapped);
+    unlink(BENCH_TRIE_IMAGE_PATH);
+    trie_clear(trie);
+    trie_destroy(trie);
+}
+
+/*
+ * bench_trie_mmap
+ *
+ * Startup cost of rebuilding a trie of 1M random 8 character keys
+ * against mapping a saved image of it, and the lookup speed of each
+ */
+static void
+bench_trie_mmap (void)
+{
+    bench_trie_object_t *objs;
+    uint32_t *order;
+    uint32_t i, count = BENCH_TRIE_OBJECTS;
+
+    objs = (bench_trie_object_t *)malloc(count * sizeof(bench_trie_object_t));
+    order = (uint32_t *)malloc(count * sizeof(uint32_t));
+    if (!objs || !order) {
+        printf("  Unable to allocate %u objects\n", count);
+        free(objs);
+        free(order);
+        return;
+    }
+
+    for (i = 0; i < count; i++) {
+        snprintf(objs[i].obj_name, sizeof(objs[i].obj_name), "%08x",
+                 i * 2654435761U);
+        objs[i].obj_id = i;
+        order[i] = i;
+    }
+    bench_shuffle(order, count, 1);
+
+    printf("Trie, %u random 8 character keys saved and mapped\n", count);
+    bench_trie_mmap_run("per character", 0, objs, order, count);
+    bench_trie_mmap_run("radix", TRIE_FLAG_RADIX, objs, order, count);
+
+    free(objs);
+    free(order);
+}
+
+/*
+ * bench_trie_freeze_run
+ *
+ * Lookup latency of a trie created with the given flags, before and
+ * after compiling it into a double array with trie_freeze()
+ */
+static void
+bench_trie_freeze_run (char *what, uint32_t flags, bench_trie_object_t *objs,
+                       uint32_t *order, uint32_t count)
+{
+    trie_t *trie;
+    uint32_t i, found = 0, nodes;
+    uint64_t start, rss;
+    char label[64];
+
+    trie = trie_create_flags("Freeze", bench_trie_get_key, flags);
+    for (i = 0; i < count; i++) {
+        trie_insert(trie, objs[i].obj_name, &objs[i]);
+    }
+    nodes = trie->node_count;
+
+    start = bench_now_ns();
+    for (i = 0; i < count; i++) {
+        if (trie_lookup(trie, objs[order[i]].obj_name)) {
+            found++;
+        }
+    }
+    snprintf(label, sizeof(label), "%s lookup", what);
+    bench_report(label, count, bench_now_ns() - start);
+
+    rss = bench_rss_kb();
+    start = bench_now_ns();
+    if (trie_freeze(trie) != EOK) {
+        printf("  Unable to freeze the trie\n");
+        trie_clear(trie);
+        trie_destroy(trie);
+        return;
+    }
+    snprintf(label, sizeof(label), "%s freeze", what);
+    bench_report(label, count, bench_now_ns() - start);
+    printf("  %-40s %10u nodes %10u states %5.1f%% used\n", "", nodes,
+           trie->node_count, 100.0 * trie->node_count / trie->da.size);
+    printf("  %-40s %10.1f bytes/key\n", "double array size",
+           (trie->da.size * 2.0 * sizeof(int32_t) +
+            count * sizeof(void *)) / count);
+    printf("  %-40s %10lld KB\n", "resident memory change",
+           (long long)(bench_rss_kb() - rss));
+
+    start = bench_now_ns();
+    for (i = 0; i < count; i++) {
+        if (trie_lookup(trie, objs[order[i]].obj_name)) {
+            found++;
+        }
+    }
+    snprintf(label, sizeof(label), "%s lookup, frozen", what);
+    bench_report(label, count, bench_now_ns() - start);
+
+    if (found != 2 * count) {
+        printf("  Lookup found only %u of %u objects\n", found, 2 * count);
+    }
+
+    trie_clear(trie);
+    trie_destroy(trie);
+}
+
+/*
+ * bench_trie_freeze
+ *
+ * Exact match lookups on a frozen double array trie against the
+ * dynamic layouts, for 1M random 8 character keys and for keys of
+ * random bytes which fan out wide at every level
+ */
+static void
+bench_trie_freeze (void)
+{
+    bench_trie_object_t *objs;
+    uint32_t *order;
+    uint32_t i, j, seed = 1, count = BENCH_TRIE_OBJECTS;
+
+    objs = (bench_trie_object_t *)malloc(count * sizeof(bench_trie_object_t));
+    order = (uint32_t *)malloc(count * sizeof(uint32_t));
+    if (!objs || !order) {
+        printf("  Unable to allocate %u objects\n", count);
+        free(objs);
+        free(order);
+        return;
+    }
+
+    for (i = 0; i < count; i++) {
+        snprintf(objs[i].obj_name, sizeof(objs[i].obj_name), "%08x",
+                 i * 2654435761U);
+        objs[i].obj_id = i;
+        order[i] = i;
+    }
+    bench_shuffle(order, count, 1);
+
+    printf("Trie, %u random 8 character keys\n", count);
+    bench_trie_freeze_run("per character", 0, objs, order, count);
+    bench_trie_freeze_run("radix", TRIE_FLAG_RADIX, objs, order, count);
+
+    /* Any byte but the terminating 0 */
+    for (i = 0; i < count; i++) {
+        for (j = 0; j < BENCH_TRIE_BYTE_KEY_LEN; j++) {
+            seed = seed * 1103515245U + 12345U;
+            objs[i].obj_name[j] = (char)(1 + (seed >> 16) % 255);
+        }
+        objs[i].obj_name[j] = '\0';
+        order[i] = i;
+    }
+    bench_shuffle(order, count, 3);
+
+    printf("Trie, %u keys of %u random bytes\n", count,
+           BENCH_TRIE_BYTE_KEY_LEN);
+    bench_trie_freeze_run("per character", 0, objs, order, count);
+    bench_trie_freeze_run("radix", TRIE_FLAG_RADIX, objs, order, count);
+
+    free(objs);
+    free(order);
+}
+
+/*
+ * bench_trie_reader_thread
+ *
+ * Reader side of bench_trie_concurrent(). Looks up random even ids.
+ */
+static void *
+bench_trie_reader_thread (void *arg)
+{
+    bench_trie_thread_t *thr = (bench_trie_thread_t *)arg;
+    uint32_t i, seed = thr->seed;
+    bench_trie_object_t *obj;
+
+    for (i = 0; i < thr->ops; i++) {
+        seed = seed * 1103515245 + 12345;
+        obj = &thr->objs[((seed >> 8) % thr->count) * 2];
+
+        if (thr->lock) {
+            pthread_mutex_lock(thr->lock);
+        }
+        if (trie_lookup(thr->trie, obj->obj_name)) {
+            thr->found++;
+        }
+        if (thr->lock) {
+            pthread_mutex_unlock(thr->lock);
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * bench_trie_writer_thread
+ *
+ * Writer side of bench_trie_concurrent(). Inserts and removes a spread
+ * out set of odd ids, different for each writer, until the readers are
+ * done.
+ */
+static void *
+bench_trie_writer_thread (void *arg)
+{
+    bench_trie_thread_t *thr = (bench_trie_thread_t *)arg;
+    uint32_t i, stride = thr->count / BENCH_TRIE_CONCURRENT_CHURN;
+    bench_trie_object_t *obj;
+
+    while (!*thr->stop) {
+        for (i = 0; i < BENCH_TRIE_CONCURRENT_CHURN; i++) {
+            obj = &thr->objs[(i * stride + thr->writer) * 2 + 1];
+            if (thr->lock) {
+                pthread_mutex_lock(thr->lock);
+            }
+            trie_insert(thr->trie, obj->obj_name, obj);
+            if (thr->lock) {
+                pthread_mutex_unlock(thr->lock);
+            }
+        }
+
+        for (i = 0; i < BENCH_TRIE_CONCURRENT_CHURN; i++) {
+            obj = &thr->objs[(i * stride + thr->writer) * 2 + 1];
+            if (thr->lock) {
+                pthread_mutex_lock(thr->lock);
+            }
+            trie_remove(thr->trie, obj->obj_name);
+            if (thr->lock) {
+                pthread_mutex_unlock(thr->lock);
+            }
+        }
+        trie_synchronize(thr->trie);
+
+        thr->ops += 2 * BENCH_TRIE_CONCURRENT_CHURN;
+    }
+
+    return NULL;
+}
+
+/*
+ * bench_trie_concurrent_run
+ *
+ * Run the given numbers of reader and writer threads against the trie
+ * and print the aggregate lookup and update throughput
+ */
+static void
+bench_trie_concurrent_run (char *what, trie_t *trie, pthread_mutex_t *lock,
+                           bench_trie_object_t *objs, uint32_t count,
+                           uint32_t num_readers, uint32_t num_writers)
+{
+    bench_trie_thread_t readers[BENCH_BST_CONCURRENT_THREADS];
+    bench_trie_thread_t writers[BENCH_TRIE_CONCURRENT_WRITERS];
+    pthread_t reader_tid[BENCH_BST_CONCURRENT_THREADS];
+    pthread_t writer_tid[BENCH_TRIE_CONCURRENT_WRITERS];
+    volatile int stop = 0;
+    uint32_t i, found = 0, updates = 0;
+    uint64_t start, elapsed;
+    char label[64];
+
+    start = bench_now_ns();
+    for (i = 0; i < num_writers; i++) {
+        memset(&writers[i], 0, sizeof(writers[i]));
+        writers[i].trie = trie;
+        writers[i].lock = lock;
+        writers[i].objs = objs;
+        writers[i].count = count;
+        writers[i].writer = i;
+        writers[i].stop = &stop;
+        pthread_create(&writer_tid[i], NULL, bench_trie_writer_thread,
+                       &writers[i]);
+    }
+    for (i = 0; i < num_readers; i++) {
+        readers[i] = writers[0];
+        readers[i].seed = i + 1;
+        readers[i].ops = BENCH_TRIE_CONCURRENT_LOOKUPS;
+        pthread_create(&reader_tid[i], NULL, bench_trie_reader_thread,
+                       &readers[i]);
+    }
+
+    for (i = 0; i < num_readers; i++) {
+        pthread_join(reader_tid[i], NULL);
+        found += readers[i].found;
+    }
+    elapsed = bench_now_ns() - start;
+    stop = 1;
+    for (i = 0; i < num_writers; i++) {
+        pthread_join(writer_tid[i], NULL);
+        updates += writers[i].ops;
+    }
+
+    snprintf(label, sizeof(label), "%s, %u readers, %u writers", what,
+             num_readers, num_writers);
+    printf("  %-44s %8.2f Mops/s %8.2f Mupd/s\n", label,
+           (double)num_readers * BENCH_TRIE_CONCURRENT_LOOKUPS * 1000.0 / elapsed,
+           (double)updates * 1000.0 / elapsed);
+
+    if (found != num_readers * BENCH_TRIE_CONCURRENT_LOOKUPS) {
+        printf("  Lookup found only %u objects\n", found);
+    }
+}
+
+/*
+ * bench_trie_concurrent
+ *
+ * Aggregate lookup throughput of 1 to 8 reader threads, and update
+ * throughput of 1 or 4 writer threads, on a trie with 500K random 8
+ * character keys. A radix trie behind a global mutex is compared
+ * against a TRIE_FLAG_CONCURRENT trie, whose readers take no locks and
+ * whose writers only lock the keys sharing their first character.
+ */
+static void
+bench_trie_concurrent (void)
+{
+    trie_t *trie;
+    pthread_mutex_t lock;
+    bench_trie_object_t *objs;
+    uint32_t i, readers, writers, count = BENCH_TRIE_CONCURRENT_OBJECTS;
+
+    objs = (bench_trie_object_t *)malloc(2 * count *
+                                         sizeof(bench_trie_object_t));
+    if (!objs) {
+        printf("  Unable to allocate %u objects\n", 2 * count);
+        return;
+    }
+
+    for (i = 0; i < 2 * count; i++) {
+        snprintf(objs[i].obj_name, sizeof(objs[i].obj_name), "%08x",
+                 i * 2654435761U);
+        objs[i].obj_id = i;
+    }
+
+    printf("Trie, %u random 8 character keys\n", count);
+
+    pthread_mutex_init(&lock, NULL);
+    for (writers = 1; writers <= BENCH_TRIE_CONCURRENT_WRITERS; writers *= 4) {
+        trie = trie_create_flags("Mutex", bench_trie_get_key, TRIE_FLAG_RADIX);
+        for (i = 0; i < count; i++) {
+            trie_insert(trie, objs[2 * i].obj_name, &objs[2 * i]);
+        }
+        for (readers = 1; readers <= BENCH_BST_CONCURRENT_THREADS;
+             readers *= 2) {
+            bench_trie_concurrent_run("global mutex", trie, &lock, objs,
+                                      count, readers, writers);
+        }
+        trie_clear(trie);
+        trie_destroy(trie);
+
+        trie = trie_create_flags("Concurrent", bench_trie_get_key,
+                                 TRIE_FLAG_CONCURRENT);
+        for (i = 0; i < count; i++) {
+            trie_insert(trie, objs[2 * i].obj_name, &objs[2 * i]);
+        }
+        for (readers = 1; readers <= BENCH_BST_CONCURRENT_THREADS;
+             readers *= 2) {
+            bench_trie_concurrent_run("TRIE_FLAG_CONCURRENT", trie, NULL,
+                                      objs, count, readers, writers);
+        }
+        trie_clear(trie);
+        trie_destroy(trie);
+    }
+    pthread_mutex_destroy(&lock);
+
+    free(objs);
+}
+
+/*
+ * bench_trie_batch_run
+ *
+ * Look up every key of a trie, in random order, one trie_lookup() at a
+ * time and then with trie_lookup_batch() in batches of 16 to 256 keys.
+ * Then insert all the keys into an empty trie one at a time and in
+ * batches of 256.
+ */
+static void
+bench_trie_batch_run (char *what, uint32_t flags, uint8_t freeze,
+                      bench_trie_object_t *objs, char **keys, void **data,
+                      uint32_t count)
+{
+    trie_t *trie;
+    void *results[BENCH_TRIE_BATCH_MAX];
+    uint32_t i, batch, n, found;
+    uint64_t start;
+    char label[64];
+
+    trie = trie_create_flags("Batch", bench_trie_get_key, flags);
+    for (i = 0; i < count; i++) {
+        trie_insert(trie, objs[i].obj_name, &objs[i]);
+    }
+    if (freeze) {
+        trie_freeze(trie);
+    }
+
+    found = 0;
+    start = bench_now_ns();
+    for (i = 0; i < count; i++) {
+        if (trie_lookup(trie, keys[i])) {
+            found++;
+        }
+    }
+    snprintf(label, sizeof(label), "%s lookup", what);
+    bench_report(label, count, bench_now_ns() - start);
+
+    for (batch = 16; batch <= BENCH_TRIE_BATCH_MAX; batch *= 4) {
+        found = 0;
+        start = bench_now_ns();
+        for (i = 0; i < count; i += batch) {
+            n = (count - i < batch) ? count - i : batch;
+            found += trie_lookup_batch(trie, keys + i, n, results);
+        }
+        snprintf(label, sizeof(label), "%s lookup, batches of %u", what, batch);
+        bench_report(label, count, bench_now_ns() - start);
+
+        if (found != count) {
+            printf("  Batch lookup found only %u of %u objects\n", found,
+                   count);
+        }
+    }
+
+    trie_clear(trie);
+    if (freeze) {
+        trie_destroy(trie);
+        return;
+    }
+
+    start = bench_now_ns();
+    for (i = 0; i < count; i++) {
+        trie_insert(trie, keys[i], data[i]);
+    }
+    snprintf(label, sizeof(label), "%s insert", what);
+    bench_report(label, count, bench_now_ns() - start);
+    trie_clear(trie);
+
+    found = 0;
+    start = bench_now_ns();
+    for (i = 0; i < count; i += BENCH_TRIE_BATCH_MAX) {
+        n = (count - i < BENCH_TRIE_BATCH_MAX) ? count - i : BENCH_TRIE_BATCH_MAX;
+        found += trie_insert_batch(trie, keys + i, data + i, n);
+    }
+    snprintf(label, sizeof(label), "%s insert, batches of %u", what,
+             BENCH_TRIE_BATCH_MAX);
+    bench_report(label, count, bench_now_ns() - start);
+
+    if (found != count) {
+        printf("  Batch insert added only %u of %u objects\n", found, count);
+    }
+
+    trie_clear(trie);
+    trie_destroy(trie);
+}
+
+/*
+ * bench_trie_batch
+ *
+ * Throughput of batched lookups and inserts, which keep several walks
+ * down the trie in flight at once, against the same keys handled one
+ * call at a time. 1M random 8 character keys.
+ */
+static void
+bench_trie_batch (void)
+{
+    bench_trie_object_t *objs;
+    uint32_t *order;
+    char **keys;
+    void **data;
+    uint32_t i, count = BENCH_TRIE_OBJECTS;
+
+    objs = (bench_trie_object_t *)malloc(count * sizeof(bench_trie_object_t));
+    order = (uint32_t *)malloc(count * sizeof(uint32_t));
+    keys = (char **)malloc(count * sizeof(char *));
+    data = (void **)malloc(count * sizeof(void *));
+    if (!objs || !order || !keys || !data) {
+        printf("  Unable to allocate %u objects\n", count);
+        free(objs);
+        free(order);
+        free(keys);
+        free(data);
+        return;
+    }
+
+    for (i = 0; i < count; i++) {
+        snprintf(objs[i].obj_name, sizeof(objs[i].obj_name), "%08x",
+                 i * 2654435761U);
+        objs[i].obj_id = i;
+        order[i] = i;
+    }
+    bench_shuffle(order, count, 1);
+    for (i = 0; i < count; i++) {
+        keys[i] = objs[order[i]].obj_name;
+        data[i] = &objs[order[i]];
+    }
+
+    printf("Trie, %u random 8 character keys\n", count);
+    bench_trie_batch_run("per character", 0, FALSE, objs, keys, data, count);
+    bench_trie_batch_run("radix", TRIE_FLAG_RADIX, FALSE, objs, keys, data,
+                         count);
+    bench_trie_batch_run("radix, frozen", TRIE_FLAG_RADIX, TRUE, objs, keys,
+                         data, count);
+
+    free(objs);
+    free(order);
+    free(keys);
+    free(data);
+}
+
+/*
+ * bench_list_ends
+ *
+ * Insert and remove at the ends of a singly and a doubly linked list:
+ * fill a long list from either end and drain it from the head, then
+ * use the lists as a short queue that keeps going empty, which is where
+ * the empty list and single element cases get hit.
+ */
+static void
+bench_list_ends (void)
+{
+    list_t *slist;
+    llist_t *dlist;
+    bench_list_object_t *objs;
+    uint32_t *order;
+    uint32_t i, j, n, ops, count = BENCH_LIST_OBJECTS;
+    uint64_t start;
+
+    objs = (bench_list_object_t *)calloc(count, sizeof(bench_list_object_t));
+    order = (uint32_t *)malloc(count * sizeof(uint32_t));
+    if (!objs || !order) {
+        printf("  Unable to allocate %u objects\n", count);
+        free(objs);
+        free(order);
+        return;
+    }
+
+    /* Random queue lengths, 1 to 4 */
+    for (i = 0; i < count; i++) {
+        objs[i].obj_id = i;
+        order[i] = i;
+    }
+    bench_shuffle(order, count, 1);
+
+    slist = list_create("Bench", offsetof(bench_list_object_t, list_link));
+    printf("Singly linked list, %u elements\n", count);
+
+    start = bench_now_ns();
+    for (i = 0; i < count; i++) {
+        list_insert_tail(slist, &objs[i].list_link);
+    }
+    bench_report("insert tail", count, bench_now_ns() - start);
+
+    start = bench_now_ns();
+    for (i = 0; i < count; i++) {
+        list_remove(slist, &objs[i].list_link);
+    }
+    bench_report("remove head", count, bench_now_ns() - start);
+
+    start = bench_now_ns();
+    for (i = 0; i < count; i++) {
+        list_insert_head(slist, &objs[i].list_link);
+    }
+    bench_report("insert head", count, bench_now_ns() - start);
+
+    for (i = count; i > 0; i--) {
+        list_remove(slist, &objs[i - 1].list_link);
+    }
+
+    ops = 0;
+    start = bench_now_ns();
+    for (i = 0; i < BENCH_LIST_QUEUE_ROUNDS; i++) {
+        n = 1 + (order[i % count] & 3);
+        for (j = 0; j < n; j++) {
+            list_insert_tail(slist, &objs[j].list_link);
+        }
+        for (j = 0; j < n; j++) {
+            list_remove(slist, &objs[j].list_link);
+        }
+        ops += 2 * n;
+    }
+    bench_report("short queue, insert tail and remove head", ops,
+                 bench_now_ns() - start);
+
+    if (!list_empty(slist)) {
+        printf("  %u elements left behind\n", list_get_count(slist));
+    }
+    list_destroy(slist);
+
+    dlist = llist_create("Bench", offsetof(bench_list_object_t, link));
+    printf("Doubly linked list, %u elements\n", count);
+
+    start = bench_now_ns();
+    for (i = 0; i < count; i++) {
+        llist_insert_tail(dlist, &objs[i].link);
+    }
+    bench_report("insert tail", count, bench_now_ns() - start);
+
+    start = bench_now_ns();
+    for (i = 0; i < count; i++) {
+        llist_remove(dlist, &objs[i].link);
+    }
+    bench_report("remove head", count, bench_now_ns() - start);
+
+    start = bench_now_ns();
+    for (i = 0; i < count; i++) {
+        llist_insert_head(dlist, &objs[i].link);
+    }
+    bench_report("insert head", count, bench_now_ns() - start);
+
+    start = bench_now_ns();
+    for (i = 0; i < count; i++) {
+        llist_remove(dlist, &objs[i].link);
+    }
+    bench_report("remove tail", count, bench_now_ns() - start);
+
+    ops = 0;
+    start = bench_now_ns();
+    for (i = 0; i < BENCH_LIST_QUEUE_ROUNDS; i++) {
+        n = 1 + (order[i % count] & 3);
+        for (j = 0; j < n; j++) {
+            llist_insert_tail(dlist, &objs[j].link);
+        }
+        for (j = 0; j < n; j++) {
+            llist_remove(dlist, &objs[j].link);
+        }
+        ops += 2 * n;
+    }
+    bench_report("short queue, insert tail and remove head", ops,
+                 bench_now_ns() - start);
+
+    if (!llist_empty(dlist)) {
+        printf("  %u elements left behind\n", llist_get_count(dlist));
+    }
+    llist_destroy(dlist);
+
+    free(objs);
+    free(order);
+}
+
+/*
+ * bench_list_hash
+ *
+ * Hash of an object id, for the indexed lists
+ */
+static uint32_t
+bench_list_hash (void *key)
+{
+    return (*(uint32_t *)key);
+}
+
+/*
+ * bench_list_get_key
+ *
+ * Return the key of the given object, for the indexed lists
+ */
+static void *
+bench_list_get_key (void *elem)
+{
+    return (&((bench_list_object_t *)elem)->obj_id);
+}
+
+/*
+ * bench_list_cmp
+ *
+ * Compare an object id to an object
+ */
+static int32_t
+bench_list_cmp (void *key, void *elem)
+{
+    if (((bench_list_object_t *)elem)->obj_id == *(uint32_t *)key) {
+        return 0;
+    }
+
+    return -1;
+}
+
+/*
+ * bench_list_find
+ *
+ * Find objects by id in a singly and a doubly linked list, both walking
+ * the list and through a hash index, and what keeping the index costs
+ * the inserts and removes
+ */
+static void
+bench_list_find (void)
+{
+    list_t *slist;
+    llist_t *dlist;
+    bench_list_object_t *objs;
+    uint32_t *ids;
+    uint32_t i, found, indexed, count = BENCH_LIST_FIND_OBJECTS;
+    uint32_t lookups = BENCH_LIST_FIND_LOOKUPS;
+    uint64_t start;
+    char label[64];
+
+    objs = (bench_list_object_t *)calloc(count, sizeof(bench_list_object_t));
+    ids = (uint32_t *)malloc(lookups * sizeof(uint32_t));
+    if (!objs || !ids) {
+        printf("  Unable to allocate %u objects\n", count);
+        free(objs);
+        free(ids);
+        return;
+    }
+
+    for (i = 0; i < count; i++) {
+        objs[i].obj_id = i * 2654435761U;
+    }
+    srand(1);
+    for (i = 0; i < lookups; i++) {
+        ids[i] = objs[rand() % count].obj_id;
+    }
+
+    printf("Linked lists, %u objects, found by id\n", count);
+    for (indexed = 0; indexed < 2; indexed++) {
+        if (indexed) {
+            slist = list_create_indexed("Bench",
+                                        offsetof(bench_list_object_t,
+                                                 list_link),
+                                        bench_list_hash, bench_list_get_key,
+                                        bench_list_cmp);
+        } else {
+            slist = list_create("Bench", offsetof(bench_list_object_t,
+                                                  list_link));
+        }
+
+        start = bench_now_ns();
+        for (i = 0; i < count; i++) {
+            list_insert_tail(slist, &objs[i].list_link);
+        }
+        snprintf(label, sizeof(label), "singly%s insert tail",
+                 indexed ? ", indexed," : "");
+        bench_report(label, count, bench_now_ns() - start);
+
+        found = 0;
+        start = bench_now_ns();
+        for (i = 0; i < lookups; i++) {
+            if (list_find(slist, &ids[i], bench_list_cmp)) {
+                found++;
+            }
+        }
+        snprintf(label, sizeof(label), "singly%s find",
+                 indexed ? ", indexed," : "");
+        bench_report(label, lookups, bench_now_ns() - start);
+        if (found != lookups) {
+            printf("  Found only %u of %u objects\n", found, lookups);
+        }
+
+        start = bench_now_ns();
+        for (i = 0; i < count; i++) {
+            list_remove(slist, &objs[i].list_link);
+        }
+        snprintf(label, sizeof(label), "singly%s remove head",
+                 indexed ? ", indexed," : "");
+        bench_report(label, count, bench_now_ns() - start);
+        list_destroy(slist);
+    }
+
+    for (indexed = 0; indexed < 2; indexed++) {
+        if (indexed) {
+            dlist = llist_create_indexed("Bench",
+                                         offsetof(bench_list_object_t, link),
+                                         bench_list_hash, bench_list_get_key,
+                                         bench_list_cmp);
+        } else {
+            dlist = llist_create("Bench", offsetof(bench_list_object_t, link));
+        }
+
+        start = bench_now_ns();
+        for (i = 0; i < count; i++) {
+            llist_insert_tail(dlist, &objs[i].link);
+        }
+        snprintf(label, sizeof(label), "doubly%s insert tail",
+                 indexed ? ", indexed," : "");
+        bench_report(label, count, bench_now_ns() - start);
+
+        found = 0;
+        start = bench_now_ns();
+        for (i = 0; i < lookups; i++) {
+            if (llist_find(dlist, &ids[i], bench_list_cmp)) {
+                found++;
+            }
+        }
+        snprintf(label, sizeof(label), "doubly%s find",
+                 indexed ? ", indexed," : "");
+        bench_report(label, lookups, bench_now_ns() - start);
+        if (found != lookups) {
+            printf("  Found only %u of %u objects\n", found, lookups);
+        }
+
+        start = bench_now_ns();
+        for (i = 0; i < count; i++) {
+            llist_remove(dlist, &objs[i].link);
+        }
+        snprintf(label, sizeof(label), "doubly%s remove",
+                 indexed ? ", indexed," : "");
+        bench_report(label, count, bench_now_ns() - start);
+        llist_destroy(dlist);
+    }
+
+    free(objs);
+    free(ids);
+}
+
+/*
+ * bench_hash_get_key
+ *
+ * Return the key of the given object, for the hash table
+ */
+static void *
+bench_hash_get_key (void *obj)
+{
+    return (&((bench_hash_object_t *)obj)->obj_id);
+}
+
+/*
+ * bench_hash_cmp
+ *
+ * Compare two object ids
+ */
+static int32_t
+bench_hash_cmp (void *key1, void *key2)
+{
+    return (*(uint32_t *)key1 != *(uint32_t *)key2);
+}
+
+/*
+ * bench_hash_bst_get_key
+ *
+ * Return the key of the given object, for the BST
+ */
+static int
+bench_hash_bst_get_key (void *node)
+{
+    return ((int)((bench_hash_object_t *)node)->obj_id);
+}
+
+/*
+ * bench_hash_ops
+ *
+ * Exact match lookups by a random 32-bit id in a hash table, against a
+ * balanced BST holding the same objects. The hash table also reports
+ * its slowest single insert, which stays small as the table is grown a
+ * little at a time.
+ */
+static void
+bench_hash_ops (void)
+{
+    hash_t *hash;
+    bst_t *tree;
+    bench_hash_object_t *objs;
+    uint32_t *order;
+    uint32_t i, found, miss, count = BENCH_HASH_OBJECTS;
+    uint64_t start, now, prev, worst;
+
+    objs = (bench_hash_object_t *)calloc(count, sizeof(bench_hash_object_t));
+    order = (uint32_t *)malloc(count * sizeof(uint32_t));
+    if (!objs || !order) {
+        printf("  Unable to allocate %u objects\n", count);
+        free(objs);
+        free(order);
+        return;
+    }
+
+    for (i = 0; i < count; i++) {
+        objs[i].obj_id = i * 2654435761U;
+        order[i] = i;
+    }
+    bench_shuffle(order, count, 1);
+
+    hash = hash_create("Bench", offsetof(bench_hash_object_t, hash_elem),
+                       bench_hash_get_key, bench_list_hash, bench_hash_cmp);
+    printf("Hash table, %u random 32-bit ids\n", count);
+
+    worst = 0;
+    start = bench_now_ns();
+    prev = start;
+    for (i = 0; i < count; i++) {
+        hash_insert(hash, &objs[i].hash_elem);
+        now = bench_now_ns();
+        if (now - prev > worst) {
+            worst = now - prev;
+        }
+        prev = now;
+    }
+    bench_report("insert", count, bench_now_ns() - start);
+    printf("  %-40s %10.1f us\n", "slowest insert", worst / 1000.0);
+
+    found = 0;
+    start = bench_now_ns();
+    for (i = 0; i < count; i++) {
+        if (hash_lookup(hash, &objs[order[i]].obj_id)) {
+            found++;
+        }
+    }
+    bench_report("random lookup", count, bench_now_ns() - start);
+
+    start = bench_now_ns();
+    for (i = 0; i < count; i++) {
+        miss = objs[order[i]].obj_id + 1;
+        if (hash_lookup(hash, &miss)) {
+            found++;
+        }
+    }
+    bench_report("random lookup, missing", count, bench_now_ns() - start);
+
+    if (found != count) {
+        printf("  Lookup found %u of %u objects\n", found, count);
+    }
+
+    start = bench_now_ns();
+    for (i = 0; i < count; i++) {
+        hash_remove(hash, &objs[order[i]].hash_elem);
+    }
+    bench_report("remove", count, bench_now_ns() - start);
+    hash_destroy(hash);
+
+    tree = bst_create_balanced("Bench", offsetof(bench_hash_object_t, bst_node),
+                               bench_hash_bst_get_key);
+    printf("Balanced BST, same ids\n");
+
+    start = bench_now_ns();
+    for (i = 0; i < count; i++) {
+        bst_insert(tree, &objs[i].bst_node);
+    }
+    bench_report("insert", count, bench_now_ns() - start);
+
+    found = 0;
+    start = bench_now_ns();
+    for (i = 0; i < count; i++) {
+        if (bst_lookup(tree, (int)objs[order[i]].obj_id)) {
+            found++;
+        }
+    }
+    bench_report("random lookup", count, bench_now_ns() - start);
+
+    start = bench_now_ns();
+    for (i = 0; i < count; i++) {
+        bst_remove(tree, &objs[order[i]].bst_node);
+    }
+    bench_report("remove", count, bench_now_ns() - start);
+    bst_destroy(tree);
+
+    free(objs);
+    free(order);
+}
+
+/*
+ * bench_queue_producer_thread
+ *
+ * Producer side of the queue benchmark. Enqueues its objects as fast as
+ * the queue takes them.
+ */
+static void *
+bench_queue_producer_thread (void *arg)
+{
+    bench_queue_thread_t *thread = (bench_queue_thread_t *)arg;
+    uint32_t i;
+
+    for (i = 0; i < thread->count; i++) {
+        switch (thread->kind) {
+        case BENCH_QUEUE_LIST:
+            pthread_mutex_lock(thread->lock);
+            list_insert_tail((list_t *)thread->queue,
+                             &thread->objs[i].list_link);
+            pthread_mutex_unlock(thread->lock);
+            break;
+        case BENCH_QUEUE_MPSC:
+            queue_enqueue((queue_t *)thread->queue,
+                          &thread->objs[i].list_link);
+            break;
+        case BENCH_QUEUE_RING:
+            while (queue_ring_enqueue((queue_ring_t *)thread->queue,
+                                      &thread->objs[i].list_link) != EOK) {
+                sched_yield();
+            }
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * bench_queue_dequeue
+ *
+ * Take the oldest object off the queue of the given kind, NULL if there
+ * is none right now
+ */
+static bench_list_object_t *
+bench_queue_dequeue (uint32_t kind, void *queue, pthread_mutex_t *lock)
+{
+    bench_list_object_t *obj = NULL;
+
+    switch (kind) {
+    case BENCH_QUEUE_LIST:
+        pthread_mutex_lock(lock);
+        obj = (bench_list_object_t *)list_get_head((list_t *)queue);
+        if (obj) {
+            list_remove((list_t *)queue, &obj->list_link);
+        }
+        pthread_mutex_unlock(lock);
+        break;
+    case BENCH_QUEUE_MPSC:
+        obj = (bench_list_object_t *)queue_dequeue((queue_t *)queue);
+        break;
+    case BENCH_QUEUE_RING:
+        obj = (bench_list_object_t *)queue_ring_dequeue((queue_ring_t *)queue);
+        break;
+    }
+
+    return obj;
+}
+
+/*
+ * bench_queue_run
+ *
+ * Hand all the objects from the given number of producer threads to
+ * this thread through one queue, and report the throughput
+ */
+static void
+bench_queue_run (char *what, uint32_t kind, uint32_t producers,
+                 bench_list_object_t *objs, uint32_t count)
+{
+    bench_queue_thread_t threads[BENCH_QUEUE_PRODUCERS];
+    pthread_t tids[BENCH_QUEUE_PRODUCERS];
+    pthread_mutex_t lock;
+    void *queue;
+    uint32_t i, done = 0, per_thread = count / producers;
+    uint64_t start, elapsed;
+    char label[64];
+
+    pthread_mutex_init(&lock, NULL);
+    if (kind == BENCH_QUEUE_LIST) {
+        queue = list_create("Bench", offsetof(bench_list_object_t, list_link));
+    } else if (kind == BENCH_QUEUE_MPSC) {
+        queue = queue_create("Bench", offsetof(bench_list_object_t, list_link));
+    } else {
+        queue = queue_ring_create("Bench",
+                                  offsetof(bench_list_object_t, list_link),
+                                  BENCH_QUEUE_RING_SIZE);
+    }
+
+    start = bench_now_ns();
+    for (i = 0; i < producers; i++) {
+        threads[i].kind = kind;
+        threads[i].queue = queue;
+        threads[i].lock = &lock;
+        threads[i].objs = objs + i * per_thread;
+        threads[i].count = per_thread;
+        pthread_create(&tids[i], NULL, bench_queue_producer_thread,
+                       &threads[i]);
+    }
+
+    while (done < per_thread * producers) {
+        if (bench_queue_dequeue(kind, queue, &lock)) {
+            done++;
+        } else {
+            sched_yield();
+        }
+    }
+    elapsed = bench_now_ns() - start;
+
+    for (i = 0; i < producers; i++) {
+        pthread_join(tids[i], NULL);
+    }
+
+    snprintf(label, sizeof(label), "%s, %u producer%s", what, producers,
+             producers > 1 ? "s" : "");
+    bench_report(label, done, elapsed);
+    printf("  %-40s %10.2f Mops/s\n", "throughput", done * 1000.0 / elapsed);
+
+    if (kind == BENCH_QUEUE_LIST) {
+        list_destroy((list_t *)queue);
+    } else if (kind == BENCH_QUEUE_MPSC) {
+        queue_destroy((queue_t *)queue);
+    } else {
+        queue_ring_destroy((queue_ring_t *)queue);
+    }
+    pthread_mutex_destroy(&lock);
+}
+
+/*
+ * bench_queue
+ *
+ * Work queue between producer threads and a single consumer: a list_t
+ * behind a mutex against the lock-free queue and ring
+ */
+static void
+bench_queue (void)
+{
+    bench_list_object_t *objs;
+    uint32_t producers, count = BENCH_QUEUE_OBJECTS;
+
+    objs = (bench_list_object_t *)calloc(count, sizeof(bench_list_object_t));
+    if (!objs) {
+        printf("  Unable to allocate %u objects\n", count);
+        return;
+    }
+
+    printf("Work queue, %u objects, one consumer, %ld CPUs\n", count,
+           sysconf(_SC_NPROCESSORS_ONLN));
+    for (producers = 1; producers <= BENCH_QUEUE_PRODUCERS; producers *= 4) {
+        bench_queue_run("list with a mutex", BENCH_QUEUE_LIST, producers,
+                        objs, count);
+        bench_queue_run("lock-free queue", BENCH_QUEUE_MPSC, producers,
+                        objs, count);
+        bench_queue_run("lock-free ring", BENCH_QUEUE_RING, producers,
+                        objs, count);
+    }
+
+    free(objs);
+}
+
+/*
+ * bench_llist_ops
+ *
+ * Splice elements into a doubly linked list next to random members and
+ * then remove every element by pointer, in random order. None of these
+ * need to walk the list.
+ */
+static void
+bench_llist_ops (void)
+{
+    llist_t *list;
+    bench_list_object_t *objs;
+    uint32_t *order;
+    uint32_t i, half, quarter, count = BENCH_LLIST_OBJECTS;
+    uint64_t start;
+
+    objs = (bench_list_object_t *)calloc(count, sizeof(bench_list_object_t));
+    order = (uint32_t *)malloc(count * sizeof(uint32_t));
+    if (!objs || !order) {
+        printf("  Unable to allocate %u objects\n", count);
+        free(objs);
+        free(order);
+        return;
+    }
+
+    list = llist_create("Bench", offsetof(bench_list_object_t, link));
+    half = count / 2;
+    quarter = count / 4;
+
+    printf("Doubly linked list, %u elements\n", count);
+    start = bench_now_ns();
+    for (i = 0; i < half; i++) {
+        objs[i].obj_id = i;
+        llist_insert_tail(list, &objs[i].link);
+    }
+    bench_report("insert tail", half, bench_now_ns() - start);
+
+    /* Anchors picked at random from the elements already on the list */
+    for (i = 0; i < count; i++) {
+        order[i] = i;
+    }
+    bench_shuffle(order, half, 1);
+
+    start = bench_now_ns();
+    for (i = 0; i < quarter; i++) {
+        objs[half + i].obj_id = half + i;
+        llist_insert_after(list, &objs[order[i]].link,
+                           &objs[half + i].link);
+    }
+    bench_report("insert after a random element", quarter,
+                 bench_now_ns() - start);
+
+    start = bench_now_ns();
+    for (i = quarter; i < half; i++) {
+        objs[half + i].obj_id = half + i;
+        llist_insert_before(list, &objs[order[i]].link,
+                            &objs[half + i].link);
+    }
+    bench_report("insert before a random element", half - quarter,
+                 bench_now_ns() - start);
+
+    for (i = 0; i < count; i++) {
+        order[i] = i;
+    }
+    bench_shuffle(order, count, 2);
+
+    start = bench_now_ns();
+    for (i = 0; i < count; i++) {
+        llist_remove(list, &objs[order[i]].link);
+    }
+    bench_report("remove in random order", count, bench_now_ns() - start);
+
+    if (!llist_empty(list)) {
+        printf("  %u elements left behind\n", llist_get_count(list));
+    }
+
+    llist_destroy(list);
+    free(objs);
+    free(order);
+}
+
+/*
+ * List of all the benchmarks
+ */
+static bench_t bench_list[] = {
+    { "list_ends",              bench_list_ends },
+    { "llist_ops",              bench_llist_ops },
+    { "list_find",              bench_list_find },
+    { "hash_ops",               bench_hash_ops },
+    { "queue",                  bench_queue },
+    { "bst_seq_insert",         bench_bst_sequential_insert },
+    { "bst_build",              bench_bst_build },
+    { "bst_random_ops",         bench_bst_random_ops },
+    { "bst_lookup",             bench_bst_lookup },
+    { "bst_key_types",          bench_bst_key_types },
+    { "btree_ops",              bench_btree_ops },
+    { "bst_concurrent",         bench_bst_concurrent },
+    { "trie_ops",               bench_trie_ops },
+    { "trie_layout",            bench_trie_layout },
+    { "trie_scan",              bench_trie_scan },
+    { "trie_prefix",            bench_trie_prefix },
+    { "trie_long_keys",         bench_trie_long_keys },
+    { "trie_mmap",              bench_trie_mmap },
+    { "trie_freeze",            bench_trie_freeze },
+    { "trie_concurrent",        bench_trie_concurrent },
+    { "trie_batch",             bench_trie_batch },
+};
+
+/* Main entry point */
+int
+main (int argc, char *argv[])
+{
+    uint32_t i, num_bench = sizeof(bench_list) / sizeof(bench_list[0]);
+    int arg;
+
+    /* Run everything if nothing was asked for */
+    if (argc < 2) {
+        for (i = 0; i < num_bench; i++) {
+            printf("[%s]\n", bench_list[i].name);
+            bench_list[i].run();
+        }
+        return 0;
+    }
+
+    for (arg = 1; arg < argc; arg++) {
+        for (i = 0; i < num_bench; i++) {
+            if (strcmp(argv[arg], bench_list[i].name) == 0) {
+                printf("[%s]\n", bench_list[i].name);
+                bench_list[i].run();
+                break;
+            }
+        }
+
+        if (i == num_bench) {
+            printf("Unknown benchmark: %s\n", argv[arg]);
+        }
+    }
+
+    return 0;
+}
+
+/* End of File */
@@ -6,9 +6,14 @@
 #include <stdlib.h>
 #include <stddef.h>
 #include <string.h>
+#include <pthread.h>
+#include <unistd.h>
 #include "list.h"
 #include "llist.h"
+#include "hash.h"
+#include "queue.h"
 #include "bst.h"
+#include "btree.h"
 #include "trie.h"
 
 /*
@@ -38,6 +43,26 @@ typedef struct object_ {
     bst_node_t      bst_node;
 } object_t;
 
+/*
+ * Example record for demonstrating usage of the 64-bit and compare
+ * function keyed binary search tree APIs. Each record sits in two
+ * trees at the same time.
+ */
+typedef struct file_ {
+    uint64_t        file_inode;
+    char            file_path[MAX_NAME_LEN];
+    bst_node_t      inode_node;
+    bst_node_t      path_node;
+} file_t;
+
+/*
+ * Example record for demonstrating usage of B+tree APIs
+ */
+typedef struct invoice_ {
+    uint32_t        inv_id;
+    uint32_t        inv_amount;
+} invoice_t;
+
 /*
  * Example record for demonstrating usage of trie APIs
  */
@@ -47,6 +72,23 @@ typedef struct professor_ {
     uint32_t        prof_experience;
 } professor_t;
 
+/*
+ * Example record for demonstrating usage of trie APIs with binary keys
+ */
+typedef struct host_ {
+    uint8_t         host_addr[4];   /* IPv4 address, may hold 0 bytes */
+    char            host_name[MAX_NAME_LEN];
+} host_t;
+
+/*
+ * Example record for demonstrating usage of hash table APIs
+ */
+typedef struct account_ {
+    char            acct_user[MAX_NAME_LEN];
+    uint32_t        acct_balance;
+    hash_elem_t     link;
+} account_t;
+
 /*
  * list_compare_fn
  *
@@ -212,7 +254,8 @@ doubly_linked_list_usage (void)
     /* Create the list */
     stu_list = llist_create("student Details", offsetof(student_t, link));
 
-    /* Create the records */
+    /* Create the records. The links start out zeroed, off any list. */
+    memset(stu_array, 0, sizeof(stu_array));
     for (i = 0; i < 20; i++) {
         stu_array[i].stu_id = i;
         stu_array[i].stu_age = i * 10;
@@ -307,6 +350,78 @@ doubly_linked_list_usage (void)
     }
 }
 
+/*
+ * list_hash_fn
+ *
+ * Hash function required for an indexed list. The key is an employee
+ * id.
+ */
+uint32_t
+list_hash_fn (void *key)
+{
+    return (*(uint32_t *)key);
+}
+
+/*
+ * list_get_key
+ *
+ * Return the key of the given employee. Called from the list library.
+ */
+void *
+list_get_key (void *emp_elem)
+{
+    employee_t *emp = (employee_t *)emp_elem;
+
+    return (&emp->emp_id);
+}
+
+/*
+ * linked_list_indexed_usage
+ *
+ * Example code to demonstrate a list which finds its records by key
+ * without walking the list
+ */
+void
+linked_list_indexed_usage (void)
+{
+    list_t *emp_list;
+    employee_t emp_array[1000];
+    employee_t *emp;
+    uint32_t id;
+    int i;
+
+    emp_list = list_create_indexed("Employee Index",
+                                   offsetof(employee_t, link),
+                                   list_hash_fn, list_get_key,
+                                   list_compare_fn);
+
+    for (i = 0; i < 1000; i++) {
+        emp_array[i].emp_id = i * 7;
+        emp_array[i].emp_age = 20 + i % 40;
+        list_insert(emp_list, &emp_array[i].link);
+    }
+
+    /* Found through the index, every insert and remove keeps it current */
+    id = 4998;
+    emp = list_find(emp_list, &id, NULL);
+    if (emp) {
+        printf("Employee record found: ID: %d, Age: %d\n",
+               emp->emp_id, emp->emp_age);
+    }
+
+    list_remove(emp_list, &emp_array[714].link);
+    emp = list_find(emp_list, &id, NULL);
+    if (!emp) {
+        printf("Employee record not found after removal\n");
+    }
+    printf("Employee Count: %d\n\n", list_get_count(emp_list));
+
+    for (i = 0; i < 1000; i++) {
+        list_remove(emp_list, &emp_array[i].link);
+    }
+    list_destroy(emp_list);
+}
+
 /*
  * bst_get_key
  *
@@ -324,6 +439,21 @@ bst_get_key (void *node)
     return obj->obj_id;
 }
 
+/*
+ * bst_print_fn
+ *
+ * Callback for bst_range_foreach(). Prints the record.
+ */
+int
+bst_print_fn (void *node, void *ctx)
+{
+    object_t *obj = (object_t *)node;
+
+    printf("ID: %d, Size: %d\n", obj->obj_id, obj->obj_size);
+
+    return 0;
+}
+
 /*
  * bst_usage
  *
@@ -423,146 +553,1318 @@ bst_usage (void)
     } else {
         printf("Object record not found\n");
     }
+
+    /* Test the bst_lower_bound() and bst_upper_bound() APIs */
+    obj = bst_lower_bound(obj_tree, 45);
+    if (obj) {
+        printf("Lower bound of 45: ID: %d, Size: %d\n",
+               obj->obj_id, obj->obj_size);
+    }
+
+    obj = bst_upper_bound(obj_tree, 45);
+    if (obj) {
+        printf("Upper bound of 45: ID: %d, Size: %d\n\n",
+               obj->obj_id, obj->obj_size);
+    }
+
+    /* Print all the records with ids in [20, 60) */
+    bst_range_foreach(obj_tree, 20, 60, bst_print_fn, NULL);
+    printf("\n");
+
+    /* Remove the remaining nodes and destroy the tree */
+    while ((obj = (object_t *)bst_get_least(obj_tree)) != NULL) {
+        bst_remove(obj_tree, &obj->bst_node);
+    }
+    bst_destroy(obj_tree);
 }
 
 /*
- * trie_get_key
+ * bst_balanced_usage
  *
- * Return the key for the given node. Called from the Trie library.
+ * Example code to demonstrate the usage of the self-balancing and
+ * order statistic BST APIs
  */
-char *
-trie_get_key (void *node)
+void
+bst_balanced_usage (void)
 {
-    professor_t *prof = (professor_t *)node;
+    bst_t *obj_tree;
+    object_t obj_array[20];
+    object_t *obj;
+    int i;
 
-    if (!prof) {
-        return 0;
+    /* Create the balanced BST with rank/select support */
+    obj_tree = bst_create_flags("Balanced Object Details",
+                                offsetof(object_t, bst_node), bst_get_key,
+                                BST_FLAG_BALANCED | BST_FLAG_ORDER_STAT);
+
+    /* 
+     * Insert records with monotonically increasing ids. An unbalanced
+     * tree would degenerate into a linked list here.
+     */
+    for (i = 0; i < 20; i++) {
+        obj_array[i].obj_id = i;
+        obj_array[i].obj_size = i * 100;
+        bst_insert(obj_tree, &obj_array[i].bst_node);
     }
 
-    return prof->prof_name;
+    /* The tree stays shallow */
+    obj = (object_t *)bst_get_root(obj_tree);
+    printf("Root: ID: %d, Tree Height: %d\n", obj->obj_id, obj->bst_node.height);
+    printf("Object Count: %d\n\n", bst_get_count(obj_tree));
+
+    /* Remove few elements and print the records again */
+    for (i = 0; i < 20; i += 3) {
+        bst_remove(obj_tree, &obj_array[i].bst_node);
+    }
+
+    obj = (object_t *)bst_get_least(obj_tree);
+    while (obj != NULL) {
+        printf("ID: %d, Size: %d\n", obj->obj_id, obj->obj_size);
+        obj = bst_get_next(obj_tree, obj);
+    }
+    printf("\n");
+
+    obj = (object_t *)bst_get_root(obj_tree);
+    printf("Root: ID: %d, Tree Height: %d\n", obj->obj_id, obj->bst_node.height);
+    printf("Object Count: %d\n\n", bst_get_count(obj_tree));
+
+    /* Test the bst_select() and bst_rank() APIs */
+    obj = (object_t *)bst_select(obj_tree, bst_get_count(obj_tree) / 2);
+    printf("Median: ID: %d, Size: %d\n", obj->obj_id, obj->obj_size);
+    printf("Objects with ID less than 10: %d\n\n", bst_rank(obj_tree, 10));
+
+    /* Remove the remaining nodes and destroy the tree */
+    while ((obj = (object_t *)bst_get_least(obj_tree)) != NULL) {
+        bst_remove(obj_tree, &obj->bst_node);
+    }
+    bst_destroy(obj_tree);
 }
 
 /*
- * trie_usage
+ * bst_reader_thread
  *
- * Example code to demonstrate the usage of Trie APIs
+ * Reader side of bst_concurrent_usage(). Looks up the even ids, which
+ * stay in the tree the whole time, while the odd ids come and go.
+ */
+void *
+bst_reader_thread (void *arg)
+{
+    bst_t *obj_tree = (bst_t *)arg;
+    object_t *obj;
+    long found = 0;
+    uint32_t i;
+    int pass;
+
+    for (pass = 0; pass < 100; pass++) {
+        for (i = 0; i < 20; i += 2) {
+            bst_read_lock(obj_tree);
+            obj = (object_t *)bst_lookup(obj_tree, i);
+            if (obj && obj->obj_id == i) {
+                found++;
+            }
+            bst_read_unlock(obj_tree);
+        }
+    }
+
+    return ((void *)found);
+}
+
+/*
+ * bst_concurrent_usage
+ *
+ * Example code to demonstrate the usage of a BST which is read by one
+ * thread without locks while another thread updates it
  */
 void
-trie_usage (void)
+bst_concurrent_usage (void)
 {
-    trie_t *prof_list;
-    professor_t prof_array[10];
-    professor_t *prof;
-    char *invalid_key = "xxxxxyyyyyzzzzz";
-    int i;
+    bst_t *obj_tree;
+    object_t obj_array[20];
+    object_t *obj;
+    pthread_t reader;
+    void *found;
+    int i, pass;
 
-    /* Create the Trie */
-    prof_list = trie_create("professor Details", trie_get_key);
+    /* Create the concurrent BST */
+    obj_tree = bst_create_flags("Concurrent Object Details",
+                                offsetof(object_t, bst_node), bst_get_key,
+                                BST_FLAG_BALANCED | BST_FLAG_CONCURRENT);
 
-    /* Create the nodes */
-    strcpy(prof_array[0].prof_name, "ann");
-    prof_array[0].prof_dept_id = 0;
-    prof_array[0].prof_experience = 0;
-    strcpy(prof_array[1].prof_name, "dileep");
-    prof_array[1].prof_dept_id = 1;
-    prof_array[1].prof_experience = 10;
-    strcpy(prof_array[2].prof_name, "dilbert");
-    prof_array[2].prof_dept_id = 2;
-    prof_array[2].prof_experience = 20;
-    strcpy(prof_array[3].prof_name, "annabel");
-    prof_array[3].prof_dept_id = 3;
-    prof_array[3].prof_experience = 30;
-    strcpy(prof_array[4].prof_name, "andrew");
-    prof_array[4].prof_dept_id = 4;
-    prof_array[4].prof_experience = 40;
-    strcpy(prof_array[5].prof_name, "deepak");
-    prof_array[5].prof_dept_id = 5;
-    prof_array[5].prof_experience = 50;
-    strcpy(prof_array[6].prof_name, "andy");
-    prof_array[6].prof_dept_id = 6;
-    prof_array[6].prof_experience = 60;
-    strcpy(prof_array[7].prof_name, "bill");
-    prof_array[7].prof_dept_id = 7;
-    prof_array[7].prof_experience = 70;
-    strcpy(prof_array[8].prof_name, "billy");
-    prof_array[8].prof_dept_id = 8;
-    prof_array[8].prof_experience = 80;
-    strcpy(prof_array[9].prof_name, "bichel");
-    prof_array[9].prof_dept_id = 9;
-    prof_array[9].prof_experience = 90;
+    for (i = 0; i < 20; i++) {
+        obj_array[i].obj_id = i;
+        obj_array[i].obj_size = i * 100;
+        bst_insert(obj_tree, &obj_array[i].bst_node);
+    }
 
-    /* Insert the records into the list */
-    for (i = 0; i < 10; i++) {
-        trie_insert(prof_list, prof_array[i].prof_name, &prof_array[i]);
+    /* Churn the odd ids while the reader is looking up the even ones */
+    pthread_create(&reader, NULL, bst_reader_thread, obj_tree);
+    for (pass = 0; pass < 100; pass++) {
+        for (i = 1; i < 20; i += 2) {
+            bst_remove(obj_tree, &obj_array[i].bst_node);
+        }
+
+        /* No reader can see the removed records past this point */
+        bst_synchronize(obj_tree);
+
+        for (i = 1; i < 20; i += 2) {
+            bst_insert(obj_tree, &obj_array[i].bst_node);
+        }
     }
+    pthread_join(reader, &found);
 
-    /* Print the records */
-    prof = (professor_t *)trie_get_least(prof_list);
-    while (prof != NULL) {
-        printf("Name: %s Dept: %d Experience: %d\n", 
-               prof->prof_name, prof->prof_dept_id, prof->prof_experience);
-        prof = trie_get_next(prof_list, prof);
+    printf("Reader found %ld of %d lookups\n", (long)found, 100 * 10);
+
+    obj = (object_t *)bst_get_least(obj_tree);
+    while (obj != NULL) {
+        printf("ID: %d, Size: %d\n", obj->obj_id, obj->obj_size);
+        obj = bst_get_next(obj_tree, obj);
     }
     printf("\n");
 
-    /* Get the current node count and print it */
-    printf("Professor Count: %d\n\n", trie_get_count(prof_list));
+    for (i = 0; i < 20; i++) {
+        bst_remove(obj_tree, &obj_array[i].bst_node);
+    }
+    bst_destroy(obj_tree);
+}
 
-    /* Remove few elements and check the count again */
-    trie_remove(prof_list, prof_array[1].prof_name);
-    trie_remove(prof_list, prof_array[3].prof_name);
-    trie_remove(prof_list, prof_array[5].prof_name);
-    trie_remove(prof_list, prof_array[7].prof_name);
+/*
+ * bst_get_inode
+ *
+ * Return the 64-bit key for the given file. Called from the BST library.
+ */
+uint64_t
+bst_get_inode (void *node)
+{
+    return ((file_t *)node)->file_inode;
+}
 
-    printf("Professor Count after deleting 4 elements: %d\n\n", trie_get_count(prof_list));
+/*
+ * bst_get_path
+ *
+ * Return the string key for the given file. Called from the BST library.
+ */
+void *
+bst_get_path (void *node)
+{
+    return ((file_t *)node)->file_path;
+}
 
-    /* Print the records again */
-    prof = (professor_t *)trie_get_least(prof_list);
-    if (!prof) {
-        printf("Trie is empty!\n");
+/*
+ * bst_path_cmp_fn
+ *
+ * Compare function for the string keyed BST
+ */
+int32_t
+bst_path_cmp_fn (void *key1, void *key2)
+{
+    return (strcmp((char *)key1, (char *)key2));
+}
+
+/*
+ * bst_generic_key_usage
+ *
+ * Example code to demonstrate the usage of BSTs keyed by 64-bit integers
+ * and by strings
+ */
+void
+bst_generic_key_usage (void)
+{
+    bst_t *inode_tree, *path_tree;
+    file_t file_array[5];
+    file_t *file;
+    char *paths[] = { "/etc/passwd", "/bin/sh", "/usr/lib/libc.so",
+                      "/home/dileep", "/tmp/scratch" };
+    int i;
+
+    /* Create the trees */
+    inode_tree = bst_create_u64("Files by inode", offsetof(file_t, inode_node),
+                                bst_get_inode, BST_FLAG_BALANCED);
+    path_tree = bst_create_cmp("Files by path", offsetof(file_t, path_node),
+                               bst_get_path, bst_path_cmp_fn,
+                               BST_FLAG_BALANCED);
+
+    /* Create the records and insert them into both trees */
+    for (i = 0; i < 5; i++) {
+        file_array[i].file_inode = 0x100000000ULL * (5 - i) + i;
+        strcpy(file_array[i].file_path, paths[i]);
+        bst_insert(inode_tree, &file_array[i].inode_node);
+        bst_insert(path_tree, &file_array[i].path_node);
     }
 
-    while (prof != NULL) {
-        printf("Name: %s Dept: %d Experience: %d\n", 
-               prof->prof_name, prof->prof_dept_id, prof->prof_experience);
-        prof = trie_get_next(prof_list, prof);
+    /* Print the records in inode order and in path order */
+    file = (file_t *)bst_get_least(inode_tree);
+    while (file != NULL) {
+        printf("Inode: %llu, Path: %s\n",
+               (unsigned long long)file->file_inode, file->file_path);
+        file = bst_get_next(inode_tree, file);
     }
     printf("\n");
 
-    /* Test the trie_lookup() API */
-    prof = trie_lookup(prof_list, prof_array[6].prof_name);
-    if (prof) {
-        printf("Professor record found: Name: %s Dept: %d, Experience: %d\n",
-               prof->prof_name, prof->prof_dept_id, prof->prof_experience);
+    file = (file_t *)bst_get_least(path_tree);
+    while (file != NULL) {
+        printf("Path: %s, Inode: %llu\n",
+               file->file_path, (unsigned long long)file->file_inode);
+        file = bst_get_next(path_tree, file);
+    }
+    printf("\n");
+
+    /* Test the bst_lookup_u64() and bst_lookup_cmp() APIs */
+    file = bst_lookup_u64(inode_tree, 0x100000000ULL * 3 + 2);
+    if (file) {
+        printf("File record found: Inode: %llu, Path: %s\n",
+               (unsigned long long)file->file_inode, file->file_path);
     } else {
-        printf("Professor record not found\n");
+        printf("File record not found\n");
     }
 
-    /* Non existing record */
-    prof = trie_lookup(prof_list, invalid_key);
-    if (prof) {
-        printf("Professor record found: Name: %s Dept: %d, Experience: %d\n",
-               prof->prof_name, prof->prof_dept_id, prof->prof_experience);
+    file = bst_lookup_cmp(path_tree, "/bin/sh");
+    if (file) {
+        printf("File record found: Inode: %llu, Path: %s\n",
+               (unsigned long long)file->file_inode, file->file_path);
     } else {
-        printf("Professor record not found\n");
+        printf("File record not found\n");
+    }
+    printf("\n");
+
+    /* Take the records out of both trees and destroy them */
+    for (i = 0; i < 5; i++) {
+        bst_remove(inode_tree, &file_array[i].inode_node);
+        bst_remove(path_tree, &file_array[i].path_node);
     }
+    bst_destroy(inode_tree);
+    bst_destroy(path_tree);
 }
 
-/* Main entry point */
-int 
-main (int argc, char *argv[])
+/*
+ * btree_get_key
+ *
+ * Return the key for the given record. Called from the B+tree library.
+ */
+int
+btree_get_key (void *data)
 {
-    /* Linked list APIs */
-    linked_list_usage();
+    invoice_t *inv = (invoice_t *)data;
 
-    /* Doubly linked list APIs */
-    doubly_linked_list_usage();
+    if (!inv) {
+        return 0;
+    }
 
-    /* Binary search tree APIs */
-    bst_usage();
-    
-    /* Trie APIs */
-    trie_usage();
+    return inv->inv_id;
+}
+
+/*
+ * btree_print_fn
+ *
+ * Callback for btree_range_foreach(). Prints the record.
+ */
+int
+btree_print_fn (void *data, void *ctx)
+{
+    invoice_t *inv = (invoice_t *)data;
+
+    printf("ID: %d, Amount: %d\n", inv->inv_id, inv->inv_amount);
+
+    return 0;
+}
+
+/*
+ * btree_usage
+ *
+ * Example code to demonstrate the usage of B+tree APIs
+ */
+void
+btree_usage (void)
+{
+    btree_t *inv_tree;
+    invoice_t inv_array[100];
+    invoice_t *inv;
+    int i;
+
+    /* Create the B+tree */
+    inv_tree = btree_create("Invoice Details", btree_get_key);
+
+    /* Create the records and insert them into the tree */
+    for (i = 0; i < 100; i++) {
+        inv_array[i].inv_id = (i * 37) % 100;
+        inv_array[i].inv_amount = inv_array[i].inv_id * 10;
+        btree_insert(inv_tree, inv_array[i].inv_id, &inv_array[i]);
+    }
+
+    /* Get the current record count and print it */
+    printf("Invoice Count: %d\n\n", btree_get_count(inv_tree));
+
+    /* Print the first few records */
+    inv = (invoice_t *)btree_get_least(inv_tree);
+    for (i = 0; i < 5 && inv != NULL; i++) {
+        printf("ID: %d, Amount: %d\n", inv->inv_id, inv->inv_amount);
+        inv = btree_get_next(inv_tree, inv);
+    }
+    printf("\n");
+
+    /* Remove few records and check the count again */
+    for (i = 40; i < 50; i += 2) {
+        btree_remove(inv_tree, i);
+    }
+
+    printf("Invoice Count after deleting 5 records: %d\n\n",
+           btree_get_count(inv_tree));
+
+    /* Print all the records with ids in [40, 50) */
+    btree_range_foreach(inv_tree, 40, 50, btree_print_fn, NULL);
+    printf("\n");
+
+    /* Test the btree_lookup() API */
+    inv = btree_lookup(inv_tree, 45);
+    if (inv) {
+        printf("Invoice record found: ID: %d, Amount: %d\n",
+               inv->inv_id, inv->inv_amount);
+    } else {
+        printf("Invoice record not found\n");
+    }
+
+    /* Removed record */
+    inv = btree_lookup(inv_tree, 44);
+    if (inv) {
+        printf("Invoice record found: ID: %d, Amount: %d\n",
+               inv->inv_id, inv->inv_amount);
+    } else {
+        printf("Invoice record not found\n");
+    }
+    printf("\n");
+
+    /* Remove the remaining records and destroy the tree */
+    for (i = 0; i < 100; i++) {
+        btree_remove(inv_tree, i);
+    }
+    btree_destroy(inv_tree);
+}
+
+/*
+ * trie_get_key
+ *
+ * Return the key for the given node. Called from the Trie library.
+ */
+char *
+trie_get_key (void *node)
+{
+    professor_t *prof = (professor_t *)node;
+
+    if (!prof) {
+        return 0;
+    }
+
+    return prof->prof_name;
+}
+
+/*
+ * trie_get_host_key
+ *
+ * Return the address of the given host. Called from the Trie library.
+ */
+char *
+trie_get_host_key (void *node)
+{
+    host_t *host = (host_t *)node;
+
+    if (!host) {
+        return 0;
+    }
+
+    return (char *)host->host_addr;
+}
+
+/*
+ * trie_get_score
+ *
+ * Return the score used to rank the given record in prefix searches.
+ * Called from the Trie library.
+ */
+uint32_t
+trie_get_score (void *node)
+{
+    professor_t *prof = (professor_t *)node;
+
+    return prof->prof_experience;
+}
+
+/*
+ * trie_print_professor
+ *
+ * Print the given record. Called from the Trie library for every
+ * record matching a prefix.
+ */
+int
+trie_print_professor (void *node, void *ctx)
+{
+    professor_t *prof = (professor_t *)node;
+
+    printf(" %s", prof->prof_name);
+
+    return 0;
+}
+
+/*
+ * trie_print_host
+ *
+ * Print the given host. Called from the Trie library for every record
+ * matching a prefix.
+ */
+int
+trie_print_host (void *node, void *ctx)
+{
+    host_t *host = (host_t *)node;
+
+    printf(" %s", host->host_name);
+
+    return 0;
+}
+
+/*
+ * trie_usage
+ *
+ * Example code to demonstrate the usage of Trie APIs
+ */
+void
+trie_usage (void)
+{
+    trie_t *prof_list;
+    professor_t prof_array[10];
+    professor_t *prof;
+    char *invalid_key = "xxxxxyyyyyzzzzz";
+    int i;
+
+    /* Create the Trie */
+    prof_list = trie_create("professor Details", trie_get_key);
+
+    /* Create the nodes */
+    strcpy(prof_array[0].prof_name, "ann");
+    prof_array[0].prof_dept_id = 0;
+    prof_array[0].prof_experience = 0;
+    strcpy(prof_array[1].prof_name, "dileep");
+    prof_array[1].prof_dept_id = 1;
+    prof_array[1].prof_experience = 10;
+    strcpy(prof_array[2].prof_name, "dilbert");
+    prof_array[2].prof_dept_id = 2;
+    prof_array[2].prof_experience = 20;
+    strcpy(prof_array[3].prof_name, "annabel");
+    prof_array[3].prof_dept_id = 3;
+    prof_array[3].prof_experience = 30;
+    strcpy(prof_array[4].prof_name, "andrew");
+    prof_array[4].prof_dept_id = 4;
+    prof_array[4].prof_experience = 40;
+    strcpy(prof_array[5].prof_name, "deepak");
+    prof_array[5].prof_dept_id = 5;
+    prof_array[5].prof_experience = 50;
+    strcpy(prof_array[6].prof_name, "andy");
+    prof_array[6].prof_dept_id = 6;
+    prof_array[6].prof_experience = 60;
+    strcpy(prof_array[7].prof_name, "bill");
+    prof_array[7].prof_dept_id = 7;
+    prof_array[7].prof_experience = 70;
+    strcpy(prof_array[8].prof_name, "billy");
+    prof_array[8].prof_dept_id = 8;
+    prof_array[8].prof_experience = 80;
+    strcpy(prof_array[9].prof_name, "bichel");
+    prof_array[9].prof_dept_id = 9;
+    prof_array[9].prof_experience = 90;
+
+    /* Insert the records into the list */
+    for (i = 0; i < 10; i++) {
+        trie_insert(prof_list, prof_array[i].prof_name, &prof_array[i]);
+    }
+
+    /* Print the records. They come out sorted by name. */
+    prof = (professor_t *)trie_get_least(prof_list);
+    while (prof != NULL) {
+        printf("Name: %s Dept: %d Experience: %d\n", 
+               prof->prof_name, prof->prof_dept_id, prof->prof_experience);
+        prof = trie_get_next(prof_list, prof);
+    }
+    printf("\n");
+
+    /* Get the current node count and print it */
+    printf("Professor Count: %d\n\n", trie_get_count(prof_list));
+
+    /* Remove few elements and check the count again */
+    trie_remove(prof_list, prof_array[1].prof_name);
+    trie_remove(prof_list, prof_array[3].prof_name);
+    trie_remove(prof_list, prof_array[5].prof_name);
+    trie_remove(prof_list, prof_array[7].prof_name);
+
+    printf("Professor Count after deleting 4 elements: %d\n\n", trie_get_count(prof_list));
+
+    /* Print the records again */
+    prof = (professor_t *)trie_get_least(prof_list);
+    if (!prof) {
+        printf("Trie is empty!\n");
+    }
+
+    while (prof != NULL) {
+        printf("Name: %s Dept: %d Experience: %d\n", 
+               prof->prof_name, prof->prof_dept_id, prof->prof_experience);
+        prof = trie_get_next(prof_list, prof);
+    }
+    printf("\n");
+
+    /* Test the trie_lookup() API */
+    prof = trie_lookup(prof_list, prof_array[6].prof_name);
+    if (prof) {
+        printf("Professor record found: Name: %s Dept: %d, Experience: %d\n",
+               prof->prof_name, prof->prof_dept_id, prof->prof_experience);
+    } else {
+        printf("Professor record not found\n");
+    }
+
+    /* Non existing record */
+    prof = trie_lookup(prof_list, invalid_key);
+    if (prof) {
+        printf("Professor record found: Name: %s Dept: %d, Experience: %d\n",
+               prof->prof_name, prof->prof_dept_id, prof->prof_experience);
+    } else {
+        printf("Professor record not found\n");
+    }
+
+    /* Drop the remaining records in one go */
+    trie_clear(prof_list);
+    printf("Professor Count after clearing the trie: %d\n\n", trie_get_count(prof_list));
+    trie_destroy(prof_list);
+}
+
+/*
+ * trie_radix_usage
+ *
+ * Example code to demonstrate the usage of a path compressed (radix) trie
+ */
+void
+trie_radix_usage (void)
+{
+    trie_t *prof_list;
+    professor_t prof_array[6];
+    professor_t *prof;
+    char *names[] = { "ann", "andrew", "annabel", "dilbert", "dileep",
+                      "andy" };
+    int i;
+
+    /* Create the Trie */
+    prof_list = trie_create_flags("Radix professor Details", trie_get_key,
+                                  TRIE_FLAG_RADIX);
+
+    for (i = 0; i < 6; i++) {
+        strcpy(prof_array[i].prof_name, names[i]);
+        prof_array[i].prof_dept_id = i;
+        prof_array[i].prof_experience = i * 10;
+        trie_insert(prof_list, prof_array[i].prof_name, &prof_array[i]);
+    }
+
+    /* The records come out sorted by name */
+    prof = (professor_t *)trie_get_least(prof_list);
+    while (prof != NULL) {
+        printf("Name: %s Dept: %d Experience: %d\n", 
+               prof->prof_name, prof->prof_dept_id, prof->prof_experience);
+        prof = trie_get_next(prof_list, prof);
+    }
+    printf("\n");
+
+    /* Only the branching points and the key ends take up a node */
+    printf("Professor Count: %d, Trie Nodes: %d\n\n",
+           trie_get_count(prof_list), prof_list->node_count);
+
+    trie_remove(prof_list, "ann");
+    prof = trie_lookup(prof_list, "annabel");
+    if (prof) {
+        printf("Professor record found: Name: %s Dept: %d, Experience: %d\n",
+               prof->prof_name, prof->prof_dept_id, prof->prof_experience);
+    } else {
+        printf("Professor record not found\n");
+    }
+    printf("Professor Count: %d, Trie Nodes: %d\n\n",
+           trie_get_count(prof_list), prof_list->node_count);
+
+    trie_clear(prof_list);
+    trie_destroy(prof_list);
+}
+
+/*
+ * trie_iter_usage
+ *
+ * Example code to demonstrate walking a trie with a cursor
+ */
+void
+trie_iter_usage (void)
+{
+    trie_t *prof_list;
+    trie_iter_t iter;
+    professor_t prof_array[6];
+    professor_t *prof;
+    char *names[] = { "dileep", "ann", "bill", "annabel", "dilbert",
+                      "andy" };
+    int i;
+
+    prof_list = trie_create_flags("Professor Cursor", trie_get_key,
+                                  TRIE_FLAG_RADIX);
+
+    for (i = 0; i < 6; i++) {
+        strcpy(prof_array[i].prof_name, names[i]);
+        prof_array[i].prof_dept_id = i;
+        prof_array[i].prof_experience = i * 10;
+        trie_insert(prof_list, prof_array[i].prof_name, &prof_array[i]);
+    }
+
+    /* The cursor remembers where it is, so no key is looked up twice */
+    for (prof = trie_iter_first(prof_list, &iter); prof != NULL;
+         prof = trie_iter_next(&iter)) {
+        printf("Name: %s Dept: %d Experience: %d\n", 
+               prof->prof_name, prof->prof_dept_id, prof->prof_experience);
+    }
+    printf("\n");
+
+    /* Start from the first name at or after "anna" */
+    printf("Names from \"anna\" on:");
+    for (prof = trie_iter_seek(prof_list, &iter, "anna"); prof != NULL;
+         prof = trie_iter_next(&iter)) {
+        printf(" %s", prof->prof_name);
+    }
+    printf("\n\n");
+
+    trie_clear(prof_list);
+    trie_destroy(prof_list);
+}
+
+/*
+ * trie_prefix_usage
+ *
+ * Example code to demonstrate prefix searches on a trie
+ */
+void
+trie_prefix_usage (void)
+{
+    trie_t *prof_list;
+    professor_t prof_array[8];
+    void *best[3];
+    char *names[] = { "dileep", "ann", "andrew", "annabel", "andy",
+                      "dilbert", "anton", "bill" };
+    uint32_t experience[] = { 10, 35, 5, 20, 40, 25, 15, 30 };
+    int i, found;
+
+    prof_list = trie_create_flags("Professor Search", trie_get_key,
+                                  TRIE_FLAG_RADIX);
+
+    /* Cache the best experience below every node */
+    trie_set_score_fn(prof_list, trie_get_score);
+
+    for (i = 0; i < 8; i++) {
+        strcpy(prof_array[i].prof_name, names[i]);
+        prof_array[i].prof_dept_id = i;
+        prof_array[i].prof_experience = experience[i];
+        trie_insert(prof_list, prof_array[i].prof_name, &prof_array[i]);
+    }
+
+    printf("Names starting with \"an\":");
+    trie_prefix_foreach(prof_list, "an", trie_print_professor, NULL);
+    printf("\n");
+
+    /* The most experienced ones first */
+    found = trie_prefix_topk(prof_list, "an", 3, trie_get_score, best);
+    printf("Most experienced starting with \"an\":");
+    for (i = 0; i < found; i++) {
+        printf(" %s (%d)", ((professor_t *)best[i])->prof_name,
+               ((professor_t *)best[i])->prof_experience);
+    }
+    printf("\n\n");
+
+    trie_clear(prof_list);
+    trie_destroy(prof_list);
+}
+
+/*
+ * trie_binary_key_usage
+ *
+ * Example code to demonstrate a trie keyed on raw bytes
+ */
+void
+trie_binary_key_usage (void)
+{
+    trie_t *host_list;
+    trie_iter_t iter;
+    host_t host_array[4];
+    host_t *host;
+    uint8_t addrs[4][4] = { { 10, 0, 0, 1 }, { 10, 0, 0, 2 },
+                            { 10, 0, 1, 0 }, { 0, 0, 0, 0 } };
+    char *names[] = { "gateway", "printer", "backup", "any" };
+    uint8_t missing[4] = { 10, 0, 0, 3 };
+    int i;
+
+    host_list = trie_create("Host", trie_get_host_key);
+
+    /* The addresses hold 0 bytes, so pass the key length along */
+    for (i = 0; i < 4; i++) {
+        memcpy(host_array[i].host_addr, addrs[i], 4);
+        strcpy(host_array[i].host_name, names[i]);
+        trie_insert_len(host_list, (char *)host_array[i].host_addr, 4,
+                        &host_array[i]);
+    }
+
+    for (host = trie_iter_first(host_list, &iter); host != NULL;
+         host = trie_iter_next(&iter)) {
+        printf("Address: %d.%d.%d.%d Host: %s\n", host->host_addr[0],
+               host->host_addr[1], host->host_addr[2], host->host_addr[3],
+               host->host_name);
+    }
+    printf("\n");
+
+    host = trie_lookup_len(host_list, (char *)addrs[1], 4);
+    if (host) {
+        printf("Host record found: %s\n", host->host_name);
+    }
+    host = trie_lookup_len(host_list, (char *)missing, 4);
+    if (!host) {
+        printf("Host record not found\n");
+    }
+
+    /* Prefixes and seek targets may hold 0 bytes too */
+    printf("Hosts in 10.0.0.0/24:");
+    trie_prefix_foreach_len(host_list, (char *)addrs[0], 3, trie_print_host,
+                            NULL);
+    printf("\n");
+
+    printf("Hosts from 10.0.0.2 on:");
+    for (host = trie_iter_seek_len(host_list, &iter, (char *)addrs[1], 4);
+         host != NULL; host = trie_iter_next(&iter)) {
+        printf(" %s", host->host_name);
+    }
+    printf("\n");
+
+    trie_remove_len(host_list, (char *)addrs[3], 4);
+    printf("Host Count after deleting 1 element: %d\n\n",
+           trie_get_count(host_list));
+
+    trie_clear(host_list);
+    trie_destroy(host_list);
+
+    /* A cursor walks binary keys of a concurrent trie just the same */
+    host_list = trie_create_flags("Host Concurrent", trie_get_host_key,
+                                  TRIE_FLAG_CONCURRENT);
+    for (i = 0; i < 4; i++) {
+        trie_insert_len(host_list, (char *)host_array[i].host_addr, 4,
+                        &host_array[i]);
+    }
+
+    printf("Concurrent hosts:");
+    for (host = trie_iter_first(host_list, &iter); host != NULL;
+         host = trie_iter_next(&iter)) {
+        printf(" %s", host->host_name);
+    }
+    printf("\n\n");
+
+    trie_clear(host_list);
+    trie_destroy(host_list);
+}
+
+/*
+ * trie_mmap_usage
+ *
+ * Example code to demonstrate saving a trie to a file and serving
+ * lookups straight from the mapped file
+ */
+void
+trie_mmap_usage (void)
+{
+    trie_t *prof_list, *mapped;
+    professor_t prof_array[6];
+    professor_t *prof;
+    char *names[] = { "dileep", "ann", "bill", "annabel", "dilbert",
+                      "andy" };
+    char *path = "/tmp/ds_usage_professors.trie";
+    int i;
+
+    prof_list = trie_create_flags("Professor", trie_get_key, TRIE_FLAG_RADIX);
+
+    for (i = 0; i < 6; i++) {
+        strcpy(prof_array[i].prof_name, names[i]);
+        prof_array[i].prof_dept_id = i;
+        prof_array[i].prof_experience = i * 10;
+        trie_insert(prof_list, prof_array[i].prof_name, &prof_array[i]);
+    }
+
+    /* The records hold no pointers, so they can be copied as they are */
+    if (trie_serialize(prof_list, path, sizeof(professor_t)) != EOK) {
+        printf("Unable to save the trie\n\n");
+        trie_clear(prof_list);
+        trie_destroy(prof_list);
+        return;
+    }
+    trie_clear(prof_list);
+    trie_destroy(prof_list);
+
+    /* Nothing is rebuilt. The records are served from the file. */
+    mapped = trie_open_mmap("Professor Mapped", path, trie_get_key);
+    if (!mapped) {
+        printf("Unable to map the trie\n\n");
+        unlink(path);
+        return;
+    }
+
+    printf("Professor Count in the mapped trie: %d\n",
+           trie_get_count(mapped));
+    prof = trie_lookup(mapped, "dilbert");
+    if (prof) {
+        printf("Professor record found: Name: %s Dept: %d, Experience: %d\n",
+               prof->prof_name, prof->prof_dept_id, prof->prof_experience);
+    }
+
+    printf("Names starting with \"an\":");
+    trie_prefix_foreach(mapped, "an", trie_print_professor, NULL);
+    printf("\n");
+
+    if (trie_insert(mapped, "bob", &prof_array[0]) != EOK) {
+        printf("The mapped trie is read only\n");
+    }
+    printf("\n");
+
+    trie_destroy(mapped);
+    unlink(path);
+}
+
+/*
+ * trie_freeze_usage
+ *
+ * Example code to demonstrate compiling a trie into a double array
+ */
+void
+trie_freeze_usage (void)
+{
+    trie_t *prof_list;
+    trie_iter_t iter;
+    professor_t prof_array[6];
+    professor_t *prof;
+    char *names[] = { "dileep", "ann", "bill", "annabel", "dilbert",
+                      "andy" };
+    int i;
+
+    prof_list = trie_create("Professor Frozen", trie_get_key);
+
+    for (i = 0; i < 6; i++) {
+        strcpy(prof_array[i].prof_name, names[i]);
+        prof_array[i].prof_dept_id = i;
+        prof_array[i].prof_experience = i * 10;
+        trie_insert(prof_list, prof_array[i].prof_name, &prof_array[i]);
+    }
+
+    /* No more changes from here on, so make lookups as fast as can be */
+    trie_freeze(prof_list);
+    printf("Professor Count: %d, Double Array States: %d\n",
+           trie_get_count(prof_list), prof_list->node_count);
+
+    prof = trie_lookup(prof_list, "annabel");
+    if (prof) {
+        printf("Professor record found: Name: %s Dept: %d, Experience: %d\n",
+               prof->prof_name, prof->prof_dept_id, prof->prof_experience);
+    }
+    prof = trie_lookup(prof_list, "anna");
+    if (!prof) {
+        printf("Professor record not found\n");
+    }
+
+    printf("Names from \"b\" on:");
+    for (prof = trie_iter_seek(prof_list, &iter, "b"); prof != NULL;
+         prof = trie_iter_next(&iter)) {
+        printf(" %s", prof->prof_name);
+    }
+    printf("\n");
+
+    if (trie_remove(prof_list, "bill") != EOK) {
+        printf("The frozen trie is read only\n");
+    }
+    printf("\n");
+
+    trie_clear(prof_list);
+    trie_destroy(prof_list);
+}
+
+/*
+ * trie_reader_thread
+ *
+ * Reader side of trie_concurrent_usage(). Looks up the names at even
+ * positions, which stay in the trie the whole time, while the others
+ * come and go.
+ */
+void *
+trie_reader_thread (void *arg)
+{
+    trie_t *prof_list = (trie_t *)arg;
+    professor_t *prof;
+    char *names[] = { "dileep", "ann", "bill", "annabel", "dilbert",
+                      "andy", "andrew", "bichel" };
+    long found = 0;
+    int i, pass;
+
+    for (pass = 0; pass < 100; pass++) {
+        for (i = 0; i < 8; i += 2) {
+            trie_read_lock(prof_list);
+            prof = (professor_t *)trie_lookup(prof_list, names[i]);
+            if (prof && !strcmp(prof->prof_name, names[i])) {
+                found++;
+            }
+            trie_read_unlock(prof_list);
+        }
+    }
+
+    return ((void *)found);
+}
+
+/*
+ * trie_concurrent_usage
+ *
+ * Example code to demonstrate the usage of a trie which is read by one
+ * thread without locks while another thread updates it
+ */
+void
+trie_concurrent_usage (void)
+{
+    trie_t *prof_list;
+    professor_t prof_array[8];
+    professor_t *prof;
+    char *names[] = { "dileep", "ann", "bill", "annabel", "dilbert",
+                      "andy", "andrew", "bichel" };
+    pthread_t reader;
+    void *found;
+    int i, pass;
+
+    prof_list = trie_create_flags("Professor Concurrent", trie_get_key,
+                                  TRIE_FLAG_CONCURRENT);
+
+    for (i = 0; i < 8; i++) {
+        strcpy(prof_array[i].prof_name, names[i]);
+        prof_array[i].prof_dept_id = i;
+        prof_array[i].prof_experience = i * 10;
+        trie_insert(prof_list, prof_array[i].prof_name, &prof_array[i]);
+    }
+
+    /* Churn the odd positions while the reader looks up the even ones */
+    pthread_create(&reader, NULL, trie_reader_thread, prof_list);
+    for (pass = 0; pass < 100; pass++) {
+        for (i = 1; i < 8; i += 2) {
+            trie_remove(prof_list, names[i]);
+        }
+
+        /* No reader can see the removed records past this point */
+        trie_synchronize(prof_list);
+
+        for (i = 1; i < 8; i += 2) {
+            trie_insert(prof_list, prof_array[i].prof_name, &prof_array[i]);
+        }
+    }
+    pthread_join(reader, &found);
+
+    printf("Reader found %ld of %d lookups\n", (long)found, 100 * 4);
+
+    prof = (professor_t *)trie_get_least(prof_list);
+    while (prof != NULL) {
+        printf("Name: %s Dept: %d Experience: %d\n", prof->prof_name,
+               prof->prof_dept_id, prof->prof_experience);
+        prof = (professor_t *)trie_get_next(prof_list, prof);
+    }
+    printf("\n");
+
+    trie_clear(prof_list);
+    trie_destroy(prof_list);
+}
+
+/*
+ * trie_batch_usage
+ *
+ * Example code to demonstrate inserting and looking up many keys of a
+ * trie in one call
+ */
+void
+trie_batch_usage (void)
+{
+    trie_t *prof_list;
+    professor_t prof_array[6];
+    professor_t *prof;
+    char *names[] = { "dileep", "ann", "bill", "annabel", "dilbert",
+                      "andy" };
+    char *queries[] = { "bill", "anna", "andy", "dileep" };
+    void *data[6];
+    void *results[4];
+    int i, count;
+
+    prof_list = trie_create_flags("Professor Batch", trie_get_key,
+                                  TRIE_FLAG_RADIX);
+
+    for (i = 0; i < 6; i++) {
+        strcpy(prof_array[i].prof_name, names[i]);
+        prof_array[i].prof_dept_id = i;
+        prof_array[i].prof_experience = i * 10;
+        data[i] = &prof_array[i];
+    }
+
+    count = trie_insert_batch(prof_list, names, data, 6);
+    printf("Professors inserted: %d\n", count);
+
+    /* One result per query, NULL where the name isn't there */
+    count = trie_lookup_batch(prof_list, queries, 4, results);
+    printf("Professors found: %d of 4\n", count);
+    for (i = 0; i < 4; i++) {
+        prof = (professor_t *)results[i];
+        if (prof) {
+            printf("Name: %s Dept: %d Experience: %d\n", prof->prof_name,
+                   prof->prof_dept_id, prof->prof_experience);
+        } else {
+            printf("Name: %s not found\n", queries[i]);
+        }
+    }
+    printf("\n");
+
+    trie_clear(prof_list);
+    trie_destroy(prof_list);
+}
+
+/*
+ * hash_get_key
+ *
+ * Return the key of the given account. Called from the hash library.
+ */
+void *
+hash_get_key (void *acct_elem)
+{
+    account_t *acct = (account_t *)acct_elem;
+
+    return (acct->acct_user);
+}
+
+/*
+ * hash_string_fn
+ *
+ * Hash function required for hash_create(). FNV-1a of a user name.
+ */
+uint32_t
+hash_string_fn (void *key)
+{
+    uint8_t *str = (uint8_t *)key;
+    uint32_t hash = 2166136261U;
+
+    while (*str) {
+        hash = (hash ^ *str++) * 16777619U;
+    }
+
+    return hash;
+}
+
+/*
+ * hash_compare_fn
+ *
+ * Compare function required for hash_create()
+ */
+int32_t
+hash_compare_fn (void *key1, void *key2)
+{
+    return (strcmp((char *)key1, (char *)key2));
+}
+
+/*
+ * hash_total_fn
+ *
+ * Callback for hash_foreach(), adding up the balances
+ */
+int
+hash_total_fn (void *acct_elem, void *ctx)
+{
+    account_t *acct = (account_t *)acct_elem;
+
+    *(uint32_t *)ctx += acct->acct_balance;
+
+    return 0;
+}
+
+/*
+ * hash_usage
+ *
+ * Example code to demonstrate the usage of hash table APIs
+ */
+void
+hash_usage (void)
+{
+    hash_t *acct_table;
+    account_t acct_array[200];
+    account_t *acct;
+    uint32_t total = 0;
+    int i;
+
+    acct_table = hash_create("Accounts", offsetof(account_t, link),
+                             hash_get_key, hash_string_fn, hash_compare_fn);
+
+    /* The table grows a little with every insert once it fills up */
+    for (i = 0; i < 200; i++) {
+        snprintf(acct_array[i].acct_user, MAX_NAME_LEN, "user%03d", i);
+        acct_array[i].acct_balance = i * 5;
+        hash_insert(acct_table, &acct_array[i].link);
+    }
+    printf("Account Count: %d\n", hash_get_count(acct_table));
+
+    if (hash_insert(acct_table, &acct_array[42].link) != EOK) {
+        printf("Duplicate account refused\n");
+    }
+
+    acct = hash_lookup(acct_table, "user042");
+    if (acct) {
+        printf("Account found: User: %s, Balance: %d\n", acct->acct_user,
+               acct->acct_balance);
+    }
+
+    hash_remove(acct_table, &acct_array[42].link);
+    acct = hash_lookup(acct_table, "user042");
+    if (!acct) {
+        printf("Account not found\n");
+    }
+
+    hash_foreach(acct_table, hash_total_fn, &total);
+    printf("Account Count: %d, Total Balance: %d\n\n",
+           hash_get_count(acct_table), total);
+
+    for (i = 0; i < 200; i++) {
+        hash_remove(acct_table, &acct_array[i].link);
+    }
+    hash_destroy(acct_table);
+}
+
+/* Queue shared by queue_usage() and its producers */
+queue_t *emp_queue;
+
+/*
+ * queue_producer_thread
+ *
+ * Producer side of queue_usage(). Hands every other employee of the
+ * array over to the consumer.
+ */
+void *
+queue_producer_thread (void *arg)
+{
+    employee_t *emp_array = (employee_t *)arg;
+    int i;
+
+    for (i = 0; i < 100; i += 2) {
+        queue_enqueue(emp_queue, &emp_array[i].link);
+    }
+
+    return NULL;
+}
+
+/*
+ * queue_usage
+ *
+ * Example code to demonstrate handing records from producer threads to
+ * a consumer through lock-free queues
+ */
+void
+queue_usage (void)
+{
+    queue_ring_t *emp_ring;
+    employee_t emp_array[100];
+    employee_t *emp;
+    pthread_t producers[2];
+    uint32_t count = 0, age = 0;
+    int i;
+
+    /* The employees are linked through their list element, no allocation */
+    emp_queue = queue_create("Employee Queue", offsetof(employee_t, link));
+
+    for (i = 0; i < 100; i++) {
+        emp_array[i].emp_id = i;
+        emp_array[i].emp_age = 20 + i % 40;
+    }
+
+    /* One producer takes the even positions, the other the odd ones */
+    pthread_create(&producers[0], NULL, queue_producer_thread, emp_array);
+    pthread_create(&producers[1], NULL, queue_producer_thread, emp_array + 1);
+
+    while (count < 100) {
+        emp = (employee_t *)queue_dequeue(emp_queue);
+        if (!emp) {
+            sched_yield();
+            continue;
+        }
+        age += emp->emp_age;
+        count++;
+    }
+    pthread_join(producers[0], NULL);
+    pthread_join(producers[1], NULL);
+    printf("Employees dequeued: %d, Total Age: %d\n", count, age);
+    queue_destroy(emp_queue);
+
+    /* Bounded queue, any number of threads on either side */
+    emp_ring = queue_ring_create("Employee Ring", offsetof(employee_t, link),
+                                 4);
+    for (i = 0; queue_ring_enqueue(emp_ring, &emp_array[i].link) == EOK; i++);
+    printf("Employees queued before the ring filled up: %d\n", i);
+
+    while ((emp = (employee_t *)queue_ring_dequeue(emp_ring)) != NULL) {
+        printf("ID: %d, Age: %d\n", emp->emp_id, emp->emp_age);
+    }
+    printf("\n");
+    queue_ring_destroy(emp_ring);
+}
+
+/* Main entry point */
+int 
+main (int argc, char *argv[])
+{
+    /* Linked list APIs */
+    linked_list_usage();
+
+    /* Doubly linked list APIs */
+    doubly_linked_list_usage();
+
+    /* Linked list with a key index */
+    linked_list_indexed_usage();
+
+    /* Binary search tree APIs */
+    bst_usage();
+
+    /* Self-balancing binary search tree APIs */
+    bst_balanced_usage();
+
+    /* Binary search tree shared between threads */
+    bst_concurrent_usage();
+
+    /* Binary search trees with 64-bit and string keys */
+    bst_generic_key_usage();
+
+    /* B+tree APIs */
+    btree_usage();
+    
+    /* Trie APIs */
+    trie_usage();
+
+    /* Path compressed trie APIs */
+    trie_radix_usage();
+
+    /* Trie cursor APIs */
+    trie_iter_usage();
+
+    /* Trie prefix search APIs */
+    trie_prefix_usage();
+
+    /* Trie keyed on raw bytes */
+    trie_binary_key_usage();
+
+    /* Trie saved to a file and mapped back in */
+    trie_mmap_usage();
+
+    /* Trie compiled into a double array */
+    trie_freeze_usage();
+
+    /* Trie with lock-free readers */
+    trie_concurrent_usage();
+
+    /* Batched trie lookups and inserts */
+    trie_batch_usage();
+
+    /* Hash table APIs */
+    hash_usage();
+
+    /* Lock-free queue APIs */
+    queue_usage();
 
     return 0;
 }
@@ -0,0 +1,336 @@
+/*
+ * epoch.c - This file contains an epoch based reclamation scheme. It
+ *           lets readers walk a shared structure without taking locks,
+ *           while writers wait for those readers to finish before the
+ *           memory they unlinked is freed or reused.
+ */
+
+/*
+ * Every thread owns one slot, on its own cache line, in each epoch
+ * instance. A reader publishes the current global epoch in its slot
+ * when it starts reading and clears it when it is done. A writer which
+ * has unlinked something bumps the global epoch and waits until every
+ * slot is either idle or shows the new epoch. Readers which started
+ * after the bump can no longer reach what was unlinked, so once the
+ * older readers have drained it is safe to free.
+ *
+ * Writers which would rather not wait can hand what they unlinked to
+ * epoch_retire() instead. Each object is tagged with the epoch it was
+ * retired in, and every so often the objects older than the oldest
+ * epoch still being read are freed.
+ *
+ * Thread slots are handed out from a process wide table the first time
+ * a thread enters an epoch and are given back when the thread exits.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <pthread.h>
+#include "epoch.h"
+
+static uint8_t          epoch_slot_used[EPOCH_MAX_THREADS];
+static pthread_key_t    epoch_slot_key;
+static pthread_once_t   epoch_slot_once = PTHREAD_ONCE_INIT;
+static __thread int     epoch_thread_slot = -1;
+
+/*
+ * epoch_slot_release
+ *
+ * Thread exit destructor. Give the thread's slot back to the table.
+ */
+static void
+epoch_slot_release (void *arg)
+{
+    int slot = (int)(uintptr_t)arg - 1;
+
+    __atomic_store_n(&epoch_slot_used[slot], 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * epoch_slot_init
+ *
+ * One time initialization of the slot table
+ */
+static void
+epoch_slot_init (void)
+{
+    pthread_key_create(&epoch_slot_key, epoch_slot_release);
+}
+
+/*
+ * epoch_get_slot
+ *
+ * Return the calling thread's slot index, claiming a free one on the
+ * first call. If every slot is taken, wait for a thread to exit.
+ */
+static inline int
+epoch_get_slot (void)
+{
+    uint8_t expected;
+    int     slot;
+
+    if (epoch_thread_slot >= 0) {
+        return epoch_thread_slot;
+    }
+
+    pthread_once(&epoch_slot_once, epoch_slot_init);
+
+    while (1) {
+        for (slot = 0; slot < EPOCH_MAX_THREADS; slot++) {
+            expected = 0;
+            if (__atomic_compare_exchange_n(&epoch_slot_used[slot], &expected,
+                                            1, FALSE, __ATOMIC_ACQUIRE,
+                                            __ATOMIC_RELAXED)) {
+                epoch_thread_slot = slot;
+                pthread_setspecific(epoch_slot_key, (void *)(uintptr_t)(slot + 1));
+                return slot;
+            }
+        }
+        sched_yield();
+    }
+}
+
+/*
+ * epoch_create
+ *
+ * Create an epoch instance and return a pointer to it
+ */
+epoch_t *
+epoch_create (void)
+{
+    epoch_t *epoch;
+
+    if (posix_memalign((void **)&epoch, EPOCH_CACHE_LINE, sizeof(epoch_t))) {
+        return NULL;
+    }
+
+    /* Initialize the contents */
+    memset(epoch, 0, sizeof(epoch_t));
+    epoch->global_epoch = 1;
+    epoch->retired_limit = EPOCH_RETIRE_BATCH;
+    pthread_mutex_init(&epoch->retire_lock, NULL);
+
+    return epoch;
+}
+
+/*
+ * epoch_destroy
+ *
+ * Free the given epoch instance, along with whatever is still waiting
+ * to be freed. There must be no readers left.
+ */
+int
+epoch_destroy (epoch_t *epoch)
+{
+    epoch_retired_t *retired, *next;
+
+    /* Sanity check */
+    if (!epoch) {
+        return EINVAL;
+    }
+
+    for (retired = epoch->retired; retired != NULL; retired = next) {
+        next = retired->next;
+        retired->free_fn(retired->ptr, retired->ctx);
+        free(retired);
+    }
+
+    /* Do the deed */
+    pthread_mutex_destroy(&epoch->retire_lock);
+    free(epoch);
+
+    return EOK;
+}
+
+/*
+ * epoch_enter
+ *
+ * Start a read side critical section. Anything reachable from the
+ * shared structure stays valid until the matching epoch_exit(). Calls
+ * may be nested.
+ */
+void
+epoch_enter (epoch_t *epoch)
+{
+    epoch_slot_t    *slot = &epoch->slots[epoch_get_slot()];
+
+    if (slot->nest++ > 0) {
+        return;
+    }
+
+    __atomic_store_n(&slot->epoch,
+                     __atomic_load_n(&epoch->global_epoch, __ATOMIC_RELAXED),
+                     __ATOMIC_RELAXED);
+
+    /* Publish the slot before any of the shared structure is read */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+/*
+ * epoch_exit
+ *
+ * End a read side critical section
+ */
+void
+epoch_exit (epoch_t *epoch)
+{
+    epoch_slot_t    *slot = &epoch->slots[epoch_get_slot()];
+
+    if (--slot->nest > 0) {
+        return;
+    }
+
+    __atomic_store_n(&slot->epoch, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * epoch_synchronize
+ *
+ * Wait until every reader which might still hold a reference to
+ * something unlinked before this call has left its critical section.
+ * Must not be called from inside a read side critical section.
+ */
+void
+epoch_synchronize (epoch_t *epoch)
+{
+    uint64_t    new_epoch, seen;
+    int         slot;
+
+    /* The unlinks done so far are ordered before the bump */
+    new_epoch = __atomic_add_fetch(&epoch->global_epoch, 1, __ATOMIC_SEQ_CST);
+
+    for (slot = 0; slot < EPOCH_MAX_THREADS; slot++) {
+        while (1) {
+            seen = __atomic_load_n(&epoch->slots[slot].epoch, __ATOMIC_ACQUIRE);
+            if (seen == 0 || seen >= new_epoch) {
+                break;
+            }
+            sched_yield();
+        }
+    }
+}
+
+/*
+ * epoch_reclaim_safe
+ *
+ * Free whatever was retired before every reader still in a critical
+ * section started. Never waits for the readers. Objects which some of
+ * them might still see stay queued for a later pass.
+ */
+static void
+epoch_reclaim_safe (epoch_t *epoch)
+{
+    epoch_retired_t *retired, *next, **prev, *done = NULL;
+    uint64_t        safe, seen;
+    int             slot;
+
+    /*
+     * Readers entering from now on can't reach anything retired so far.
+     * The oldest epoch still being read bounds what is safe to free.
+     */
+    safe = __atomic_add_fetch(&epoch->global_epoch, 1, __ATOMIC_SEQ_CST);
+    for (slot = 0; slot < EPOCH_MAX_THREADS; slot++) {
+        seen = __atomic_load_n(&epoch->slots[slot].epoch, __ATOMIC_ACQUIRE);
+        if (seen != 0 && seen < safe) {
+            safe = seen;
+        }
+    }
+
+    pthread_mutex_lock(&epoch->retire_lock);
+    prev = &epoch->retired;
+    for (retired = epoch->retired; retired != NULL; retired = next) {
+        next = retired->next;
+        if (retired->epoch < safe) {
+            *prev = next;
+            retired->next = done;
+            done = retired;
+            epoch->retired_count--;
+        } else {
+            prev = &retired->next;
+        }
+    }
+    epoch->retired_limit = epoch->retired_count + EPOCH_RETIRE_BATCH;
+    pthread_mutex_unlock(&epoch->retire_lock);
+
+    for (retired = done; retired != NULL; retired = next) {
+        next = retired->next;
+        retired->free_fn(retired->ptr, retired->ctx);
+        free(retired);
+    }
+}
+
+/*
+ * epoch_retire
+ *
+ * Have free_fn(ptr, ctx) called once no reader can still be looking at
+ * ptr, which has already been unlinked. Every EPOCH_RETIRE_BATCH calls
+ * the queued objects which are safe by then are freed. Never waits for
+ * the readers, so it may be called from a read side critical section.
+ */
+void
+epoch_retire (epoch_t *epoch, void *ptr,
+              void (*free_fn)(void *ptr, void *ctx), void *ctx)
+{
+    epoch_retired_t *retired;
+    uint8_t         full;
+
+    retired = (epoch_retired_t *)malloc(sizeof(epoch_retired_t));
+    if (!retired) {
+        /* Nowhere to queue it. Wait for the readers right away. */
+        epoch_synchronize(epoch);
+        free_fn(ptr, ctx);
+        return;
+    }
+
+    /* The unlink is ordered before the epoch is read */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    retired->epoch = __atomic_load_n(&epoch->global_epoch, __ATOMIC_RELAXED);
+    retired->ptr = ptr;
+    retired->free_fn = free_fn;
+    retired->ctx = ctx;
+
+    pthread_mutex_lock(&epoch->retire_lock);
+    retired->next = epoch->retired;
+    epoch->retired = retired;
+    full = (++epoch->retired_count >= epoch->retired_limit);
+    pthread_mutex_unlock(&epoch->retire_lock);
+
+    if (full) {
+        epoch_reclaim_safe(epoch);
+    }
+}
+
+/*
+ * epoch_reclaim
+ *
+ * Wait for the readers and free everything retired so far. Must not be
+ * called from inside a read side critical section.
+ */
+void
+epoch_reclaim (epoch_t *epoch)
+{
+    epoch_retired_t *retired, *next;
+
+    pthread_mutex_lock(&epoch->retire_lock);
+    retired = epoch->retired;
+    epoch->retired = NULL;
+    epoch->retired_count = 0;
+    epoch->retired_limit = EPOCH_RETIRE_BATCH;
+    pthread_mutex_unlock(&epoch->retire_lock);
+
+    if (!retired) {
+        return;
+    }
+
+    epoch_synchronize(epoch);
+
+    for (; retired != NULL; retired = next) {
+        next = retired->next;
+        retired->free_fn(retired->ptr, retired->ctx);
+        free(retired);
+    }
+}
+
+/* End of File */
@@ -0,0 +1,61 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+/* Defines */
+
+#define TRUE                         1
+#define FALSE                        0
+
+#define EOK                          0
+#define EINVAL                      -1
+#define ENOTFOUND                   -2
+#define EFAIL                       -3
+
+#define EPOCH_CACHE_LINE            64
+#define EPOCH_MAX_THREADS           256
+#define EPOCH_RETIRE_BATCH          256     /* Retired objects between reclaim passes */
+
+/* Structure Definitions */
+
+/*
+ * Per thread reader state. Each slot sits on its own cache line so
+ * that readers never write to a shared line.
+ */
+typedef struct epoch_slot_ {
+    uint64_t        epoch;      /* Epoch seen on entry, 0 when not reading */
+    uint32_t        nest;       /* Nesting depth of epoch_enter() calls */
+} __attribute__((aligned(EPOCH_CACHE_LINE))) epoch_slot_t;
+
+/* Object handed to epoch_retire(), waiting for the readers to drain */
+typedef struct epoch_retired_ {
+    struct epoch_retired_   *next;
+    uint64_t                epoch;      /* Global epoch when it was retired */
+    void                    *ptr;
+    void                    (*free_fn)(void *ptr, void *ctx);
+    void                    *ctx;
+} epoch_retired_t;
+
+typedef struct epoch_ {
+    uint64_t        global_epoch __attribute__((aligned(EPOCH_CACHE_LINE)));
+    epoch_slot_t    slots[EPOCH_MAX_THREADS];
+    pthread_mutex_t retire_lock;
+    epoch_retired_t *retired;
+    uint32_t        retired_count;
+    uint32_t        retired_limit;  /* Count at which to look for what's safe */
+} epoch_t;
+
+/* Function prototypes */
+
+epoch_t* epoch_create (void);
+int epoch_destroy (epoch_t *epoch);
+void epoch_enter (epoch_t *epoch);
+void epoch_exit (epoch_t *epoch);
+void epoch_synchronize (epoch_t *epoch);
+void epoch_retire (epoch_t *epoch, void *ptr,
+                   void (*free_fn)(void *ptr, void *ctx), void *ctx);
+void epoch_reclaim (epoch_t *epoch);
+
+#endif /* EPOCH_H */
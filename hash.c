@@ -0,0 +1,578 @@
+/*
+ * hash.c - This file contains a generic hash table implementation
+ *          where each object embeds a hash_elem_t and is found by an
+ *          opaque key
+ */
+
+/*
+ * The table is open addressed. Slots come in groups of HASH_GROUP_SIZE,
+ * each with a control byte holding 7 bits of the hash of its object, or
+ * a marker for an empty or a deleted slot. A key is looked for group by
+ * group from its home group on, and with SSE2 all the control bytes of
+ * a group are compared in one go, so most slots whose object doesn't
+ * match are never looked at.
+ *
+ *      ctrl    [ 92 | 00 | da | 01 | b3 | 00 | ... ]   one group
+ *      slots   [ o1 |    | o2 |    | o3 |    | ... ]
+ *
+ * Growing the table doesn't move every object at once. A new table is
+ * allocated and the old one is drained into it a few groups per update.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "hash.h"
+
+/*
+ * hash_mix
+ *
+ * Scramble the value returned by hash_fn, so that even a weak hash such
+ * as an id spreads the objects evenly. The home group is taken from the
+ * upper half of the result and the control byte from bits 25 to 31.
+ */
+static inline uint64_t
+hash_mix (uint32_t hash)
+{
+    return ((uint64_t)hash * 0x9E3779B97F4A7C15ULL);
+}
+
+/*
+ * hash_ctrl_byte
+ *
+ * Return the control byte of a full slot holding an object with the
+ * given scrambled hash
+ */
+static inline uint8_t
+hash_ctrl_byte (uint64_t mixed)
+{
+    return ((uint8_t)((mixed >> 25) | HASH_CTRL_FULL));
+}
+
+/*
+ * hash_group_match
+ *
+ * Return a bit mask of the slots of a group whose control byte is the
+ * given one
+ */
+static inline uint32_t
+hash_group_match (uint8_t *ctrl, uint8_t byte)
+{
+#ifdef __SSE2__
+    __m128i group = _mm_loadu_si128((__m128i *)ctrl);
+
+    return ((uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(group,
+                                                       _mm_set1_epi8(byte))));
+#else
+    uint32_t mask = 0;
+    int i;
+
+    for (i = 0; i < HASH_GROUP_SIZE; i++) {
+        mask |= (uint32_t)(ctrl[i] == byte) << i;
+    }
+
+    return mask;
+#endif
+}
+
+/*
+ * hash_group_free
+ *
+ * Return a bit mask of the slots of a group which are empty or deleted,
+ * the ones without HASH_CTRL_FULL
+ */
+static inline uint32_t
+hash_group_free (uint8_t *ctrl)
+{
+#ifdef __SSE2__
+    return (~(uint32_t)_mm_movemask_epi8(_mm_loadu_si128((__m128i *)ctrl)) &
+            0xFFFF);
+#else
+    uint32_t mask = 0;
+    int i;
+
+    for (i = 0; i < HASH_GROUP_SIZE; i++) {
+        mask |= (uint32_t)!(ctrl[i] & HASH_CTRL_FULL) << i;
+    }
+
+    return mask;
+#endif
+}
+
+/*
+ * hash_table_alloc
+ *
+ * Allocate an empty table of the given size. The slots and the control
+ * bytes share one block. Empty control bytes are zero, so a large table
+ * comes straight from zeroed pages, which are only touched as the
+ * objects are moved in.
+ */
+static int
+hash_table_alloc (hash_table_t *table, uint32_t size)
+{
+    table->slots = (void **)calloc(size, sizeof(void *) + 1);
+    if (!table->slots) {
+        return EFAIL;
+    }
+
+    table->ctrl = (uint8_t *)(table->slots + size);
+    table->size = size;
+    table->count = 0;
+    table->deleted = 0;
+
+    return EOK;
+}
+
+/*
+ * hash_table_free
+ *
+ * Release the memory of a table
+ */
+static void
+hash_table_free (hash_table_t *table)
+{
+    free(table->slots);
+    table->slots = NULL;
+    table->ctrl = NULL;
+    table->size = 0;
+    table->count = 0;
+    table->deleted = 0;
+}
+
+/*
+ * hash_table_lookup
+ *
+ * Return the object of the table with the given key, NULL if there is
+ * none
+ */
+static void *
+hash_table_lookup (hash_t *hash, hash_table_t *table, void *key,
+                   uint64_t mixed)
+{
+    uint32_t mask, group, match, slot;
+    uint8_t byte = hash_ctrl_byte(mixed);
+    void *obj;
+
+    if (!table->size) {
+        return NULL;
+    }
+
+    mask = table->size / HASH_GROUP_SIZE - 1;
+    group = (uint32_t)(mixed >> 32) & mask;
+    for (;;) {
+        slot = group * HASH_GROUP_SIZE;
+        match = hash_group_match(&table->ctrl[slot], byte);
+        while (match) {
+            obj = table->slots[slot + __builtin_ctz(match)];
+            if (hash->cmp_fn(key, hash->get_key(obj)) == 0) {
+                return obj;
+            }
+            match &= match - 1;
+        }
+
+        /* The key would have been put in this group if not earlier */
+        if (hash_group_match(&table->ctrl[slot], HASH_CTRL_EMPTY)) {
+            return NULL;
+        }
+        group = (group + 1) & mask;
+    }
+}
+
+/*
+ * hash_table_find_obj
+ *
+ * Return the slot of the table holding the given object, -1 if it
+ * isn't in the table
+ */
+static int64_t
+hash_table_find_obj (hash_table_t *table, void *obj, uint64_t mixed)
+{
+    uint32_t mask, group, match, slot;
+    uint8_t byte = hash_ctrl_byte(mixed);
+
+    if (!table->size) {
+        return -1;
+    }
+
+    mask = table->size / HASH_GROUP_SIZE - 1;
+    group = (uint32_t)(mixed >> 32) & mask;
+    for (;;) {
+        slot = group * HASH_GROUP_SIZE;
+        match = hash_group_match(&table->ctrl[slot], byte);
+        while (match) {
+            if (table->slots[slot + __builtin_ctz(match)] == obj) {
+                return (slot + __builtin_ctz(match));
+            }
+            match &= match - 1;
+        }
+
+        if (hash_group_match(&table->ctrl[slot], HASH_CTRL_EMPTY)) {
+            return -1;
+        }
+        group = (group + 1) & mask;
+    }
+}
+
+/*
+ * hash_table_place
+ *
+ * Put an object in the first free slot on its probe sequence. The
+ * caller makes sure the table has room.
+ */
+static void
+hash_table_place (hash_table_t *table, void *obj, uint64_t mixed)
+{
+    uint32_t mask, group, free_mask, slot;
+
+    mask = table->size / HASH_GROUP_SIZE - 1;
+    group = (uint32_t)(mixed >> 32) & mask;
+    for (;;) {
+        slot = group * HASH_GROUP_SIZE;
+        free_mask = hash_group_free(&table->ctrl[slot]);
+        if (free_mask) {
+            slot += __builtin_ctz(free_mask);
+            break;
+        }
+        group = (group + 1) & mask;
+    }
+
+    if (table->ctrl[slot] == HASH_CTRL_DELETED) {
+        table->deleted--;
+    }
+    table->ctrl[slot] = hash_ctrl_byte(mixed);
+    table->slots[slot] = obj;
+    table->count++;
+}
+
+/*
+ * hash_table_erase
+ *
+ * Free the given slot of a table. A group which still has an empty slot
+ * has never been full, so no probe ever went past it, and the slot can
+ * be marked empty again. Otherwise it has to be marked deleted, so that
+ * lookups keep going.
+ */
+static void
+hash_table_erase (hash_table_t *table, uint32_t slot)
+{
+    uint32_t group = slot & ~(HASH_GROUP_SIZE - 1);
+
+    if (hash_group_match(&table->ctrl[group], HASH_CTRL_EMPTY)) {
+        table->ctrl[slot] = HASH_CTRL_EMPTY;
+    } else {
+        table->ctrl[slot] = HASH_CTRL_DELETED;
+        table->deleted++;
+    }
+    table->count--;
+}
+
+/*
+ * hash_migrate
+ *
+ * Move up to the given number of groups of the old table into the new
+ * one, and free the old table once it has all been moved. The hashes
+ * cached in the elements are used, so no callbacks are made.
+ */
+static void
+hash_migrate (hash_t *hash, uint32_t groups)
+{
+    hash_table_t *old = &hash->old;
+    hash_elem_t *elem;
+    uint32_t slot, end;
+    void *obj;
+
+    while (groups-- > 0 && hash->migrate_pos < old->size) {
+        end = hash->migrate_pos + HASH_GROUP_SIZE;
+        for (slot = hash->migrate_pos; slot < end; slot++) {
+            if (!(old->ctrl[slot] & HASH_CTRL_FULL)) {
+                continue;
+            }
+
+            obj = old->slots[slot];
+            elem = (hash_elem_t *)((uint8_t *)obj + hash->elem_offset);
+            hash_table_place(&hash->table, obj, hash_mix(elem->hash));
+            hash_table_erase(old, slot);
+        }
+        hash->migrate_pos = end;
+    }
+
+    if (hash->migrate_pos >= old->size) {
+        hash_table_free(old);
+    }
+}
+
+/*
+ * hash_resize
+ *
+ * Start moving the objects into a new table. It is twice the size if
+ * at least half of the table is in use, else it is the same size and
+ * just gets rid of the deleted slots.
+ */
+static int
+hash_resize (hash_t *hash)
+{
+    uint32_t size = hash->table.size;
+
+    /* Finish the resize in progress first */
+    if (hash->old.size) {
+        hash_migrate(hash, hash->old.size / HASH_GROUP_SIZE);
+    }
+
+    if (hash->table.count >= size / 2) {
+        size *= 2;
+    }
+
+    hash->old = hash->table;
+    if (hash_table_alloc(&hash->table, size) != EOK) {
+        hash->table = hash->old;
+        hash->old.slots = NULL;
+        hash->old.ctrl = NULL;
+        hash->old.size = 0;
+        return EFAIL;
+    }
+    hash->migrate_pos = 0;
+
+    return EOK;
+}
+
+/*
+ * hash_create
+ *
+ * Create an empty hash table. get_key returns a pointer to the key of
+ * an object, which has to stay unchanged while the object is in the
+ * table. hash_fn hashes a key and cmp_fn compares two keys, returning
+ * 0 if they are equal.
+ */
+hash_t *
+hash_create (char *name, uint32_t offset, void* (*get_key)(void *obj),
+             uint32_t (*hash_fn)(void *key),
+             int32_t (*cmp_fn)(void *key1, void *key2))
+{
+    hash_t  *hash;
+
+    /* Sanity check */
+    if (!get_key || !hash_fn || !cmp_fn) {
+        return NULL;
+    }
+
+    hash = (hash_t *)malloc(sizeof(hash_t));
+    if (!hash) {
+        return NULL;
+    }
+
+    /* Initialize the contents */
+    memset(hash, 0, sizeof(hash_t));
+    strncpy(hash->hash_name, name, MAX_NAME_LEN - 1);
+    hash->elem_offset = offset;
+    hash->get_key = get_key;
+    hash->hash_fn = hash_fn;
+    hash->cmp_fn = cmp_fn;
+
+    if (hash_table_alloc(&hash->table, HASH_INITIAL) != EOK) {
+        free(hash);
+        return NULL;
+    }
+
+    return hash;
+}
+
+/*
+ * hash_destroy
+ *
+ * Free the given hash table
+ */
+int
+hash_destroy (hash_t *hash)
+{
+    /* Bail if the table is not empty */
+    if (!hash_empty(hash)) {
+        return EFAIL;
+    }
+
+    /* Do the deed */
+    hash_table_free(&hash->table);
+    hash_table_free(&hash->old);
+    free(hash);
+
+    return EOK;
+}
+
+/*
+ * hash_get_count
+ *
+ * Return the count of objects in the table
+ */
+uint32_t
+hash_get_count (hash_t *hash)
+{
+    return hash->elem_count;
+}
+
+/*
+ * hash_empty
+ *
+ * Returns true if the table is empty. False otherwise
+ */
+uint8_t
+hash_empty (hash_t *hash)
+{
+    if (hash->elem_count == 0) {
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+/*
+ * hash_insert
+ *
+ * Insert an object into the table. Fails if an object with the same key
+ * is in the table already.
+ */
+int
+hash_insert (hash_t *hash, hash_elem_t *elem)
+{
+    void *obj, *key;
+    uint32_t hash_val;
+    uint64_t mixed;
+
+    /* Sanity check */
+    if (!hash || !elem) {
+        return EINVAL;
+    }
+
+    obj = (uint8_t *)elem - hash->elem_offset;
+    key = hash->get_key(obj);
+    hash_val = hash->hash_fn(key);
+    mixed = hash_mix(hash_val);
+
+    if (hash_table_lookup(hash, &hash->table, key, mixed) ||
+        hash_table_lookup(hash, &hash->old, key, mixed)) {
+        return EFAIL;
+    }
+
+    if (hash->old.size) {
+        hash_migrate(hash, HASH_MIGRATE_GROUPS);
+    }
+
+    /* Keep at least 1/8 of the slots empty, so that probes stay short */
+    if ((hash->table.count + hash->table.deleted + 1) * 8 >
+        hash->table.size * 7) {
+        if (hash_resize(hash) != EOK) {
+            return EFAIL;
+        }
+    }
+
+    elem->hash = hash_val;
+    hash_table_place(&hash->table, obj, mixed);
+    hash->elem_count++;
+
+    return EOK;
+}
+
+/*
+ * hash_remove
+ *
+ * Remove an object from the table
+ */
+int
+hash_remove (hash_t *hash, hash_elem_t *elem)
+{
+    void *obj;
+    uint64_t mixed;
+    int64_t slot;
+
+    /* Sanity check */
+    if (!hash || !elem) {
+        return EINVAL;
+    }
+
+    obj = (uint8_t *)elem - hash->elem_offset;
+    mixed = hash_mix(elem->hash);
+
+    slot = hash_table_find_obj(&hash->table, obj, mixed);
+    if (slot >= 0) {
+        hash_table_erase(&hash->table, (uint32_t)slot);
+    } else {
+        slot = hash_table_find_obj(&hash->old, obj, mixed);
+        if (slot < 0) {
+            return ENOTFOUND;
+        }
+        hash_table_erase(&hash->old, (uint32_t)slot);
+    }
+    hash->elem_count--;
+
+    if (hash->old.size) {
+        hash_migrate(hash, HASH_MIGRATE_GROUPS);
+    }
+
+    return EOK;
+}
+
+/*
+ * hash_lookup
+ *
+ * Return the object with the given key, NULL if there is none
+ */
+void *
+hash_lookup (hash_t *hash, void *key)
+{
+    uint64_t mixed;
+    void *obj;
+
+    /* Sanity check */
+    if (!hash || !key) {
+        return NULL;
+    }
+
+    mixed = hash_mix(hash->hash_fn(key));
+    obj = hash_table_lookup(hash, &hash->table, key, mixed);
+    if (!obj && hash->old.size) {
+        obj = hash_table_lookup(hash, &hash->old, key, mixed);
+    }
+
+    return obj;
+}
+
+/*
+ * hash_foreach
+ *
+ * Invoke the callback for every object in the table, in no particular
+ * order. The table must not be changed meanwhile. The scan stops early
+ * if the callback returns non-zero, and that value is returned.
+ */
+int
+hash_foreach (hash_t *hash, int (*callback)(void *obj, void *ctx),
+              void *ctx)
+{
+    hash_table_t *tables[2];
+    uint32_t i, slot;
+    int rc;
+
+    /* Sanity check */
+    if (!hash || !callback) {
+        return EINVAL;
+    }
+
+    tables[0] = &hash->table;
+    tables[1] = &hash->old;
+    for (i = 0; i < 2; i++) {
+        for (slot = 0; slot < tables[i]->size; slot++) {
+            if (!(tables[i]->ctrl[slot] & HASH_CTRL_FULL)) {
+                continue;
+            }
+
+            rc = callback(tables[i]->slots[slot], ctx);
+            if (rc != 0) {
+                return rc;
+            }
+        }
+    }
+
+    return EOK;
+}
+
+/* End of File */
@@ -0,0 +1,81 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <stdint.h>
+
+/* Defines */
+
+#define MAX_NAME_LEN                64
+#define HASH_GROUP_SIZE             16      /* Control bytes probed at once */
+#define HASH_INITIAL                64      /* Slots allocated up front, a power of 2 */
+#define HASH_MIGRATE_GROUPS         2       /* Groups moved per update while resizing */
+
+#define HASH_CTRL_EMPTY             0x00    /* Never used since the table was built */
+#define HASH_CTRL_DELETED           0x01    /* Used before, skipped by lookups */
+#define HASH_CTRL_FULL              0x80    /* Set in the control byte of a full slot */
+
+#define TRUE                         1
+#define FALSE                        0
+
+#define EOK                          0
+#define EINVAL                      -1
+#define ENOTFOUND                   -2
+#define EFAIL                       -3
+
+/* Structure Definitions */
+
+typedef struct hash_elem_ {
+    uint32_t            hash;       /* hash_fn() of the key, taken on insert */
+} hash_elem_t;
+
+/*
+ * Open addressed table. Slots are probed HASH_GROUP_SIZE at a time, by
+ * their control bytes: HASH_CTRL_EMPTY, HASH_CTRL_DELETED, or else
+ * HASH_CTRL_FULL plus 7 bits of the hash of the object in the slot. A
+ * lookup compares the control bytes of all the slots of a group at once
+ * and only looks at the objects whose bits match, and it stops at the
+ * first group with an empty slot.
+ */
+typedef struct hash_table_ {
+    void                **slots;    /* The objects */
+    uint8_t             *ctrl;      /* One per slot, in the same block as slots */
+    uint32_t            size;       /* A power of 2, 0 if there is no table */
+    uint32_t            count;
+    uint32_t            deleted;
+} hash_table_t;
+
+/*
+ * Hash table of objects. The table is grown incrementally: a new table
+ * twice the size is set up, and every insert and remove after that
+ * moves HASH_MIGRATE_GROUPS groups of the old one over until it is
+ * empty. No single update pays for moving the whole table. Lookups
+ * check both tables while the move is in progress.
+ */
+typedef struct hash_ {
+    char                hash_name[MAX_NAME_LEN];
+    hash_table_t        table;      /* New objects go here */
+    hash_table_t        old;        /* Being moved into table while resizing */
+    uint32_t            migrate_pos;    /* Next group of old to move */
+    uint32_t            elem_offset;
+    uint32_t            elem_count;
+    void*               (*get_key)(void *obj);
+    uint32_t            (*hash_fn)(void *key);
+    int32_t             (*cmp_fn)(void *key1, void *key2);
+} hash_t;
+
+/* Function prototypes */
+
+hash_t* hash_create (char *name, uint32_t elem_offset,
+                     void* (*get_key)(void *obj),
+                     uint32_t (*hash_fn)(void *key),
+                     int32_t (*cmp_fn)(void *key1, void *key2));
+int hash_destroy (hash_t *hash);
+uint32_t hash_get_count (hash_t *hash);
+uint8_t hash_empty (hash_t *hash);
+int hash_insert (hash_t *hash, hash_elem_t *elem);
+int hash_remove (hash_t *hash, hash_elem_t *elem);
+void* hash_lookup (hash_t *hash, void *key);
+int hash_foreach (hash_t *hash, int (*callback)(void *obj, void *ctx),
+                  void *ctx);
+
+#endif /* HASH_H */
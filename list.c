@@ -26,7 +26,40 @@ list_create (char *name, uint32_t offset)
     strncpy(new_list->list_name, name, strlen(name));
     new_list->list_offset = offset;
     new_list->list_count = 0;
-    new_list->list_head = NULL;
+    new_list->list_sentinel.next = &new_list->list_sentinel;
+    new_list->list_tail = &new_list->list_sentinel;
+    new_list->list_index = NULL;
+
+    return new_list;
+}
+
+/*
+ * list_create_indexed
+ *
+ * Create an empty list which also keeps a hash index of its elements,
+ * so that list_find() doesn't have to walk the list. hash_fn hashes a
+ * key, get_key returns the key of an element and cmp_fn compares a key
+ * to an element, returning 0 if they match. The key of an element must
+ * not change while it is on the list.
+ */
+list_t *
+list_create_indexed (char *name, uint32_t offset,
+                     uint32_t (*hash_fn)(void *key),
+                     void* (*get_key)(void *elem),
+                     int32_t (*cmp_fn)(void *key, void *elem))
+{
+    list_t  *new_list;
+
+    new_list = list_create(name, offset);
+    if (!new_list) {
+        return NULL;
+    }
+
+    new_list->list_index = list_index_create(hash_fn, get_key, cmp_fn);
+    if (!new_list->list_index) {
+        free(new_list);
+        return NULL;
+    }
 
     return new_list;
 }
@@ -45,6 +78,7 @@ list_destroy (list_t *list)
     }
 
     /* Do the deed */
+    list_index_destroy(list->list_index);
     free(list);
 
     return EOK;
@@ -53,27 +87,31 @@ list_destroy (list_t *list)
 /*
  * list_get_head
  *
- * Return a pointer to the head
+ * Return a pointer to the head, NULL if the list is empty
  */
 void *
 list_get_head (list_t *list)
 {
-    void *elem = (uint8_t *)list->list_head - list->list_offset;
+    if (list_empty(list)) {
+        return NULL;
+    }
 
-    return elem;
+    return ((void *)((uint8_t *)list->list_sentinel.next - list->list_offset));
 }
 
 /*
  * list_get_tail
  *
- * Return a pointer to the tail
+ * Return a pointer to the tail, NULL if the list is empty
  */
 void *
 list_get_tail (list_t *list)
 {
-    void *elem = (uint8_t *)list->list_tail - list->list_offset;
+    if (list_empty(list)) {
+        return NULL;
+    }
 
-    return elem;
+    return ((void *)((uint8_t *)list->list_tail - list->list_offset));
 }
 
 /*
@@ -87,14 +125,15 @@ list_get_next (list_t *list, void *prev_elem)
     list_elem_t *elem;
 
     /* Sanity check */
-    if (!list || !elem) {
+    if (!list || !prev_elem) {
         return NULL;
     }
 
     elem = (list_elem_t *)((uint8_t *)prev_elem + list->list_offset);
     elem = elem->next;
 
-    if (!elem) {
+    /* Past the tail */
+    if (elem == &list->list_sentinel) {
         return NULL;
     }
 
@@ -127,6 +166,36 @@ list_empty (list_t *list)
     return FALSE;
 }
 
+/*
+ * list_track
+ *
+ * Add an element to the index of the list, if it has one
+ */
+static inline int
+list_track (list_t *list, list_elem_t *elem)
+{
+    if (!list->list_index) {
+        return EOK;
+    }
+
+    return (list_index_insert(list->list_index,
+                              (uint8_t *)elem - list->list_offset));
+}
+
+/*
+ * list_untrack
+ *
+ * Drop an element from the index of the list, if it has one
+ */
+static inline void
+list_untrack (list_t *list, list_elem_t *elem)
+{
+    if (list->list_index) {
+        list_index_remove(list->list_index,
+                          (uint8_t *)elem - list->list_offset);
+    }
+}
+
 /*
  * list_insert
  *
@@ -135,26 +204,20 @@ list_empty (list_t *list)
 int
 list_insert (list_t *list, list_elem_t *elem)
 {
-    list_elem_t *link;
-
     /* Sanity check */
     if (!list || !elem) {
         return EINVAL;
     }
 
-    if (list_empty(list)) {
-        /* First element */
-        list->list_head = elem;
-        list->list_tail = elem;
-        elem->next = NULL;
-    } else {
-        /* Insert it in the end */
-        link = list->list_tail;
-        elem->next = NULL;
-        link->next = elem;
-        list->list_tail = elem;
+    if (list_track(list, elem) != EOK) {
+        return EFAIL;
     }
 
+    /* The tail is the sentinel itself if the list is empty */
+    elem->next = &list->list_sentinel;
+    list->list_tail->next = elem;
+    list->list_tail = elem;
+
     /* Bump up the count */
     list->list_count++;
 
@@ -174,8 +237,17 @@ list_insert_head (list_t *list, list_elem_t *elem)
         return EINVAL;
     }
 
-    elem->next = list->list_head;
-    list->list_head = elem;
+    if (list_track(list, elem) != EOK) {
+        return EFAIL;
+    }
+
+    elem->next = list->list_sentinel.next;
+    list->list_sentinel.next = elem;
+
+    /* The first element is the tail as well */
+    if (list->list_tail == &list->list_sentinel) {
+        list->list_tail = elem;
+    }
 
     /* Bump up the count */
     list->list_count++;
@@ -210,9 +282,13 @@ list_insert_after (list_t *list, list_elem_t *prev_elem, list_elem_t *elem)
         return EINVAL;
     }
 
-    link = list->list_head;
-    while (link != NULL) {
+    link = list->list_sentinel.next;
+    while (link != &list->list_sentinel) {
         if (link == prev_elem) {
+            if (list_track(list, elem) != EOK) {
+                return EFAIL;
+            }
+
             elem->next = prev_elem->next;
             prev_elem->next = elem;
 
@@ -251,15 +327,14 @@ list_insert_before (list_t *list, list_elem_t *next_elem, list_elem_t *elem)
         return EINVAL;
     }
 
-    link = list->list_head;
-
-    /* Are we asked to insert before head? */
-    if (link == next_elem) {
-        return (list_insert_head(list, elem));
-    }
-
-    while (link != NULL) {
+    /* Start at the sentinel, so that the head needs no special case */
+    link = &list->list_sentinel;
+    while (link->next != &list->list_sentinel) {
         if (link->next == next_elem) {
+            if (list_track(list, elem) != EOK) {
+                return EFAIL;
+            }
+
             elem->next = next_elem;
             link->next = elem;
 
@@ -290,20 +365,17 @@ list_remove (list_t *list, list_elem_t *elem)
         return EINVAL;
     }
 
-    link = list->list_head;
-
-    /* Special case: Are we asked to remove the head? */
-    if (link == elem) {
-        list->list_head = link->next;
-        list->list_count--;
-        return EOK;
-    }
-
-    while (link != NULL) {
+    /* Start at the sentinel, so that the head needs no special case */
+    link = &list->list_sentinel;
+    while (link->next != &list->list_sentinel) {
         if (link->next == elem) {
             link->next = elem->next;
+            list_untrack(list, elem);
 
-            /* Are we asked to remove the tail? */
+            /*
+             * Are we asked to remove the tail? If it was the only
+             * element, the sentinel becomes the tail again.
+             */
             if (list->list_tail == elem) {
                 list->list_tail = link;
             }
@@ -341,7 +413,11 @@ list_default_cmp_fn (void *key1, void *key2)
  *
  * This routine tries to lookup an element in the given key using the
  * supplied key and a compare function. If no compare function is
- * passed, the default compare function is used.
+ * passed, the default compare function is used. On an indexed list,
+ * a find with no compare function or with the index's own goes through
+ * the index, and if several elements share the key any one of them may
+ * be returned, not necessarily the first in list order. Any other
+ * compare function walks the list.
  */
 void *
 list_find (list_t *list, void *key, int32_t (*cmp_fn)(void *key1, void *key2))
@@ -354,13 +430,19 @@ list_find (list_t *list, void *key, int32_t (*cmp_fn)(void *key1, void *key2))
         return NULL;
     }
 
+    /* Indexed lists don't need to be walked, for the key they index */
+    if (list->list_index &&
+        (!cmp_fn || cmp_fn == list->list_index->cmp_fn)) {
+        return (list_index_find(list->list_index, key, NULL));
+    }
+
     /* Use the default compare function ifnothing is passed */
     if (!cmp_fn) {
         cmp_fn = list_default_cmp_fn;
     }
 
-    elem = list->list_head;
-    while (elem != NULL) {
+    elem = list->list_sentinel.next;
+    while (elem != &list->list_sentinel) {
         elem_key = (void *)((uint8_t *)elem - list->list_offset);
 
         /* Compare the elements */
@@ -2,6 +2,7 @@
 #define LIST_H
 
 #include <stdint.h>
+#include "list_index.h"
 
 /* Defines */
 
@@ -21,17 +22,28 @@ typedef struct list_elem_ {
     struct list_elem_   *next;
 } list_elem_t;
 
+/*
+ * The list is circular, closed by a sentinel element kept in the list
+ * itself. The sentinel's next is the head and the tail's next is the
+ * sentinel, so an empty list is just the sentinel pointing to itself
+ * and no operation needs to check for a NULL head or tail.
+ */
 typedef struct list_ {
     char            list_name[MAX_NAME_LEN];
-    list_elem_t     *list_head;
-    list_elem_t     *list_tail;
+    list_elem_t     list_sentinel;
+    list_elem_t     *list_tail;     /* The sentinel when empty */
     uint32_t        list_offset;
     uint32_t        list_count;
+    list_index_t    *list_index;    /* Key index, NULL if not indexed */
 } list_t;
 
 /* Function prototypes */
 
 list_t* list_create (char *name, uint32_t list_offset);
+list_t* list_create_indexed (char *name, uint32_t list_offset,
+                             uint32_t (*hash_fn)(void *key),
+                             void* (*get_key)(void *elem),
+                             int32_t (*cmp_fn)(void *key, void *elem));
 int list_destroy (list_t *list);
 void* list_get_head (list_t *list);
 void* list_get_tail (list_t *list);
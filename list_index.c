@@ -0,0 +1,248 @@
+/*
+ * list_index.c - This file contains the hash index that can be kept
+ *                next to a list_t or an llist_t, so that finding an
+ *                element by its key doesn't need to walk the list.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "list_index.h"
+
+/*
+ * list_index_home
+ *
+ * Return the slot where the probe for the given hash starts. The hash
+ * is scrambled first, so that even a weak hash_fn, such as the id
+ * itself, spreads the elements over the whole table.
+ */
+static inline uint32_t
+list_index_home (list_index_t *index, uint32_t hash)
+{
+    return ((hash * 2654435769U) >> index->shift);
+}
+
+/*
+ * list_index_create
+ *
+ * Create an empty index. hash_fn hashes a key, get_key returns the key
+ * of an element and cmp_fn compares a key to an element, returning 0
+ * if they match.
+ */
+list_index_t *
+list_index_create (uint32_t (*hash_fn)(void *key),
+                   void* (*get_key)(void *elem),
+                   int32_t (*cmp_fn)(void *key, void *elem))
+{
+    list_index_t *index;
+
+    /* Sanity check */
+    if (!hash_fn || !get_key || !cmp_fn) {
+        return NULL;
+    }
+
+    index = (list_index_t *)malloc(sizeof(list_index_t));
+    if (!index) {
+        return NULL;
+    }
+
+    index->slots = (list_index_slot_t *)calloc(LIST_INDEX_INITIAL,
+                                               sizeof(list_index_slot_t));
+    if (!index->slots) {
+        free(index);
+        return NULL;
+    }
+
+    /* Initialize the contents */
+    index->size = LIST_INDEX_INITIAL;
+    index->shift = 32 - __builtin_ctz(LIST_INDEX_INITIAL);
+    index->count = 0;
+    index->hash_fn = hash_fn;
+    index->get_key = get_key;
+    index->cmp_fn = cmp_fn;
+
+    return index;
+}
+
+/*
+ * list_index_destroy
+ *
+ * Free the given index. The elements are not touched.
+ */
+void
+list_index_destroy (list_index_t *index)
+{
+    if (!index) {
+        return;
+    }
+
+    free(index->slots);
+    free(index);
+}
+
+/*
+ * list_index_grow
+ *
+ * Double the size of the table. The hashes are kept in the slots, so
+ * the elements are moved over without calling back into the user.
+ */
+static int
+list_index_grow (list_index_t *index)
+{
+    list_index_slot_t *old_slots = index->slots;
+    uint32_t old_size = index->size;
+    uint32_t i, slot, mask;
+
+    index->slots = (list_index_slot_t *)calloc(old_size * 2,
+                                               sizeof(list_index_slot_t));
+    if (!index->slots) {
+        index->slots = old_slots;
+        return EFAIL;
+    }
+    index->size = old_size * 2;
+    index->shift--;
+    mask = index->size - 1;
+
+    for (i = 0; i < old_size; i++) {
+        if (!old_slots[i].elem) {
+            continue;
+        }
+
+        slot = list_index_home(index, old_slots[i].hash);
+        while (index->slots[slot].elem) {
+            slot = (slot + 1) & mask;
+        }
+        index->slots[slot] = old_slots[i];
+    }
+
+    free(old_slots);
+
+    return EOK;
+}
+
+/*
+ * list_index_insert
+ *
+ * Add an element to the index. Elements with the same key can be added
+ * more than once.
+ */
+int
+list_index_insert (list_index_t *index, void *elem)
+{
+    uint32_t hash, slot, mask;
+
+    /* Sanity check */
+    if (!index || !elem) {
+        return EINVAL;
+    }
+
+    /* Keep the table at most 3/4 full */
+    if ((index->count + 1) * 4 > index->size * 3) {
+        if (list_index_grow(index) != EOK) {
+            return EFAIL;
+        }
+    }
+
+    hash = index->hash_fn(index->get_key(elem));
+    mask = index->size - 1;
+    slot = list_index_home(index, hash);
+    while (index->slots[slot].elem) {
+        slot = (slot + 1) & mask;
+    }
+
+    index->slots[slot].elem = elem;
+    index->slots[slot].hash = hash;
+    index->count++;
+
+    return EOK;
+}
+
+/*
+ * list_index_remove
+ *
+ * Drop an element from the index. Its key must not have changed since
+ * it was added.
+ */
+int
+list_index_remove (list_index_t *index, void *elem)
+{
+    uint32_t hash, slot, next, home, mask;
+
+    /* Sanity check */
+    if (!index || !elem) {
+        return EINVAL;
+    }
+
+    hash = index->hash_fn(index->get_key(elem));
+    mask = index->size - 1;
+    slot = list_index_home(index, hash);
+    while (index->slots[slot].elem != elem) {
+        if (!index->slots[slot].elem) {
+            return ENOTFOUND;
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    /*
+     * Close the gap by pulling back every following element of the run
+     * whose probe didn't start between the gap and where it sits now
+     */
+    next = slot;
+    for (;;) {
+        next = (next + 1) & mask;
+        if (!index->slots[next].elem) {
+            break;
+        }
+
+        home = list_index_home(index, index->slots[next].hash);
+        if (((next - home) & mask) >= ((next - slot) & mask)) {
+            index->slots[slot] = index->slots[next];
+            slot = next;
+        }
+    }
+    index->slots[slot].elem = NULL;
+    index->count--;
+
+    return EOK;
+}
+
+/*
+ * list_index_find
+ *
+ * Return an element matching the given key, NULL if there is none. If
+ * more than one element matches, any one of them may be returned. The
+ * key is compared with cmp_fn if one is passed, with the index's own
+ * otherwise.
+ */
+void *
+list_index_find (list_index_t *index, void *key,
+                 int32_t (*cmp_fn)(void *key, void *elem))
+{
+    list_index_slot_t *entry;
+    uint32_t hash, slot, mask;
+
+    /* Sanity check */
+    if (!index || !key) {
+        return NULL;
+    }
+
+    if (!cmp_fn) {
+        cmp_fn = index->cmp_fn;
+    }
+
+    hash = index->hash_fn(key);
+    mask = index->size - 1;
+    slot = list_index_home(index, hash);
+    for (;;) {
+        entry = &index->slots[slot];
+        if (!entry->elem) {
+            return NULL;
+        }
+        if (entry->hash == hash && cmp_fn(key, entry->elem) == 0) {
+            return entry->elem;
+        }
+        slot = (slot + 1) & mask;
+    }
+}
+
+/* End of File */
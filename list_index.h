@@ -0,0 +1,52 @@
+#ifndef LIST_INDEX_H
+#define LIST_INDEX_H
+
+#include <stdint.h>
+
+/* Defines */
+
+#define LIST_INDEX_INITIAL          64      /* Slots allocated up front, a power of 2 */
+
+#define TRUE                         1
+#define FALSE                        0
+
+#define EOK                          0
+#define EINVAL                      -1
+#define ENOTFOUND                   -2
+#define EFAIL                       -3
+
+/* Structure Definitions */
+
+typedef struct list_index_slot_ {
+    void            *elem;          /* NULL if the slot is free */
+    uint32_t        hash;           /* As returned by hash_fn */
+} list_index_slot_t;
+
+/*
+ * Hash table kept next to a list, mapping the key of every element on
+ * the list to the element. It uses open addressing with linear probing,
+ * and removal shifts the rest of the probe run back, so there are no
+ * tombstones. The table is doubled once it is 3/4 full.
+ */
+typedef struct list_index_ {
+    list_index_slot_t   *slots;
+    uint32_t            size;       /* A power of 2 */
+    uint32_t            shift;      /* 32 - log2(size) */
+    uint32_t            count;
+    uint32_t            (*hash_fn)(void *key);
+    void*               (*get_key)(void *elem);
+    int32_t             (*cmp_fn)(void *key, void *elem);
+} list_index_t;
+
+/* Function prototypes */
+
+list_index_t* list_index_create (uint32_t (*hash_fn)(void *key),
+                                 void* (*get_key)(void *elem),
+                                 int32_t (*cmp_fn)(void *key, void *elem));
+void list_index_destroy (list_index_t *index);
+int list_index_insert (list_index_t *index, void *elem);
+int list_index_remove (list_index_t *index, void *elem);
+void* list_index_find (list_index_t *index, void *key,
+                       int32_t (*cmp_fn)(void *key, void *elem));
+
+#endif /* LIST_INDEX_H */
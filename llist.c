@@ -26,7 +26,38 @@ llist_create (char *name, uint32_t offset)
     strncpy(new_list->list_name, name, strlen(name));
     new_list->list_offset = offset;
     new_list->list_count = 0;
-    new_list->list_head = NULL;
+    new_list->list_sentinel.next = &new_list->list_sentinel;
+    new_list->list_sentinel.prev = &new_list->list_sentinel;
+    new_list->list_sentinel.owner = NULL;
+    new_list->list_index = NULL;
+
+    return new_list;
+}
+
+/*
+ * llist_create_indexed
+ *
+ * Create an empty list which also keeps a hash index of its elements,
+ * as list_create_indexed() does for singly linked lists
+ */
+llist_t *
+llist_create_indexed (char *name, uint32_t offset,
+                      uint32_t (*hash_fn)(void *key),
+                      void* (*get_key)(void *elem),
+                      int32_t (*cmp_fn)(void *key, void *elem))
+{
+    llist_t  *new_list;
+
+    new_list = llist_create(name, offset);
+    if (!new_list) {
+        return NULL;
+    }
+
+    new_list->list_index = list_index_create(hash_fn, get_key, cmp_fn);
+    if (!new_list->list_index) {
+        free(new_list);
+        return NULL;
+    }
 
     return new_list;
 }
@@ -40,11 +71,12 @@ int
 llist_destroy (llist_t *list)
 {   
     /* Bail if the list is not empty */
-    if (!list_empty(list)) {
+    if (!llist_empty(list)) {
         return EFAIL;
     }
 
     /* Do the deed */
+    list_index_destroy(list->list_index);
     free(list);
 
     return EOK; 
@@ -53,27 +85,31 @@ llist_destroy (llist_t *list)
 /*
  * llist_get_head
  *
- * Return a pointer to the head
+ * Return a pointer to the head, NULL if the list is empty
  */
 void *
 llist_get_head (llist_t *list)
 {
-    void *elem = (uint8_t *)list->list_head - list->list_offset;
+    if (llist_empty(list)) {
+        return NULL;
+    }
 
-    return elem;
+    return ((void *)((uint8_t *)list->list_sentinel.next - list->list_offset));
 }
 
 /*
  * llist_get_tail
  *
- * Return a pointer to the tail
+ * Return a pointer to the tail, NULL if the list is empty
  */
 void *
 llist_get_tail (llist_t *list)
 {
-    void *elem = (uint8_t *)list->list_tail - list->list_offset;
+    if (llist_empty(list)) {
+        return NULL;
+    }
 
-    return elem;
+    return ((void *)((uint8_t *)list->list_sentinel.prev - list->list_offset));
 }
 
 /*
@@ -94,7 +130,8 @@ llist_get_next (llist_t *list, void *prev_elem)
     elem = (llist_elem_t *)((uint8_t *)prev_elem + list->list_offset);
     elem = elem->next;
 
-    if (!elem) {
+    /* Past the tail */
+    if (elem == &list->list_sentinel) {
         return NULL;
     }
 
@@ -119,7 +156,8 @@ llist_get_prev (llist_t *list, void *next_elem)
     elem = (llist_elem_t *)((uint8_t *)next_elem + list->list_offset);
     elem = elem->prev;
 
-    if (!elem) {
+    /* Before the head */
+    if (elem == &list->list_sentinel) {
         return NULL;
     }
 
@@ -152,6 +190,40 @@ llist_empty (llist_t *list)
     return FALSE;
 }
 
+/*
+ * llist_link
+ *
+ * Splice an element in after prev_elem, which is either on the list or
+ * the sentinel. The sentinel closes the ring, so the head and the tail
+ * need no special handling. Fails if the element is on a list already,
+ * or can't be added to the index of the list.
+ */
+static inline int
+llist_link (llist_t *list, llist_elem_t *prev_elem, llist_elem_t *elem)
+{
+    /* Linking it in twice would break both rings */
+    if (elem->owner != NULL) {
+        return EFAIL;
+    }
+
+    if (list->list_index &&
+        list_index_insert(list->list_index,
+                          (uint8_t *)elem - list->list_offset) != EOK) {
+        return EFAIL;
+    }
+
+    elem->next = prev_elem->next;
+    elem->prev = prev_elem;
+    elem->owner = list;
+    prev_elem->next->prev = elem;
+    prev_elem->next = elem;
+
+    /* Bump up the count */
+    list->list_count++;
+
+    return EOK;
+}
+
 /*
  * llist_insert
  *
@@ -160,32 +232,12 @@ llist_empty (llist_t *list)
 int
 llist_insert (llist_t *list, llist_elem_t *elem)
 {
-    llist_elem_t *link;
-
     /* Sanity check */
     if (!list || !elem) {
         return EINVAL;
     }
 
-    if (list_empty(list)) {
-        /* First element */
-        list->list_head = elem;
-        list->list_tail = elem;
-        elem->next = NULL;
-        elem->next = NULL;
-    } else {
-        /* Insert it in the end */
-        link = list->list_tail;
-        elem->next = NULL;
-        elem->prev = link;
-        link->next = elem;
-        list->list_tail = elem;
-    }
-
-    /* Bump up the count */
-    list->list_count++;
-
-    return EOK;
+    return (llist_link(list, list->list_sentinel.prev, elem));
 }
 
 /*
@@ -201,15 +253,7 @@ llist_insert_head (llist_t *list, llist_elem_t *elem)
         return EINVAL;
     }
 
-    elem->next = list->list_head;
-    elem->prev = NULL;
-    list->list_head->prev = elem;
-    list->list_head = elem;
-
-    /* Bump up the count */
-    list->list_count++;
-
-    return EOK;
+    return (llist_link(list, &list->list_sentinel, elem));
 }
 
 /*
@@ -220,51 +264,29 @@ llist_insert_head (llist_t *list, llist_elem_t *elem)
 int
 llist_insert_tail (llist_t *list, llist_elem_t *elem)
 {
-    /* Just call list_insert */
-    return (list_insert(list, elem));
+    /* Just call llist_insert */
+    return (llist_insert(list, elem));
 }
 
 /*
  * llist_insert_after
  *
- * Insert an element after the given element
+ * Insert an element after the given element. prev_elem's owner tag
+ * tells whether it is on this list, so there is nothing to walk.
  */
 int 
 llist_insert_after (llist_t *list, llist_elem_t *prev_elem, llist_elem_t *elem)
 {
-    llist_elem_t *link;
-
     /* Sanity check */
     if (!list || !prev_elem || !elem) {
         return EINVAL;
     }
 
-    link = list->list_head;
-    while (link != NULL) {
-        if (link == prev_elem) {
-            elem->next = prev_elem->next;
-            elem->prev = prev_elem;
-            prev_elem->next = elem;
-            prev_elem->next->prev = elem;
-
-            /* 
-             * Update the tail pointer if we are asked to insert after the
-             * tail
-             */
-            if (list->list_tail == prev_elem) {
-                list->list_tail = elem;
-            }
-
-            /* Bump up the count */
-            list->list_count++;
-
-            return EOK;
-        }
-
-        link = link->next;
+    if (prev_elem->owner != list) {
+        return ENOTFOUND;
     }
 
-    return ENOTFOUND;
+    return (llist_link(list, prev_elem, elem));
 }
 
 /*
@@ -275,86 +297,53 @@ llist_insert_after (llist_t *list, llist_elem_t *prev_elem, llist_elem_t *elem)
 int
 llist_insert_before (llist_t *list, llist_elem_t *next_elem, llist_elem_t *elem)
 {
-    llist_elem_t *link;
-
     /* Sanity check */
     if (!list || !next_elem || !elem) {
         return EINVAL;
     }
 
-    link = list->list_head;
-
-    /* Are we asked to insert before head? */
-    if (link == next_elem) {
-        return (list_insert_head(list, elem));
+    if (next_elem->owner != list) {
+        return ENOTFOUND;
     }
 
-    while (link != NULL) {
-        if (link->next == next_elem) {
-            elem->next = next_elem;
-            elem->prev = link;
-            link->next = elem;
-            next_elem->prev = elem;
-
-            /* Bump up the count */
-            list->list_count++;
-
-            return EOK;
-        }
-
-        link = link->next;
-    }
-
-    return ENOTFOUND;
+    return (llist_link(list, next_elem->prev, elem));
 }
 
 /*
  * llist_remove
  *
- * Remove an element from the list
+ * Remove an element from the list in constant time. Returns ENOTFOUND
+ * if the element is not on this list.
  */
 int
 llist_remove (llist_t *list, llist_elem_t *elem)
 {
-    llist_elem_t *link;
-
     /* Sanity check */
     if (!list || !elem) {
         return EINVAL;
     }
 
-    link = list->list_head;
+    if (elem->owner != list) {
+        return ENOTFOUND;
+    }
 
-    /* Special case: Are we asked to remove the head? */
-    if (link == elem) {
-        list->list_head = link->next;
-        list->list_head->prev =  NULL;
-        list->list_count--;
-        return EOK;
+    if (list->list_index) {
+        list_index_remove(list->list_index,
+                          (uint8_t *)elem - list->list_offset);
     }
 
-    while (link != NULL) {
-        if (link->next == elem) {
-            link->next = elem->next;
-            if (elem->next) {
-                elem->next->prev = link;
-            }
+    /* Unlink it. The head and the tail are linked to the sentinel. */
+    elem->prev->next = elem->next;
+    elem->next->prev = elem->prev;
 
-            /* Are we asked to remove the tail? */
-            if (list->list_tail == elem) {
-                list->list_tail = link;
-            }
+    elem->next = NULL;
+    elem->prev = NULL;
+    elem->owner = NULL;
 
-            /* Update the count */
-            list->list_count--;
+    /* Update the count */
+    list->list_count--;
 
-            return EOK;
-        }
-
-        link = link->next;
-    }
-
-    return ENOTFOUND;
+    return EOK;
 }
 
 /*
@@ -378,7 +367,11 @@ llist_default_cmp_fn (void *key1, void *key2)
  *
  * This routine tries to lookup an element in the given key using the
  * supplied key and a compare function. If no compare function is
- * passed, the default compare function is used.
+ * passed, the default compare function is used. On an indexed list,
+ * a find with no compare function or with the index's own goes through
+ * the index, and if several elements share the key any one of them may
+ * be returned, not necessarily the first in list order. Any other
+ * compare function walks the list.
  */
 void *
 llist_find (llist_t *list, void *key, int32_t (*cmp_fn)(void *key1, void *key2))
@@ -391,13 +384,19 @@ llist_find (llist_t *list, void *key, int32_t (*cmp_fn)(void *key1, void *key2))
         return NULL;
     }
 
+    /* Indexed lists don't need to be walked, for the key they index */
+    if (list->list_index &&
+        (!cmp_fn || cmp_fn == list->list_index->cmp_fn)) {
+        return (list_index_find(list->list_index, key, NULL));
+    }
+
     /* Use the default compare function ifnothing is passed */
     if (!cmp_fn) {
         cmp_fn = llist_default_cmp_fn;
     }
 
-    elem = list->list_head;
-    while (elem != NULL) {
+    elem = list->list_sentinel.next;
+    while (elem != &list->list_sentinel) {
         elem_key = (void *)((uint8_t *)elem - list->list_offset);
 
         /* Compare the elements */
@@ -2,6 +2,7 @@
 #define LLIST_H
 
 #include <stdint.h>
+#include "list_index.h"
 
 /* Defines */
 
@@ -17,22 +18,39 @@
 
 /* Structure Definitions */
 
+/*
+ * Link embedded in every list element. owner tells which list the
+ * element is on, so that inserting next to an element or removing it
+ * can check its membership without walking the list. An element must
+ * start out with owner NULL, e.g. zeroed, before it is first inserted.
+ */
 typedef struct llist_elem_ {
     struct llist_elem_   *next;
-    struct llist_elem_   *prev;    
+    struct llist_elem_   *prev;
+    struct llist_        *owner;    /* NULL when not on a list */
 } llist_elem_t;
 
+/*
+ * The list is circular, closed by a sentinel element kept in the list
+ * itself. Its next is the head and its prev the tail, so an empty list
+ * is just the sentinel pointing to itself both ways and splicing never
+ * has to special-case the ends.
+ */
 typedef struct llist_ {
     char            list_name[MAX_NAME_LEN];
-    llist_elem_t    *list_head;
-    llist_elem_t    *list_tail;
+    llist_elem_t    list_sentinel;  /* Never on the list, owner is NULL */
     uint32_t        list_offset;
     uint32_t        list_count;
+    list_index_t    *list_index;    /* Key index, NULL if not indexed */
 } llist_t;
 
 /* Function prototypes */
 
 llist_t* llist_create (char *name, uint32_t list_offset);
+llist_t* llist_create_indexed (char *name, uint32_t list_offset,
+                               uint32_t (*hash_fn)(void *key),
+                               void* (*get_key)(void *elem),
+                               int32_t (*cmp_fn)(void *key, void *elem));
 int llist_destroy (llist_t *list);
 void* llist_get_head (llist_t *list);
 void* llist_get_tail (llist_t *list);
@@ -0,0 +1,344 @@
+/*
+ * queue.c - This file contains lock-free queues of objects which embed
+ *           a list_elem_t: an unbounded one for many producers and a
+ *           single consumer, and a bounded ring for many producers and
+ *           many consumers
+ */
+
+/*
+ * The unbounded queue is a chain of elements from tail (oldest) to head
+ * (newest), always holding at least the stub element:
+ *
+ *      tail                                    head
+ *       |                                       |
+ *      stub  -->  elem  -->  elem  -->  ...  -->  elem  --> NULL
+ *
+ * A producer swaps its element in as the new head with one atomic
+ * exchange and only then links the old head to it. Until that second
+ * store lands, the consumer sees the chain end early and reports the
+ * queue as empty, so the consumer has to poll. The consumer puts the
+ * stub back in when it is about to take the last element, so that the
+ * chain never runs dry under the producers.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "queue.h"
+
+#define QUEUE_LOAD(ptr)         __atomic_load_n(&(ptr), __ATOMIC_ACQUIRE)
+#define QUEUE_STORE(ptr, val)   __atomic_store_n(&(ptr), (val), __ATOMIC_RELEASE)
+
+/*
+ * queue_create
+ *
+ * Create an empty queue and return a pointer to it
+ */
+queue_t *
+queue_create (char *name, uint32_t offset)
+{
+    queue_t *queue;
+
+    if (posix_memalign((void **)&queue, QUEUE_CACHE_LINE, sizeof(queue_t))) {
+        return NULL;
+    }
+
+    /* Initialize the contents */
+    memset(queue, 0, sizeof(queue_t));
+    strncpy(queue->queue_name, name, MAX_NAME_LEN - 1);
+    queue->queue_offset = offset;
+    queue->stub.next = NULL;
+    queue->head = &queue->stub;
+    queue->tail = &queue->stub;
+
+    return queue;
+}
+
+/*
+ * queue_destroy
+ *
+ * Free the given queue
+ */
+int
+queue_destroy (queue_t *queue)
+{
+    /* Bail if the queue is not empty */
+    if (!queue_empty(queue)) {
+        return EFAIL;
+    }
+
+    /* Do the deed */
+    free(queue);
+
+    return EOK;
+}
+
+/*
+ * queue_empty
+ *
+ * Returns true if the queue is empty. False otherwise. Only meant for
+ * the consumer.
+ */
+uint8_t
+queue_empty (queue_t *queue)
+{
+    if (queue->tail == &queue->stub &&
+        QUEUE_LOAD(queue->head) == &queue->stub) {
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+/*
+ * queue_enqueue
+ *
+ * Add an element at the head of the queue. Any number of threads can
+ * do this at the same time. Never blocks and never fails for a valid
+ * element.
+ */
+int
+queue_enqueue (queue_t *queue, list_elem_t *elem)
+{
+    list_elem_t *prev;
+
+    /* Sanity check */
+    if (!queue || !elem) {
+        return EINVAL;
+    }
+
+    __atomic_store_n(&elem->next, NULL, __ATOMIC_RELAXED);
+    prev = __atomic_exchange_n(&queue->head, elem, __ATOMIC_ACQ_REL);
+
+    /* The consumer can't get past prev until this lands */
+    QUEUE_STORE(prev->next, elem);
+
+    return EOK;
+}
+
+/*
+ * queue_dequeue
+ *
+ * Take the oldest object off the queue. Must only be called by one
+ * thread at a time. Returns NULL if the queue is empty, and also if a
+ * producer is half way through adding the next element, in which case
+ * it will be there on a later call.
+ */
+void *
+queue_dequeue (queue_t *queue)
+{
+    list_elem_t *tail, *next, *head;
+
+    /* Sanity check */
+    if (!queue) {
+        return NULL;
+    }
+
+    tail = queue->tail;
+    next = QUEUE_LOAD(tail->next);
+
+    /* Step over the stub */
+    if (tail == &queue->stub) {
+        if (!next) {
+            return NULL;
+        }
+        queue->tail = next;
+        tail = next;
+        next = QUEUE_LOAD(next->next);
+    }
+
+    if (next) {
+        queue->tail = next;
+        return ((void *)((uint8_t *)tail - queue->queue_offset));
+    }
+
+    /* tail looks like the last one. Is a producer still linking to it? */
+    head = QUEUE_LOAD(queue->head);
+    if (tail != head) {
+        return NULL;
+    }
+
+    /* Put the stub back behind it, so that tail can be handed out */
+    queue_enqueue(queue, &queue->stub);
+    next = QUEUE_LOAD(tail->next);
+    if (next) {
+        queue->tail = next;
+        return ((void *)((uint8_t *)tail - queue->queue_offset));
+    }
+
+    return NULL;
+}
+
+/*
+ * queue_ring_create
+ *
+ * Create an empty bounded queue holding up to size objects, rounded up
+ * to a power of 2
+ */
+queue_ring_t *
+queue_ring_create (char *name, uint32_t offset, uint32_t size)
+{
+    queue_ring_t *ring;
+    uint32_t cells = 2, i;
+
+    /* Sanity check */
+    if (!size || size > (1U << 31)) {
+        return NULL;
+    }
+
+    while (cells < size) {
+        cells *= 2;
+    }
+
+    if (posix_memalign((void **)&ring, QUEUE_CACHE_LINE,
+                       sizeof(queue_ring_t))) {
+        return NULL;
+    }
+
+    /* Initialize the contents */
+    memset(ring, 0, sizeof(queue_ring_t));
+    ring->cells = (queue_cell_t *)malloc(cells * sizeof(queue_cell_t));
+    if (!ring->cells) {
+        free(ring);
+        return NULL;
+    }
+    for (i = 0; i < cells; i++) {
+        ring->cells[i].seq = i;
+        ring->cells[i].obj = NULL;
+    }
+    strncpy(ring->queue_name, name, MAX_NAME_LEN - 1);
+    ring->queue_offset = offset;
+    ring->mask = cells - 1;
+
+    return ring;
+}
+
+/*
+ * queue_ring_destroy
+ *
+ * Free the given bounded queue
+ */
+int
+queue_ring_destroy (queue_ring_t *ring)
+{
+    /* Bail if the queue is not empty */
+    if (!queue_ring_empty(ring)) {
+        return EFAIL;
+    }
+
+    /* Do the deed */
+    free(ring->cells);
+    free(ring);
+
+    return EOK;
+}
+
+/*
+ * queue_ring_empty
+ *
+ * Returns true if the bounded queue was empty at the time of the call.
+ * False otherwise.
+ */
+uint8_t
+queue_ring_empty (queue_ring_t *ring)
+{
+    if (__atomic_load_n(&ring->dequeue_pos, __ATOMIC_ACQUIRE) ==
+        __atomic_load_n(&ring->enqueue_pos, __ATOMIC_ACQUIRE)) {
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+/*
+ * queue_ring_enqueue
+ *
+ * Add an object to the bounded queue. Any number of threads can do this
+ * at the same time. Returns EFAIL if the queue is full.
+ */
+int
+queue_ring_enqueue (queue_ring_t *ring, list_elem_t *elem)
+{
+    queue_cell_t *cell;
+    uint64_t pos, seq;
+    int64_t diff;
+
+    /* Sanity check */
+    if (!ring || !elem) {
+        return EINVAL;
+    }
+
+    pos = __atomic_load_n(&ring->enqueue_pos, __ATOMIC_RELAXED);
+    for (;;) {
+        cell = &ring->cells[pos & ring->mask];
+        seq = QUEUE_LOAD(cell->seq);
+        diff = (int64_t)(seq - pos);
+        if (diff == 0) {
+            /* The cell is free, claim the position */
+            if (__atomic_compare_exchange_n(&ring->enqueue_pos, &pos, pos + 1,
+                                            TRUE, __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            /* Still holds what was written a lap ago */
+            return EFAIL;
+        } else {
+            pos = __atomic_load_n(&ring->enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+
+    cell->obj = (uint8_t *)elem - ring->queue_offset;
+    QUEUE_STORE(cell->seq, pos + 1);
+
+    return EOK;
+}
+
+/*
+ * queue_ring_dequeue
+ *
+ * Take the oldest object off the bounded queue. Any number of threads
+ * can do this at the same time. Returns NULL if the queue is empty.
+ */
+void *
+queue_ring_dequeue (queue_ring_t *ring)
+{
+    queue_cell_t *cell;
+    uint64_t pos, seq;
+    int64_t diff;
+    void *obj;
+
+    /* Sanity check */
+    if (!ring) {
+        return NULL;
+    }
+
+    pos = __atomic_load_n(&ring->dequeue_pos, __ATOMIC_RELAXED);
+    for (;;) {
+        cell = &ring->cells[pos & ring->mask];
+        seq = QUEUE_LOAD(cell->seq);
+        diff = (int64_t)(seq - (pos + 1));
+        if (diff == 0) {
+            /* The cell has been written, claim the position */
+            if (__atomic_compare_exchange_n(&ring->dequeue_pos, &pos, pos + 1,
+                                            TRUE, __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            /* Nothing written here yet */
+            return NULL;
+        } else {
+            pos = __atomic_load_n(&ring->dequeue_pos, __ATOMIC_RELAXED);
+        }
+    }
+
+    obj = cell->obj;
+
+    /* Free the cell for the producer one lap ahead */
+    QUEUE_STORE(cell->seq, pos + ring->mask + 1);
+
+    return obj;
+}
+
+/* End of File */
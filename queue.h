@@ -0,0 +1,77 @@
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#include <stdint.h>
+#include "list.h"
+
+/* Defines */
+
+#define MAX_NAME_LEN                64
+#define QUEUE_CACHE_LINE            64
+
+#define TRUE                         1
+#define FALSE                        0
+
+#define EOK                          0
+#define EINVAL                      -1
+#define ENOTFOUND                   -2
+#define EFAIL                       -3
+
+/* Structure Definitions */
+
+/*
+ * Unbounded lock-free queue with any number of producers and a single
+ * consumer. Objects are linked through the list_elem_t they embed, so
+ * enqueueing allocates nothing, and an object can't be on a list and on
+ * a queue through the same link at the same time.
+ *
+ * Producers only ever swap themselves in at head, the consumer only
+ * ever moves tail along, and they sit on separate cache lines. The stub
+ * element keeps the chain from ever becoming empty.
+ */
+typedef struct queue_ {
+    list_elem_t     *head __attribute__((aligned(QUEUE_CACHE_LINE)));
+    list_elem_t     *tail __attribute__((aligned(QUEUE_CACHE_LINE)));
+    list_elem_t     stub;
+    char            queue_name[MAX_NAME_LEN];
+    uint32_t        queue_offset;
+} queue_t;
+
+/* Slot of a queue_ring_t */
+typedef struct queue_cell_ {
+    uint64_t        seq;        /* Position it can be written at, or read at + 1 */
+    void            *obj;
+} queue_cell_t;
+
+/*
+ * Bounded lock-free queue with any number of producers and consumers.
+ * Objects are kept by pointer in a ring of cells allocated up front.
+ * Producers and consumers each claim a position with a compare and
+ * swap, and the cell's sequence number tells whether it is ready to be
+ * written or read. A consumer which gets to a cell before the producer
+ * that claimed it has filled it in sees the queue as empty.
+ */
+typedef struct queue_ring_ {
+    uint64_t        enqueue_pos __attribute__((aligned(QUEUE_CACHE_LINE)));
+    uint64_t        dequeue_pos __attribute__((aligned(QUEUE_CACHE_LINE)));
+    queue_cell_t    *cells __attribute__((aligned(QUEUE_CACHE_LINE)));
+    uint32_t        mask;       /* Number of cells - 1 */
+    char            queue_name[MAX_NAME_LEN];
+    uint32_t        queue_offset;
+} queue_ring_t;
+
+/* Function prototypes */
+
+queue_t* queue_create (char *name, uint32_t queue_offset);
+int queue_destroy (queue_t *queue);
+uint8_t queue_empty (queue_t *queue);
+int queue_enqueue (queue_t *queue, list_elem_t *elem);
+void* queue_dequeue (queue_t *queue);
+queue_ring_t* queue_ring_create (char *name, uint32_t queue_offset,
+                                 uint32_t size);
+int queue_ring_destroy (queue_ring_t *ring);
+uint8_t queue_ring_empty (queue_ring_t *ring);
+int queue_ring_enqueue (queue_ring_t *ring, list_elem_t *elem);
+void* queue_ring_dequeue (queue_ring_t *ring);
+
+#endif /* QUEUE_H */
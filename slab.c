@@ -0,0 +1,153 @@
+/*
+ * slab.c - This file contains a simple slab allocator for fixed size
+ *          objects. Objects are carved out of large chunks, freed
+ *          objects are reused before new ones are carved, and all the
+ *          chunks are released together when the slab is destroyed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "slab.h"
+
+/*
+ * slab_create
+ *
+ * Create a slab handing out objects of the given size, allocated from
+ * the system objs_per_chunk at a time
+ */
+slab_t *
+slab_create (uint32_t obj_size, uint32_t objs_per_chunk)
+{
+    slab_t  *slab;
+
+    /* Sanity check */
+    if (!obj_size || !objs_per_chunk) {
+        return NULL;
+    }
+
+    slab = (slab_t *)malloc(sizeof(slab_t));
+    if (!slab) {
+        return NULL;
+    }
+
+    /* Initialize the contents. Every object must be able to hold a link */
+    if (obj_size < sizeof(void *)) {
+        obj_size = sizeof(void *);
+    }
+    slab->obj_size = (obj_size + 7) & ~7U;
+    slab->objs_per_chunk = objs_per_chunk;
+    slab->chunk_used = objs_per_chunk;
+    slab->chunk_count = 0;
+    slab->obj_count = 0;
+    slab->chunks = NULL;
+    slab->free_list = NULL;
+
+    return slab;
+}
+
+/*
+ * slab_reset
+ *
+ * Release every chunk in one go. All objects handed out so far become
+ * invalid.
+ */
+void
+slab_reset (slab_t *slab)
+{
+    slab_chunk_t    *chunk, *next;
+
+    for (chunk = slab->chunks; chunk != NULL; chunk = next) {
+        next = chunk->next;
+        free(chunk);
+    }
+
+    slab->chunks = NULL;
+    slab->chunk_used = slab->objs_per_chunk;
+    slab->chunk_count = 0;
+    slab->obj_count = 0;
+    slab->free_list = NULL;
+}
+
+/*
+ * slab_destroy
+ *
+ * Free the given slab along with every object allocated from it
+ */
+int
+slab_destroy (slab_t *slab)
+{
+    /* Sanity check */
+    if (!slab) {
+        return EINVAL;
+    }
+
+    /* Do the deed */
+    slab_reset(slab);
+    free(slab);
+
+    return EOK;
+}
+
+/*
+ * slab_alloc
+ *
+ * Return an uninitialized object. Freed objects are handed out first,
+ * then the rest of the current chunk, and only then is a new chunk
+ * allocated.
+ */
+void *
+slab_alloc (slab_t *slab)
+{
+    slab_chunk_t    *chunk;
+    void            *obj;
+
+    obj = slab->free_list;
+    if (obj) {
+        slab->free_list = *(void **)obj;
+        slab->obj_count++;
+        return obj;
+    }
+
+    if (slab->chunk_used == slab->objs_per_chunk) {
+        chunk = (slab_chunk_t *)malloc(sizeof(slab_chunk_t) +
+                                       (size_t)slab->obj_size *
+                                       slab->objs_per_chunk);
+        if (!chunk) {
+            return NULL;
+        }
+
+        chunk->next = slab->chunks;
+        slab->chunks = chunk;
+        slab->chunk_used = 0;
+        slab->chunk_count++;
+    }
+
+    obj = (uint8_t *)(slab->chunks + 1) +
+          (size_t)slab->obj_size * slab->chunk_used;
+    slab->chunk_used++;
+    slab->obj_count++;
+
+    return obj;
+}
+
+/*
+ * slab_free
+ *
+ * Give an object back to the slab. The memory stays with the slab and
+ * is reused by the next slab_alloc().
+ */
+void
+slab_free (slab_t *slab, void *obj)
+{
+    /* Sanity check */
+    if (!obj) {
+        return;
+    }
+
+    *(void **)obj = slab->free_list;
+    slab->free_list = obj;
+    slab->obj_count--;
+}
+
+/* End of File */
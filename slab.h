@@ -0,0 +1,45 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stdint.h>
+
+/* Defines */
+
+#define TRUE                         1
+#define FALSE                        0
+
+#define EOK                          0
+#define EINVAL                      -1
+#define ENOTFOUND                   -2
+#define EFAIL                       -3
+
+/* Structure Definitions */
+
+/*
+ * A chunk of objects carved out of a single malloc(). The objects
+ * follow the header.
+ */
+typedef struct slab_chunk_ {
+    struct slab_chunk_  *next;
+    uint64_t            pad;        /* Keeps the objects 16 byte aligned */
+} slab_chunk_t;
+
+typedef struct slab_ {
+    uint32_t        obj_size;       /* Rounded up to a multiple of 8 */
+    uint32_t        objs_per_chunk;
+    uint32_t        chunk_used;     /* Objects carved out of the newest chunk */
+    uint32_t        chunk_count;
+    uint32_t        obj_count;      /* Objects currently allocated */
+    slab_chunk_t    *chunks;        /* Most recent chunk first */
+    void            *free_list;     /* Freed objects, linked through their first word */
+} slab_t;
+
+/* Function prototypes */
+
+slab_t* slab_create (uint32_t obj_size, uint32_t objs_per_chunk);
+int slab_destroy (slab_t *slab);
+void* slab_alloc (slab_t *slab);
+void slab_free (slab_t *slab, void *obj);
+void slab_reset (slab_t *slab);
+
+#endif /* SLAB_H */
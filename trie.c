@@ -10,47 +10,282 @@
  * parent pointer. The set containing keys ann, andrew, annabel
  * and dilbert will be represented as:
  * 
- *       a ---------------> d
- *       n                  i
- *       n--------> d       l
- *       0--> a     r       b
- *            b     e       e
- *            e     w       r
- *            l     0       t
- *            0             0
+ *       a ---------------------> d
+ *       n                        i
+ *       d --------> n            l
+ *       r           0 --> a      b
+ *       e                 b      e
+ *       w                 e      r
+ *       0                 l      t
+ *                         0      0
  *          
+ * The 0 nodes are leaf nodes, which carry a flag of their own, so keys
+ * may hold any byte, 0 included, when given with their length through
+ * the *_len() calls. The siblings at each level are kept sorted by
+ * character, with the leaf of a key ending there coming first. A
+ * lookup gives up as soon as it has gone past the character it is
+ * looking for, and the keys come out in lexicographic order from
+ * trie_get_least()/trie_get_next().
+ *
  * 
+ * The trie nodes are carved out of a slab owned by the trie instead of
+ * being malloc'ed one character at a time. Removed nodes go back to the
+ * slab for reuse, and the whole slab is released in one go when the
+ * trie is cleared or destroyed.
+ *
+ * Tries created with TRIE_FLAG_RADIX collapse every chain of single
+ * child nodes into one node carrying the whole run of characters as
+ * its edge label, and mark the nodes where a key ends instead of
+ * hanging a 0 node off them. The same set of keys is then held as:
+ *
+ *       an --------------> dilbert*
+ *       drew* ---> n*
+ *                  abel*
+ *
+ * where * marks a node holding a key. A node only exists where keys
+ * branch or end, so a key costs at most two nodes however long it is.
+ *
+ * As in an adaptive radix tree, the children of a radix node are held
+ * in an array sized to how many there are: sorted arrays of 4 or 16
+ * bytes, a 256 entry index into 48 slots, or 256 direct slots. Finding
+ * the child for the next character is then a short scan, a single
+ * vector compare or a plain array index, instead of a walk down a list
+ * of siblings. Nodes holding a key and nothing else carry no array at
+ * all. All the types keep the children in byte order, so the keys come
+ * out sorted from trie_get_least()/trie_get_next().
+ *
+ * Either kind of trie can be saved with trie_serialize() as an image
+ * laid out like a radix trie, with offsets in place of pointers and a
+ * copy of every record. trie_open_mmap() maps such an image read only
+ * and serves lookups, cursors and prefix searches straight from it.
+ *
+ * A trie which won't change any more can be compiled in place into a
+ * double array with trie_freeze(). Each state is then a slot of two
+ * parallel arrays, base and check, and following a byte is one add and
+ * one compare instead of a search among the children.
+ *
+ * Radix tries created with TRIE_FLAG_CONCURRENT can be read by any
+ * number of threads while others update them. Readers take no locks.
+ * Writers lock only the part of the trie under the first byte of their
+ * key, so writers of keys starting with different bytes run side by
+ * side. The root is a TRIE_NODE_256 which never moves, and below it a
+ * node is never changed in a way a reader could trip over: a new copy
+ * is made with the change and swapped in with a single store. The old
+ * node is freed once the readers which might still be on it have gone,
+ * through epoch based reclamation (see epoch.c).
  */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "trie.h"
 
+#define TRIE_LOAD(ptr)          __atomic_load_n(&(ptr), __ATOMIC_ACQUIRE)
+#define TRIE_STORE(ptr, val)    __atomic_store_n(&(ptr), (val), __ATOMIC_RELEASE)
+#define TRIE_PREFETCH(ptr)      __builtin_prefetch(ptr)
+
+static trie_radix_node_t* trie_radix_alloc_node (trie_t *trie, uint8_t type,
+                                                 trie_radix_node_t *parent,
+                                                 char *label, uint32_t len);
+
 /*
- * trie_create
+ * Size of each type of radix node, indexed by TRIE_NODE_*
+ */
+static const uint32_t trie_radix_node_size[TRIE_NODE_TYPES] = {
+    sizeof(trie_radix_node_t),
+    sizeof(trie_node4_t),
+    sizeof(trie_node16_t),
+    sizeof(trie_node48_t),
+    sizeof(trie_node256_t),
+};
+
+/*
+ * Most children each type of radix node can hold, and the number of
+ * children at which it is shrunk to the next smaller type. The slack
+ * keeps a node from flipping between two types.
+ */
+static const uint16_t trie_radix_node_capacity[TRIE_NODE_TYPES] = {
+    0, 4, 16, 48, 256
+};
+static const uint16_t trie_radix_node_shrink[TRIE_NODE_TYPES] = {
+    0, 0, 3, 12, 40
+};
+
+/*
+ * trie_destroy_slabs
  *
- * Create an instance of the trie and return a pointer to it
+ * Release the node slabs of the given trie along with every node in them
+ */
+static void
+trie_destroy_slabs (trie_t *trie)
+{
+    uint8_t type;
+
+    if (trie->node_slab) {
+        slab_destroy(trie->node_slab);
+    }
+    for (type = 0; type < TRIE_NODE_TYPES; type++) {
+        if (trie->radix_slab[type]) {
+            slab_destroy(trie->radix_slab[type]);
+        }
+    }
+}
+
+/*
+ * trie_concurrent_fini
+ *
+ * Release the locks and the epoch of a concurrent trie. Whatever was
+ * retired and not freed yet is freed first.
+ */
+static void
+trie_concurrent_fini (trie_t *trie)
+{
+    uint32_t    i;
+
+    if (trie->epoch) {
+        epoch_destroy(trie->epoch);
+        trie->epoch = NULL;
+    }
+    if (trie->write_locks) {
+        for (i = 0; i < TRIE_LOCK_STRIPES; i++) {
+            pthread_mutex_destroy(&trie->write_locks[i]);
+        }
+        pthread_mutex_destroy(&trie->alloc_lock);
+        free(trie->write_locks);
+        trie->write_locks = NULL;
+    }
+}
+
+/*
+ * trie_concurrent_init
+ *
+ * Set up the locks, the epoch and the root of a concurrent trie. The
+ * root has room for every first byte from the start, so that it never
+ * has to be replaced.
+ */
+static int
+trie_concurrent_init (trie_t *trie)
+{
+    uint32_t    i;
+
+    trie->epoch = epoch_create();
+    trie->write_locks = (pthread_mutex_t *)malloc(TRIE_LOCK_STRIPES *
+                                                  sizeof(pthread_mutex_t));
+    if (!trie->epoch || !trie->write_locks) {
+        if (trie->epoch) {
+            epoch_destroy(trie->epoch);
+        }
+        free(trie->write_locks);
+        trie->epoch = NULL;
+        trie->write_locks = NULL;
+        return EFAIL;
+    }
+
+    for (i = 0; i < TRIE_LOCK_STRIPES; i++) {
+        pthread_mutex_init(&trie->write_locks[i], NULL);
+    }
+    pthread_mutex_init(&trie->alloc_lock, NULL);
+
+    trie->radix_root = trie_radix_alloc_node(trie, TRIE_NODE_256, NULL, "", 0);
+    if (!trie->radix_root) {
+        trie_concurrent_fini(trie);
+        return EFAIL;
+    }
+
+    return EOK;
+}
+
+/*
+ * trie_create_flags
+ *
+ * Create an instance of the trie with the given behaviour flags
+ * (TRIE_FLAG_*) and return a pointer to it. Tries with TRIE_FLAG_MAPPED
+ * come from trie_open_mmap() instead. TRIE_FLAG_CONCURRENT implies
+ * TRIE_FLAG_RADIX.
  */
 trie_t *
-trie_create (char *name, char* (*get_key)(void *trie_node))
+trie_create_flags (char *name, char* (*get_key)(void *trie_node),
+                   uint32_t flags)
 {
     trie_t  *trie;
+    uint8_t type;
 
     trie = (trie_t *)malloc(sizeof(trie_t));
     if (!trie) {
         return NULL;
     }
 
+    if (flags & TRIE_FLAG_CONCURRENT) {
+        flags |= TRIE_FLAG_RADIX;
+    }
+
+    /* Radix nodes come in different sizes, each with a slab of its own */
+    memset(trie->radix_slab, 0, sizeof(trie->radix_slab));
+    trie->node_slab = NULL;
+
+    if (flags & TRIE_FLAG_MAPPED) {
+        /* The nodes live in the image, see trie_open_mmap() */
+    } else if (flags & TRIE_FLAG_RADIX) {
+        for (type = 0; type < TRIE_NODE_TYPES; type++) {
+            trie->radix_slab[type] =
+                slab_create(trie_radix_node_size[type],
+                            TRIE_SLAB_BYTES / trie_radix_node_size[type]);
+            if (!trie->radix_slab[type]) {
+                trie_destroy_slabs(trie);
+                free(trie);
+                return NULL;
+            }
+        }
+    } else {
+        trie->node_slab = slab_create(sizeof(trie_node_t), TRIE_SLAB_NODES);
+        if (!trie->node_slab) {
+            free(trie);
+            return NULL;
+        }
+    }
+
     /* Initialize the contents */
     strncpy(trie->trie_name, name, strlen(name));
     trie->node_count = 0;
+    trie->leaf_count = 0;
     trie->root = NULL;
+    trie->radix_root = NULL;
+    trie->flags = flags;
     trie->get_key = get_key;
+    trie->score_fn = NULL;
+    trie->image = NULL;
+    trie->image_size = 0;
+    memset(&trie->da, 0, sizeof(trie->da));
+    trie->write_locks = NULL;
+    trie->epoch = NULL;
+
+    if ((flags & TRIE_FLAG_CONCURRENT) && trie_concurrent_init(trie) != EOK) {
+        trie_destroy_slabs(trie);
+        free(trie);
+        return NULL;
+    }
 
     return trie;
 }
 
+/*
+ * trie_create
+ *
+ * Create an instance of the trie and return a pointer to it
+ */
+trie_t *
+trie_create (char *name, char* (*get_key)(void *trie_node))
+{
+    return (trie_create_flags(name, get_key, 0));
+}
+
 /*
  * trie_destroy
  *
@@ -59,575 +294,4272 @@ trie_create (char *name, char* (*get_key)(void *trie_node))
 int
 trie_destroy (trie_t *trie)
 {
+    /* A mapped trie is never empty, and has nothing but the image */
+    if (trie->flags & TRIE_FLAG_MAPPED) {
+        munmap(trie->image, trie->image_size);
+        free(trie);
+        return EOK;
+    }
+
     /* Bail if the trie is not empty */
     if (!trie_empty(trie)) {
         return EFAIL;
     }
 
-    /* Do the deed */
+    /* Do the deed. Retired nodes go back to the slabs first. */
+    if (trie->flags & TRIE_FLAG_CONCURRENT) {
+        trie_concurrent_fini(trie);
+    }
+    trie_destroy_slabs(trie);
+    free(trie->da.base);
+    free(trie->da.check);
+    free(trie->da.data);
     free(trie);
 
     return EOK;
 }
 
 /*
- * trie_get_least_internal
+ * trie_radix_label
  *
- * Return the leaf node from the given level
+ * Return the whole edge label of the given radix node
  */
-static trie_node_t *
-trie_get_least_internal (trie_node_t *level)
+static inline char *
+trie_radix_label (trie_radix_node_t *node)
 {
-    /* Go down the trie children by children till we hit a leaf */
-    while (level != NULL) {
-        if (level->key == 0) {
-            return level->data;
+    return (node->label_ext ? node->label_ext : node->label);
+}
+
+/*
+ * trie_radix_set_label
+ *
+ * Set the edge label of the given radix node to a copy of the given
+ * bytes. The bytes may be part of the node's current label.
+ */
+static int
+trie_radix_set_label (trie_radix_node_t *node, char *label, uint32_t len)
+{
+    char    *label_ext = NULL;
+
+    if (len > TRIE_LABEL_INLINE) {
+        label_ext = (char *)malloc(len);
+        if (!label_ext) {
+            return EFAIL;
         }
-        level = level->children;
+        memcpy(label_ext, label, len);
     }
 
-    /* Shouldn't come here */
-    return NULL;
+    memmove(node->label, label, len < TRIE_LABEL_INLINE ? len : TRIE_LABEL_INLINE);
+
+    /* Only now is it safe to let go of the old label */
+    free(node->label_ext);
+    node->label_ext = label_ext;
+    node->label_len = len;
+
+    return EOK;
 }
 
 /*
- * trie_get_least
+ * trie_count_add
  *
- * Return a pointer to the first key in the trie
+ * Add delta to one of the counters of the given trie. Writers of a
+ * concurrent trie may be updating it side by side.
  */
-void *
-trie_get_least (trie_t *trie)
+static inline void
+trie_count_add (trie_t *trie, uint32_t *count, int32_t delta)
 {
-    trie_node_t *root = trie->root;
-    void *data;
+    if (trie->flags & TRIE_FLAG_CONCURRENT) {
+        __atomic_add_fetch(count, delta, __ATOMIC_RELAXED);
+    } else {
+        *count += delta;
+    }
+}
 
-    /* Sanity check */
-    if (!root) {
-        return NULL;
+/*
+ * trie_radix_slab_alloc
+ *
+ * Take a radix node of the given type from its slab. The slabs of a
+ * concurrent trie are shared by all the writers.
+ */
+static inline trie_radix_node_t *
+trie_radix_slab_alloc (trie_t *trie, uint8_t type)
+{
+    trie_radix_node_t   *node;
+
+    if (!(trie->flags & TRIE_FLAG_CONCURRENT)) {
+        return ((trie_radix_node_t *)slab_alloc(trie->radix_slab[type]));
     }
 
-    /* Go down the trie one level at a time till we hit a leaf */
-    data = trie_get_least_internal(root);
+    pthread_mutex_lock(&trie->alloc_lock);
+    node = (trie_radix_node_t *)slab_alloc(trie->radix_slab[type]);
+    pthread_mutex_unlock(&trie->alloc_lock);
 
-    /* Return whatever we got */
-    return data;
+    return node;
 }
 
 /*
- * trie_get_next
+ * trie_radix_slab_free
  *
- * Return the next key in the trie
+ * Give a radix node of the given type back to its slab
  */
-void *
-trie_get_next (trie_t *trie, void *prev_node)
+static inline void
+trie_radix_slab_free (trie_t *trie, uint8_t type, trie_radix_node_t *node)
 {
-    trie_node_t *level, *key_node, *node, *parent;
-    char *key;
-
-    /* Sanity check */
-    if (!trie || !prev_node || !trie->root) {
-        return NULL;
+    if (!(trie->flags & TRIE_FLAG_CONCURRENT)) {
+        slab_free(trie->radix_slab[type], node);
+        return;
     }
 
-    /* Get the key associated with the previous node */
-    key = trie->get_key(prev_node);
-    if (!key) {
-        return NULL;
-    }
+    pthread_mutex_lock(&trie->alloc_lock);
+    slab_free(trie->radix_slab[type], node);
+    pthread_mutex_unlock(&trie->alloc_lock);
+}
 
-    /* First get the leaf corresponding to the given key */
-    key_node = (trie_node_t *)trie_lookup_internal(trie, key);
-    if (!key_node) {
+/*
+ * trie_radix_alloc_node
+ *
+ * Allocate a radix node of the given type with the given edge label,
+ * hanging off parent. The caller adds it to the parent's children.
+ */
+static trie_radix_node_t *
+trie_radix_alloc_node (trie_t *trie, uint8_t type, trie_radix_node_t *parent,
+                       char *label, uint32_t len)
+{
+    trie_radix_node_t   *node;
+
+    node = trie_radix_slab_alloc(trie, type);
+    if (!node) {
         return NULL;
     }
 
-    /* 
-     * Walk up the trie one level at a time. Stop when you
-     * reach a level which is having a right sibling.
-     */
-    parent = key_node;
-    node = NULL;
-
-    while (parent != NULL) {
-        if (parent->sibling != NULL) {
-            if (parent->sibling != node) {
-                break;
-            }
-        }
-        node = parent;
-        parent = node->parent;
-    }
+    /* Clears the child array as well */
+    memset(node, 0, trie_radix_node_size[type]);
+    node->type = type;
+    node->parent = parent;
 
-    /* Bail if we didn't find anything */
-    if (!parent) {
-        /* We have iterated over all the nodes */
+    if (trie_radix_set_label(node, label, len) != EOK) {
+        trie_radix_slab_free(trie, type, node);
         return NULL;
     }
 
-    /* 
-     * We have come to the correct branch. Pick the leaf node
-     * for this branch and return the corresponding data.
-     */
-    return (trie_get_least_internal(parent->sibling));
+    trie_count_add(trie, &trie->node_count, 1);
+
+    return node;
 }
 
 /*
- * trie_get_count
+ * trie_radix_free_node
  *
- * Return the count of elements in the given trie
+ * Give a radix node, and its label, back
  */
-uint32_t
-trie_get_count (trie_t *trie)
+static void
+trie_radix_free_node (trie_t *trie, trie_radix_node_t *node)
 {
-    return trie->leaf_count;
+    free(node->label_ext);
+    trie_radix_slab_free(trie, node->type, node);
+    trie_count_add(trie, &trie->node_count, -1);
 }
 
 /*
- * trie_empty
+ * trie_radix_sorted
  *
- * Returns true if trie is empty. False otherwise.
+ * Return the key and child arrays of a node which keeps its children
+ * sorted by key (TRIE_NODE_4 and TRIE_NODE_16)
  */
-uint8_t
-trie_empty (trie_t *trie)
+static inline void
+trie_radix_sorted (trie_radix_node_t *node, uint8_t **keys,
+                   trie_radix_node_t ***children)
 {
-    if (trie->node_count == 0) {
-        return TRUE;
+    if (node->type == TRIE_NODE_4) {
+        *keys = ((trie_node4_t *)node)->keys;
+        *children = ((trie_node4_t *)node)->children;
+    } else {
+        *keys = ((trie_node16_t *)node)->keys;
+        *children = ((trie_node16_t *)node)->children;
     }
-
-    return FALSE;
 }
 
 /*
- * trie_insert_internal
+ * trie_radix_find_child
  *
- * This routine is called from trie_insert() once a branching point is
- * reached. From the branching point, we just have to create trie nodes
- * for each of the remaining elements of the key and store the value
- * in the leaf node.
+ * Return the slot holding the child whose label starts with the given
+ * byte, or NULL if there is no such child
  */
-static int
-trie_insert_internal (trie_t *trie, trie_node_t *parent, 
-                      char *key, void *data, int key_index) 
+static inline trie_radix_node_t **
+trie_radix_find_child (trie_radix_node_t *node, uint8_t c)
 {
-    trie_node_t *new_node;
+    trie_node4_t        *node4;
+    trie_node16_t       *node16;
+    trie_node48_t       *node48;
+    trie_node256_t      *node256;
+    uint32_t            i;
+#ifdef __SSE2__
+    uint32_t            mask;
+#endif
 
-    /*
-     * Start from level = parent and keep adding internal nodes till we
-     * exhaust all characters in the key
-     */
-    while (1) {
-        
-        new_node = (trie_node_t *)malloc(sizeof(trie_node_t));
-        if (!new_node) {
-            return EFAIL;
+    switch (node->type) {
+    case TRIE_NODE_4:
+        node4 = (trie_node4_t *)node;
+        for (i = 0; i < node->num_children; i++) {
+            if (node4->keys[i] == c) {
+                return &node4->children[i];
+            }
         }
+        return NULL;
 
-        if (key_index >= strlen(key)) {
-            /*
-             * We have come to the leaf node after creating trie nodes
-             * for each character in the key. This is where we store the
-             * actual value.
-             */
-            new_node->key = 0;
-            new_node->data = data;
-            new_node->sibling = NULL;
-            new_node->children = NULL;
-            new_node->parent = parent;
-            parent->children = new_node;
-            trie->node_count++;
-            trie->leaf_count++;
-            break;
+    case TRIE_NODE_16:
+        node16 = (trie_node16_t *)node;
+#ifdef __SSE2__
+        /* Compare all 16 keys at once and mask off the unused ones */
+        mask = _mm_movemask_epi8(_mm_cmpeq_epi8(
+                   _mm_loadu_si128((__m128i *)node16->keys),
+                   _mm_set1_epi8((char)c)));
+        mask &= (1U << node->num_children) - 1;
+        return (mask ? &node16->children[__builtin_ctz(mask)] : NULL);
+#else
+        for (i = 0; i < node->num_children; i++) {
+            if (node16->keys[i] == c) {
+                return &node16->children[i];
+            }
         }
+        return NULL;
+#endif
 
-        /* Internal trie nodes holding the key */
-        new_node->key = key[key_index];
-        new_node->data = NULL;
-        new_node->sibling = NULL;
-        new_node->children = NULL;
-        new_node->parent = parent;
-        parent->children = new_node;
-        parent = new_node;
-        trie->node_count++;
-        key_index++;
+    case TRIE_NODE_48:
+        node48 = (trie_node48_t *)node;
+        i = node48->index[c];
+        return (i ? &node48->children[i - 1] : NULL);
+
+    case TRIE_NODE_256:
+        /* The root of a concurrent trie is filled in place, under readers */
+        node256 = (trie_node256_t *)node;
+        return (TRIE_LOAD(node256->children[c]) ? &node256->children[c] : NULL);
+
+    default:
+        return NULL;
     }
 }
 
 /*
- * trie_insert
+ * trie_radix_next_child
  *
- * Insert a node to the trie
+ * Return the child with the smallest first byte which is not less than
+ * from (0 to 256), or NULL if there is none. Walks the children in
+ * byte order. The child slots are read the way readers of a concurrent
+ * trie have to, as a writer may be swapping in a copy of a child.
  */
-int
-trie_insert (trie_t *trie, char *key, void *data)
+static trie_radix_node_t *
+trie_radix_next_child (trie_radix_node_t *node, uint32_t from)
 {
-    trie_node_t *root, *level, *node, *prev_node, *new_node, *last_node;
-    int         key_index;
-    uint8_t     match_found;
-
-    /* Sanity check */
-    if (!trie || !key) {
-        return EINVAL;
-    }
-
-    /* Grab a pointer to the root */
-    root = trie->root;
+    trie_node48_t       *node48;
+    trie_node256_t      *node256;
+    trie_radix_node_t   **children, *child;
+    uint8_t             *keys;
+    uint32_t            i;
 
-    /* Check if this is the first element in the trie */
-    if (!root) {
-        root = (trie_node_t *)malloc(sizeof(trie_node_t));
-        trie->node_count++;
-        root->key = key[0];
-        root->data = NULL;
-        root->sibling = NULL;
-        root->children = NULL;
-        root->parent = NULL;
-        trie->root = root;
-
-        if (key[0] == 0) {
-            /* We are done */
-            return;
+    switch (node->type) {
+    case TRIE_NODE_4:
+    case TRIE_NODE_16:
+        trie_radix_sorted(node, &keys, &children);
+        for (i = 0; i < node->num_children; i++) {
+            if (keys[i] >= from) {
+                return TRIE_LOAD(children[i]);
+            }
         }
+        return NULL;
 
-        /* Scan through each character of the key and create nodes for them */
-        return (trie_insert_internal(trie, root, key, data, 1));
-    }
-        
-    /*
-     * Check if there is a common prefix already present. If not, we 
-     * have to create a new one.
-     */
-    level = root;
-
-    for (key_index = 0; key_index < strlen(key);) {
-
-        /* Search all nodes in the current level for a match */
-        node = level;
-        match_found = FALSE;
-
-        while (node != NULL) {
-            prev_node = node;
-            if (node->key == key[key_index]) {
-                match_found = TRUE;
-                break;
+    case TRIE_NODE_48:
+        node48 = (trie_node48_t *)node;
+        for (i = from; i < 256; i++) {
+            if (node48->index[i]) {
+                return TRIE_LOAD(node48->children[node48->index[i] - 1]);
             }
-            node = node->sibling;
         }
+        return NULL;
 
-        /* Did we find a match? */
-        if (match_found == TRUE) {
-            /* Jump to the next level */
-            level = node->children;;
-            key_index++;
-        } else {
-            /* 
-             * We have come to a branching point. Create a new set of 
-             * nodes for the remaining characters in the key
-             */
-            new_node = (trie_node_t *)malloc(sizeof(trie_node_t));
-            trie->node_count++;
-
-            new_node->key = key[key_index];
-            new_node->data = NULL;
-            new_node->sibling = NULL;
-            new_node->children = NULL;
-            new_node->parent = prev_node;
-            prev_node->sibling = new_node;
-            key_index++;
-
-            return (trie_insert_internal(trie, new_node, key, data, key_index));
+    case TRIE_NODE_256:
+        node256 = (trie_node256_t *)node;
+        for (i = from; i < 256; i++) {
+            child = TRIE_LOAD(node256->children[i]);
+            if (child) {
+                return child;
+            }
         }
-    }
+        return NULL;
 
-    /* 
-     * If we come here, then we were passed a key which is a prefix of
-     * an already existing longer key. First check if we were passed
-     * a duplicate key.
-     */
-    if (level->key == 0) {
-        printf("Duplicate key passed: %s\n", key);
-        return EFAIL;
+    default:
+        return NULL;
     }
-
-    /* 
-     * Create the leaf node for this key. Other nodes have already been
-     * created.
-     */
-    last_node = (trie_node_t *)malloc(sizeof(trie_node_t));
-    trie->node_count++;
-    trie->leaf_count++;
-    last_node->key = 0;
-    last_node->data = data;
-    last_node->sibling = NULL;
-    last_node->children = NULL;
-    last_node->parent = level;
-    level->sibling = last_node;
-
-    return EOK;
 }
 
 /*
- * trie_remove
+ * trie_radix_replace
  *
- * Remove a node from the trie
+ * Make whatever points to old (its parent's child slot, or the root
+ * pointer) point to new instead. Both have the same first byte.
  */
-int
-trie_remove (trie_t *trie, char *key)
+static void
+trie_radix_replace (trie_t *trie, trie_radix_node_t *old,
+                    trie_radix_node_t *new)
 {
-    trie_node_t     *root, *level, *node, *parent;
-    trie_del_node_t delete_arr[MAX_KEY_LEN];
-    int             key_index;
-    uint8_t         match_found;
+    if (!old->parent) {
+        trie->radix_root = new;
+    } else {
+        *trie_radix_find_child(old->parent, (uint8_t)old->label[0]) = new;
+    }
+}
 
-    /* Sanity check */
-    if (!trie || !key) {
-        return EINVAL;
+/*
+ * trie_radix_put_child
+ *
+ * Store a child in a node which is known to have room for it
+ */
+static void
+trie_radix_put_child (trie_radix_node_t *node, trie_radix_node_t *child)
+{
+    trie_node48_t       *node48;
+    trie_radix_node_t   **children;
+    uint8_t             *keys;
+    uint8_t             c = (uint8_t)child->label[0];
+    uint32_t            i, slot;
+
+    switch (node->type) {
+    case TRIE_NODE_4:
+    case TRIE_NODE_16:
+        trie_radix_sorted(node, &keys, &children);
+        for (i = node->num_children; i > 0 && keys[i - 1] > c; i--) {
+            keys[i] = keys[i - 1];
+            children[i] = children[i - 1];
+        }
+        keys[i] = c;
+        children[i] = child;
+        break;
+
+    case TRIE_NODE_48:
+        node48 = (trie_node48_t *)node;
+        for (slot = 0; node48->children[slot] != NULL; slot++);
+        node48->children[slot] = child;
+        node48->index[c] = slot + 1;
+        break;
+
+    default:
+        ((trie_node256_t *)node)->children[c] = child;
+        break;
     }
 
-    /* Grab a pointer to the root */
-    root = trie->root;
-    if (!root) {
-        return EINVAL;
+    node->num_children++;
+    child->parent = node;
+}
+
+/*
+ * trie_radix_resize
+ *
+ * Move a node into a new node of the given type, which must be able to
+ * hold all its children, and free the old one. Returns the new node, or
+ * NULL if it couldn't be allocated, in which case the old node stays.
+ */
+static trie_radix_node_t *
+trie_radix_resize (trie_t *trie, trie_radix_node_t *node, uint8_t type)
+{
+    trie_radix_node_t   *new, *child;
+
+    new = trie_radix_slab_alloc(trie, type);
+    if (!new) {
+        return NULL;
     }
 
-    level = root;
-    parent = NULL;
+    /* The header, along with the label, moves over as it is */
+    memset(new, 0, trie_radix_node_size[type]);
+    *new = *node;
+    new->type = type;
+    new->num_children = 0;
 
-    /*
-     * Populate the temporary delete array. The purpose of using this
-     * array is to simplify the process of identifying what all nodes
-     * have to be removed as many keys can share common prefixes. For
-     * each element in the key, the delete array contains:
-     * - The node to be deleted
-     * - The first node in the linked list at the current level
-     * - The parent node
-     * - Number of siblings
-     * - Number of children
-     */
-    for (key_index = 0; key_index < strlen(key); key_index++) {
+    for (child = trie_radix_next_child(node, 0); child != NULL;
+         child = trie_radix_next_child(node, (uint8_t)child->label[0] + 1)) {
+        trie_radix_put_child(new, child);
+    }
 
-        node = level;
-        match_found = FALSE;
-        delete_arr[key_index].first_node = node;
-        delete_arr[key_index].num_siblings = 0;
-        delete_arr[key_index].num_children = 0;
-
-        while (node != NULL) {
-            if (node->key == key[key_index]) {
-                match_found = TRUE;
-                delete_arr[key_index].del_node = node;
-                delete_arr[key_index].parent = parent;
-                parent = node;
-                level = node->children;
-            }
-            delete_arr[key_index].num_siblings++;
-            node = node->sibling;
+    trie_radix_replace(trie, node, new);
+    trie_radix_slab_free(trie, node->type, node);
+
+    return new;
+}
+
+/*
+ * trie_radix_add_child
+ *
+ * Add a child to the given node, growing it to the next type first if
+ * it is full. Returns the node, which may have moved, or NULL if it
+ * couldn't be grown.
+ */
+static trie_radix_node_t *
+trie_radix_add_child (trie_t *trie, trie_radix_node_t *node,
+                      trie_radix_node_t *child)
+{
+    if (node->num_children == trie_radix_node_capacity[node->type]) {
+        node = trie_radix_resize(trie, node, node->type + 1);
+        if (!node) {
+            return NULL;
         }
+    }
+
+    trie_radix_put_child(node, child);
+
+    return node;
+}
+
+/*
+ * trie_radix_remove_child
+ *
+ * Remove the child starting with the given byte from the given node,
+ * shrinking the node to a smaller type once it is sparse enough.
+ * Returns the node, which may have moved.
+ */
+static trie_radix_node_t *
+trie_radix_remove_child (trie_t *trie, trie_radix_node_t *node, uint8_t c)
+{
+    trie_node48_t       *node48;
+    trie_radix_node_t   *new;
+    trie_radix_node_t   **children;
+    uint8_t             *keys;
+    uint32_t            i;
 
-        if (key_index > 0) {
-            delete_arr[key_index - 1].num_children = delete_arr[key_index].num_siblings;
+    switch (node->type) {
+    case TRIE_NODE_4:
+    case TRIE_NODE_16:
+        trie_radix_sorted(node, &keys, &children);
+        for (i = 0; keys[i] != c; i++);
+        for (; i + 1 < node->num_children; i++) {
+            keys[i] = keys[i + 1];
+            children[i] = children[i + 1];
         }
+        break;
+
+    case TRIE_NODE_48:
+        node48 = (trie_node48_t *)node;
+        node48->children[node48->index[c] - 1] = NULL;
+        node48->index[c] = 0;
+        break;
+
+    default:
+        ((trie_node256_t *)node)->children[c] = NULL;
+        break;
+    }
 
-        if (match_found == FALSE) {
-            return ENOTFOUND;
+    node->num_children--;
+
+    if (node->num_children <= trie_radix_node_shrink[node->type]) {
+        new = trie_radix_resize(trie, node, node->type - 1);
+        if (new) {
+            node = new;
         }
     }
 
-    /* 
-     * An additional iteration to cover the leaf node. We need this to
-     * handle cases like deleting "ann" in a trie containing "ann" and
-     * "annabel" as keys 
-     */
-    node = level;
-    match_found = FALSE;;
-    delete_arr[key_index].first_node = node;
-    delete_arr[key_index].num_siblings = 0;
-    delete_arr[key_index].num_children = 0;
+    return node;
+}
+
+/*
+ * trie_radix_raise_score
+ *
+ * A record with the given score was added at the given node. Raise the
+ * cached best score of the node and its ancestors where it is lower.
+ */
+static void
+trie_radix_raise_score (trie_radix_node_t *node, uint32_t score)
+{
+    for (; node != NULL; node = node->parent) {
+        if (node->max_score >= score) {
+            break;
+        }
+        node->max_score = score;
+    }
+}
+
+/*
+ * trie_radix_rescore
+ *
+ * Work out the cached best score of the given node from its own record
+ * and its children, and carry on up while the scores change
+ */
+static void
+trie_radix_rescore (trie_t *trie, trie_radix_node_t *node)
+{
+    trie_radix_node_t   *start = node, *child;
+    uint32_t            max;
 
     while (node != NULL) {
-        if (node->key == 0) {
-            match_found = TRUE;
-            delete_arr[key_index].del_node = node;
-            delete_arr[key_index].parent = parent;
+        max = node->leaf ? trie->score_fn(node->data) : 0;
+        for (child = trie_radix_next_child(node, 0); child != NULL;
+             child = trie_radix_next_child(node, (uint8_t)child->label[0] + 1)) {
+            if (child->max_score > max) {
+                max = child->max_score;
+            }
         }
-        delete_arr[key_index].num_siblings++;
-        node = node->sibling;
+
+        /* The start node may have taken the place of a changed one */
+        if (node != start && node->max_score == max) {
+            break;
+        }
+        node->max_score = max;
+        node = node->parent;
     }
+}
+
+/*
+ * trie_radix_find
+ *
+ * Walk down the radix trie along the given key and return the node
+ * where the key ends, or NULL if the key is not present
+ */
+static trie_radix_node_t *
+trie_radix_find (trie_t *trie, char *key, uint32_t len)
+{
+    trie_radix_node_t   *node = trie->radix_root;
+    trie_radix_node_t   **slot;
+    uint32_t            pos = 0;
+
+    while (node != NULL && pos < len) {
+        slot = trie_radix_find_child(node, (uint8_t)key[pos]);
+        if (!slot) {
+            return NULL;
+        }
+
+        /* A concurrent writer may have just emptied the slot */
+        node = TRIE_LOAD(*slot);
+        if (!node) {
+            return NULL;
+        }
+
+        /* The first byte matched already. The rest of the label has to. */
+        if (node->label_len > len - pos ||
+            (node->label_len > 1 &&
+             memcmp(trie_radix_label(node) + 1, key + pos + 1,
+                    node->label_len - 1) != 0)) {
+            return NULL;
+        }
 
-    if (key_index > 0) {
-        delete_arr[key_index - 1].num_children = delete_arr[key_index].num_siblings;
+        pos += node->label_len;
     }
 
-    if (match_found == FALSE) {
-        return ENOTFOUND;
+    if (!node || !TRIE_LOAD(node->leaf)) {
+        return NULL;
     }
 
-    /*
-     * Now that we have the delete array, our job is almost done. We start
-     * from the last node. Traverse up one node at a time till we come to a
-     * branching point. This means, the parent has more than one child. Here
-     * we stop and adjust the pointers. Remember to free the nodes.
-     */
-    for (key_index = strlen(key); key_index >= 0; key_index--) {
+    return node;
+}
 
-        if (delete_arr[key_index - 1].num_children == 1) {
-            /* Can remove this node as parent has only this one child */
-            free(delete_arr[key_index].del_node);
-            trie->node_count--;
-            continue;
+/*
+ * trie_radix_insert
+ *
+ * Insert a key into a radix trie. The walk down follows the key as far
+ * as it matches. An edge whose label only partly matches is split in
+ * two, and whatever is left of the key becomes a single new node.
+ */
+static int
+trie_radix_insert (trie_t *trie, char *key, uint32_t len, void *data)
+{
+    trie_radix_node_t   *node, *child, *mid;
+    trie_radix_node_t   **slot;
+    char                *label;
+    uint32_t            pos = 0, common, max;
+
+    /* The root has an empty label and stays around while the trie is in use */
+    if (!trie->radix_root) {
+        trie->radix_root = trie_radix_alloc_node(trie, TRIE_NODE_0, NULL,
+                                                 "", 0);
+        if (!trie->radix_root) {
+            return EFAIL;
         }
+    }
 
-        /* 
-         * We have come to a branching point. We need to adjust the parent
-         * and sibling pointers here.
-         */
-        if (delete_arr[key_index].first_node == delete_arr[key_index].del_node) {
-            /* 
-             * Special case. Node to be deleted is the first node in the 
-             * list. Set the parent to point to the next sibling. If we
-             * are already at the top level, then we are blowing away
-             * trie->root. Set the trie->root pointer to point to the
-             * next sibling.
-             */
-            if (key_index == 0) {
-                trie->root = delete_arr[key_index].del_node->sibling;
-            } else {
-                delete_arr[key_index].parent->children = 
-                    delete_arr[key_index].first_node->sibling;
+    node = trie->radix_root;
+
+    while (pos < len) {
+        slot = trie_radix_find_child(node, (uint8_t)key[pos]);
+        if (!slot) {
+            /* Nothing shares this prefix. The rest of the key is one node. */
+            child = trie_radix_alloc_node(trie, TRIE_NODE_0, node,
+                                          key + pos, len - pos);
+            if (!child) {
+                return EFAIL;
             }
-            free(delete_arr[key_index].del_node);
-            trie->node_count--;
-        } else {
-            node = delete_arr[key_index].first_node;
+            child->leaf = TRUE;
+            child->data = data;
+
+            if (!trie_radix_add_child(trie, node, child)) {
+                trie_radix_free_node(trie, child);
+                return EFAIL;
+            }
+            trie->leaf_count++;
 
-            /* Traverse till we reach the victim node and then adjust the pointer */
-            while (node->sibling != delete_arr[key_index].del_node) {
-                node = node->sibling;
+            if (trie->score_fn) {
+                trie_radix_raise_score(child, trie->score_fn(data));
             }
 
+            return EOK;
+        }
+        child = *slot;
+
+        /* How much of the label matches? */
+        label = trie_radix_label(child);
+        max = (child->label_len < len - pos) ? child->label_len : len - pos;
+        for (common = 1; common < max && label[common] == key[pos + common];
+             common++);
+
+        if (common < child->label_len) {
             /*
-             * If we are at the top level, we need to adjust the parent
-             * pointer of the deleted node's sibling
+             * Split the edge. A new node takes the common part of the
+             * label and the old child, keeping the rest, moves under it.
              */
-            if (key_index == 0 && node->sibling->sibling) {
-                node->sibling->sibling->parent = node;
+            mid = trie_radix_alloc_node(trie, TRIE_NODE_4, node, label, common);
+            if (!mid) {
+                return EFAIL;
+            }
+            if (trie_radix_set_label(child, label + common,
+                                     child->label_len - common) != EOK) {
+                trie_radix_free_node(trie, mid);
+                return EFAIL;
             }
 
-            node->sibling = node->sibling->sibling;
-            free(delete_arr[key_index].del_node);
-            trie->node_count--;
+            *slot = mid;
+            trie_radix_put_child(mid, child);
+            mid->max_score = child->max_score;
+            child = mid;
         }
 
-        /* All done */
-        break;
+        pos += common;
+        node = child;
     }
 
-    trie->leaf_count--;
+    /* The key ends at an existing node */
+    if (node->leaf) {
+        return EFAIL;
+    }
+
+    node->leaf = TRUE;
+    node->data = data;
+    trie->leaf_count++;
+
+    if (trie->score_fn) {
+        trie_radix_raise_score(node, trie->score_fn(data));
+    }
 
     return EOK;
 }
 
 /*
- * trie_lookup_internal
+ * trie_radix_merge
  *
- * Same as trie_lookup but returns a pointer to the leaf trie node
- * instead of the actual data. Used by trie_get_next()
+ * Fold a node which no longer holds a key into its only child. The
+ * child takes over the node's place and prepends the node's label to
+ * its own. Returns whichever of the two is left in that place.
  */
-void *
-trie_lookup_internal (trie_t *trie, char *key)
+static trie_radix_node_t *
+trie_radix_merge (trie_t *trie, trie_radix_node_t *node)
 {
-    trie_node_t  *root, *level, *node;
-    uint8_t match_found = FALSE;
-    int i = 0;
+    trie_radix_node_t   *child = trie_radix_next_child(node, 0);
+    char                label[TRIE_LABEL_INLINE];
+    char                *buf = label;
+    uint32_t            len = node->label_len + child->label_len;
 
-    /* Sanity check */
-    if (!trie) {
-        return NULL;
+    if (len > TRIE_LABEL_INLINE) {
+        buf = (char *)malloc(len);
+        if (!buf) {
+            /* Leave the node in place. The trie is still valid. */
+            return node;
+        }
     }
 
-    /* Grab a pointer to the root */
-    root = trie->root;
-    if (!root) {
-        return NULL;
+    memcpy(buf, trie_radix_label(node), node->label_len);
+    memcpy(buf + node->label_len, trie_radix_label(child), child->label_len);
+
+    if (trie_radix_set_label(child, buf, len) == EOK) {
+        child->parent = node->parent;
+        trie_radix_replace(trie, node, child);
+        trie_radix_free_node(trie, node);
+        node = child;
     }
 
-    /* Search level by level */
-    level = root;
-    while (level != NULL) {
-        node = level;
-        while (node != NULL) {
-            if (node->key == key[i]) {
-                level = node->children;
-                match_found = TRUE;
-
-                /* Are we at the leaf node? */
-                if (key[i] == 0) {
-                    /* Match found */
-                    return node;
-                }
+    if (buf != label) {
+        free(buf);
+    }
 
-                i++;
-                break;
-            }
-            node = node->sibling;
+    return node;
+}
+
+/*
+ * trie_radix_remove
+ *
+ * Remove a key from a radix trie. The node holding the key goes away if
+ * it has no children, and a node left with a single child and no key is
+ * folded into that child, so that no chains of single children remain.
+ */
+static int
+trie_radix_remove (trie_t *trie, char *key, uint32_t len)
+{
+    trie_radix_node_t   *node, *parent;
+
+    node = trie_radix_find(trie, key, len);
+    if (!node) {
+        return ENOTFOUND;
+    }
+
+    node->leaf = FALSE;
+    node->data = NULL;
+    trie->leaf_count--;
+
+    if (node->num_children == 0 && node->parent != NULL) {
+        /* Unlink the node. The parent may now be a chain link. */
+        parent = trie_radix_remove_child(trie, node->parent,
+                                         (uint8_t)node->label[0]);
+        trie_radix_free_node(trie, node);
+        node = parent;
+    }
+
+    if (node->parent == NULL) {
+        /* The root goes away with the last key */
+        if (node->num_children == 0 && !node->leaf) {
+            trie_radix_free_node(trie, node);
+            trie->radix_root = NULL;
+            return EOK;
         }
+    } else if (!node->leaf && node->num_children == 1) {
+        node = trie_radix_merge(trie, node);
+    }
 
-        /* Bail if nothing matched */
-        if (match_found == FALSE) {
-            return NULL;
+    /* The record may have been the best one below its ancestors */
+    if (trie->score_fn) {
+        trie_radix_rescore(trie, node);
+    }
+
+    return EOK;
+}
+
+/*
+ * trie_radix_first_leaf
+ *
+ * Return the first node holding a key in the subtree rooted at the
+ * given node. A node's own key sorts before the keys of its children.
+ */
+static trie_radix_node_t *
+trie_radix_first_leaf (trie_radix_node_t *node)
+{
+    while (node != NULL && !TRIE_LOAD(node->leaf)) {
+        node = trie_radix_next_child(node, 0);
+    }
+
+    return node;
+}
+
+/*
+ * trie_radix_next_subtree
+ *
+ * Return the node holding the first key after all the keys in the
+ * subtree rooted at the given node, or NULL if there is none. The
+ * search doesn't leave the subtree rooted at top, if one is given.
+ */
+static trie_radix_node_t *
+trie_radix_next_subtree (trie_radix_node_t *node, trie_radix_node_t *top)
+{
+    trie_radix_node_t   *next;
+
+    /* Climb up till there is a sibling to the right */
+    while (node != top && node->parent != NULL) {
+        next = trie_radix_next_child(node->parent,
+                                     (uint8_t)node->label[0] + 1);
+        if (next) {
+            return (trie_radix_first_leaf(next));
         }
+        node = node->parent;
     }
+
+    return NULL;
 }
 
 /*
- * trie_lookup
+ * trie_radix_next_leaf
  *
- * Lookup a node in the trie with the given key. Returns NULL
- * if node is not found.
+ * Return the node holding the next key after the given node in key
+ * order, or NULL if it holds the last key (in the subtree rooted at
+ * top, if one is given)
  */
-void *
-trie_lookup (trie_t *trie, char *key)
+static trie_radix_node_t *
+trie_radix_next_leaf (trie_radix_node_t *node, trie_radix_node_t *top)
 {
-    trie_node_t  *root, *level, *node;
-    uint8_t match_found = FALSE;
-    int i = 0;
+    if (node->num_children) {
+        return (trie_radix_first_leaf(trie_radix_next_child(node, 0)));
+    }
 
-    /* Sanity check */
-    if (!trie) {
-        return NULL;
+    return (trie_radix_next_subtree(node, top));
+}
+
+/*
+ * trie_radix_seek
+ *
+ * Return the node holding the smallest key which is not less than the
+ * given key, or NULL if every key is smaller
+ */
+static trie_radix_node_t *
+trie_radix_seek (trie_t *trie, char *key, uint32_t len)
+{
+    trie_radix_node_t   *node = trie->radix_root;
+    trie_radix_node_t   *child, **slot;
+    char                *label;
+    uint32_t            pos = 0, common, max;
+
+    while (node != NULL) {
+        /* The key ends here. Everything below sorts after it. */
+        if (pos == len) {
+            return (trie_radix_first_leaf(node));
+        }
+
+        slot = trie_radix_find_child(node, (uint8_t)key[pos]);
+        if (!slot) {
+            child = trie_radix_next_child(node, (uint8_t)key[pos] + 1);
+            return (child ? trie_radix_first_leaf(child) :
+                            trie_radix_next_subtree(node, NULL));
+        }
+        child = *slot;
+
+        label = trie_radix_label(child);
+        max = (child->label_len < len - pos) ? child->label_len : len - pos;
+        for (common = 1; common < max && label[common] == key[pos + common];
+             common++);
+
+        if (common < child->label_len) {
+            /*
+             * The key leaves the label part way. The whole subtree sorts
+             * after the key if the key ran out or has the smaller byte,
+             * and before it otherwise.
+             */
+            if (pos + common == len ||
+                (uint8_t)key[pos + common] < (uint8_t)label[common]) {
+                return (trie_radix_first_leaf(child));
+            }
+            return (trie_radix_next_subtree(child, NULL));
+        }
+
+        pos += common;
+        node = child;
     }
 
-    /* Grab a pointer to the root */
-    root = trie->root;
-    if (!root) {
-        return NULL;
+    return NULL;
+}
+
+/*
+ * trie_radix_first_leaf_len
+ *
+ * trie_radix_first_leaf() for a subtree whose root's label starts at
+ * the given depth. The length of the key found is stored in len, if
+ * one is passed.
+ */
+static trie_radix_node_t *
+trie_radix_first_leaf_len (trie_radix_node_t *node, uint32_t depth,
+                           uint32_t *len)
+{
+    while (node != NULL) {
+        depth += node->label_len;
+        if (TRIE_LOAD(node->leaf)) {
+            break;
+        }
+        node = trie_radix_next_child(node, 0);
     }
 
-    /* Search level by level */
-    level = root;
-    while (level != NULL) {
-        node = level;
-        while (node != NULL) {
-            if (node->key == key[i]) {
-                level = node->children;
-                match_found = TRUE;
-
-                /* Are we at the leaf node? */
-                if (key[i] == 0) {
-                    /* Match found */
-                    return node->data;
-                }
+    if (len) {
+        *len = depth;
+    }
 
-                i++;
-                break;
+    return node;
+}
+
+/*
+ * trie_radix_seek_concurrent
+ *
+ * Same as trie_radix_seek() for a concurrent trie, whose readers can't
+ * climb back up through the parent pointers. The next subtree to the
+ * right is noted on the way down instead. With after set, the given key
+ * itself is skipped. The length of the key found is stored in found_len,
+ * if one is passed, as the key may hold 0 bytes. Must be called inside
+ * the trie's epoch.
+ */
+static trie_radix_node_t *
+trie_radix_seek_concurrent (trie_t *trie, char *key, uint32_t len,
+                            uint8_t after, uint32_t *found_len)
+{
+    trie_radix_node_t   *node = trie->radix_root;
+    trie_radix_node_t   *child, *right = NULL, *next, **slot;
+    char                *label;
+    uint32_t            pos = 0, right_pos = 0, common, max;
+
+    while (node != NULL) {
+        if (pos == len) {
+            if (!after && TRIE_LOAD(node->leaf)) {
+                if (found_len) {
+                    *found_len = pos;
+                }
+                return node;
             }
-            node = node->sibling;
+            child = trie_radix_next_child(node, 0);
+            return (child ? trie_radix_first_leaf_len(child, pos, found_len) :
+                            trie_radix_first_leaf_len(right, right_pos,
+                                                      found_len));
         }
 
-        /* Bail if nothing matched */
-        if (match_found == FALSE) {
-            return NULL;
+        /* The deepest subtree to the right comes first after the key */
+        next = trie_radix_next_child(node, (uint8_t)key[pos] + 1);
+        if (next) {
+            right = next;
+            right_pos = pos;
+        }
+
+        slot = trie_radix_find_child(node, (uint8_t)key[pos]);
+        child = slot ? TRIE_LOAD(*slot) : NULL;
+        if (!child) {
+            return (trie_radix_first_leaf_len(right, right_pos, found_len));
+        }
+
+        label = trie_radix_label(child);
+        max = (child->label_len < len - pos) ? child->label_len : len - pos;
+        for (common = 1; common < max && label[common] == key[pos + common];
+             common++);
+
+        if (common < child->label_len) {
+            if (pos + common == len ||
+                (uint8_t)key[pos + common] < (uint8_t)label[common]) {
+                return (trie_radix_first_leaf_len(child, pos, found_len));
+            }
+            return (trie_radix_first_leaf_len(right, right_pos, found_len));
         }
+
+        pos += common;
+        node = child;
     }
+
+    return NULL;
+}
+
+/*
+ * trie_radix_reclaim
+ *
+ * Free a node of a concurrent trie which no reader can reach any more.
+ * Called back from the epoch.
+ */
+static void
+trie_radix_reclaim (void *ptr, void *ctx)
+{
+    trie_radix_node_t   *node = (trie_radix_node_t *)ptr;
+
+    free(node->label_ext);
+    trie_radix_slab_free((trie_t *)ctx, node->type, node);
+}
+
+/*
+ * trie_radix_retire
+ *
+ * A node of a concurrent trie has been unlinked. Free it, along with
+ * its label, once the readers which might be on it have moved on.
+ */
+static void
+trie_radix_retire (trie_t *trie, trie_radix_node_t *node)
+{
+    trie_count_add(trie, &trie->node_count, -1);
+    epoch_retire(trie->epoch, node, trie_radix_reclaim, trie);
+}
+
+/*
+ * trie_radix_copy
+ *
+ * Make a copy of the given node, for a concurrent trie to swap in. Its
+ * label is head followed by the node's label less the first drop bytes.
+ * The children move over to the copy, except for skip, and add joins
+ * them. The copy is the smallest type they fit in. Returns NULL, with
+ * nothing changed, if the copy couldn't be allocated.
+ */
+static trie_radix_node_t *
+trie_radix_copy (trie_t *trie, trie_radix_node_t *node, char *head,
+                 uint32_t head_len, uint32_t drop, trie_radix_node_t *skip,
+                 trie_radix_node_t *add)
+{
+    trie_radix_node_t   *new, *child;
+    char                buf[TRIE_LABEL_INLINE], *label = buf;
+    uint32_t            len = head_len + node->label_len - drop;
+    uint32_t            count;
+    uint8_t             type = TRIE_NODE_0;
+
+    count = node->num_children - (skip ? 1 : 0) + (add ? 1 : 0);
+    while (trie_radix_node_capacity[type] < count) {
+        type++;
+    }
+
+    if (len > TRIE_LABEL_INLINE) {
+        label = (char *)malloc(len);
+        if (!label) {
+            return NULL;
+        }
+    }
+    if (head_len) {
+        memcpy(label, head, head_len);
+    }
+    memcpy(label + head_len, trie_radix_label(node) + drop,
+           node->label_len - drop);
+
+    /* A long label is handed over as it is instead of copied again */
+    new = trie_radix_alloc_node(trie, type, node->parent, "", 0);
+    if (!new) {
+        if (label != buf) {
+            free(label);
+        }
+        return NULL;
+    }
+    memcpy(new->label, label, len < TRIE_LABEL_INLINE ? len : TRIE_LABEL_INLINE);
+    new->label_ext = (label != buf) ? label : NULL;
+    new->label_len = len;
+
+    new->leaf = node->leaf;
+    new->data = node->data;
+    new->max_score = node->max_score;
+
+    for (child = trie_radix_next_child(node, 0); child != NULL;
+         child = trie_radix_next_child(node, (uint8_t)child->label[0] + 1)) {
+        if (child != skip) {
+            trie_radix_put_child(new, child);
+        }
+    }
+    if (add) {
+        trie_radix_put_child(new, add);
+    }
+
+    return new;
+}
+
+/*
+ * trie_radix_publish
+ *
+ * Swap a copy made by trie_radix_copy() in for the node below the root
+ * it was made from. Readers see either one or the other, never a half
+ * made change.
+ */
+static inline void
+trie_radix_publish (trie_radix_node_t *old, trie_radix_node_t *new)
+{
+    TRIE_STORE(*trie_radix_find_child(old->parent, (uint8_t)old->label[0]),
+               new);
+}
+
+/*
+ * trie_radix_insert_concurrent
+ *
+ * Same as trie_radix_insert() for a concurrent trie. The caller holds
+ * the lock for the first byte of the key. Nodes below the root are
+ * never changed in place: whatever changes is copied, and the copy is
+ * swapped in once it is complete.
+ */
+static int
+trie_radix_insert_concurrent (trie_t *trie, char *key, uint32_t len,
+                              void *data)
+{
+    trie_radix_node_t   *node = trie->radix_root;
+    trie_radix_node_t   *child, *mid, *leaf, *new, **slot;
+    char                *label;
+    uint32_t            pos = 0, common, max;
+
+    if (!node) {
+        return EFAIL;
+    }
+
+    while (pos < len) {
+        slot = trie_radix_find_child(node, (uint8_t)key[pos]);
+        if (!slot) {
+            /* Nothing shares this prefix. The rest of the key is one node. */
+            child = trie_radix_alloc_node(trie, TRIE_NODE_0, node,
+                                          key + pos, len - pos);
+            if (!child) {
+                return EFAIL;
+            }
+            child->leaf = TRUE;
+            child->data = data;
+
+            if (node == trie->radix_root) {
+                TRIE_STORE(((trie_node256_t *)node)->children[(uint8_t)key[pos]],
+                           child);
+                __atomic_add_fetch(&node->num_children, 1, __ATOMIC_RELAXED);
+            } else {
+                new = trie_radix_copy(trie, node, NULL, 0, 0, NULL, child);
+                if (!new) {
+                    trie_radix_free_node(trie, child);
+                    return EFAIL;
+                }
+                trie_radix_publish(node, new);
+                trie_radix_retire(trie, node);
+            }
+            trie_count_add(trie, &trie->leaf_count, 1);
+
+            return EOK;
+        }
+        child = *slot;
+
+        /* How much of the label matches? */
+        label = trie_radix_label(child);
+        max = (child->label_len < len - pos) ? child->label_len : len - pos;
+        for (common = 1; common < max && label[common] == key[pos + common];
+             common++);
+
+        if (common < child->label_len) {
+            /*
+             * Split the edge. The new node in the middle, with the rest
+             * of the key below it if any, and a copy of the child with
+             * the shorter label are all put together before the middle
+             * node takes the child's place.
+             */
+            mid = trie_radix_alloc_node(trie, TRIE_NODE_4, node, label, common);
+            if (!mid) {
+                return EFAIL;
+            }
+
+            if (pos + common == len) {
+                mid->leaf = TRUE;
+                mid->data = data;
+            } else {
+                leaf = trie_radix_alloc_node(trie, TRIE_NODE_0, mid,
+                                             key + pos + common,
+                                             len - pos - common);
+                if (!leaf) {
+                    trie_radix_free_node(trie, mid);
+                    return EFAIL;
+                }
+                leaf->leaf = TRUE;
+                leaf->data = data;
+                trie_radix_put_child(mid, leaf);
+            }
+
+            new = trie_radix_copy(trie, child, NULL, 0, common, NULL, NULL);
+            if (!new) {
+                if (!mid->leaf) {
+                    trie_radix_free_node(trie, trie_radix_next_child(mid, 0));
+                }
+                trie_radix_free_node(trie, mid);
+                return EFAIL;
+            }
+            trie_radix_put_child(mid, new);
+
+            TRIE_STORE(*slot, mid);
+            trie_radix_retire(trie, child);
+            trie_count_add(trie, &trie->leaf_count, 1);
+
+            return EOK;
+        }
+
+        pos += common;
+        node = child;
+    }
+
+    /* The key ends at an existing node. The record goes in before the flag. */
+    if (node->leaf) {
+        return EFAIL;
+    }
+
+    TRIE_STORE(node->data, data);
+    TRIE_STORE(node->leaf, TRUE);
+    trie_count_add(trie, &trie->leaf_count, 1);
+
+    return EOK;
+}
+
+/*
+ * trie_radix_remove_concurrent
+ *
+ * Same as trie_radix_remove() for a concurrent trie. The caller holds
+ * the lock for the first byte of the key. The record is left in the
+ * node for the readers which are still on it.
+ */
+static int
+trie_radix_remove_concurrent (trie_t *trie, char *key, uint32_t len)
+{
+    trie_radix_node_t   *node, *parent, *child, *new;
+
+    node = trie_radix_find(trie, key, len);
+    if (!node) {
+        return ENOTFOUND;
+    }
+    parent = node->parent;
+
+    if (node->num_children) {
+        /* The node stays, unless it is left a chain link */
+        TRIE_STORE(node->leaf, FALSE);
+
+        if (parent && node->num_children == 1) {
+            child = trie_radix_next_child(node, 0);
+            new = trie_radix_copy(trie, child, trie_radix_label(node),
+                                  node->label_len, 0, NULL, NULL);
+            if (new) {
+                new->parent = parent;
+                trie_radix_publish(node, new);
+                trie_radix_retire(trie, node);
+                trie_radix_retire(trie, child);
+            }
+        }
+    } else if (!parent) {
+        /* The empty key, at the root */
+        TRIE_STORE(node->leaf, FALSE);
+    } else if (parent == trie->radix_root) {
+        TRIE_STORE(((trie_node256_t *)parent)->children[(uint8_t)node->label[0]],
+                   (trie_radix_node_t *)NULL);
+        __atomic_sub_fetch(&parent->num_children, 1, __ATOMIC_RELAXED);
+        trie_radix_retire(trie, node);
+    } else {
+        if (!parent->leaf && parent->num_children == 2) {
+            /*
+             * The parent would be left a chain link. A copy of the other
+             * child, with the parent's label in front, takes its place.
+             */
+            child = trie_radix_next_child(parent, 0);
+            if (child == node) {
+                child = trie_radix_next_child(parent,
+                                              (uint8_t)node->label[0] + 1);
+            }
+            new = trie_radix_copy(trie, child, trie_radix_label(parent),
+                                  parent->label_len, 0, NULL, NULL);
+            if (!new) {
+                return EFAIL;
+            }
+            new->parent = parent->parent;
+            trie_radix_publish(parent, new);
+            trie_radix_retire(trie, child);
+        } else {
+            new = trie_radix_copy(trie, parent, NULL, 0, 0, node, NULL);
+            if (!new) {
+                return EFAIL;
+            }
+            trie_radix_publish(parent, new);
+        }
+        trie_radix_retire(trie, parent);
+        trie_radix_retire(trie, node);
+    }
+
+    trie_count_add(trie, &trie->leaf_count, -1);
+
+    return EOK;
+}
+
+/*
+ * trie_radix_free_labels
+ *
+ * Free the separately allocated labels of all the radix nodes. The
+ * nodes themselves are left to the slabs.
+ */
+static void
+trie_radix_free_labels (trie_radix_node_t *node)
+{
+    trie_radix_node_t   *next;
+
+    while (node != NULL) {
+        free(node->label_ext);
+        node->label_ext = NULL;
+
+        next = trie_radix_next_child(node, 0);
+        if (next) {
+            node = next;
+            continue;
+        }
+
+        /* Climb up till there is a sibling to the right */
+        while (node->parent != NULL) {
+            next = trie_radix_next_child(node->parent,
+                                         (uint8_t)node->label[0] + 1);
+            if (next) {
+                break;
+            }
+            node = node->parent;
+        }
+        node = next;
+    }
+}
+
+/*
+ * trie_image_node
+ *
+ * Return the node at the given offset of a mapped trie
+ */
+static inline trie_image_node_t *
+trie_image_node (trie_t *trie, uint32_t offset)
+{
+    return ((trie_image_node_t *)(trie->image +
+                                  (uint64_t)offset * TRIE_IMAGE_ALIGN));
+}
+
+/*
+ * trie_image_children
+ *
+ * Return the offsets of the children of the given image node
+ */
+static inline uint32_t *
+trie_image_children (trie_image_node_t *node)
+{
+    return ((uint32_t *)(node + 1));
+}
+
+/*
+ * trie_image_keys
+ *
+ * Return the first characters of the children of the given image node
+ */
+static inline uint8_t *
+trie_image_keys (trie_image_node_t *node)
+{
+    return ((uint8_t *)(trie_image_children(node) + node->num_children));
+}
+
+/*
+ * trie_image_label
+ *
+ * Return the characters of the given image node
+ */
+static inline char *
+trie_image_label (trie_image_node_t *node)
+{
+    return ((char *)(trie_image_keys(node) + node->num_children));
+}
+
+/*
+ * trie_image_record
+ *
+ * Return the copy of the record held by the given image node, or NULL
+ * if no key ends there
+ */
+static inline void *
+trie_image_record (trie_t *trie, trie_image_node_t *node)
+{
+    trie_image_hdr_t    *hdr = (trie_image_hdr_t *)trie->image;
+
+    if (!node->record) {
+        return NULL;
+    }
+
+    return (trie->image + hdr->records +
+            (uint64_t)(node->record - 1) * hdr->record_stride);
+}
+
+/*
+ * trie_image_root
+ *
+ * Return the offset of the root node of a mapped trie
+ */
+static inline uint32_t
+trie_image_root (void)
+{
+    return (sizeof(trie_image_hdr_t) / TRIE_IMAGE_ALIGN);
+}
+
+/*
+ * trie_image_find_child
+ *
+ * Return the position of the child starting with the given character
+ * among the children of the given image node, or -1 if there is none
+ */
+static inline int
+trie_image_find_child (trie_image_node_t *node, uint8_t c)
+{
+    uint8_t *keys = trie_image_keys(node);
+    uint8_t *key;
+
+    key = (uint8_t *)memchr(keys, c, node->num_children);
+
+    return (key ? (int)(key - keys) : -1);
+}
+
+/*
+ * trie_image_find
+ *
+ * Return the offset of the image node holding the given key, or 0 if
+ * the key is not there
+ */
+static uint32_t
+trie_image_find (trie_t *trie, char *key, uint32_t len)
+{
+    trie_image_node_t   *node;
+    uint32_t            offset = trie_image_root();
+    uint32_t            pos = 0;
+    int                 i;
+
+    node = trie_image_node(trie, offset);
+    while (pos < len) {
+        i = trie_image_find_child(node, (uint8_t)key[pos]);
+        if (i < 0) {
+            return 0;
+        }
+        offset = trie_image_children(node)[i];
+        node = trie_image_node(trie, offset);
+
+        /* The first byte matched already. The rest of the label has to. */
+        if (node->label_len > len - pos ||
+            (node->label_len > 1 &&
+             memcmp(trie_image_label(node) + 1, key + pos + 1,
+                    node->label_len - 1) != 0)) {
+            return 0;
+        }
+
+        pos += node->label_len;
+    }
+
+    return (node->record ? offset : 0);
+}
+
+/*
+ * trie_image_prefix
+ *
+ * Walk down a mapped trie along the given prefix. Returns the offset of
+ * the root of the subtree holding every key starting with it, or 0 if
+ * there are none.
+ */
+static uint32_t
+trie_image_prefix (trie_t *trie, char *prefix, uint32_t len)
+{
+    trie_image_node_t   *node;
+    uint32_t            offset = trie_image_root();
+    uint32_t            pos = 0, max;
+    int                 i;
+
+    node = trie_image_node(trie, offset);
+    while (pos < len) {
+        i = trie_image_find_child(node, (uint8_t)prefix[pos]);
+        if (i < 0) {
+            return 0;
+        }
+        offset = trie_image_children(node)[i];
+        node = trie_image_node(trie, offset);
+
+        max = (node->label_len < len - pos) ? node->label_len : len - pos;
+        if (max > 1 && memcmp(trie_image_label(node) + 1, prefix + pos + 1,
+                              max - 1) != 0) {
+            return 0;
+        }
+
+        pos += max;
+    }
+
+    return offset;
+}
+
+/*
+ * trie_image_first_leaf
+ *
+ * Return the offset of the node holding the first key in the subtree
+ * rooted at the given node, or 0 if there is none
+ */
+static uint32_t
+trie_image_first_leaf (trie_t *trie, uint32_t offset)
+{
+    trie_image_node_t   *node;
+
+    while (offset != 0) {
+        node = trie_image_node(trie, offset);
+        if (node->record) {
+            break;
+        }
+        offset = node->num_children ? trie_image_children(node)[0] : 0;
+    }
+
+    return offset;
+}
+
+/*
+ * trie_image_next_subtree
+ *
+ * Return the offset of the node holding the first key after all the
+ * keys in the subtree rooted at the given node, or 0 if there is none.
+ * The search doesn't leave the subtree rooted at top, if one is given.
+ */
+static uint32_t
+trie_image_next_subtree (trie_t *trie, uint32_t offset, uint32_t top)
+{
+    trie_image_node_t   *node, *parent;
+    int                 i;
+
+    /* Climb up till there is a sibling to the right */
+    while (offset != top) {
+        node = trie_image_node(trie, offset);
+        if (node->parent == 0) {
+            break;
+        }
+        parent = trie_image_node(trie, node->parent);
+        i = trie_image_find_child(parent, (uint8_t)trie_image_label(node)[0]);
+        if (i + 1 < parent->num_children) {
+            return (trie_image_first_leaf(trie,
+                                          trie_image_children(parent)[i + 1]));
+        }
+        offset = node->parent;
+    }
+
+    return 0;
+}
+
+/*
+ * trie_image_next_leaf
+ *
+ * Return the offset of the node holding the next key after the given
+ * node in key order, or 0 if it holds the last key (in the subtree
+ * rooted at top, if one is given)
+ */
+static uint32_t
+trie_image_next_leaf (trie_t *trie, uint32_t offset, uint32_t top)
+{
+    trie_image_node_t   *node = trie_image_node(trie, offset);
+
+    if (node->num_children) {
+        return (trie_image_first_leaf(trie, trie_image_children(node)[0]));
+    }
+
+    return (trie_image_next_subtree(trie, offset, top));
+}
+
+/*
+ * trie_image_seek
+ *
+ * Return the offset of the node holding the smallest key which is not
+ * less than the given key, or 0 if every key is smaller
+ */
+static uint32_t
+trie_image_seek (trie_t *trie, char *key, uint32_t len)
+{
+    trie_image_node_t   *node, *child;
+    uint32_t            offset = trie_image_root(), child_offset;
+    uint32_t            pos = 0, common, max;
+    uint8_t             *keys;
+    char                *label;
+    int                 i;
+
+    for (;;) {
+        node = trie_image_node(trie, offset);
+
+        /* The key ends here. Everything below sorts after it. */
+        if (pos == len) {
+            return (trie_image_first_leaf(trie, offset));
+        }
+
+        i = trie_image_find_child(node, (uint8_t)key[pos]);
+        if (i < 0) {
+            /* Go for the first child past the key's byte, if any */
+            keys = trie_image_keys(node);
+            for (i = 0; i < node->num_children &&
+                        keys[i] < (uint8_t)key[pos]; i++);
+            if (i < node->num_children) {
+                return (trie_image_first_leaf(trie,
+                                              trie_image_children(node)[i]));
+            }
+            return (trie_image_next_subtree(trie, offset, 0));
+        }
+        child_offset = trie_image_children(node)[i];
+        child = trie_image_node(trie, child_offset);
+
+        label = trie_image_label(child);
+        max = (child->label_len < len - pos) ? child->label_len : len - pos;
+        for (common = 1; common < max && label[common] == key[pos + common];
+             common++);
+
+        if (common < child->label_len) {
+            /*
+             * The key leaves the label part way. The whole subtree sorts
+             * after the key if the key ran out or has the smaller byte,
+             * and before it otherwise.
+             */
+            if (pos + common == len ||
+                (uint8_t)key[pos + common] < (uint8_t)label[common]) {
+                return (trie_image_first_leaf(trie, child_offset));
+            }
+            return (trie_image_next_subtree(trie, child_offset, 0));
+        }
+
+        pos += common;
+        offset = child_offset;
+    }
+}
+
+/*
+ * trie_da_child
+ *
+ * Return the state the given code (0 for the key end, else byte + 1)
+ * leads to from the given state of a frozen trie, or 0 if there is none
+ */
+static inline uint32_t
+trie_da_child (trie_da_t *da, uint32_t state, uint32_t code)
+{
+    uint32_t    next = (uint32_t)da->base[state] + code;
+
+    return ((next < da->used && da->check[next] == (int32_t)state) ?
+            next : 0);
+}
+
+/*
+ * trie_da_record
+ *
+ * Return the record of the given leaf state of a frozen trie
+ */
+static inline void *
+trie_da_record (trie_da_t *da, uint32_t state)
+{
+    return (da->data[-da->base[state] - 1]);
+}
+
+/*
+ * trie_da_find
+ *
+ * Return the leaf state of the given key in a frozen trie, or 0 if the
+ * key is not there
+ */
+static uint32_t
+trie_da_find (trie_t *trie, char *key, uint32_t len)
+{
+    trie_da_t   *da = &trie->da;
+    uint32_t    state = TRIE_DA_ROOT, i;
+
+    for (i = 0; i < len; i++) {
+        state = trie_da_child(da, state, (uint8_t)key[i] + 1);
+        if (!state) {
+            return 0;
+        }
+    }
+
+    return (trie_da_child(da, state, 0));
+}
+
+/*
+ * trie_da_next_child
+ *
+ * Return the first child of the given state of a frozen trie with a
+ * code of at least from, or 0 if there is none
+ */
+static uint32_t
+trie_da_next_child (trie_da_t *da, uint32_t state, uint32_t from)
+{
+    uint32_t    next;
+
+    for (; from < TRIE_DA_CODES; from++) {
+        next = trie_da_child(da, state, from);
+        if (next) {
+            return next;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * trie_da_first_leaf
+ *
+ * Return the leaf state of the first key below the given state of a
+ * frozen trie, or 0 if there is none. Leaf states have a negative base.
+ */
+static uint32_t
+trie_da_first_leaf (trie_da_t *da, uint32_t state)
+{
+    while (state != 0 && da->base[state] >= 0) {
+        state = trie_da_next_child(da, state, 0);
+    }
+
+    return state;
+}
+
+/*
+ * trie_da_next_subtree
+ *
+ * Return the leaf state of the first key after all the keys below the
+ * given state of a frozen trie, or 0 if there is none. The search
+ * doesn't leave the subtree rooted at top.
+ */
+static uint32_t
+trie_da_next_subtree (trie_da_t *da, uint32_t state, uint32_t top)
+{
+    uint32_t    parent, next;
+
+    /* Climb up till there is a sibling to the right */
+    while (state != top && state != TRIE_DA_ROOT) {
+        parent = da->check[state];
+        next = trie_da_next_child(da, parent,
+                                  state - (uint32_t)da->base[parent] + 1);
+        if (next) {
+            return (trie_da_first_leaf(da, next));
+        }
+        state = parent;
+    }
+
+    return 0;
+}
+
+/*
+ * trie_da_prefix
+ *
+ * Return the state of a frozen trie reached by the given prefix, or 0
+ * if no key starts with it
+ */
+static uint32_t
+trie_da_prefix (trie_t *trie, char *prefix, uint32_t len)
+{
+    uint32_t    state = TRIE_DA_ROOT, i;
+
+    for (i = 0; i < len; i++) {
+        state = trie_da_child(&trie->da, state, (uint8_t)prefix[i] + 1);
+        if (!state) {
+            return 0;
+        }
+    }
+
+    return state;
+}
+
+/*
+ * trie_da_seek
+ *
+ * Return the leaf state of the smallest key in a frozen trie which is
+ * not less than the given key, or 0 if every key is smaller
+ */
+static uint32_t
+trie_da_seek (trie_t *trie, char *key, uint32_t len)
+{
+    trie_da_t   *da = &trie->da;
+    uint32_t    state = TRIE_DA_ROOT, next, i;
+
+    for (i = 0; i < len; i++) {
+        next = trie_da_child(da, state, (uint8_t)key[i] + 1);
+        if (!next) {
+            /* Go for the first child past the key's byte, if any */
+            next = trie_da_next_child(da, state, (uint8_t)key[i] + 2);
+            return (next ? trie_da_first_leaf(da, next) :
+                           trie_da_next_subtree(da, state, 0));
+        }
+        state = next;
+    }
+
+    /* The key ends here. Everything below sorts after it. */
+    return (trie_da_first_leaf(da, state));
+}
+
+/*
+ * trie_clear
+ *
+ * Remove every key from the trie at once. The slab holding the nodes
+ * is released as a whole. Only radix tries with labels of their own
+ * have to visit the nodes, to free the labels. Mapped tries are read
+ * only and are left alone. Frozen tries drop their double array and can
+ * take inserts again. A concurrent trie must not be in use by any other
+ * thread while it is cleared.
+ */
+void
+trie_clear (trie_t *trie)
+{
+    uint8_t type;
+
+    if (trie->flags & TRIE_FLAG_MAPPED) {
+        return;
+    }
+
+    if (trie->flags & TRIE_FLAG_FROZEN) {
+        free(trie->da.base);
+        free(trie->da.check);
+        free(trie->da.data);
+        memset(&trie->da, 0, sizeof(trie->da));
+        trie->flags &= ~TRIE_FLAG_FROZEN;
+    }
+
+    /* Retired nodes go back to the slabs first */
+    if (trie->flags & TRIE_FLAG_CONCURRENT) {
+        epoch_reclaim(trie->epoch);
+    }
+
+    if (trie->flags & TRIE_FLAG_RADIX) {
+        trie_radix_free_labels(trie->radix_root);
+        trie->radix_root = NULL;
+        for (type = 0; type < TRIE_NODE_TYPES; type++) {
+            slab_reset(trie->radix_slab[type]);
+        }
+    } else {
+        slab_reset(trie->node_slab);
+    }
+    trie->root = NULL;
+    trie->node_count = 0;
+    trie->leaf_count = 0;
+
+    /* A concurrent trie always has its root */
+    if (trie->flags & TRIE_FLAG_CONCURRENT) {
+        trie->radix_root = trie_radix_alloc_node(trie, TRIE_NODE_256, NULL,
+                                                 "", 0);
+    }
+}
+
+/*
+ * trie_node_rank
+ *
+ * Position of the given node among its siblings. Leaf nodes end a key
+ * and come before every character, 0 included.
+ */
+static inline uint32_t
+trie_node_rank (trie_node_t *node)
+{
+    return (node->leaf ? 0 : (uint8_t)node->key + 1);
+}
+
+/*
+ * trie_key_rank
+ *
+ * The rank a node must have to match the given position of a key of
+ * the given length. The position just past the end matches the leaf.
+ */
+static inline uint32_t
+trie_key_rank (char *key, uint32_t len, uint32_t key_index)
+{
+    return ((key_index < len) ? (uint8_t)key[key_index] + 1 : 0);
+}
+
+/*
+ * trie_lookup_node
+ *
+ * Walk down a per character trie along the given key and return its
+ * leaf node, or NULL if the key is not present
+ */
+static trie_node_t *
+trie_lookup_node (trie_t *trie, char *key, uint32_t len)
+{
+    trie_node_t *node;
+    uint32_t    key_index, rank;
+
+    /* Search level by level */
+    node = trie->root;
+    for (key_index = 0; ; key_index++) {
+        rank = trie_key_rank(key, len, key_index);
+
+        /* Siblings are sorted, so give up once we are past the character */
+        while (node != NULL && trie_node_rank(node) < rank) {
+            node = node->sibling;
+        }
+
+        /* Bail if nothing matched */
+        if (node == NULL || trie_node_rank(node) != rank) {
+            return NULL;
+        }
+
+        /* Are we at the leaf node? */
+        if (rank == 0) {
+            return node;
+        }
+
+        node = node->children;
+    }
+}
+
+/*
+ * trie_get_least_internal
+ *
+ * Return the leaf node from the given level
+ */
+static trie_node_t *
+trie_get_least_internal (trie_node_t *level)
+{
+    /* Go down the trie children by children till we hit a leaf */
+    while (level != NULL) {
+        if (level->leaf) {
+            return level;
+        }
+        level = level->children;
+    }
+
+    /* Shouldn't come here */
+    return NULL;
+}
+
+/*
+ * trie_get_next_internal
+ *
+ * Return the leaf node of the first key after all the keys below the
+ * given node, or NULL if there is none. For a leaf node this is simply
+ * the leaf of the next key. If top is given, the search stays among the
+ * keys below top.
+ */
+static trie_node_t *
+trie_get_next_internal (trie_node_t *key_node, trie_node_t *top)
+{
+    trie_node_t *node, *parent;
+
+    /* 
+     * Walk up the trie one level at a time. Stop when you
+     * reach a level which is having a right sibling.
+     */
+    parent = key_node;
+    node = NULL;
+
+    while (parent != top) {
+        if (parent->sibling != NULL) {
+            if (parent->sibling != node) {
+                break;
+            }
+        }
+        node = parent;
+        parent = node->parent;
+    }
+
+    /* Bail if we didn't find anything */
+    if (parent == top) {
+        /* We have iterated over all the nodes */
+        return NULL;
+    }
+
+    /* 
+     * We have come to the correct branch. Pick the leaf node
+     * for this branch.
+     */
+    return (trie_get_least_internal(parent->sibling));
+}
+
+/*
+ * trie_seek_internal
+ *
+ * Return the leaf node of the smallest key which is not less than the
+ * given key, or NULL if every key is smaller
+ */
+static trie_node_t *
+trie_seek_internal (trie_t *trie, char *key, uint32_t len)
+{
+    trie_node_t *level, *node, *parent = NULL;
+    uint32_t    key_index, rank;
+
+    level = trie->root;
+    for (key_index = 0; level != NULL; key_index++) {
+        rank = trie_key_rank(key, len, key_index);
+
+        /* Find the character, or else the smallest one above it */
+        node = level;
+        while (node != NULL && trie_node_rank(node) < rank) {
+            node = node->sibling;
+        }
+
+        if (node == NULL) {
+            break;
+        }
+        if (trie_node_rank(node) != rank) {
+            return (trie_get_least_internal(node));
+        }
+
+        /* Are we at the leaf node? */
+        if (rank == 0) {
+            return node;
+        }
+
+        parent = node;
+        level = node->children;
+    }
+
+    /* Every key below the last match sorts before the given key */
+    return (parent ? trie_get_next_internal(parent, NULL) : NULL);
+}
+
+/*
+ * trie_get_least
+ *
+ * Return a pointer to the first key in the trie
+ */
+void *
+trie_get_least (trie_t *trie)
+{
+    trie_node_t *root = trie->root;
+    trie_node_t *node;
+    trie_radix_node_t *leaf;
+    uint32_t offset;
+    void *data;
+
+    if (trie->flags & TRIE_FLAG_MAPPED) {
+        offset = trie_image_first_leaf(trie, trie_image_root());
+        return (offset ? trie_image_record(trie, trie_image_node(trie, offset))
+                       : NULL);
+    }
+
+    if (trie->flags & TRIE_FLAG_FROZEN) {
+        offset = trie_da_first_leaf(&trie->da, TRIE_DA_ROOT);
+        return (offset ? trie_da_record(&trie->da, offset) : NULL);
+    }
+
+    if (trie->flags & TRIE_FLAG_CONCURRENT) {
+        epoch_enter(trie->epoch);
+        leaf = trie_radix_first_leaf(trie->radix_root);
+        data = leaf ? TRIE_LOAD(leaf->data) : NULL;
+        epoch_exit(trie->epoch);
+        return data;
+    }
+
+    if (trie->flags & TRIE_FLAG_RADIX) {
+        leaf = trie_radix_first_leaf(trie->radix_root);
+        return (leaf ? leaf->data : NULL);
+    }
+
+    /* Sanity check */
+    if (!root) {
+        return NULL;
+    }
+
+    /* Go down the trie one level at a time till we hit a leaf */
+    node = trie_get_least_internal(root);
+
+    /* Return whatever we got */
+    return (node ? node->data : NULL);
+}
+
+/*
+ * trie_get_next
+ *
+ * Return the next key in the trie. The key of the previous record is
+ * taken to end at its first 0, so tries with keys holding a 0 have to
+ * be walked with a cursor instead.
+ */
+void *
+trie_get_next (trie_t *trie, void *prev_node)
+{
+    trie_node_t *key_node;
+    trie_radix_node_t *leaf;
+    uint32_t offset;
+    char *key;
+    void *data;
+
+    /* Sanity check */
+    if (!trie || !prev_node) {
+        return NULL;
+    }
+
+    /* Get the key associated with the previous node */
+    key = trie->get_key(prev_node);
+    if (!key) {
+        return NULL;
+    }
+
+    if (trie->flags & TRIE_FLAG_MAPPED) {
+        offset = trie_image_find(trie, key, strlen(key));
+        if (!offset) {
+            return NULL;
+        }
+        offset = trie_image_next_leaf(trie, offset, 0);
+        return (offset ? trie_image_record(trie, trie_image_node(trie, offset))
+                       : NULL);
+    }
+
+    if (trie->flags & TRIE_FLAG_FROZEN) {
+        offset = trie_da_find(trie, key, strlen(key));
+        if (!offset) {
+            return NULL;
+        }
+        offset = trie_da_next_subtree(&trie->da, offset, 0);
+        return (offset ? trie_da_record(&trie->da, offset) : NULL);
+    }
+
+    /* The key may have gone meanwhile. Whatever follows it still does. */
+    if (trie->flags & TRIE_FLAG_CONCURRENT) {
+        epoch_enter(trie->epoch);
+        leaf = trie_radix_seek_concurrent(trie, key, strlen(key), TRUE, NULL);
+        data = leaf ? TRIE_LOAD(leaf->data) : NULL;
+        epoch_exit(trie->epoch);
+        return data;
+    }
+
+    if (trie->flags & TRIE_FLAG_RADIX) {
+        leaf = trie_radix_find(trie, key, strlen(key));
+        if (!leaf) {
+            return NULL;
+        }
+        leaf = trie_radix_next_leaf(leaf, NULL);
+        return (leaf ? leaf->data : NULL);
+    }
+
+    if (!trie->root) {
+        return NULL;
+    }
+
+    /* First get the leaf corresponding to the given key */
+    key_node = (trie_node_t *)trie_lookup_internal(trie, key);
+    if (!key_node) {
+        return NULL;
+    }
+
+    key_node = trie_get_next_internal(key_node, NULL);
+    return (key_node ? key_node->data : NULL);
+}
+
+/*
+ * trie_iter_concurrent
+ *
+ * Put the cursor of a concurrent trie on the given node, holding a key
+ * of the given length, and return its record. The record's own key is
+ * kept along with the length, so that the next key can be sought from
+ * the root even if the key holds 0 bytes. Must be called inside the
+ * trie's epoch.
+ */
+static void *
+trie_iter_concurrent (trie_iter_t *iter, trie_radix_node_t *leaf,
+                      uint32_t len)
+{
+    iter->data = leaf ? TRIE_LOAD(leaf->data) : NULL;
+    iter->key = iter->data ? iter->trie->get_key(iter->data) : NULL;
+    iter->key_len = iter->data ? len : 0;
+
+    return iter->data;
+}
+
+/*
+ * trie_iter_first
+ *
+ * Position the cursor on the first key in the trie and return its
+ * record, or NULL if the trie is empty
+ */
+void *
+trie_iter_first (trie_t *trie, trie_iter_t *iter)
+{
+    /* Sanity check */
+    if (!trie || !iter) {
+        return NULL;
+    }
+
+    /* The empty key comes before every other */
+    if (trie->flags & TRIE_FLAG_CONCURRENT) {
+        return (trie_iter_seek_len(trie, iter, "", 0));
+    }
+
+    iter->trie = trie;
+    iter->node = NULL;
+    iter->radix_node = NULL;
+    iter->image_node = 0;
+    iter->da_state = 0;
+    iter->data = NULL;
+    iter->key = NULL;
+    iter->key_len = 0;
+
+    if (trie->flags & TRIE_FLAG_MAPPED) {
+        iter->image_node = trie_image_first_leaf(trie, trie_image_root());
+        return (iter->image_node ?
+                trie_image_record(trie, trie_image_node(trie, iter->image_node)) :
+                NULL);
+    }
+
+    if (trie->flags & TRIE_FLAG_FROZEN) {
+        iter->da_state = trie_da_first_leaf(&trie->da, TRIE_DA_ROOT);
+        return (iter->da_state ? trie_da_record(&trie->da, iter->da_state) :
+                                 NULL);
+    }
+
+    if (trie->flags & TRIE_FLAG_RADIX) {
+        iter->radix_node = trie_radix_first_leaf(trie->radix_root);
+        return (iter->radix_node ? iter->radix_node->data : NULL);
+    }
+
+    iter->node = trie_get_least_internal(trie->root);
+    return (iter->node ? iter->node->data : NULL);
+}
+
+/*
+ * trie_iter_seek_len
+ *
+ * Position the cursor on the smallest key which is not less than the
+ * given key of the given length and return its record, or NULL if
+ * there is no such key
+ */
+void *
+trie_iter_seek_len (trie_t *trie, trie_iter_t *iter, char *key, uint32_t len)
+{
+    trie_radix_node_t *leaf;
+    uint32_t found_len;
+
+    /* Sanity check */
+    if (!trie || !iter || !key) {
+        return NULL;
+    }
+
+    iter->trie = trie;
+    iter->node = NULL;
+    iter->radix_node = NULL;
+    iter->image_node = 0;
+    iter->da_state = 0;
+    iter->data = NULL;
+    iter->key = NULL;
+    iter->key_len = 0;
+
+    if (trie->flags & TRIE_FLAG_CONCURRENT) {
+        epoch_enter(trie->epoch);
+        leaf = trie_radix_seek_concurrent(trie, key, len, FALSE, &found_len);
+        trie_iter_concurrent(iter, leaf, found_len);
+        epoch_exit(trie->epoch);
+        return iter->data;
+    }
+
+    if (trie->flags & TRIE_FLAG_MAPPED) {
+        iter->image_node = trie_image_seek(trie, key, len);
+        return (iter->image_node ?
+                trie_image_record(trie, trie_image_node(trie, iter->image_node)) :
+                NULL);
+    }
+
+    if (trie->flags & TRIE_FLAG_FROZEN) {
+        iter->da_state = trie_da_seek(trie, key, len);
+        return (iter->da_state ? trie_da_record(&trie->da, iter->da_state) :
+                                 NULL);
+    }
+
+    if (trie->flags & TRIE_FLAG_RADIX) {
+        iter->radix_node = trie_radix_seek(trie, key, len);
+        return (iter->radix_node ? iter->radix_node->data : NULL);
+    }
+
+    iter->node = trie_seek_internal(trie, key, len);
+    return (iter->node ? iter->node->data : NULL);
+}
+
+/*
+ * trie_iter_seek
+ *
+ * Position the cursor on the smallest key which is not less than the
+ * given key and return its record, or NULL if there is no such key
+ */
+void *
+trie_iter_seek (trie_t *trie, trie_iter_t *iter, char *key)
+{
+    /* Sanity check */
+    if (!key) {
+        return NULL;
+    }
+
+    return (trie_iter_seek_len(trie, iter, key, strlen(key)));
+}
+
+/*
+ * trie_iter_next
+ *
+ * Move the cursor to the next key and return its record, or NULL once
+ * the keys run out. Unlike trie_get_next(), the current key is not
+ * looked up again, so a full scan only visits each node a few times.
+ */
+void *
+trie_iter_next (trie_iter_t *iter)
+{
+    trie_radix_node_t *leaf;
+    uint32_t len;
+
+    /* Sanity check */
+    if (!iter) {
+        return NULL;
+    }
+
+    /* Seek past the current key, which may have gone meanwhile */
+    if (iter->data) {
+        epoch_enter(iter->trie->epoch);
+        leaf = trie_radix_seek_concurrent(iter->trie, iter->key, iter->key_len,
+                                          TRUE, &len);
+        trie_iter_concurrent(iter, leaf, len);
+        epoch_exit(iter->trie->epoch);
+        return iter->data;
+    }
+
+    if (iter->image_node) {
+        iter->image_node = trie_image_next_leaf(iter->trie, iter->image_node, 0);
+        return (iter->image_node ?
+                trie_image_record(iter->trie,
+                                  trie_image_node(iter->trie, iter->image_node)) :
+                NULL);
+    }
+
+    if (iter->da_state) {
+        iter->da_state = trie_da_next_subtree(&iter->trie->da, iter->da_state,
+                                              0);
+        return (iter->da_state ?
+                trie_da_record(&iter->trie->da, iter->da_state) : NULL);
+    }
+
+    if (iter->radix_node) {
+        iter->radix_node = trie_radix_next_leaf(iter->radix_node, NULL);
+        return (iter->radix_node ? iter->radix_node->data : NULL);
+    }
+
+    if (iter->node) {
+        iter->node = trie_get_next_internal(iter->node, NULL);
+        return (iter->node ? iter->node->data : NULL);
+    }
+
+    return NULL;
+}
+
+/*
+ * trie_set_score_fn
+ *
+ * Have the trie cache, for every subtree, the best score of the records
+ * in it, so that trie_prefix_topk() with the same score_fn can skip the
+ * subtrees which can't make the cut. Must be called while the trie is
+ * empty. A record's score must not change while it is in the trie.
+ * Concurrent tries don't cache scores.
+ */
+int
+trie_set_score_fn (trie_t *trie, uint32_t (*score_fn)(void *data))
+{
+    /* Sanity check */
+    if (!trie || (trie->flags & TRIE_FLAG_CONCURRENT)) {
+        return EINVAL;
+    }
+
+    if (!trie_empty(trie)) {
+        return EFAIL;
+    }
+
+    trie->score_fn = score_fn;
+
+    return EOK;
+}
+
+/*
+ * trie_prefix_level
+ *
+ * Walk down a per character trie along the given prefix. Returns the
+ * first node of the level holding whatever follows the prefix, or NULL
+ * if no key starts with it. top is set to the node of the last prefix
+ * character, which is NULL for an empty prefix.
+ */
+static trie_node_t *
+trie_prefix_level (trie_t *trie, char *prefix, uint32_t len,
+                   trie_node_t **top)
+{
+    trie_node_t *level = trie->root, *node;
+    uint32_t    i, rank;
+
+    *top = NULL;
+
+    for (i = 0; i < len; i++) {
+        rank = trie_key_rank(prefix, len, i);
+        node = level;
+        while (node != NULL && trie_node_rank(node) < rank) {
+            node = node->sibling;
+        }
+
+        if (node == NULL || trie_node_rank(node) != rank) {
+            return NULL;
+        }
+
+        *top = node;
+        level = node->children;
+    }
+
+    return level;
+}
+
+/*
+ * trie_radix_prefix
+ *
+ * Walk down a radix trie along the given prefix. Returns the root of
+ * the subtree holding every key starting with it, or NULL if there are
+ * none. The prefix may end part way along the root's label.
+ */
+static trie_radix_node_t *
+trie_radix_prefix (trie_t *trie, char *prefix, uint32_t len)
+{
+    trie_radix_node_t   *node = trie->radix_root;
+    trie_radix_node_t   **slot;
+    uint32_t            pos = 0, max;
+
+    while (node != NULL && pos < len) {
+        slot = trie_radix_find_child(node, (uint8_t)prefix[pos]);
+        if (!slot) {
+            return NULL;
+        }
+        node = *slot;
+
+        max = (node->label_len < len - pos) ? node->label_len : len - pos;
+        if (max > 1 && memcmp(trie_radix_label(node) + 1, prefix + pos + 1,
+                              max - 1) != 0) {
+            return NULL;
+        }
+
+        pos += max;
+    }
+
+    return node;
+}
+
+/*
+ * trie_prefix_foreach_concurrent
+ *
+ * trie_prefix_foreach() on a concurrent trie. Each key is found afresh
+ * from the root, as the one before may be gone. Keys which stay in the
+ * trie for the whole scan are all visited, the others may or may not
+ * be.
+ */
+static int
+trie_prefix_foreach_concurrent (trie_t *trie, char *prefix, uint32_t len,
+                                int (*callback)(void *data, void *ctx),
+                                void *ctx)
+{
+    trie_radix_node_t   *leaf;
+    uint32_t            key_len;
+    char                *key;
+    void                *data;
+    int                 rc = EOK;
+
+    epoch_enter(trie->epoch);
+
+    leaf = trie_radix_seek_concurrent(trie, prefix, len, FALSE, &key_len);
+    while (leaf != NULL) {
+        data = TRIE_LOAD(leaf->data);
+        key = trie->get_key(data);
+        if (key_len < len || memcmp(key, prefix, len) != 0) {
+            break;
+        }
+
+        rc = callback(data, ctx);
+        if (rc != 0) {
+            break;
+        }
+
+        leaf = trie_radix_seek_concurrent(trie, key, key_len, TRUE, &key_len);
+    }
+
+    epoch_exit(trie->epoch);
+
+    return rc;
+}
+
+/*
+ * trie_prefix_foreach_len
+ *
+ * Invoke the callback for every record with a key starting with the
+ * given prefix of the given length, in key order. The trie is descended
+ * once to the end of the prefix and the keys below are streamed from
+ * there. The scan stops early if the callback returns non-zero, and
+ * that value is returned.
+ */
+int
+trie_prefix_foreach_len (trie_t *trie, char *prefix, uint32_t len,
+                         int (*callback)(void *data, void *ctx), void *ctx)
+{
+    trie_node_t         *node, *top;
+    trie_radix_node_t   *leaf, *sub;
+    uint32_t            offset, top_offset;
+    int                 rc;
+
+    /* Sanity check */
+    if (!trie || !prefix || !callback) {
+        return EINVAL;
+    }
+
+    if (trie->flags & TRIE_FLAG_MAPPED) {
+        top_offset = trie_image_prefix(trie, prefix, len);
+        for (offset = trie_image_first_leaf(trie, top_offset); offset != 0;
+             offset = trie_image_next_leaf(trie, offset, top_offset)) {
+            rc = callback(trie_image_record(trie, trie_image_node(trie, offset)),
+                          ctx);
+            if (rc != 0) {
+                return rc;
+            }
+        }
+        return EOK;
+    }
+
+    if (trie->flags & TRIE_FLAG_FROZEN) {
+        top_offset = trie_da_prefix(trie, prefix, len);
+        for (offset = trie_da_first_leaf(&trie->da, top_offset); offset != 0;
+             offset = trie_da_next_subtree(&trie->da, offset, top_offset)) {
+            rc = callback(trie_da_record(&trie->da, offset), ctx);
+            if (rc != 0) {
+                return rc;
+            }
+        }
+        return EOK;
+    }
+
+    if (trie->flags & TRIE_FLAG_CONCURRENT) {
+        return (trie_prefix_foreach_concurrent(trie, prefix, len, callback,
+                                               ctx));
+    }
+
+    if (trie->flags & TRIE_FLAG_RADIX) {
+        sub = trie_radix_prefix(trie, prefix, len);
+        for (leaf = trie_radix_first_leaf(sub); leaf != NULL;
+             leaf = trie_radix_next_leaf(leaf, sub)) {
+            rc = callback(leaf->data, ctx);
+            if (rc != 0) {
+                return rc;
+            }
+        }
+        return EOK;
+    }
+
+    node = trie_get_least_internal(trie_prefix_level(trie, prefix, len, &top));
+    for (; node != NULL; node = trie_get_next_internal(node, top)) {
+        rc = callback(node->data, ctx);
+        if (rc != 0) {
+            return rc;
+        }
+    }
+
+    return EOK;
+}
+
+/*
+ * trie_prefix_foreach
+ *
+ * Invoke the callback for every record with a key starting with the
+ * given prefix. See trie_prefix_foreach_len().
+ */
+int
+trie_prefix_foreach (trie_t *trie, char *prefix,
+                     int (*callback)(void *data, void *ctx), void *ctx)
+{
+    /* Sanity check */
+    if (!prefix) {
+        return EINVAL;
+    }
+
+    return (trie_prefix_foreach_len(trie, prefix, strlen(prefix), callback,
+                                    ctx));
+}
+
+/*
+ * trie_topk_above
+ *
+ * Does entry a belong above entry b in the heap?
+ */
+static inline uint8_t
+trie_topk_above (trie_topk_t *topk, trie_topk_entry_t *a, trie_topk_entry_t *b)
+{
+    return (topk->max_heap ? a->score > b->score : a->score < b->score);
+}
+
+/*
+ * trie_topk_push
+ *
+ * Add an entry to the heap of a top-k query
+ */
+static int
+trie_topk_push (trie_topk_t *topk, void *ptr, uint32_t score, uint8_t record)
+{
+    trie_topk_entry_t   *entries, tmp;
+    uint32_t            i, up;
+
+    if (topk->count == topk->size) {
+        entries = (trie_topk_entry_t *)realloc(topk->entries,
+                                               (topk->size ? topk->size * 2 : 16) *
+                                               sizeof(trie_topk_entry_t));
+        if (!entries) {
+            return EFAIL;
+        }
+        topk->entries = entries;
+        topk->size = topk->size ? topk->size * 2 : 16;
+    }
+
+    i = topk->count++;
+    topk->entries[i].ptr = ptr;
+    topk->entries[i].score = score;
+    topk->entries[i].record = record;
+
+    /* Sift it up */
+    while (i > 0) {
+        up = (i - 1) / 2;
+        if (!trie_topk_above(topk, &topk->entries[i], &topk->entries[up])) {
+            break;
+        }
+        tmp = topk->entries[i];
+        topk->entries[i] = topk->entries[up];
+        topk->entries[up] = tmp;
+        i = up;
+    }
+
+    return EOK;
+}
+
+/*
+ * trie_topk_pop
+ *
+ * Take the top entry off the heap of a top-k query
+ */
+static trie_topk_entry_t
+trie_topk_pop (trie_topk_t *topk)
+{
+    trie_topk_entry_t   top = topk->entries[0], tmp;
+    uint32_t            i = 0, child;
+
+    topk->entries[0] = topk->entries[--topk->count];
+
+    /* Sift the last entry down from the top */
+    while ((child = 2 * i + 1) < topk->count) {
+        if (child + 1 < topk->count &&
+            trie_topk_above(topk, &topk->entries[child + 1],
+                            &topk->entries[child])) {
+            child++;
+        }
+        if (!trie_topk_above(topk, &topk->entries[child], &topk->entries[i])) {
+            break;
+        }
+        tmp = topk->entries[i];
+        topk->entries[i] = topk->entries[child];
+        topk->entries[child] = tmp;
+        i = child;
+    }
+
+    return top;
+}
+
+/*
+ * trie_topk_collect
+ *
+ * trie_prefix_foreach() callback for top-k queries without cached
+ * scores. Keeps the k best records seen so far, with the worst on top.
+ */
+static int
+trie_topk_collect (void *data, void *ctx)
+{
+    trie_topk_t *topk = (trie_topk_t *)ctx;
+    uint32_t    score = topk->score_fn(data);
+
+    if (topk->count == topk->k) {
+        if (score <= topk->entries[0].score) {
+            return 0;
+        }
+        trie_topk_pop(topk);
+    }
+
+    return (trie_topk_push(topk, data, score, TRUE));
+}
+
+/*
+ * trie_topk_cached
+ *
+ * Best first search for the top-k records, using the best score cached
+ * for every subtree. A subtree is only opened up once it is the best
+ * candidate left, so subtrees which can't make the cut are never
+ * visited. Returns the number of records found.
+ */
+static int
+trie_topk_cached (trie_t *trie, char *prefix, uint32_t len, trie_topk_t *topk,
+                  void **results)
+{
+    trie_topk_entry_t   entry;
+    trie_node_t         *node, *top;
+    trie_radix_node_t   *radix, *child;
+    uint32_t            found = 0;
+
+    if (trie->flags & TRIE_FLAG_RADIX) {
+        radix = trie_radix_prefix(trie, prefix, len);
+        if (radix && trie_topk_push(topk, radix, radix->max_score, FALSE) != EOK) {
+            return EFAIL;
+        }
+    } else {
+        for (node = trie_prefix_level(trie, prefix, len, &top); node != NULL;
+             node = node->sibling) {
+            if (trie_topk_push(topk, node, node->max_score,
+                               node->leaf) != EOK) {
+                return EFAIL;
+            }
+        }
+    }
+
+    while (found < topk->k && topk->count > 0) {
+        entry = trie_topk_pop(topk);
+
+        if (trie->flags & TRIE_FLAG_RADIX) {
+            radix = (trie_radix_node_t *)entry.ptr;
+            if (entry.record) {
+                results[found++] = radix->data;
+                continue;
+            }
+
+            /* Open up the subtree. The node's own record is a candidate too. */
+            if (radix->leaf &&
+                trie_topk_push(topk, radix, trie->score_fn(radix->data),
+                               TRUE) != EOK) {
+                return EFAIL;
+            }
+            for (child = trie_radix_next_child(radix, 0); child != NULL;
+                 child = trie_radix_next_child(radix,
+                                               (uint8_t)child->label[0] + 1)) {
+                if (trie_topk_push(topk, child, child->max_score,
+                                   FALSE) != EOK) {
+                    return EFAIL;
+                }
+            }
+            continue;
+        }
+
+        node = (trie_node_t *)entry.ptr;
+        if (entry.record) {
+            results[found++] = node->data;
+            continue;
+        }
+
+        for (node = node->children; node != NULL; node = node->sibling) {
+            if (trie_topk_push(topk, node, node->max_score,
+                               node->leaf) != EOK) {
+                return EFAIL;
+            }
+        }
+    }
+
+    return ((int)found);
+}
+
+/*
+ * trie_prefix_topk_len
+ *
+ * Fill results with up to k records, best score first, out of those
+ * with a key starting with the given prefix of the given length.
+ * Returns the number of records found. If the trie caches scores for
+ * the same score_fn (see trie_set_score_fn()) only the promising
+ * subtrees are visited, else every matching record is scored.
+ */
+int
+trie_prefix_topk_len (trie_t *trie, char *prefix, uint32_t len, uint32_t k,
+                      uint32_t (*score_fn)(void *data), void **results)
+{
+    trie_topk_t         topk;
+    trie_topk_entry_t   entry;
+    int                 found;
+
+    /* Sanity check */
+    if (!trie || !prefix || !score_fn || !results) {
+        return EINVAL;
+    }
+
+    memset(&topk, 0, sizeof(topk));
+    topk.k = k;
+    topk.score_fn = score_fn;
+
+    if (k == 0) {
+        return 0;
+    }
+
+    /* Frozen tries have no nodes to cache the scores in */
+    if (score_fn == trie->score_fn && !(trie->flags & TRIE_FLAG_FROZEN)) {
+        topk.max_heap = TRUE;
+        found = trie_topk_cached(trie, prefix, len, &topk, results);
+    } else {
+        found = trie_prefix_foreach_len(trie, prefix, len, trie_topk_collect,
+                                        &topk);
+        if (found == EOK) {
+            /* The worst record comes off first */
+            found = topk.count;
+            while (topk.count > 0) {
+                entry = trie_topk_pop(&topk);
+                results[topk.count] = entry.ptr;
+            }
+        }
+    }
+
+    free(topk.entries);
+
+    return found;
+}
+
+/*
+ * trie_prefix_topk
+ *
+ * Fill results with up to k records, best score first, out of those
+ * with a key starting with the given prefix. See trie_prefix_topk_len().
+ */
+int
+trie_prefix_topk (trie_t *trie, char *prefix, uint32_t k,
+                  uint32_t (*score_fn)(void *data), void **results)
+{
+    /* Sanity check */
+    if (!prefix) {
+        return EINVAL;
+    }
+
+    return (trie_prefix_topk_len(trie, prefix, strlen(prefix), k, score_fn,
+                                 results));
+}
+
+/*
+ * trie_read_lock
+ *
+ * Keep the records returned by lookups on a concurrent trie valid until
+ * trie_read_unlock(). Writers are not blocked. Calls may be nested,
+ * and are a no-op on other tries.
+ */
+void
+trie_read_lock (trie_t *trie)
+{
+    if (trie->flags & TRIE_FLAG_CONCURRENT) {
+        epoch_enter(trie->epoch);
+    }
+}
+
+/*
+ * trie_read_unlock
+ *
+ * End a section started by trie_read_lock()
+ */
+void
+trie_read_unlock (trie_t *trie)
+{
+    if (trie->flags & TRIE_FLAG_CONCURRENT) {
+        epoch_exit(trie->epoch);
+    }
+}
+
+/*
+ * trie_synchronize
+ *
+ * Wait until no reader of a concurrent trie can still be looking at a
+ * record removed before this call. The memory of removed records can be
+ * freed or reused once this returns. Must not be called between
+ * trie_read_lock() and trie_read_unlock().
+ */
+void
+trie_synchronize (trie_t *trie)
+{
+    if (trie->flags & TRIE_FLAG_CONCURRENT) {
+        epoch_synchronize(trie->epoch);
+    }
+}
+
+/*
+ * trie_write_lock
+ *
+ * Return the lock a writer of a concurrent trie takes to change the
+ * given key. Every key starting with the same byte shares a lock, and
+ * so does everything below the same child of the root.
+ */
+static inline pthread_mutex_t *
+trie_write_lock (trie_t *trie, char *key, uint32_t len)
+{
+    return &trie->write_locks[len ? (uint8_t)key[0] : TRIE_LOCK_STRIPES - 1];
+}
+
+/*
+ * trie_write_lock_all
+ *
+ * Hold off every writer of a concurrent trie, or let them go again
+ */
+static void
+trie_write_lock_all (trie_t *trie, uint8_t lock)
+{
+    uint32_t    i;
+
+    for (i = 0; i < TRIE_LOCK_STRIPES; i++) {
+        if (lock) {
+            pthread_mutex_lock(&trie->write_locks[i]);
+        } else {
+            pthread_mutex_unlock(&trie->write_locks[i]);
+        }
+    }
+}
+
+/*
+ * trie_get_count
+ *
+ * Return the count of elements in the given trie
+ */
+uint32_t
+trie_get_count (trie_t *trie)
+{
+    return trie->leaf_count;
+}
+
+/*
+ * trie_empty
+ *
+ * Returns true if trie is empty. False otherwise.
+ */
+uint8_t
+trie_empty (trie_t *trie)
+{
+    /* The root of a concurrent trie is there even when it is empty */
+    if (trie->flags & TRIE_FLAG_CONCURRENT) {
+        return (trie->leaf_count == 0);
+    }
+
+    if (trie->node_count == 0) {
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+/*
+ * trie_node_up
+ *
+ * Return the node whose children list holds the given node, or NULL for
+ * a node at the top level. The parent pointer of all but the first node
+ * in a list points to the previous sibling.
+ */
+static trie_node_t *
+trie_node_up (trie_node_t *node)
+{
+    while (node->parent != NULL && node->parent->children != node) {
+        node = node->parent;
+    }
+
+    return node->parent;
+}
+
+/*
+ * trie_raise_score
+ *
+ * A record with the given score is being added below the given node.
+ * Raise the cached best score of the node and the nodes above it where
+ * it is lower.
+ */
+static void
+trie_raise_score (trie_node_t *node, uint32_t score)
+{
+    for (; node != NULL; node = trie_node_up(node)) {
+        if (node->max_score >= score) {
+            break;
+        }
+        node->max_score = score;
+    }
+}
+
+/*
+ * trie_rescore
+ *
+ * Work out the cached best score of the given node again from its
+ * children, and carry on up while the scores change
+ */
+static void
+trie_rescore (trie_node_t *node)
+{
+    trie_node_t *child;
+    uint32_t    max;
+
+    for (; node != NULL; node = trie_node_up(node)) {
+        max = 0;
+        for (child = node->children; child != NULL; child = child->sibling) {
+            if (child->max_score > max) {
+                max = child->max_score;
+            }
+        }
+
+        if (node->max_score == max) {
+            break;
+        }
+        node->max_score = max;
+    }
+}
+
+/*
+ * trie_insert_internal
+ *
+ * This routine is called from trie_insert_len() once a branching point
+ * is reached. From the branching point, we just have to create trie
+ * nodes for each of the remaining elements of the key and store the
+ * value in the leaf node. The record's score is the best below every
+ * one of the new nodes.
+ */
+static int
+trie_insert_internal (trie_t *trie, trie_node_t *parent, char *key,
+                      uint32_t len, void *data, uint32_t key_index,
+                      uint32_t score)
+{
+    trie_node_t *new_node;
+
+    /*
+     * Start from level = parent and keep adding internal nodes till we
+     * exhaust all characters in the key. One more node is the leaf.
+     */
+    for (; key_index <= len; key_index++) {
+        
+        new_node = (trie_node_t *)slab_alloc(trie->node_slab);
+        if (!new_node) {
+            return EFAIL;
+        }
+
+        new_node->key = (key_index < len) ? key[key_index] : 0;
+        new_node->leaf = (key_index == len);
+        new_node->max_score = score;
+        new_node->data = NULL;
+        new_node->sibling = NULL;
+        new_node->children = NULL;
+        new_node->parent = parent;
+        parent->children = new_node;
+        parent = new_node;
+        trie->node_count++;
+    }
+
+    /*
+     * We have come to the leaf node after creating trie nodes for each
+     * character in the key. This is where we store the actual value.
+     */
+    parent->data = data;
+    trie->leaf_count++;
+
+    return EOK;
+}
+
+/*
+ * trie_insert_len
+ *
+ * Insert a node to the trie under a key of the given length. The key
+ * may hold any bytes, 0 included.
+ */
+int
+trie_insert_len (trie_t *trie, char *key, uint32_t len, void *data)
+{
+    trie_node_t *parent = NULL, *node, *prev_node, *new_node;
+    uint32_t    key_index, rank;
+    uint32_t    score = 0;
+    pthread_mutex_t *lock;
+    int         rc;
+
+    /* Sanity check */
+    if (!trie || (!key && len)) {
+        return EINVAL;
+    }
+
+    /* Mapped and frozen tries are read only */
+    if (trie->flags & (TRIE_FLAG_MAPPED | TRIE_FLAG_FROZEN)) {
+        return EFAIL;
+    }
+
+    if (trie->flags & TRIE_FLAG_CONCURRENT) {
+        lock = trie_write_lock(trie, key, len);
+        pthread_mutex_lock(lock);
+        rc = trie_radix_insert_concurrent(trie, key, len, data);
+        pthread_mutex_unlock(lock);
+        return rc;
+    }
+
+    if (trie->flags & TRIE_FLAG_RADIX) {
+        return (trie_radix_insert(trie, key, len, data));
+    }
+
+    /*
+     * Check if there is a common prefix already present. The end of
+     * the key is matched like any other character, against the leaf
+     * nodes.
+     */
+    for (key_index = 0; ; key_index++) {
+        rank = trie_key_rank(key, len, key_index);
+
+        /* Siblings are sorted, so stop at the first one not below it */
+        prev_node = NULL;
+        node = parent ? parent->children : trie->root;
+        while (node != NULL && trie_node_rank(node) < rank) {
+            prev_node = node;
+            node = node->sibling;
+        }
+
+        /* Did we find a match? */
+        if (node == NULL || trie_node_rank(node) != rank) {
+            break;
+        }
+
+        if (node->leaf) {
+            printf("Duplicate key passed: %.*s\n", (int)len, key);
+            return EFAIL;
+        }
+
+        /* Jump to the next level */
+        parent = node;
+    }
+
+    /* 
+     * We have come to a branching point. Link in a node for this
+     * character between prev_node and node, keeping the level sorted.
+     */
+    new_node = (trie_node_t *)slab_alloc(trie->node_slab);
+    if (!new_node) {
+        return EFAIL;
+    }
+    trie->node_count++;
+
+    if (trie->score_fn) {
+        score = trie->score_fn(data);
+        trie_raise_score(parent, score);
+    }
+
+    new_node->key = (key_index < len) ? key[key_index] : 0;
+    new_node->leaf = (key_index == len);
+    new_node->max_score = score;
+    new_node->data = NULL;
+    new_node->children = NULL;
+    new_node->sibling = node;
+    if (prev_node) {
+        prev_node->sibling = new_node;
+        new_node->parent = prev_node;
+    } else if (parent) {
+        parent->children = new_node;
+        new_node->parent = parent;
+    } else {
+        trie->root = new_node;
+        new_node->parent = NULL;
+    }
+    if (node) {
+        node->parent = new_node;
+    }
+
+    /* The key was a prefix of an existing one. This is its leaf. */
+    if (new_node->leaf) {
+        new_node->data = data;
+        trie->leaf_count++;
+        return EOK;
+    }
+
+    /* Create a new set of nodes for the remaining characters in the key */
+    return (trie_insert_internal(trie, new_node, key, len, data,
+                                 key_index + 1, score));
+}
+
+/*
+ * trie_insert
+ *
+ * Insert a node to the trie
+ */
+int
+trie_insert (trie_t *trie, char *key, void *data)
+{
+    /* Sanity check */
+    if (!key) {
+        return EINVAL;
+    }
+
+    return (trie_insert_len(trie, key, strlen(key), data));
+}
+
+/*
+ * trie_unlink_node
+ *
+ * Take the given node out of its sibling list
+ */
+static void
+trie_unlink_node (trie_t *trie, trie_node_t *node)
+{
+    trie_node_t *parent = node->parent;
+
+    if (!parent) {
+        trie->root = node->sibling;
+    } else if (parent->children == node) {
+        parent->children = node->sibling;
+    } else {
+        parent->sibling = node->sibling;
+    }
+
+    /* The next sibling now hangs off whatever pointed to the node */
+    if (node->sibling) {
+        node->sibling->parent = parent;
+    }
+}
+
+/*
+ * trie_remove_len
+ *
+ * Remove the node with the given key of the given length from the trie
+ */
+int
+trie_remove_len (trie_t *trie, char *key, uint32_t len)
+{
+    trie_node_t *node, *up;
+    uint8_t     only_child;
+    pthread_mutex_t *lock;
+    int         rc;
+
+    /* Sanity check */
+    if (!trie || (!key && len)) {
+        return EINVAL;
+    }
+
+    /* Mapped and frozen tries are read only */
+    if (trie->flags & (TRIE_FLAG_MAPPED | TRIE_FLAG_FROZEN)) {
+        return EFAIL;
+    }
+
+    if (trie->flags & TRIE_FLAG_CONCURRENT) {
+        lock = trie_write_lock(trie, key, len);
+        pthread_mutex_lock(lock);
+        rc = trie_radix_remove_concurrent(trie, key, len);
+        pthread_mutex_unlock(lock);
+        return rc;
+    }
+
+    if (trie->flags & TRIE_FLAG_RADIX) {
+        return (trie_radix_remove(trie, key, len));
+    }
+
+    node = trie_lookup_node(trie, key, len);
+    if (!node) {
+        return ENOTFOUND;
+    }
+
+    /*
+     * Start from the leaf and remove one node at a time up the key.
+     * Keys can share common prefixes, so stop at the first level which
+     * still has other nodes in it. That is the branching point.
+     */
+    while (1) {
+        up = trie_node_up(node);
+        only_child = (node->sibling == NULL &&
+                      (node->parent == NULL || node->parent->children == node));
+
+        trie_unlink_node(trie, node);
+        slab_free(trie->node_slab, node);
+        trie->node_count--;
+
+        if (!only_child || !up) {
+            break;
+        }
+
+        /* The node above has nothing left below it */
+        node = up;
+    }
+
+    trie->leaf_count--;
+
+    /* The record may have been the best one below the branching point */
+    if (trie->score_fn) {
+        trie_rescore(up);
+    }
+
+    return EOK;
+}
+
+/*
+ * trie_remove
+ *
+ * Remove a node from the trie
+ */
+int
+trie_remove (trie_t *trie, char *key)
+{
+    /* Sanity check */
+    if (!key) {
+        return EINVAL;
+    }
+
+    return (trie_remove_len(trie, key, strlen(key)));
+}
+
+/*
+ * trie_lookup_internal
+ *
+ * Same as trie_lookup but returns a pointer to the leaf trie node
+ * instead of the actual data. Used by trie_get_next()
+ */
+void *
+trie_lookup_internal (trie_t *trie, char *key)
+{
+    uint32_t offset;
+
+    /* Sanity check */
+    if (!trie || !key) {
+        return NULL;
+    }
+
+    if (trie->flags & TRIE_FLAG_MAPPED) {
+        offset = trie_image_find(trie, key, strlen(key));
+        return (offset ? trie_image_node(trie, offset) : NULL);
+    }
+
+    /* Frozen tries have no nodes */
+    if (trie->flags & TRIE_FLAG_FROZEN) {
+        return NULL;
+    }
+
+    if (trie->flags & TRIE_FLAG_RADIX) {
+        return (trie_radix_find(trie, key, strlen(key)));
+    }
+
+    return (trie_lookup_node(trie, key, strlen(key)));
+}
+
+/*
+ * trie_lookup_len
+ *
+ * Lookup a node in the trie with the given key of the given length.
+ * Returns NULL if node is not found.
+ */
+void *
+trie_lookup_len (trie_t *trie, char *key, uint32_t len)
+{
+    trie_node_t *node;
+    trie_radix_node_t *leaf;
+    uint32_t offset;
+    void *data;
+
+    /* Sanity check */
+    if (!trie || (!key && len)) {
+        return NULL;
+    }
+
+    if (trie->flags & TRIE_FLAG_FROZEN) {
+        offset = trie_da_find(trie, key, len);
+        return (offset ? trie_da_record(&trie->da, offset) : NULL);
+    }
+
+    if (trie->flags & TRIE_FLAG_MAPPED) {
+        offset = trie_image_find(trie, key, len);
+        return (offset ? trie_image_record(trie, trie_image_node(trie, offset))
+                       : NULL);
+    }
+
+    /* Readers of a concurrent trie take no locks and never wait */
+    if (trie->flags & TRIE_FLAG_CONCURRENT) {
+        epoch_enter(trie->epoch);
+        leaf = trie_radix_find(trie, key, len);
+        data = leaf ? TRIE_LOAD(leaf->data) : NULL;
+        epoch_exit(trie->epoch);
+        return data;
+    }
+
+    if (trie->flags & TRIE_FLAG_RADIX) {
+        leaf = trie_radix_find(trie, key, len);
+        return (leaf ? leaf->data : NULL);
+    }
+
+    node = trie_lookup_node(trie, key, len);
+    return (node ? node->data : NULL);
+}
+
+/*
+ * trie_lookup
+ *
+ * Lookup a node in the trie with the given key. Returns NULL
+ * if node is not found.
+ */
+void *
+trie_lookup (trie_t *trie, char *key)
+{
+    /* Sanity check */
+    if (!key) {
+        return NULL;
+    }
+
+    return (trie_lookup_len(trie, key, strlen(key)));
+}
+
+/*
+ * trie_batch_step_node
+ *
+ * Take a lookup in a per character trie one node further. Returns TRUE
+ * once the lookup is over, with its record, if any, in slot->result.
+ */
+static inline uint8_t
+trie_batch_step_node (trie_batch_slot_t *slot)
+{
+    trie_node_t *node = (trie_node_t *)slot->node;
+    uint32_t    rank = trie_key_rank(slot->key, slot->len, slot->pos);
+
+    if (node == NULL || trie_node_rank(node) > rank) {
+        return TRUE;
+    }
+
+    if (trie_node_rank(node) < rank) {
+        node = node->sibling;
+    } else if (rank == 0) {
+        slot->result = node->data;
+        return TRUE;
+    } else {
+        node = node->children;
+        slot->pos++;
+    }
+
+    TRIE_PREFETCH(node);
+    slot->node = node;
+
+    return FALSE;
+}
+
+/*
+ * trie_batch_step_radix
+ *
+ * Take a lookup in a radix trie one node further. The node's label is
+ * checked, then the child for the next byte is found and prefetched.
+ */
+static inline uint8_t
+trie_batch_step_radix (trie_batch_slot_t *slot)
+{
+    trie_radix_node_t   *node = (trie_radix_node_t *)slot->node;
+    trie_radix_node_t   *child, **child_slot;
+    uint32_t            pos = slot->pos;
+
+    /* The first byte matched already. The rest of the label has to. */
+    if (node->label_len > slot->len - pos ||
+        (node->label_len > 1 &&
+         memcmp(trie_radix_label(node) + 1, slot->key + pos + 1,
+                node->label_len - 1) != 0)) {
+        return TRUE;
+    }
+    pos += node->label_len;
+
+    if (pos == slot->len) {
+        if (TRIE_LOAD(node->leaf)) {
+            slot->result = TRIE_LOAD(node->data);
+        }
+        return TRUE;
+    }
+
+    child_slot = trie_radix_find_child(node, (uint8_t)slot->key[pos]);
+    child = child_slot ? TRIE_LOAD(*child_slot) : NULL;
+    if (!child) {
+        return TRUE;
+    }
+
+    /* The header and the start of the child array */
+    TRIE_PREFETCH(child);
+    TRIE_PREFETCH((char *)child + 64);
+    slot->node = child;
+    slot->pos = pos;
+
+    return FALSE;
+}
+
+/*
+ * trie_batch_step_da
+ *
+ * Take a lookup in a frozen trie one byte further. The state the byte
+ * should lead to was prefetched on the previous step, so it is checked
+ * and the state for the byte after is prefetched in turn.
+ */
+static inline uint8_t
+trie_batch_step_da (trie_da_t *da, trie_batch_slot_t *slot)
+{
+    uint32_t    code;
+
+    if (slot->next >= da->used ||
+        da->check[slot->next] != (int32_t)slot->state) {
+        return TRUE;
+    }
+
+    /* The key end has been followed. The record hangs off that state. */
+    if (slot->pos == slot->len) {
+        slot->result = trie_da_record(da, slot->next);
+        return TRUE;
+    }
+
+    slot->state = slot->next;
+    slot->pos++;
+    code = (slot->pos < slot->len) ? (uint8_t)slot->key[slot->pos] + 1 : 0;
+    slot->next = (uint32_t)da->base[slot->state] + code;
+
+    TRIE_PREFETCH(&da->check[slot->next]);
+    TRIE_PREFETCH(&da->base[slot->next]);
+
+    return FALSE;
+}
+
+/*
+ * trie_batch_start
+ *
+ * Set up a slot for the lookup of the given key of the given length
+ */
+static inline void
+trie_batch_start (trie_t *trie, trie_batch_slot_t *slot, char *key,
+                  uint32_t len, uint32_t index)
+{
+    uint32_t    code;
+
+    slot->key = key;
+    slot->len = len;
+    slot->pos = 0;
+    slot->index = index;
+    slot->result = NULL;
+
+    if (trie->flags & TRIE_FLAG_FROZEN) {
+        code = slot->len ? (uint8_t)key[0] + 1 : 0;
+        slot->state = TRIE_DA_ROOT;
+        slot->next = (uint32_t)trie->da.base[TRIE_DA_ROOT] + code;
+        TRIE_PREFETCH(&trie->da.check[slot->next]);
+        TRIE_PREFETCH(&trie->da.base[slot->next]);
+    } else if (trie->flags & TRIE_FLAG_RADIX) {
+        slot->node = trie->radix_root;
+    } else {
+        slot->node = trie->root;
+    }
+}
+
+/*
+ * trie_batch_run
+ *
+ * Look up the given keys with up to TRIE_BATCH_GROUP of them in flight
+ * at a time. Each lookup is taken one node further in turn, and the
+ * node it needs next is prefetched, so that by the time the lookup
+ * comes round again the node has arrived from memory. The key lengths
+ * are taken from lens, or with strlen() if there is none. The records
+ * are stored in results, if given. Returns the number of keys found.
+ */
+static uint32_t
+trie_batch_run (trie_t *trie, char **keys, uint32_t *lens, uint32_t n,
+                void **results)
+{
+    trie_batch_slot_t   slots[TRIE_BATCH_GROUP];
+    uint32_t            active = 0, next = 0, found = 0, i;
+    uint8_t             done;
+
+    /* An empty radix trie has no root yet */
+    if ((trie->flags & (TRIE_FLAG_RADIX | TRIE_FLAG_FROZEN)) == TRIE_FLAG_RADIX &&
+        !trie->radix_root) {
+        if (results) {
+            memset(results, 0, n * sizeof(void *));
+        }
+        return 0;
+    }
+
+    while (active < TRIE_BATCH_GROUP && next < n) {
+        trie_batch_start(trie, &slots[active++], keys[next],
+                         lens ? lens[next] : strlen(keys[next]), next);
+        next++;
+    }
+
+    while (active > 0) {
+        for (i = 0; i < active; ) {
+            if (trie->flags & TRIE_FLAG_FROZEN) {
+                done = trie_batch_step_da(&trie->da, &slots[i]);
+            } else if (trie->flags & TRIE_FLAG_RADIX) {
+                done = trie_batch_step_radix(&slots[i]);
+            } else {
+                done = trie_batch_step_node(&slots[i]);
+            }
+            if (!done) {
+                i++;
+                continue;
+            }
+
+            if (slots[i].result) {
+                found++;
+            }
+            if (results) {
+                results[slots[i].index] = slots[i].result;
+            }
+
+            /* Start the next key in the freed slot, or close the gap */
+            if (next < n) {
+                trie_batch_start(trie, &slots[i], keys[next],
+                                 lens ? lens[next] : strlen(keys[next]), next);
+                next++;
+            } else {
+                slots[i] = slots[--active];
+            }
+        }
+    }
+
+    return found;
+}
+
+/*
+ * trie_lookup_batch_len
+ *
+ * Look up n keys at once, keys[i] being lens[i] bytes long, and store
+ * the record of each, or NULL, at the same position in results. The
+ * lookups are interleaved so that the memory accesses of several of
+ * them overlap, instead of each waiting for the one before. Returns the
+ * number of keys found. Mapped tries are looked up one key at a time.
+ * With lens NULL, the keys are taken to be 0 terminated.
+ */
+int
+trie_lookup_batch_len (trie_t *trie, char **keys, uint32_t *lens, uint32_t n,
+                       void **results)
+{
+    uint32_t    i, found = 0;
+
+    /* Sanity check */
+    if (!trie || (n && (!keys || !results))) {
+        return EINVAL;
+    }
+
+    if (trie->flags & TRIE_FLAG_MAPPED) {
+        for (i = 0; i < n; i++) {
+            results[i] = trie_lookup_len(trie, keys[i],
+                                         lens ? lens[i] : strlen(keys[i]));
+            if (results[i]) {
+                found++;
+            }
+        }
+        return found;
+    }
+
+    /* One epoch covers the whole batch */
+    if (trie->flags & TRIE_FLAG_CONCURRENT) {
+        epoch_enter(trie->epoch);
+    }
+
+    found = trie_batch_run(trie, keys, lens, n, results);
+
+    if (trie->flags & TRIE_FLAG_CONCURRENT) {
+        epoch_exit(trie->epoch);
+    }
+
+    return found;
+}
+
+/*
+ * trie_lookup_batch
+ *
+ * Look up n 0 terminated keys at once. See trie_lookup_batch_len().
+ */
+int
+trie_lookup_batch (trie_t *trie, char **keys, uint32_t n, void **results)
+{
+    return (trie_lookup_batch_len(trie, keys, NULL, n, results));
+}
+
+/*
+ * trie_insert_batch_len
+ *
+ * Insert n keys, keys[i] being lens[i] bytes long, with data[i] as its
+ * record. The keys are taken TRIE_BATCH_GROUP at a time. The paths of
+ * a group are first walked together, as in trie_lookup_batch_len(),
+ * which brings them into the cache. The inserts themselves are not
+ * interleaved: the keys of the group are then inserted one at a time
+ * with trie_insert_len(). Returns the number of keys inserted, which is
+ * less than n if some were already present or couldn't be added. With
+ * lens NULL, the keys are taken to be 0 terminated.
+ */
+int
+trie_insert_batch_len (trie_t *trie, char **keys, uint32_t *lens,
+                       void **data, uint32_t n)
+{
+    uint32_t    i, j, count, inserted = 0;
+
+    /* Sanity check */
+    if (!trie || (n && (!keys || !data))) {
+        return EINVAL;
+    }
+
+    /* Mapped and frozen tries are read only */
+    if (trie->flags & (TRIE_FLAG_MAPPED | TRIE_FLAG_FROZEN)) {
+        return EFAIL;
+    }
+
+    for (i = 0; i < n; i += TRIE_BATCH_GROUP) {
+        count = (n - i < TRIE_BATCH_GROUP) ? n - i : TRIE_BATCH_GROUP;
+
+        if (trie->flags & TRIE_FLAG_CONCURRENT) {
+            epoch_enter(trie->epoch);
+            trie_batch_run(trie, keys + i, lens ? lens + i : NULL, count, NULL);
+            epoch_exit(trie->epoch);
+        } else {
+            trie_batch_run(trie, keys + i, lens ? lens + i : NULL, count, NULL);
+        }
+
+        for (j = i; j < i + count; j++) {
+            if (trie_insert_len(trie, keys[j],
+                                lens ? lens[j] : strlen(keys[j]),
+                                data[j]) == EOK) {
+                inserted++;
+            }
+        }
+    }
+
+    return inserted;
+}
+
+/*
+ * trie_insert_batch
+ *
+ * Insert n 0 terminated keys, with data[i] as the record of keys[i].
+ * See trie_insert_batch_len().
+ */
+int
+trie_insert_batch (trie_t *trie, char **keys, void **data, uint32_t n)
+{
+    return (trie_insert_batch_len(trie, keys, NULL, data, n));
+}
+
+/*
+ * trie_image_add_node
+ *
+ * Lay out a node at the end of the image being built, and return its
+ * offset, or 0 if out of memory. Only the header is filled in. The
+ * buffer may move, so the node must be looked up again by offset after
+ * adding any other node.
+ */
+static uint32_t
+trie_image_add_node (trie_image_build_t *build, uint32_t parent,
+                     uint32_t label_len, uint32_t num_children,
+                     uint8_t leaf, void *data)
+{
+    trie_image_node_t   *node;
+    uint64_t            size, new_size;
+    void                **records;
+    char                *buf;
+
+    size = sizeof(trie_image_node_t) + num_children * 5ULL + label_len;
+    size = (size + TRIE_IMAGE_ALIGN - 1) & ~(uint64_t)(TRIE_IMAGE_ALIGN - 1);
+
+    /* Offsets have to fit in 32 bits */
+    if ((build->len + size) / TRIE_IMAGE_ALIGN > UINT32_MAX) {
+        build->error = TRUE;
+        return 0;
+    }
+
+    if (build->len + size > build->size) {
+        for (new_size = build->size; new_size < build->len + size;
+             new_size *= 2);
+        buf = (char *)realloc(build->buf, new_size);
+        if (!buf) {
+            build->error = TRUE;
+            return 0;
+        }
+        build->buf = buf;
+        build->size = new_size;
+    }
+
+    if (leaf && build->record_count == build->records_size) {
+        new_size = build->records_size ? build->records_size * 2 : 1024;
+        records = (void **)realloc(build->records,
+                                   new_size * sizeof(void *));
+        if (!records) {
+            build->error = TRUE;
+            return 0;
+        }
+        build->records = records;
+        build->records_size = new_size;
+    }
+
+    node = (trie_image_node_t *)(build->buf + build->len);
+    memset(node, 0, size);
+    node->parent = parent;
+    node->label_len = label_len;
+    node->num_children = num_children;
+    if (leaf) {
+        build->records[build->record_count++] = data;
+        node->record = build->record_count;
+    }
+
+    build->len += size;
+    build->node_count++;
+
+    return ((build->len - size) / TRIE_IMAGE_ALIGN);
+}
+
+/*
+ * trie_image_build_node
+ *
+ * Return the node at the given offset of the image being built
+ */
+static inline trie_image_node_t *
+trie_image_build_node (trie_image_build_t *build, uint32_t offset)
+{
+    return ((trie_image_node_t *)(build->buf +
+                                  (uint64_t)offset * TRIE_IMAGE_ALIGN));
+}
+
+/*
+ * trie_image_put_radix
+ *
+ * Add the subtree rooted at the given radix node to the image being
+ * built. Returns the offset of its top node, or 0 on failure.
+ */
+static uint32_t
+trie_image_put_radix (trie_image_build_t *build, trie_radix_node_t *node,
+                      uint32_t parent)
+{
+    trie_radix_node_t   *child;
+    trie_image_node_t   *image;
+    uint32_t            offset, child_offset, i = 0;
+
+    offset = trie_image_add_node(build, parent, node->label_len,
+                                 node->num_children, node->leaf, node->data);
+    if (!offset) {
+        return 0;
+    }
+    image = trie_image_build_node(build, offset);
+    memcpy(trie_image_label(image), trie_radix_label(node), node->label_len);
+
+    for (child = trie_radix_next_child(node, 0); child != NULL;
+         child = trie_radix_next_child(node, (uint8_t)child->label[0] + 1)) {
+        child_offset = trie_image_put_radix(build, child, offset);
+        if (!child_offset) {
+            return 0;
+        }
+        image = trie_image_build_node(build, offset);
+        trie_image_children(image)[i] = child_offset;
+        trie_image_keys(image)[i] = (uint8_t)child->label[0];
+        i++;
+    }
+
+    return offset;
+}
+
+/*
+ * trie_image_put_chain
+ *
+ * Add the subtree of a per character trie starting at the given node to
+ * the image being built. The node is merged with the single child nodes
+ * below it into one image node, as in a radix trie. start is NULL for
+ * the top level, which gets a root node with an empty label. Returns
+ * the offset of the image node, or 0 on failure.
+ */
+static uint32_t
+trie_image_put_chain (trie_image_build_t *build, trie_t *trie,
+                      trie_node_t *start, uint32_t parent)
+{
+    trie_node_t         *node, *level = trie->root, *leaf = NULL;
+    trie_image_node_t   *image;
+    uint32_t            offset, child_offset, label_len = 0;
+    uint32_t            num_children = 0, i;
+
+    if (start) {
+        for (node = start, label_len = 1;
+             node->children && !node->children->leaf &&
+             !node->children->sibling; node = node->children) {
+            label_len++;
+        }
+        level = node->children;
+    }
+
+    /* The leaf of a key ending here comes first */
+    if (level && level->leaf) {
+        leaf = level;
+        level = level->sibling;
+    }
+    for (node = level; node != NULL; node = node->sibling) {
+        num_children++;
+    }
+
+    offset = trie_image_add_node(build, parent, label_len, num_children,
+                                 leaf != NULL, leaf ? leaf->data : NULL);
+    if (!offset) {
+        return 0;
+    }
+    image = trie_image_build_node(build, offset);
+    for (node = start, i = 0; i < label_len; node = node->children, i++) {
+        trie_image_label(image)[i] = node->key;
+    }
+
+    for (node = level, i = 0; node != NULL; node = node->sibling, i++) {
+        child_offset = trie_image_put_chain(build, trie, node, offset);
+        if (!child_offset) {
+            return 0;
+        }
+        image = trie_image_build_node(build, offset);
+        trie_image_children(image)[i] = child_offset;
+        trie_image_keys(image)[i] = (uint8_t)node->key;
+    }
+
+    return offset;
+}
+
+/*
+ * trie_serialize
+ *
+ * Write the given trie out to a file as an image which trie_open_mmap()
+ * can serve lookups from without rebuilding anything. The image holds
+ * no pointers. Each record is copied into it as record_size bytes, so
+ * the records must hold no pointers either, and should hold their key
+ * if trie_get_next() is to work on the mapped trie. The image uses the
+ * byte order of the machine writing it. Writers of a concurrent trie
+ * are held off while its nodes are copied.
+ */
+int
+trie_serialize (trie_t *trie, char *path, uint32_t record_size)
+{
+    trie_image_build_t  build;
+    trie_image_hdr_t    hdr;
+    uint64_t            pad = 0;
+    uint32_t            i, offset;
+    FILE                *fp;
+    int                 rc = EOK;
+
+    /* Sanity check */
+    if (!trie || !path || !record_size ||
+        (trie->flags & (TRIE_FLAG_MAPPED | TRIE_FLAG_FROZEN))) {
+        return EINVAL;
+    }
+
+    memset(&build, 0, sizeof(build));
+    build.size = 65536;
+    build.buf = (char *)malloc(build.size);
+    if (!build.buf) {
+        return EFAIL;
+    }
+
+    /* The header goes first, so the offsets are right as they are */
+    build.len = sizeof(trie_image_hdr_t);
+    if (trie->flags & TRIE_FLAG_CONCURRENT) {
+        trie_write_lock_all(trie, TRUE);
+    }
+    if (trie->flags & TRIE_FLAG_RADIX) {
+        offset = trie->radix_root ?
+                 trie_image_put_radix(&build, trie->radix_root, 0) :
+                 trie_image_add_node(&build, 0, 0, 0, FALSE, NULL);
+    } else {
+        offset = trie_image_put_chain(&build, trie, NULL, 0);
+    }
+    if (trie->flags & TRIE_FLAG_CONCURRENT) {
+        trie_write_lock_all(trie, FALSE);
+    }
+    if (!offset || build.error) {
+        free(build.buf);
+        free(build.records);
+        return EFAIL;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = TRIE_IMAGE_MAGIC;
+    hdr.version = TRIE_IMAGE_VERSION;
+    hdr.key_count = build.record_count;
+    hdr.node_count = build.node_count;
+    hdr.record_size = record_size;
+    hdr.record_stride = (record_size + 7) & ~7U;
+    hdr.records = (build.len + 7) & ~7ULL;
+    hdr.size = hdr.records + (uint64_t)hdr.key_count * hdr.record_stride;
+    memcpy(build.buf, &hdr, sizeof(hdr));
+
+    fp = fopen(path, "wb");
+    if (!fp) {
+        free(build.buf);
+        free(build.records);
+        return EFAIL;
+    }
+
+    if (fwrite(build.buf, 1, build.len, fp) != build.len ||
+        fwrite(&pad, 1, hdr.records - build.len, fp) !=
+        hdr.records - build.len) {
+        rc = EFAIL;
+    }
+    for (i = 0; i < build.record_count && rc == EOK; i++) {
+        if (fwrite(build.records[i], 1, record_size, fp) != record_size ||
+            fwrite(&pad, 1, hdr.record_stride - record_size, fp) !=
+            hdr.record_stride - record_size) {
+            rc = EFAIL;
+        }
+    }
+    if (fclose(fp) != 0) {
+        rc = EFAIL;
+    }
+
+    free(build.buf);
+    free(build.records);
+
+    return rc;
+}
+
+/*
+ * trie_open_mmap
+ *
+ * Map an image written by trie_serialize() and return a read only trie
+ * serving lookups, cursors and prefix searches straight from it, or
+ * NULL if the file is not a valid image. Nothing is copied, so opening
+ * takes the same time however big the image is, and every process
+ * mapping the image shares the same pages. The records handed out point
+ * into the image. Inserts and removes fail with EFAIL.
+ */
+trie_t *
+trie_open_mmap (char *name, char *path, char* (*get_key)(void *trie_node))
+{
+    trie_image_hdr_t    *hdr;
+    trie_image_node_t   *root;
+    trie_t              *trie;
+    struct stat         st;
+    void                *image;
+    int                 fd;
+
+    /* Sanity check */
+    if (!name || !path) {
+        return NULL;
+    }
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(trie_image_hdr_t)) {
+        close(fd);
+        return NULL;
+    }
+
+    image = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (image == MAP_FAILED) {
+        return NULL;
+    }
+
+    /*
+     * The header and the root node are checked. The nodes below the root
+     * are trusted.
+     */
+    hdr = (trie_image_hdr_t *)image;
+    if (hdr->magic != TRIE_IMAGE_MAGIC || hdr->version != TRIE_IMAGE_VERSION ||
+        hdr->size != (uint64_t)st.st_size || hdr->records > hdr->size ||
+        hdr->record_size == 0 || hdr->record_stride < hdr->record_size ||
+        (hdr->size - hdr->records) / hdr->record_stride < hdr->key_count ||
+        hdr->records < sizeof(trie_image_hdr_t) + sizeof(trie_image_node_t)) {
+        munmap(image, st.st_size);
+        return NULL;
+    }
+
+    root = (trie_image_node_t *)((char *)image + sizeof(trie_image_hdr_t));
+    if (sizeof(trie_image_hdr_t) + sizeof(trie_image_node_t) +
+        root->num_children * 5ULL + root->label_len > hdr->records) {
+        munmap(image, st.st_size);
+        return NULL;
+    }
+
+    trie = trie_create_flags(name, get_key, TRIE_FLAG_MAPPED);
+    if (!trie) {
+        munmap(image, st.st_size);
+        return NULL;
+    }
+
+    trie->image = (char *)image;
+    trie->image_size = st.st_size;
+    trie->node_count = hdr->key_count ? hdr->node_count : 0;
+    trie->leaf_count = hdr->key_count;
+
+    return trie;
+}
+
+/*
+ * trie_da_grow
+ *
+ * Make room for states up to the given one in a double array being
+ * built
+ */
+static int
+trie_da_grow (trie_da_t *da, uint32_t need)
+{
+    int32_t     *base, *check;
+    uint32_t    size, i;
+
+    if (need < da->size) {
+        return EOK;
+    }
+
+    size = da->size ? da->size : TRIE_DA_INITIAL;
+    while (size <= need) {
+        size *= 2;
+    }
+
+    base = (int32_t *)realloc(da->base, size * sizeof(int32_t));
+    if (!base) {
+        return EFAIL;
+    }
+    da->base = base;
+
+    check = (int32_t *)realloc(da->check, size * sizeof(int32_t));
+    if (!check) {
+        return EFAIL;
+    }
+    da->check = check;
+
+    for (i = da->size; i < size; i++) {
+        da->base[i] = 0;
+        da->check[i] = TRIE_DA_FREE;
+    }
+    da->size = size;
+
+    return EOK;
+}
+
+/*
+ * trie_da_place
+ *
+ * Find a base for the given state such that every one of its child
+ * states, one per code, is free, and claim those states. The codes must
+ * be sorted. Returns the base, or -1 if out of memory.
+ */
+static int32_t
+trie_da_place (trie_da_t *da, uint32_t state, uint16_t *codes, uint32_t n)
+{
+    uint32_t    base, i;
+
+    if (n == 0) {
+        da->base[state] = 1;
+        return 1;
+    }
+
+    /* The first child can't go below the first free state */
+    base = (da->next_free > codes[0]) ? da->next_free - codes[0] : 1;
+    for (;; base++) {
+        if (trie_da_grow(da, base + codes[n - 1]) != EOK) {
+            return -1;
+        }
+        for (i = 0; i < n && da->check[base + codes[i]] == TRIE_DA_FREE; i++);
+        if (i == n) {
+            break;
+        }
+    }
+
+    for (i = 0; i < n; i++) {
+        da->check[base + codes[i]] = state;
+    }
+    if (base + codes[n - 1] + 1 > da->used) {
+        da->used = base + codes[n - 1] + 1;
+    }
+    while (da->next_free < da->used &&
+           da->check[da->next_free] != TRIE_DA_FREE) {
+        da->next_free++;
+    }
+
+    da->base[state] = base;
+
+    return base;
+}
+
+/*
+ * trie_da_put_leaf
+ *
+ * Make the given state of a double array being built the end of a key
+ * with the given record
+ */
+static inline void
+trie_da_put_leaf (trie_da_t *da, uint32_t state, void *data)
+{
+    da->data[da->record_count++] = data;
+    da->base[state] = -(int32_t)da->record_count;
+}
+
+/*
+ * trie_da_put_level
+ *
+ * Add the given level of a per character trie, and everything below
+ * it, to a double array being built, as the children of the given
+ * state. The rank of a node is its code.
+ */
+static int
+trie_da_put_level (trie_da_t *da, uint32_t state, trie_node_t *level,
+                   uint16_t *codes)
+{
+    trie_node_t *node;
+    uint32_t    n = 0;
+    int32_t     base;
+
+    for (node = level; node != NULL; node = node->sibling) {
+        codes[n++] = trie_node_rank(node);
+    }
+
+    base = trie_da_place(da, state, codes, n);
+    if (base < 0) {
+        return EFAIL;
+    }
+
+    for (node = level; node != NULL; node = node->sibling) {
+        if (node->leaf) {
+            trie_da_put_leaf(da, base, node->data);
+        } else if (trie_da_put_level(da, base + trie_node_rank(node),
+                                     node->children, codes) != EOK) {
+            return EFAIL;
+        }
+    }
+
+    return EOK;
+}
+
+/*
+ * trie_da_put_radix
+ *
+ * Add the children of the given radix node, and everything below them,
+ * to a double array being built, as the children of the given state.
+ * Each label turns into a chain of single child states.
+ */
+static int
+trie_da_put_radix (trie_da_t *da, uint32_t state, trie_radix_node_t *node,
+                   uint16_t *codes)
+{
+    trie_radix_node_t   *child;
+    uint32_t            n = 0, next, i;
+    int32_t             base;
+    char                *label;
+
+    if (node->leaf) {
+        codes[n++] = 0;
+    }
+    for (child = trie_radix_next_child(node, 0); child != NULL;
+         child = trie_radix_next_child(node, (uint8_t)child->label[0] + 1)) {
+        codes[n++] = (uint8_t)child->label[0] + 1;
+    }
+
+    base = trie_da_place(da, state, codes, n);
+    if (base < 0) {
+        return EFAIL;
+    }
+
+    if (node->leaf) {
+        trie_da_put_leaf(da, base, node->data);
+    }
+    for (child = trie_radix_next_child(node, 0); child != NULL;
+         child = trie_radix_next_child(node, (uint8_t)child->label[0] + 1)) {
+        label = trie_radix_label(child);
+        next = base + (uint8_t)label[0] + 1;
+        for (i = 1; i < child->label_len; i++) {
+            codes[0] = (uint8_t)label[i] + 1;
+            if (trie_da_place(da, next, codes, 1) < 0) {
+                return EFAIL;
+            }
+            next = da->base[next] + codes[0];
+        }
+        if (trie_da_put_radix(da, next, child, codes) != EOK) {
+            return EFAIL;
+        }
+    }
+
+    return EOK;
+}
+
+/*
+ * trie_freeze
+ *
+ * Compile the given trie into a double array, after which every lookup
+ * is a couple of array reads per byte of the key, with no sibling lists
+ * or child arrays to search. The trie nodes are released. A frozen trie
+ * serves lookups, cursors and prefix searches as before, but inserts
+ * and removes fail with EFAIL until trie_clear() empties it again.
+ * Concurrent tries can't be frozen, their readers may be on the nodes.
+ */
+int
+trie_freeze (trie_t *trie)
+{
+    trie_da_t   da;
+    uint16_t    codes[TRIE_DA_CODES];
+    uint32_t    count, states = 0, i;
+    int32_t     *array;
+    int         rc;
+
+    /* Sanity check */
+    if (!trie || (trie->flags & (TRIE_FLAG_MAPPED | TRIE_FLAG_FROZEN |
+                                 TRIE_FLAG_CONCURRENT))) {
+        return EINVAL;
+    }
+
+    memset(&da, 0, sizeof(da));
+    da.data = (void **)malloc((trie->leaf_count + 1) * sizeof(void *));
+    if (!da.data || trie_da_grow(&da, TRIE_DA_ROOT) != EOK) {
+        free(da.data);
+        free(da.base);
+        free(da.check);
+        return EFAIL;
+    }
+
+    /* State 0 is never used, so that it can stand for none */
+    da.check[0] = 0;
+    da.check[TRIE_DA_ROOT] = 0;
+    da.used = TRIE_DA_ROOT + 1;
+    da.next_free = TRIE_DA_ROOT + 1;
+
+    if (trie->flags & TRIE_FLAG_RADIX) {
+        rc = trie->radix_root ?
+             trie_da_put_radix(&da, TRIE_DA_ROOT, trie->radix_root, codes) :
+             trie_da_put_level(&da, TRIE_DA_ROOT, NULL, codes);
+    } else {
+        rc = trie_da_put_level(&da, TRIE_DA_ROOT, trie->root, codes);
+    }
+    if (rc != EOK) {
+        free(da.data);
+        free(da.base);
+        free(da.check);
+        return EFAIL;
+    }
+
+    /* Give back the room grown for but never used */
+    array = (int32_t *)realloc(da.base, da.used * sizeof(int32_t));
+    if (array) {
+        da.base = array;
+    }
+    array = (int32_t *)realloc(da.check, da.used * sizeof(int32_t));
+    if (array) {
+        da.check = array;
+    }
+    da.size = da.used;
+    for (i = TRIE_DA_ROOT; i < da.used; i++) {
+        if (da.check[i] != TRIE_DA_FREE) {
+            states++;
+        }
+    }
+
+    /* The nodes are no longer needed */
+    count = trie->leaf_count;
+    trie_clear(trie);
+    trie->da = da;
+    trie->flags |= TRIE_FLAG_FROZEN;
+    trie->leaf_count = count;
+    trie->node_count = count ? states : 0;
+
+    return EOK;
 }
 
 /* End of File */
@@ -2,11 +2,40 @@
 #define TRIE_H
 
 #include <stdint.h>
+#include <pthread.h>
+#include "slab.h"
+#include "epoch.h"
 
 /* Defines */
 
 #define MAX_NAME_LEN                64
-#define MAX_KEY_LEN                 64
+#define TRIE_SLAB_NODES             1024    /* Trie nodes allocated at a time */
+#define TRIE_LABEL_INLINE           12      /* Edge label bytes kept in a radix node */
+
+#define TRIE_FLAG_RADIX             0x1     /* Path compressed (radix) nodes */
+#define TRIE_FLAG_MAPPED            0x2     /* Read only, served from a mapped image */
+#define TRIE_FLAG_FROZEN            0x4     /* Read only, compiled by trie_freeze() */
+#define TRIE_FLAG_CONCURRENT        0x8     /* Lock-free readers, writers locked per first byte */
+
+#define TRIE_NODE_0                 0       /* Radix node types, by child capacity */
+#define TRIE_NODE_4                 1
+#define TRIE_NODE_16                2
+#define TRIE_NODE_48                3
+#define TRIE_NODE_256               4
+#define TRIE_NODE_TYPES             5
+#define TRIE_SLAB_BYTES             65536   /* Chunk size of the radix node slabs */
+
+#define TRIE_IMAGE_MAGIC            0x45495254  /* "TRIE", also tells the byte order */
+#define TRIE_IMAGE_VERSION          1
+#define TRIE_IMAGE_ALIGN            4       /* Node offsets count in these units */
+
+#define TRIE_DA_CODES               257     /* Key end, then every byte value */
+#define TRIE_DA_INITIAL             1024    /* States allocated up front */
+#define TRIE_DA_FREE                -1      /* check[] of an unused state */
+#define TRIE_DA_ROOT                1       /* State 0 stands for none */
+
+#define TRIE_LOCK_STRIPES           257     /* Writer locks, by first byte, then the empty key */
+#define TRIE_BATCH_GROUP            16      /* Lookups in flight in a batch */
 
 #define TRUE                         1
 #define FALSE                        0
@@ -20,40 +49,242 @@
 
 typedef struct trie_node_ {
     char                key;
+    uint8_t             leaf;       /* A key ends here. key is unused. */
+    uint32_t            max_score;  /* Best score below, with a score_fn */
     void                *data;
     struct trie_node_   *sibling;
     struct trie_node_   *children;
     struct trie_node_   *parent;
 } trie_node_t;
 
-typedef struct trie_del_node_ {
-    trie_node_t     *del_node;
-    trie_node_t     *first_node;
-    trie_node_t     *parent;
-    uint32_t        num_siblings;
-    uint32_t        num_children;
-} trie_del_node_t;
+/*
+ * Node of a TRIE_FLAG_RADIX trie. Each node stands for a whole run of
+ * characters (its edge label) instead of a single one. The first
+ * TRIE_LABEL_INLINE bytes of the label are always kept in the node, and
+ * longer labels additionally get a buffer of their own holding the
+ * whole label. parent always points to the actual parent. Readers of a
+ * TRIE_FLAG_CONCURRENT trie never follow it, only writers do.
+ *
+ * This header is followed by a child array sized to the number of
+ * children, as in an adaptive radix tree. Nodes are grown and shrunk
+ * between the types as children come and go.
+ */
+typedef struct trie_radix_node_ {
+    uint8_t                 type;       /* TRIE_NODE_* */
+    uint8_t                 leaf;       /* A key ends at this node */
+    uint16_t                num_children;
+    uint32_t                label_len;
+    uint32_t                max_score;  /* Best score below, with a score_fn */
+    char                    label[TRIE_LABEL_INLINE];
+    struct trie_radix_node_ *parent;
+    void                    *data;
+    char                    *label_ext; /* Whole label, if it doesn't fit inline */
+} trie_radix_node_t;
+
+/* Up to 4 children, keys sorted */
+typedef struct trie_node4_ {
+    trie_radix_node_t       hdr;
+    uint8_t                 keys[4];
+    trie_radix_node_t       *children[4];
+} trie_node4_t;
+
+/* Up to 16 children, keys sorted and searched with one vector compare */
+typedef struct trie_node16_ {
+    trie_radix_node_t       hdr;
+    uint8_t                 keys[16];
+    trie_radix_node_t       *children[16];
+} trie_node16_t;
+
+/* Up to 48 children, found through a 256 entry index of slot + 1 */
+typedef struct trie_node48_ {
+    trie_radix_node_t       hdr;
+    uint8_t                 index[256];
+    trie_radix_node_t       *children[48];
+} trie_node48_t;
+
+/* Up to 256 children, indexed directly by the next byte */
+typedef struct trie_node256_ {
+    trie_radix_node_t       hdr;
+    trie_radix_node_t       *children[256];
+} trie_node256_t;
+
+/*
+ * Header at the start of a trie_serialize() image. The nodes follow,
+ * starting with the root, then the copies of the records in key order.
+ */
+typedef struct trie_image_hdr_ {
+    uint32_t        magic;          /* TRIE_IMAGE_MAGIC */
+    uint32_t        version;        /* TRIE_IMAGE_VERSION */
+    uint32_t        key_count;
+    uint32_t        node_count;
+    uint32_t        record_size;    /* As passed to trie_serialize() */
+    uint32_t        record_stride;  /* record_size rounded up to 8 bytes */
+    uint64_t        records;        /* Byte offset of the first record */
+    uint64_t        size;           /* Byte size of the whole image */
+} trie_image_hdr_t;
+
+/*
+ * Node of a trie_serialize() image. Nodes refer to each other by offset
+ * from the start of the image, in TRIE_IMAGE_ALIGN units, so the image
+ * can be mapped anywhere. As in a radix trie, each node stands for a
+ * run of characters. The header is followed by
+ *
+ *   uint32_t  children[num_children]    offsets of the children
+ *   uint8_t   keys[num_children]        their first characters, sorted
+ *   char      label[label_len]          the node's own characters
+ *
+ * padded out to TRIE_IMAGE_ALIGN.
+ */
+typedef struct trie_image_node_ {
+    uint32_t        parent;         /* 0 at the root */
+    uint32_t        record;         /* Index of the record + 1, 0 if no key ends here */
+    uint32_t        label_len;
+    uint16_t        num_children;
+    uint16_t        pad;
+} trie_image_node_t;
+
+/* State of a trie_serialize() call */
+typedef struct trie_image_build_ {
+    char            *buf;           /* The nodes, laid out as in the image */
+    uint64_t        len;
+    uint64_t        size;
+    void            **records;      /* Records in key order */
+    uint32_t        record_count;
+    uint32_t        records_size;
+    uint32_t        node_count;
+    uint8_t         error;
+} trie_image_build_t;
+
+/*
+ * Double array form of a trie, made by trie_freeze(). Every state is an
+ * index into base and check, the root being TRIE_DA_ROOT. Byte c takes
+ * state s to state t = base[s] + c + 1, if check[t] == s. A key ends at
+ * state s if state t = base[s] has check[t] == s, and then
+ * data[-base[t] - 1] is its record.
+ */
+typedef struct trie_da_ {
+    int32_t         *base;
+    int32_t         *check;
+    void            **data;         /* Records in key order */
+    uint32_t        size;           /* Entries in base and check */
+    uint32_t        used;           /* One past the highest state in use */
+    uint32_t        next_free;      /* No free state below this one */
+    uint32_t        record_count;
+} trie_da_t;
 
 typedef struct trie_ {
     char            trie_name[MAX_NAME_LEN];
     trie_node_t     *root;
+    trie_radix_node_t *radix_root;  /* Only used with TRIE_FLAG_RADIX */
+    uint32_t        flags;
     uint32_t        node_count; /* Includes internal nodes as well. For debugging */
     uint32_t        leaf_count; /* This contains the actual number of records */
+    slab_t          *node_slab; /* Per character nodes come from here */
+    slab_t          *radix_slab[TRIE_NODE_TYPES];   /* Radix nodes, by type */
     char*           (*get_key)(void *trie_node);
+    uint32_t        (*score_fn)(void *data);    /* Scores cached per subtree, if set */
+    char            *image;     /* Mapped image, with TRIE_FLAG_MAPPED */
+    uint64_t        image_size;
+    trie_da_t       da;         /* Double array, with TRIE_FLAG_FROZEN */
+    pthread_mutex_t *write_locks;   /* With TRIE_FLAG_CONCURRENT, TRIE_LOCK_STRIPES of them */
+    pthread_mutex_t alloc_lock;     /* Guards the slabs, with TRIE_FLAG_CONCURRENT */
+    epoch_t         *epoch;         /* Only used with TRIE_FLAG_CONCURRENT */
 } trie_t;
 
+/*
+ * Cursor over the keys of a trie. It stays on the node holding the
+ * current key, so moving on to the next key needs no lookup. The trie
+ * must not be changed while a cursor is in use, except for a concurrent
+ * trie, where the cursor only holds on to the current record and the
+ * length of its key, and finds the next key from the root.
+ */
+typedef struct trie_iter_ {
+    trie_t              *trie;
+    trie_node_t         *node;          /* Current key, per character tries */
+    trie_radix_node_t   *radix_node;    /* Current key, radix tries */
+    uint32_t            image_node;     /* Current key, mapped tries, 0 if none */
+    uint32_t            da_state;       /* Current key, frozen tries, 0 if none */
+    void                *data;          /* Current record, concurrent tries */
+    char                *key;           /* Its key, as returned by get_key */
+    uint32_t            key_len;        /* Which may hold 0 bytes */
+} trie_iter_t;
+
+/* Lookup in flight in trie_lookup_batch() */
+typedef struct trie_batch_slot_ {
+    char            *key;
+    uint32_t        len;
+    uint32_t        pos;        /* Bytes of the key matched so far */
+    uint32_t        index;      /* Of the key in the batch */
+    void            *node;      /* Node to visit next, prefetched */
+    uint32_t        state;      /* Frozen tries: state the next byte leaves */
+    uint32_t        next;       /* Frozen tries: state it should lead to, prefetched */
+    void            *result;
+} trie_batch_slot_t;
+
+/* Candidate held by a trie_prefix_topk() query */
+typedef struct trie_topk_entry_ {
+    void            *ptr;       /* Trie node, or the record itself */
+    uint32_t        score;      /* Best score below the node, or the record's */
+    uint8_t         record;     /* Is the score final? */
+} trie_topk_entry_t;
+
+/* State of a trie_prefix_topk() query. The entries form a binary heap. */
+typedef struct trie_topk_ {
+    trie_topk_entry_t   *entries;
+    uint32_t            count;
+    uint32_t            size;
+    uint8_t             max_heap;   /* Best score on top, else the worst */
+    uint32_t            k;
+    uint32_t            (*score_fn)(void *data);
+} trie_topk_t;
+
 /* Function prototypes */
 
 trie_t* trie_create (char *name, char* (*get_key)(void *trie_node));
+trie_t* trie_create_flags (char *name, char* (*get_key)(void *trie_node),
+                           uint32_t flags);
 int trie_destroy (trie_t *trie);
+void trie_clear (trie_t *trie);
 void* trie_get_root (trie_t *trie);
 void* trie_get_least (trie_t *trie);
 void* trie_get_next (trie_t *trie, void *prev_node);
+void* trie_iter_first (trie_t *trie, trie_iter_t *iter);
+void* trie_iter_seek (trie_t *trie, trie_iter_t *iter, char *key);
+void* trie_iter_seek_len (trie_t *trie, trie_iter_t *iter, char *key,
+                          uint32_t len);
+void* trie_iter_next (trie_iter_t *iter);
+int trie_set_score_fn (trie_t *trie, uint32_t (*score_fn)(void *data));
+int trie_prefix_foreach (trie_t *trie, char *prefix,
+                         int (*callback)(void *data, void *ctx), void *ctx);
+int trie_prefix_foreach_len (trie_t *trie, char *prefix, uint32_t len,
+                             int (*callback)(void *data, void *ctx),
+                             void *ctx);
+int trie_prefix_topk (trie_t *trie, char *prefix, uint32_t k,
+                      uint32_t (*score_fn)(void *data), void **results);
+int trie_prefix_topk_len (trie_t *trie, char *prefix, uint32_t len,
+                          uint32_t k, uint32_t (*score_fn)(void *data),
+                          void **results);
+void trie_read_lock (trie_t *trie);
+void trie_read_unlock (trie_t *trie);
+void trie_synchronize (trie_t *trie);
 uint32_t trie_get_count (trie_t *trie);
 uint8_t trie_empty (trie_t *trie);
 int trie_insert (trie_t *trie, char *key, void *data);
+int trie_insert_len (trie_t *trie, char *key, uint32_t len, void *data);
 int trie_remove (trie_t *trie, char *key);
+int trie_remove_len (trie_t *trie, char *key, uint32_t len);
 void* trie_lookup_internal (trie_t *trie, char *key);
 void* trie_lookup (trie_t *trie, char *key);
+void* trie_lookup_len (trie_t *trie, char *key, uint32_t len);
+int trie_lookup_batch (trie_t *trie, char **keys, uint32_t n, void **results);
+int trie_lookup_batch_len (trie_t *trie, char **keys, uint32_t *lens,
+                           uint32_t n, void **results);
+int trie_insert_batch (trie_t *trie, char **keys, void **data, uint32_t n);
+int trie_insert_batch_len (trie_t *trie, char **keys, uint32_t *lens,
+                           void **data, uint32_t n);
+int trie_serialize (trie_t *trie, char *path, uint32_t record_size);
+int trie_freeze (trie_t *trie);
+trie_t* trie_open_mmap (char *name, char *path,
+                        char* (*get_key)(void *trie_node));
 
 #endif /* TRIE_H */